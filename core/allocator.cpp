@@ -3,6 +3,8 @@
 #include <vector>
 #include "core/allocator.h"
 #include "core/operations.h"
+#include "core/kv_cache.h"
+#include "core/sparse.h"
 #include "core/utils.h"
 
 namespace deeplib {
@@ -11,7 +13,8 @@ Allocator::Allocator(): total_allocations_(0),
                         total_deallocations_(0),
                         bytes_allocated_(0),
                         bytes_deallocated_(0),
-                        bytes_currently_allocated_(0)
+                        bytes_currently_allocated_(0),
+                        peak_bytes_allocated_(0)
     {}
 
 Allocator::~Allocator() {
@@ -21,8 +24,7 @@ Allocator::~Allocator() {
 Operation* Allocator::newOperation(Operation* new_op) {
     operations_.push_back(new_op);
 
-    bytes_allocated_ += sizeof(Operation);
-    bytes_currently_allocated_ += sizeof(Operation);
+    track(sizeof(Operation));
     total_allocations_++;
 
     return new_op;
@@ -31,26 +33,63 @@ Operation* Allocator::newOperation(Operation* new_op) {
 Buffer* Allocator::newBuffer(Buffer* new_buf) {
     buffers_.push_back(new_buf);
 
-    bytes_allocated_ += sizeof(Buffer);
-    bytes_currently_allocated_ += sizeof(Buffer);
+    track(sizeof(Buffer));
     total_allocations_++;
 
     return new_buf;
 }
 
+KVCache* Allocator::newKVCache(KVCache* new_cache) {
+    caches_.push_back(new_cache);
+
+    track(sizeof(KVCache));
+    total_allocations_++;
+
+    return new_cache;
+}
+
+SparseMatrix* Allocator::newSparseMatrix(SparseMatrix* new_matrix) {
+    sparse_matrices_.push_back(new_matrix);
+
+    track(sizeof(SparseMatrix));
+    total_allocations_++;
+
+    return new_matrix;
+}
+
+void Allocator::track(uint64_t bytes) {
+    bytes_allocated_ += bytes;
+    bytes_currently_allocated_ += bytes;
+
+    if (bytes_currently_allocated_ > peak_bytes_allocated_)
+        peak_bytes_allocated_ = bytes_currently_allocated_;
+}
+
 void Allocator::freeBuffer(Buffer* buf) {
+    uint64_t dealloc_size = sizeof(Buffer);
+
+    // Buffers that only describe a result (e.g. those of gradient
+    // operations) may have never been allocated.
     if (buf->buffer_data_ != nullptr) {
         free(buf->buffer_data_);
         buf->buffer_data_ = nullptr;
 
-        delete buf;
+        dealloc_size += buf->total_size_;
+    }
 
-        uint64_t dealloc_size = buf->total_size_ + sizeof(Buffer);
+    delete buf;
 
-        bytes_deallocated_ += dealloc_size;
-        bytes_currently_allocated_ -= dealloc_size;
-        total_deallocations_++;
-    }
+    bytes_deallocated_ += dealloc_size;
+    bytes_currently_allocated_ -= dealloc_size;
+    total_deallocations_++;
+}
+
+void Allocator::releaseBuffer(Buffer* buf) {
+    int i = in<Buffer>(buf, buffers_);
+    assert(i > -1);
+
+    freeBuffer(buf);
+    buffers_.erase(buffers_.begin() + i);
 }
 
 void Allocator::uproot() {
@@ -64,13 +103,28 @@ void Allocator::uproot() {
         total_deallocations_++;
     }
 
+    for (auto cache : caches_) {
+        delete cache;
+        bytes_deallocated_ += sizeof(KVCache);
+        bytes_currently_allocated_ -= sizeof(KVCache);
+        total_deallocations_++;
+    }
+
+    for (auto matrix : sparse_matrices_) {
+        delete matrix;
+        bytes_deallocated_ += sizeof(SparseMatrix);
+        bytes_currently_allocated_ -= sizeof(SparseMatrix);
+        total_deallocations_++;
+    }
+
     buffers_.clear();
     operations_.clear();
+    caches_.clear();
+    sparse_matrices_.clear();
 }
 
 void Allocator::uprootOperation(Operation* op, int& index) {
-    Operation* p1 = op->parent1_;
-    Operation* p2 = op->parent2_;
+    std::vector<Operation*> parents = op->getParents();
 
     // The actual deallocation of the operation
     // and it's related buffer.
@@ -89,13 +143,11 @@ void Allocator::uprootOperation(Operation* op, int& index) {
 
     // Recursively travel up the tree and deallocate.
 
-    index = in<Operation>(p1, operations_);
-    if (p1 != nullptr && index > -1)
-        uprootOperation(p1, index);
-
-    index = in<Operation>(p2, operations_);
-    if (p2 != nullptr && index > -1)
-        uprootOperation(p2, index);
+    for (Operation* p : parents) {
+        index = in<Operation>(p, operations_);
+        if (index > -1)
+            uprootOperation(p, index);
+    }
 }
 
 void Allocator::uprootOperation(Operation* op) {
@@ -112,12 +164,25 @@ void Allocator::uprootOperation(Operation* op) {
         uprootOperation(op, i);
 }
 
+uint64_t Allocator::getBytesCurrentlyAllocated() {
+    return bytes_currently_allocated_;
+}
+
+uint64_t Allocator::getPeakBytesAllocated() {
+    return peak_bytes_allocated_;
+}
+
+void Allocator::resetPeak() {
+    peak_bytes_allocated_ = bytes_currently_allocated_;
+}
+
 void Allocator::printStats() {
     std::cout << "total_allocations_: " << total_allocations_ << std::endl
               << "total_deallocations_: " << total_deallocations_ << std::endl
               << "bytes_allocated_: " << bytes_allocated_ << std::endl
               << "bytes_deallocated_: " << bytes_deallocated_ << std::endl
-              << "bytes_currently_allocated_: " << bytes_currently_allocated_ << std::endl;
+              << "bytes_currently_allocated_: " << bytes_currently_allocated_ << std::endl
+              << "peak_bytes_allocated_: " << peak_bytes_allocated_ << std::endl;
 }
 
 } // namespace deeplib
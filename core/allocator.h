@@ -8,6 +8,8 @@ namespace deeplib {
 class Tensor;
 class Operation;
 class Buffer;
+class KVCache;
+class SparseMatrix;
 
 // Container for handling memory allocation and cleanup.
 // Keeps track of the operations and buffers allocated.
@@ -21,9 +23,15 @@ class Allocator {
     uint64_t bytes_allocated_;
     uint64_t bytes_deallocated_;
     uint64_t bytes_currently_allocated_;
+    uint64_t peak_bytes_allocated_;
 
     std::vector<Operation*> operations_;
     std::vector<Buffer*> buffers_;
+    std::vector<KVCache*> caches_;
+    std::vector<SparseMatrix*> sparse_matrices_;
+
+    // Records `bytes` as allocated, updating the peak.
+    void track(uint64_t bytes);
 
   public:
     Allocator();
@@ -41,6 +49,12 @@ class Allocator {
     // Register a new buffer under this allocator.
     Buffer* newBuffer(Buffer* new_buf);
 
+    // Register a new key/value cache under this allocator.
+    KVCache* newKVCache(KVCache* new_cache);
+
+    // Register a new sparse matrix under this allocator.
+    SparseMatrix* newSparseMatrix(SparseMatrix* new_matrix);
+
     // Allocates `count` elements of data type `AlDType`.
     template <typename AlDType>
     void* allocate(uint64_t count);
@@ -48,6 +62,10 @@ class Allocator {
     // Deallocates the given buffer, rendering it unusable.
     void freeBuffer(Buffer* buf);
 
+    // Deallocates the given buffer and stops keeping track of it,
+    // for buffers that are done with before the allocator is.
+    void releaseBuffer(Buffer* buf);
+
     // Deallocates EVERYTHING allocated by this allocator.
     void uproot();
 
@@ -61,6 +79,14 @@ class Allocator {
     //       Doesn't quite feel like it's robust enough for general use.
     void uprootOperation(Operation* op);
 
+    uint64_t getBytesCurrentlyAllocated();
+
+    // Most bytes ever allocated at once.
+    uint64_t getPeakBytesAllocated();
+
+    // Restarts the peak from what is currently allocated.
+    void resetPeak();
+
     // Give a quick summary of everything this Allocator has allocated
     // and deallocated.
     void printStats();
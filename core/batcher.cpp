@@ -0,0 +1,198 @@
+#include <iostream>
+#include <cassert>
+#include <vector>
+#include "core/batcher.h"
+
+namespace deeplib {
+
+//-----------------------------------\\
+// class Histogram;                  \\
+//-----------------------------------\\
+
+Histogram::Histogram(std::string name, std::vector<double> bounds) {
+    name_ = name;
+    bounds_ = bounds;
+    counts_ = std::vector<uint64_t>(bounds.size() + 1, 0);
+
+    total_count_ = 0;
+    total_sum_ = 0;
+    max_ = 0;
+}
+
+void Histogram::record(double value) {
+    int bucket = 0;
+    while (bucket < bounds_.size() && value > bounds_[bucket])
+        bucket++;
+
+    counts_[bucket]++;
+
+    total_count_++;
+    total_sum_ += value;
+    max_ = std::max(max_, value);
+}
+
+uint64_t Histogram::getCount() {
+    return total_count_;
+}
+
+double Histogram::getMean() {
+    return total_count_ > 0 ? total_sum_ / total_count_ : 0;
+}
+
+double Histogram::getMax() {
+    return max_;
+}
+
+std::vector<uint64_t>& Histogram::getCounts() {
+    return counts_;
+}
+
+void Histogram::print() {
+    std::cout << name_ << " (count: " << total_count_
+              << ", mean: " << getMean()
+              << ", max: " << max_ << ")" << std::endl;
+
+    // Empty buckets are left out.
+    for (int i = 0; i < counts_.size(); i++) {
+        if (counts_[i] == 0)
+            continue;
+
+        if (i < bounds_.size())
+            std::cout << "  <= " << bounds_[i];
+        else
+            std::cout << "  >  " << bounds_.back();
+
+        std::cout << ": " << counts_[i] << std::endl;
+    }
+}
+
+//-----------------------------------\\
+// class Batcher;                    \\
+//-----------------------------------\\
+
+// Powers of two from 1 up to and including `max`.
+static std::vector<double> powersOfTwo(double max) {
+    std::vector<double> bounds;
+    for (double b = 1; b < max; b *= 2)
+        bounds.push_back(b);
+
+    bounds.push_back(max);
+    return bounds;
+}
+
+Batcher::Batcher(Tensor& input, Tensor& output, int max_latency_us)
+    : queue_times_("queue_time_us", powersOfTwo(1 << 20)),
+      batch_sizes_("batch_size", powersOfTwo(input.getShape()[0])) {
+    assert(!input.getOperation()->getType().compare("placeholder"));
+    assert(input.getShape()[0] == output.getShape()[0]);
+
+    input_tensor_ = &input;
+    output_tensor_ = &output;
+
+    max_batch_size_ = input.getShape()[0];
+    max_latency_ = std::chrono::microseconds(max_latency_us);
+
+    sample_elements_ = input.getBuffer()->getElements() / max_batch_size_;
+
+    stopping_ = false;
+    worker_ = std::thread(&Batcher::serve, this);
+}
+
+Batcher::~Batcher() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+
+    ready_.notify_all();
+    worker_.join();
+}
+
+std::future<std::vector<float>> Batcher::submit(std::vector<float> sample) {
+    assert(sample.size() == sample_elements_);
+
+    Request* request = new Request;
+    request->sample = std::move(sample);
+    request->arrival = std::chrono::steady_clock::now();
+
+    std::future<std::vector<float>> result = request->result.get_future();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(request);
+    }
+
+    ready_.notify_one();
+    return result;
+}
+
+void Batcher::serve() {
+    std::vector<Request*> batch;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            ready_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+
+            if (queue_.empty())
+                return;
+
+            // Wait for the batch to fill up, but no longer
+            // than the oldest request's deadline.
+            auto deadline = queue_.front()->arrival + max_latency_;
+            ready_.wait_until(lock, deadline, [this] {
+                return stopping_ || queue_.size() >= max_batch_size_;
+            });
+
+            auto now = std::chrono::steady_clock::now();
+            while (!queue_.empty() && batch.size() < max_batch_size_) {
+                auto waited = now - queue_.front()->arrival;
+                queue_times_.record(std::chrono::duration_cast<std::chrono::microseconds>(waited).count());
+
+                batch.push_back(queue_.front());
+                queue_.pop_front();
+            }
+
+            batch_sizes_.record(batch.size());
+        }
+
+        runBatch(batch);
+        batch.clear();
+    }
+}
+
+void Batcher::runBatch(std::vector<Request*>& batch) {
+    std::vector<float> inputs;
+    inputs.reserve(batch.size() * sample_elements_);
+    for (Request* request : batch)
+        inputs.insert(inputs.end(), request->sample.begin(), request->sample.end());
+
+    context_.feed<float>(*input_tensor_, inputs);
+    Buffer* output = context_.operate(*output_tensor_);
+
+    uint64_t output_elements = output->getElements() / batch.size();
+    for (int i = 0; i < batch.size(); i++) {
+        std::vector<float> result(output_elements);
+        output->copyTo<float>(result, i * output_elements);
+
+        batch[i]->result.set_value(std::move(result));
+        delete batch[i];
+    }
+}
+
+Histogram& Batcher::getQueueTimes() {
+    return queue_times_;
+}
+
+Histogram& Batcher::getBatchSizes() {
+    return batch_sizes_;
+}
+
+void Batcher::printStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    queue_times_.print();
+    batch_sizes_.print();
+}
+
+} // namespace deeplib
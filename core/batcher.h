@@ -0,0 +1,109 @@
+#ifndef BATCHER
+#define BATCHER
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <future>
+#include <chrono>
+#include <condition_variable>
+#include "core/tensor.h"
+#include "core/execution_context.h"
+
+namespace deeplib {
+
+// Counts of recorded values falling into buckets with the given upper bounds
+// (inclusive). Values above the last bound go into a final overflow bucket.
+class Histogram {
+    std::string name_;
+    std::vector<double> bounds_;
+    std::vector<uint64_t> counts_;
+
+    uint64_t total_count_;
+    double total_sum_;
+    double max_;
+
+  public:
+    Histogram(std::string name, std::vector<double> bounds);
+
+    void record(double value);
+
+    uint64_t getCount();
+    double getMean();
+    double getMax();
+
+    std::vector<uint64_t>& getCounts();
+
+    void print();
+};
+
+// Front end for serving a graph to many single-sample requests at once.
+//
+// Requests are queued and concatenated along the leading (batch) dimension
+// of the graph's input placeholder until either the batch is full or the
+// oldest request has waited `max_latency_us`. The batch is then evaluated
+// in one go and each request gets back its own row of the output.
+//
+// The graph must be built for the maximum batch size, i.e. `input` is a
+// placeholder of shape [max_batch_size, ...] and `output` a tensor depending
+// on it whose leading dimension is also the batch. Smaller batches shrink
+// the batch dimension (see ExecutionContext), rather than being padded.
+//
+// Evaluation happens on a worker thread with its own ExecutionContext, so the
+// graph can keep serving other contexts (or batchers) at the same time.
+class Batcher {
+    struct Request {
+        std::vector<float> sample;
+        std::promise<std::vector<float>> result;
+        std::chrono::steady_clock::time_point arrival;
+    };
+
+    Tensor* input_tensor_;
+    Tensor* output_tensor_;
+
+    int max_batch_size_;
+    std::chrono::microseconds max_latency_;
+
+    uint64_t sample_elements_;
+
+    ExecutionContext context_;
+
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<Request*> queue_;
+    bool stopping_;
+
+    Histogram queue_times_;
+    Histogram batch_sizes_;
+
+    std::thread worker_;
+
+    // Worker thread loop.
+    void serve();
+
+    // Evaluates the given requests as one batch and hands back their results.
+    void runBatch(std::vector<Request*>& batch);
+
+  public:
+    Batcher(Tensor& input, Tensor& output, int max_latency_us);
+
+    // Finishes the queued requests before returning.
+    ~Batcher();
+
+    // Queues a single sample, i.e. `input` without its leading dimension.
+    std::future<std::vector<float>> submit(std::vector<float> sample);
+
+    // Time in microseconds requests waited in the queue before being evaluated.
+    // NOTE: Only safe to read once no more requests are being submitted.
+    Histogram& getQueueTimes();
+
+    // Number of requests in each evaluated batch.
+    // NOTE: Same as getQueueTimes().
+    Histogram& getBatchSizes();
+
+    void printStats();
+};
+
+} // namespace deeplib
+
+#endif
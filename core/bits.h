@@ -0,0 +1,122 @@
+#ifndef BITS
+#define BITS
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+namespace deeplib {
+namespace bits {
+
+// Bit-packed booleans (DataType::BOOL), 64 to a word: element i is bit
+// i % 64 of word i / 64. Bits past the last element are left unspecified,
+// so anything reading whole words masks off the ones it doesn't own.
+//
+// As in simd.h, no intrinsics are used. Kernels producing bits compare a
+// word's worth of elements into bytes (a loop the compiler vectorizes like
+// any other) and then fold the bytes into bits with a multiplication.
+
+inline uint64_t words(uint64_t n) {
+    return (n + 63) / 64;
+}
+
+inline bool get(const uint64_t* data, uint64_t i) {
+    return (data[i / 64] >> (i % 64)) & 1;
+}
+
+inline void set(uint64_t* data, uint64_t i, bool value) {
+    uint64_t bit = uint64_t(1) << (i % 64);
+    data[i / 64] = value ? (data[i / 64] | bit) : (data[i / 64] & ~bit);
+}
+
+// Bits [begin % 64, end % 64) of a word, for the words a range starts and ends in.
+inline uint64_t headMask(uint64_t begin) {
+    return ~uint64_t(0) << (begin % 64);
+}
+
+inline uint64_t tailMask(uint64_t end) {
+    return ~uint64_t(0) >> (63 - (end - 1) % 64);
+}
+
+// Number of set bits. Without the popcnt instruction (-mpopcnt), the
+// builtin is a library call, slower than counting in parallel within the word.
+inline uint64_t popcount(uint64_t x) {
+#ifdef __POPCNT__
+    return __builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555);
+    x = (x & 0x3333333333333333) + ((x >> 2) & 0x3333333333333333);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0f;
+    return (x * 0x0101010101010101) >> 56;
+#endif
+}
+
+// Packs 64 bytes, each 0 or 1, into a word. A multiplication gathers every
+// 8 bytes at once: byte k (bit 8k) times 2^(56 - 7k) lands on bit 56 + k,
+// and no two of the partial products share a bit.
+inline uint64_t fold(const uint8_t* flags) {
+    uint64_t word = 0;
+    for (int j = 0; j < 8; j++) {
+        uint64_t x;
+        std::memcpy(&x, flags + 8 * j, sizeof(x));
+        word |= ((x * 0x0102040810204080) >> 56) << (8 * j);
+    }
+
+    return word;
+}
+
+// Sets bits [begin, end) to predicate(i). Only whole words are written, so
+// begin must be the first bit of a word, and ranges of different threads
+// must not share one, i.e. be split on word boundaries.
+template <class Predicate>
+void pack(uint64_t* data, uint64_t begin, uint64_t end, Predicate predicate) {
+    uint8_t flags[64];
+
+    uint64_t i = begin;
+    for (; i + 64 <= end; i += 64) {
+        for (int k = 0; k < 64; k++)
+            flags[k] = predicate(i + k);
+
+        data[i / 64] = fold(flags);
+    }
+
+    if (i < end) {
+        std::fill(flags, flags + 64, 0);
+        for (uint64_t k = 0; k < end - i; k++)
+            flags[k] = predicate(i + k);
+
+        data[i / 64] = fold(flags);
+    }
+}
+
+// Number of set bits in [begin, end).
+inline uint64_t count(const uint64_t* data, uint64_t begin, uint64_t end) {
+    if (begin >= end)
+        return 0;
+
+    uint64_t first = begin / 64, last = (end - 1) / 64;
+    if (first == last)
+        return popcount(data[first] & headMask(begin) & tailMask(end));
+
+    uint64_t total = popcount(data[first] & headMask(begin)) + popcount(data[last] & tailMask(end));
+    for (uint64_t w = first + 1; w < last; w++)
+        total += popcount(data[w]);
+
+    return total;
+}
+
+// Calls f(offset, word, n) for the runs of [begin, end) within a word, with
+// the run's first bit shifted down to bit 0 of `word`, i.e. element
+// begin + offset + k is bit k of it for k in [0, n).
+template <class F>
+void forEachWord(const uint64_t* data, uint64_t begin, uint64_t end, F f) {
+    for (uint64_t i = begin; i < end;) {
+        uint64_t n = std::min<uint64_t>(64 - i % 64, end - i);
+        f(i - begin, data[i / 64] >> (i % 64), n);
+        i += n;
+    }
+}
+
+} // namespace bits
+} // namespace deeplib
+
+#endif
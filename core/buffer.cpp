@@ -6,10 +6,15 @@
 
 namespace deeplib {
 
-Buffer::Buffer() {}
+Buffer::Buffer() {
+    pinned_ = false;
+    version_ = 0;
+}
 
 Buffer::Buffer(Buffer* buf) {
     buffer_data_ = nullptr;
+    pinned_ = false;
+    version_ = 0;
 
     shape_ = buf->getShape();
 
@@ -18,6 +23,7 @@ Buffer::Buffer(Buffer* buf) {
     void* buf_ptr = buf->buffer_data_;
 
     dtype_ = buf->getDataType();
+    quantization_ = buf->getQuantization();
 
     allocator_ = buf->getAllocator();
 
@@ -27,6 +33,8 @@ Buffer::Buffer(Buffer* buf) {
 
 Buffer::Buffer(Buffer* buf, DataType dtype) {
     buffer_data_ = nullptr;
+    pinned_ = false;
+    version_ = 0;
 
     shape_ = buf->getShape();
 
@@ -58,6 +66,8 @@ Buffer::Buffer(std::vector<int> s, Allocator* a) {
     dtype_ = DataType::FLOAT32;
 
     buffer_data_ = nullptr;
+    pinned_ = false;
+    version_ = 0;
 
     shape_ = s;
 }
@@ -80,6 +90,8 @@ Buffer::Buffer(std::vector<int> values, std::vector<int>& s, Allocator* a) {
         buf_d[i] = values[i];
 
     buffer_data_ = (void*)buf_d;
+    pinned_ = false;
+    version_ = 0;
 
     shape_ = s;
 }
@@ -140,8 +152,18 @@ void Buffer::initialize() {
             return;
 
           case DataType::BOOL:
-            buffer_data_ = allocator_->allocate<bool>(total_elements_);
-            total_size_ = total_elements_ *  sizeof(bool);
+            buffer_data_ = allocator_->allocate<uint64_t>(bits::words(total_elements_));
+            total_size_ = bits::words(total_elements_) * sizeof(uint64_t);
+            return;
+
+          case DataType::FLOAT16:
+            buffer_data_ = allocator_->allocate<float16>(total_elements_);
+            total_size_ = total_elements_ *  sizeof(float16);
+            return;
+
+          case DataType::BFLOAT16:
+            buffer_data_ = allocator_->allocate<bfloat16>(total_elements_);
+            total_size_ = total_elements_ *  sizeof(bfloat16);
             return;
 
           default:
@@ -151,6 +173,18 @@ void Buffer::initialize() {
     }
 }
 
+void Buffer::reshape(std::vector<int> new_shape) {
+    uint64_t new_elements = 1;
+    for (int i : new_shape)
+        new_elements *= i;
+
+    if (buffer_data_ != nullptr)
+        assert(dataSize(dtype_, new_elements) <= total_size_);
+
+    shape_ = new_shape;
+    total_elements_ = new_elements;
+}
+
 std::vector<int>& Buffer::getShape() {
     return shape_;
 }
@@ -167,6 +201,37 @@ void Buffer::setDataType(DataType new_dtype) {
     dtype_ = new_dtype;
 }
 
+void Buffer::pin() {
+    pinned_ = true;
+}
+
+bool Buffer::isPinned() {
+    return pinned_;
+}
+
+uint64_t Buffer::getVersion() {
+    return version_;
+}
+
+void Buffer::bumpVersion() {
+    version_++;
+}
+
+void Buffer::setQuantization(Quantization quantization) {
+    assert(dtype_ == DataType::INT8 || dtype_ == DataType::UINT8);
+    assert(quantization.scales.size() == quantization.zero_points.size());
+
+    quantization_ = quantization;
+}
+
+Quantization& Buffer::getQuantization() {
+    return quantization_;
+}
+
+bool Buffer::isQuantized() {
+    return !quantization_.scales.empty();
+}
+
 uint64_t Buffer::getSize() {
     return total_size_;
 }
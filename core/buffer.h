@@ -4,11 +4,23 @@
 #include <vector>
 #include "core/allocator.h"
 #include "core/data_types.h"
+#include "core/half.h"
+#include "core/bits.h"
 
 namespace deeplib {
 
 class Allocator;
 
+// How quantized (INT8 or UINT8) data maps to the real values it stands for:
+//   real = (q - zero_points[c]) * scales[c]
+// where c is the element's index along `axis`, i.e. one scale and zero point
+// per channel, or always 0 with a single pair for the whole tensor (axis -1).
+struct Quantization {
+    std::vector<float> scales;
+    std::vector<int32_t> zero_points;
+    int axis = -1;
+};
+
 // Buffer class intended hold allocated data for tensors in the graph.
 // Basically a wrapper for the dynamically allocated data pointer,
 // which here is void* buffer_data.
@@ -48,6 +60,26 @@ class Buffer {
     // will change as the shape of buffer_data changes.
     uint64_t total_elements_;
 
+    // Pinned buffers hold graph inputs (constants and placeholders).
+    // Results are never computed in place over them, so their data
+    // survives any number of re-executions of the graph.
+    bool pinned_;
+
+    // Bumped whenever the buffer's data is replaced from outside the graph
+    // (e.g. by fill()), letting incremental operates know it has changed.
+    uint64_t version_;
+
+    // Empty unless the data is quantized.
+    Quantization quantization_;
+
+    // Child function of fill().
+    template <typename BDType, typename VDType>
+    void fillAs(std::vector<VDType>& values);
+
+    // Child function of copyTo().
+    template <typename BDType, typename VDType>
+    void copyAs(std::vector<VDType>& values, uint64_t offset);
+
   public:
     Buffer();
 
@@ -77,7 +109,22 @@ class Buffer {
     // this allocates buffer_data. Otherwise, it does nothing.
     void initialize();
 
-    // Returns the value at the given index.
+    // Overwrites the buffer's data with the given set of values,
+    // converting each of them to the buffer's data type.
+    template <typename VDType>
+    void fill(std::vector<VDType>& values);
+
+    // Copies values.size() elements starting at `offset` into `values`,
+    // converting each of them to the vector's data type.
+    template <typename VDType>
+    void copyTo(std::vector<VDType>& values, uint64_t offset=0);
+
+    // Changes the buffer's shape without touching its data. As per the note on
+    // total_size_, the new shape can't hold more elements than were allocated.
+    void reshape(std::vector<int> new_shape);
+
+    // Returns the value at the given index. BOOL data is read (and
+    // written) as bool, a bit at a time (see bits.h).
     template <typename BDType>
     BDType getIndex(uint64_t index);
 
@@ -94,8 +141,23 @@ class Buffer {
 
     void setDataType(DataType new_dtype);
 
+    void pin();
+    bool isPinned();
+
+    uint64_t getVersion();
+
+    // Marks the buffer's data as changed. Must be called after
+    // writing to a graph input directly through setIndex().
+    void bumpVersion();
+
     std::vector<int>& getShape();
 
+    // Scales and zero points of quantized data, set by the operations
+    // producing it (see quantize() in op_functions.h).
+    void setQuantization(Quantization quantization);
+    Quantization& getQuantization();
+    bool isQuantized();
+
     Allocator* getAllocator();
 
     uint64_t getSize();
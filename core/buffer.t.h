@@ -7,12 +7,10 @@ namespace deeplib {
 // only deals with the last two dimensions
 template <typename BDType>
 void Buffer::print(bool linear) {
-    BDType* data = (BDType*)buffer_data_;
-
     if (linear) {
         std::cout << "[ ";
         for (int i = 0; i < total_elements_; i++)
-            std::cout << data[i] << " ";
+            std::cout << getIndex<BDType>(i) << " ";
 
         std::cout << "]" << std::endl;
     }
@@ -28,7 +26,7 @@ void Buffer::print(bool linear) {
         for (int i = 0; i < r; i++) {
             std::cout << "[ ";
             for (int j = 0; j < c; j++)
-                std::cout << data[i*c+j] << " ";
+                std::cout << getIndex<BDType>(i*c+j) << " ";
 
             std::cout << "]" << std::endl;
         }
@@ -54,6 +52,167 @@ void Buffer::setIndex(uint64_t index, BDType value) {
     buffer_data_ = (void*)buffer_data_;
 }
 
+template <>
+inline bool Buffer::getIndex<bool>(uint64_t index) {
+    assert(buffer_data_ != nullptr);
+    assert(index < total_elements_);
+    return bits::get((uint64_t*)buffer_data_, index);
+}
+
+template <>
+inline void Buffer::setIndex<bool>(uint64_t index, bool value) {
+    assert(buffer_data_ != nullptr);
+    assert(index < total_elements_);
+    bits::set((uint64_t*)buffer_data_, index, value);
+}
+
+template <typename VDType>
+void Buffer::fill(std::vector<VDType>& values) {
+    assert(values.size() == getElements());
+    initialize();
+
+    switch (dtype_) {
+      case DataType::UINT8:
+        fillAs<uint8_t>(values);
+        break;
+
+      case DataType::UINT16:
+        fillAs<uint16_t>(values);
+        break;
+
+      case DataType::UINT32:
+        fillAs<uint32_t>(values);
+        break;
+
+      case DataType::UINT64:
+        fillAs<uint64_t>(values);
+        break;
+
+      case DataType::INT8:
+        fillAs<int8_t>(values);
+        break;
+
+      case DataType::INT16:
+        fillAs<int16_t>(values);
+        break;
+
+      case DataType::INT32:
+        fillAs<int32_t>(values);
+        break;
+
+      case DataType::INT64:
+        fillAs<int64_t>(values);
+        break;
+
+      case DataType::FLOAT32:
+        fillAs<float>(values);
+        break;
+
+      case DataType::FLOAT64:
+        fillAs<double>(values);
+        break;
+
+      case DataType::FLOAT16:
+        fillAs<float16>(values);
+        break;
+
+      case DataType::BFLOAT16:
+        fillAs<bfloat16>(values);
+        break;
+
+      case DataType::BOOL:
+        bits::pack((uint64_t*)buffer_data_, 0, values.size(), [&](uint64_t i) {
+            return values[i] != 0;
+        });
+        break;
+
+      default:
+        std::cout << "ERROR: bad data type, buffer_data not filled!" << std::endl;
+        assert(false);
+    }
+
+    version_++;
+}
+
+template <typename BDType, typename VDType>
+void Buffer::fillAs(std::vector<VDType>& values) {
+    BDType* data = (BDType*)buffer_data_;
+    for (uint64_t i = 0; i < values.size(); i++)
+        data[i] = static_cast<BDType>(values[i]);
+}
+
+template <typename VDType>
+void Buffer::copyTo(std::vector<VDType>& values, uint64_t offset) {
+    assert(buffer_data_ != nullptr);
+    assert(offset + values.size() <= total_elements_);
+
+    switch (dtype_) {
+      case DataType::UINT8:
+        copyAs<uint8_t>(values, offset);
+        return;
+
+      case DataType::UINT16:
+        copyAs<uint16_t>(values, offset);
+        return;
+
+      case DataType::UINT32:
+        copyAs<uint32_t>(values, offset);
+        return;
+
+      case DataType::UINT64:
+        copyAs<uint64_t>(values, offset);
+        return;
+
+      case DataType::INT8:
+        copyAs<int8_t>(values, offset);
+        return;
+
+      case DataType::INT16:
+        copyAs<int16_t>(values, offset);
+        return;
+
+      case DataType::INT32:
+        copyAs<int32_t>(values, offset);
+        return;
+
+      case DataType::INT64:
+        copyAs<int64_t>(values, offset);
+        return;
+
+      case DataType::FLOAT32:
+        copyAs<float>(values, offset);
+        return;
+
+      case DataType::FLOAT64:
+        copyAs<double>(values, offset);
+        return;
+
+      case DataType::FLOAT16:
+        copyAs<float16>(values, offset);
+        return;
+
+      case DataType::BFLOAT16:
+        copyAs<bfloat16>(values, offset);
+        return;
+
+      case DataType::BOOL:
+        for (uint64_t i = 0; i < values.size(); i++)
+            values[i] = static_cast<VDType>(getIndex<bool>(offset + i));
+        return;
+
+      default:
+        std::cout << "ERROR: bad data type, buffer_data not copied!" << std::endl;
+        assert(false);
+    }
+}
+
+template <typename BDType, typename VDType>
+void Buffer::copyAs(std::vector<VDType>& values, uint64_t offset) {
+    BDType* data = (BDType*)buffer_data_ + offset;
+    for (uint64_t i = 0; i < values.size(); i++)
+        values[i] = static_cast<VDType>(data[i]);
+}
+
 template <typename BDType>
 BDType* Buffer::getBufferDataAsTemplate() {
     return (BDType*)buffer_data_;
@@ -0,0 +1,42 @@
+#include <atomic>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include "core/config.h"
+
+namespace deeplib {
+
+static bool envFlag(const char* name) {
+    const char* value = std::getenv(name);
+    return value != nullptr && std::string(value) != "" && std::string(value) != "0";
+}
+
+static std::atomic<bool> deterministic(envFlag("DEEPLIB_DETERMINISTIC"));
+
+void setDeterministic(bool value) {
+    deterministic = value;
+}
+
+bool isDeterministic() {
+    return deterministic;
+}
+
+static std::atomic<bool> vector_math(!envFlag("DEEPLIB_LIBM"));
+
+void setVectorMath(bool value) {
+    vector_math = value;
+}
+
+bool isVectorMath() {
+    return vector_math;
+}
+
+int getDefaultThreads() {
+    const char* value = std::getenv("DEEPLIB_THREADS");
+    if (value != nullptr && std::atoi(value) > 0)
+        return std::atoi(value);
+
+    return std::thread::hardware_concurrency();
+}
+
+} // namespace deeplib
@@ -0,0 +1,40 @@
+#ifndef CONFIG
+#define CONFIG
+
+namespace deeplib {
+
+// Library-wide execution settings.
+//
+// All of them can be set through the environment as well, so a run can be
+// configured without touching the code:
+//   DEEPLIB_DETERMINISTIC=1    starts in deterministic mode
+//   DEEPLIB_THREADS=N          sizes ThreadPool::shared() to N threads
+//   DEEPLIB_LIBM=1             starts with vector math off
+
+// In deterministic mode, parallel kernels split their work by the shape of
+// the data alone and combine partial results in a fixed order. Floating point
+// results are then bit-identical across runs and thread counts, at the cost
+// of always splitting long reductions (see Reduction), even when there are
+// enough output elements to keep every thread busy.
+//
+// Off (i.e. fast mode) by default.
+void setDeterministic(bool deterministic);
+
+bool isDeterministic();
+
+// Threads ThreadPool::shared() is created with.
+int getDefaultThreads();
+
+// With vector math on, Exponential, Logarithm and Power are computed with
+// the functions of vector_math.h, and Power picks a cheaper way to raise to
+// a single exponent it can (e.g. x * x for x^2, or sqrt(x) for x^0.5). Off,
+// they call into libm element by element, e.g. to compare against.
+//
+// On by default.
+void setVectorMath(bool vector_math);
+
+bool isVectorMath();
+
+} // namespace deeplib
+
+#endif
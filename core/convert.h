@@ -0,0 +1,151 @@
+#ifndef CONVERT
+#define CONVERT
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <algorithm>
+#include "core/half.h"
+
+namespace deeplib {
+namespace convert {
+
+// Conversions between the C++ types of the data types, over whole arrays.
+//
+// As in simd.h, no intrinsics are used (other than through half.h): every
+// element goes through the same few comparisons and selects, which the
+// compiler turns into vector blends, so each conversion is a single
+// vectorized loop.
+//
+// Narrowing either wraps around or saturates:
+//   - integers keep their low bits, or are clamped to the target's range,
+//   - floats overflow to +-inf, or are clamped to the largest finite value
+//     (infinities staying infinite).
+// Floats converted to integers always saturate (with NaN becoming 0), as
+// the out of range values are undefined otherwise.
+
+// x > max(To), comparing the values rather than their bit patterns.
+template <typename To, typename From>
+bool above(From x) {
+    if constexpr (std::is_signed<From>::value) {
+        if (x < 0)
+            return false;
+    }
+
+    return static_cast<uint64_t>(x) > static_cast<uint64_t>(std::numeric_limits<To>::max());
+}
+
+// x < lowest(To), likewise.
+template <typename To, typename From>
+bool below(From x) {
+    if constexpr (!std::is_signed<From>::value)
+        return false;
+    else if constexpr (!std::is_signed<To>::value)
+        return x < 0;
+    else
+        return static_cast<int64_t>(x) < static_cast<int64_t>(std::numeric_limits<To>::lowest());
+}
+
+// Float to integer, clamped to To's range.
+template <typename To, typename From>
+To toInteger(From x) {
+    // Both limits are exact: 0, or +-2^k (one past the largest value).
+    const From low = static_cast<From>(std::numeric_limits<To>::lowest());
+    const From high = static_cast<From>(std::numeric_limits<To>::max() / 2 + 1) * 2;
+
+    bool over = x >= high;
+    From safe = (over || x != x) ? From(0) : ((x < low) ? low : x);
+
+    To value = static_cast<To>(safe);
+    return over ? std::numeric_limits<To>::max() : value;
+}
+
+template <typename To, typename From>
+To saturated(From x) {
+    if constexpr (std::is_floating_point<To>::value) {
+        // Only double -> float can overflow. NaN fails both tests and stays NaN.
+        if constexpr (sizeof(From) > sizeof(To) && std::is_floating_point<From>::value) {
+            const From high = std::numeric_limits<To>::max();
+            const From inf = std::numeric_limits<From>::infinity();
+            x = (x > high && x < inf) ? high : x;
+            x = (x < -high && x > -inf) ? -high : x;
+        }
+
+        return static_cast<To>(x);
+    }
+    else if constexpr (std::is_floating_point<From>::value)
+        return toInteger<To>(x);
+    else {
+        To value = static_cast<To>(x);
+        value = above<To>(x) ? std::numeric_limits<To>::max() : value;
+        return below<To>(x) ? std::numeric_limits<To>::lowest() : value;
+    }
+}
+
+template <typename To, typename From>
+To wrapped(From x) {
+    if constexpr (std::is_integral<To>::value && std::is_floating_point<From>::value)
+        return toInteger<To>(x);
+    else
+        return static_cast<To>(x);
+}
+
+// Clamps FP32 values to the finite range of a 16 bit type, ahead of narrow().
+// Its largest values are exact, so rounding can't take them past it: BFLOAT16
+// tops out below FLT_MAX, which rounds up to infinity.
+template <typename T>
+void clampToHalf(float* data, uint64_t n) {
+    const float high = std::is_same<T, float16>::value ? 65504.0f : 3.38953139e38f;
+    const float inf = std::numeric_limits<float>::infinity();
+
+    for (uint64_t i = 0; i < n; i++) {
+        float x = data[i];
+        x = (x > high && x < inf) ? high : x;
+        data[i] = (x < -high && x > -inf) ? -high : x;
+    }
+}
+
+// Elements converted at a time through a FP32 block, for 16 bit floats.
+const uint64_t half_block = 256;
+
+// dst[i] = src[i] for i in [0, n), converted to To.
+template <typename To, typename From>
+void array(To* dst, const From* src, uint64_t n, bool saturate) {
+    if constexpr (std::is_same<To, From>::value)
+        std::memcpy(dst, src, n * sizeof(To));
+    else if constexpr (is_half_v<To> || is_half_v<From>) {
+        // Through FP32, the 16 bit side converted by widen() or narrow().
+        float block[half_block];
+
+        for (uint64_t i = 0; i < n; i += half_block) {
+            uint64_t m = std::min(half_block, n - i);
+
+            if constexpr (is_half_v<From>)
+                widen(block, src + i, m);
+            else
+                array(block, src + i, m, saturate);
+
+            if constexpr (is_half_v<To>) {
+                if (saturate)
+                    clampToHalf<To>(block, m);
+
+                narrow(dst + i, block, m);
+            }
+            else
+                array(dst + i, block, m, saturate);
+        }
+    }
+    else if (saturate) {
+        for (uint64_t i = 0; i < n; i++)
+            dst[i] = saturated<To>(src[i]);
+    }
+    else {
+        for (uint64_t i = 0; i < n; i++)
+            dst[i] = wrapped<To>(src[i]);
+    }
+}
+
+} // namespace convert
+} // namespace deeplib
+
+#endif
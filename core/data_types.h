@@ -1,5 +1,6 @@
 #ifndef DATA_TYPES
 #define DATA_TYPES
+#include <cstdint>
 
 namespace deeplib {
 
@@ -10,7 +11,7 @@ enum class DataType {
 
     UINT16,
     INT16,
-    __,
+    FLOAT16,
 
     UINT32,
     INT32,
@@ -20,9 +21,59 @@ enum class DataType {
     INT64,
     FLOAT64,
 
-    BOOL
+    BOOL,
+
+    BFLOAT16
 };
 
+// Size in bytes of a single element of the given data type. BOOL elements
+// are bit-packed and have none (0), see dataSize().
+inline uint64_t dataTypeSize(DataType dtype) {
+    switch (dtype) {
+      case DataType::UINT8:
+      case DataType::INT8:
+        return 1;
+
+      case DataType::UINT16:
+      case DataType::INT16:
+      case DataType::FLOAT16:
+      case DataType::BFLOAT16:
+        return 2;
+
+      case DataType::UINT32:
+      case DataType::INT32:
+      case DataType::FLOAT32:
+        return 4;
+
+      case DataType::UINT64:
+      case DataType::INT64:
+      case DataType::FLOAT64:
+        return 8;
+
+      default:
+        return 0;
+    }
+}
+
+// Size in bytes of `elements` elements of the given data type. BOOL ones
+// take a bit each, in whole 64 bit words (see bits.h).
+inline uint64_t dataSize(DataType dtype, uint64_t elements) {
+    if (dtype == DataType::BOOL)
+        return (elements + 63) / 64 * sizeof(uint64_t);
+
+    return elements * dataTypeSize(dtype);
+}
+
+inline bool isFloatingPoint(DataType dtype) {
+    return dtype == DataType::FLOAT16 || dtype == DataType::BFLOAT16 ||
+           dtype == DataType::FLOAT32 || dtype == DataType::FLOAT64;
+}
+
+// FLOAT16 and BFLOAT16, which are only stored in 16 bits and computed in FP32.
+inline bool isHalfPrecision(DataType dtype) {
+    return dtype == DataType::FLOAT16 || dtype == DataType::BFLOAT16;
+}
+
 } // namespace deeplib
 
 #endif
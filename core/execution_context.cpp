@@ -0,0 +1,328 @@
+#include <cassert>
+#include <vector>
+#include <algorithm>
+#include "core/execution_context.h"
+
+namespace deeplib {
+
+// Constants are read from the graph and placeholders from the fed buffers,
+// everything else is an activation computed by the context.
+static bool isActivation(Operation* op) {
+    return op->getType().compare("constant") && op->getType().compare("placeholder");
+}
+
+ExecutionContext::ExecutionContext() {
+    plan_ = nullptr;
+}
+
+ExecutionContext::~ExecutionContext() {}
+
+// Schedules `op` again, along with whatever released activations it reads.
+static void recompute(Operation* op, std::unordered_set<Operation*>& live, std::vector<Operation*>& steps) {
+    if (!isActivation(op) || live.count(op))
+        return;
+
+    for (Operation* p : op->getParents())
+        recompute(p, live, steps);
+
+    steps.push_back(op);
+    live.insert(op);
+}
+
+std::vector<Operation*> ExecutionContext::schedule(std::vector<Operation*>& roots) {
+    std::vector<Operation*> order = topologicalOrder(roots);
+    if (recomputed_.empty())
+        return order;
+
+    std::unordered_set<Operation*> needed(order.begin(), order.end());
+    std::unordered_set<Operation*> forward(forward_.begin(), forward_.end());
+
+    // The forward graph runs first, so its interior activations
+    // are released before the backward graph starts.
+    std::vector<Operation*> forward_order;
+    for (Operation* op : forward_) {
+        if (needed.count(op))
+            forward_order.push_back(op);
+    }
+
+    std::unordered_map<Operation*, int> last_forward_use;
+    for (int i = 0; i < forward_order.size(); i++) {
+        for (Operation* p : forward_order[i]->getParents())
+            last_forward_use[p] = i;
+    }
+
+    std::vector<Operation*> steps;
+    std::unordered_set<Operation*> live;
+
+    for (int i = 0; i < forward_order.size(); i++) {
+        Operation* op = forward_order[i];
+        steps.push_back(op);
+        live.insert(op);
+
+        for (Operation* p : op->getParents()) {
+            if (recomputed_.count(p) && last_forward_use[p] == i)
+                live.erase(p);
+        }
+    }
+
+    for (Operation* op : order) {
+        if (forward.count(op))
+            continue;
+
+        for (Operation* p : op->getParents())
+            recompute(p, live, steps);
+
+        steps.push_back(op);
+        live.insert(op);
+    }
+
+    for (Operation* root : roots)
+        recompute(root, live, steps);
+
+    return steps;
+}
+
+ExecutionContext::Plan& ExecutionContext::getPlan(std::vector<Operation*>& roots) {
+    auto found = plans_.find(roots);
+    if (found != plans_.end())
+        return found->second;
+
+    Plan& plan = plans_[roots];
+    std::vector<Operation*> steps = schedule(roots);
+
+    // A step's result is read until its operation is evaluated again,
+    // so its last use is the last step reading it before then.
+    // Roots are read after the run, so their results are never released.
+    std::vector<int> last_use(steps.size(), -1);
+    std::unordered_map<Operation*, int> latest;
+    for (int i = 0; i < steps.size(); i++) {
+        for (Operation* p : steps[i]->getParents())
+            last_use[latest[p]] = i;
+
+        latest[steps[i]] = i;
+    }
+
+    for (Operation* root : roots)
+        last_use[latest[root]] = steps.size();
+
+    for (Operation* op : steps) {
+        if (!op->getType().compare("placeholder")) {
+            plan.batched[op] = { op, 0 };
+            continue;
+        }
+
+        if (!isActivation(op))
+            continue;
+
+        std::vector<Operation*> parents = op->getParents();
+        for (int p = 0; p < parents.size(); p++) {
+            auto batch = plan.batched.find(parents[p]);
+            if (batch == plan.batched.end())
+                continue;
+
+            int axis = op->batchAxis(p, batch->second.axis);
+            if (axis >= 0) {
+                plan.batched[op] = { batch->second.placeholder, axis };
+                break;
+            }
+        }
+    }
+
+    std::vector<Buffer*> free_slots = slots_;
+    std::vector<Buffer*> step_slots(steps.size(), nullptr);
+    latest.clear();
+
+    for (int i = 0; i < steps.size(); i++) {
+        Operation* op = steps[i];
+        if (!isActivation(op)) {
+            latest[op] = i;
+            continue;
+        }
+
+        Buffer* graph_buf = op->getBuffer();
+        uint64_t bytes = dataSize(graph_buf->getDataType(), graph_buf->getElements());
+
+        // Smallest free slot that fits, or a new one.
+        auto best = free_slots.end();
+        for (auto slot = free_slots.begin(); slot != free_slots.end(); slot++) {
+            if ((*slot)->getSize() >= bytes && (best == free_slots.end() || (*slot)->getSize() < (*best)->getSize()))
+                best = slot;
+        }
+
+        Buffer* slot;
+        if (best != free_slots.end()) {
+            slot = *best;
+            free_slots.erase(best);
+        }
+        else {
+            std::vector<int> slot_shape = { static_cast<int>(bytes) };
+            slot = allocator_.newBuffer(new Buffer(slot_shape, &allocator_));
+            slot->setDataType(DataType::UINT8);
+            slot->initialize();
+
+            slots_.push_back(slot);
+        }
+
+        plan.steps.push_back({ op, slot });
+        plan.buffers[op] = slot;
+        step_slots[i] = slot;
+
+        // The output is assigned before the inputs are released,
+        // so an operation never computes over its own inputs.
+        std::vector<Operation*> parents = op->getParents();
+        for (int p = 0; p < parents.size(); p++) {
+            bool repeated = std::find(parents.begin(), parents.begin() + p, parents[p]) != parents.begin() + p;
+            int source = latest[parents[p]];
+
+            if (!repeated && isActivation(parents[p]) && last_use[source] == i)
+                free_slots.push_back(step_slots[source]);
+        }
+
+        latest[op] = i;
+
+        // Dead ends are never read at all.
+        if (last_use[i] == -1)
+            free_slots.push_back(slot);
+    }
+
+    return plan;
+}
+
+void ExecutionContext::clearPlans() {
+    for (Buffer* slot : slots_)
+        allocator_.releaseBuffer(slot);
+
+    slots_.clear();
+    plans_.clear();
+    plan_ = nullptr;
+}
+
+void ExecutionContext::setCheckpoints(Operation* output, std::vector<Operation*>& checkpoints) {
+    clearPlans();
+
+    std::unordered_set<Operation*> kept(checkpoints.begin(), checkpoints.end());
+    kept.insert(output);
+
+    forward_ = topologicalOrder(output);
+    recomputed_.clear();
+    for (Operation* op : forward_) {
+        if (isActivation(op) && !kept.count(op))
+            recomputed_.insert(op);
+    }
+}
+
+void ExecutionContext::clearCheckpoints() {
+    clearPlans();
+
+    forward_.clear();
+    recomputed_.clear();
+}
+
+void ExecutionContext::feed(Tensor& placeholder, Buffer* buf) {
+    Operation* op = placeholder.getOperation();
+    assert(!op->getType().compare("placeholder"));
+
+    std::vector<int> shape = buf->getShape();
+    std::vector<int> graph_shape = op->getBuffer()->getShape();
+
+    assert(buf->getDataType() == op->getBuffer()->getDataType());
+    assert(shape.size() == graph_shape.size());
+    for (int i = 1; i < shape.size(); i++)
+        assert(shape[i] == graph_shape[i]);
+
+    inferBatchSize(op, buf->getElements());
+    feeds_[op] = buf;
+}
+
+void ExecutionContext::inferBatchSize(Operation* placeholder, uint64_t elements) {
+    std::vector<int>& graph_shape = placeholder->getBuffer()->getShape();
+    uint64_t sample_elements = placeholder->getBuffer()->getElements() / graph_shape[0];
+
+    assert(elements % sample_elements == 0);
+    assert(elements / sample_elements <= graph_shape[0]);
+
+    batch_sizes_[placeholder] = elements / sample_elements;
+}
+
+void ExecutionContext::fitActivation(Operation* op, Buffer* buf) {
+    std::vector<int> shape = op->getBuffer()->getShape();
+
+    // Placeholders are fitted as they're fed, possibly before any plan.
+    Batch batch = { op, 0 };
+    bool batched = !op->getType().compare("placeholder");
+
+    if (!batched) {
+        auto found = plan_->batched.find(op);
+        if (found != plan_->batched.end()) {
+            batch = found->second;
+            batched = true;
+        }
+    }
+
+    auto batch_size = batch_sizes_.find(batch.placeholder);
+    if (batched && batch_size != batch_sizes_.end()) {
+        assert(shape[batch.axis] == batch.placeholder->getBuffer()->getShape()[0]);
+        shape[batch.axis] = batch_size->second;
+    }
+
+    buf->setDataType(op->getBuffer()->getDataType());
+    if (shape != buf->getShape())
+        buf->reshape(shape);
+}
+
+Buffer* ExecutionContext::operate(Tensor& t) {
+    std::vector<Operation*> roots = { t.getOperation() };
+    operate(roots);
+
+    return getBuffer(t.getOperation());
+}
+
+void ExecutionContext::operate(std::vector<Operation*>& roots) {
+    plan_ = &getPlan(roots);
+
+    std::vector<Buffer*> inputs;
+    for (Step& step : plan_->steps) {
+        fitActivation(step.op, step.out);
+
+        inputs.clear();
+        for (Operation* p : step.op->getParents())
+            inputs.push_back(getBuffer(p));
+
+        plan_->buffers[step.op] = step.out;
+        step.op->evaluate(step.out, inputs);
+    }
+}
+
+void ExecutionContext::plan(std::vector<Operation*>& roots) {
+    plan_ = &getPlan(roots);
+}
+
+Buffer* ExecutionContext::getBuffer(Operation* op) {
+    if (!op->getType().compare("constant"))
+        return op->getBuffer();
+
+    if (!op->getType().compare("placeholder")) {
+        auto buf = feeds_.find(op);
+        if (buf != feeds_.end())
+            return buf->second;
+
+        // Unfed placeholders get a (zeroed) buffer of their own.
+        Buffer* graph_buf = op->getBuffer();
+
+        Buffer* new_buf = allocator_.newBuffer(new Buffer(graph_buf->getShape(), &allocator_));
+        new_buf->setDataType(graph_buf->getDataType());
+        new_buf->initialize();
+
+        feeds_[op] = new_buf;
+        return new_buf;
+    }
+
+    assert(plan_ != nullptr);
+    return plan_->buffers[op];
+}
+
+Allocator* ExecutionContext::getAllocator() {
+    return &allocator_;
+}
+
+} // namespace deeplib
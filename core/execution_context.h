@@ -0,0 +1,169 @@
+#ifndef EXECUTION_CONTEXT
+#define EXECUTION_CONTEXT
+#include <map>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include "core/allocator.h"
+#include "core/buffer.h"
+#include "core/operations.h"
+#include "core/tensor.h"
+
+namespace deeplib {
+
+// Per-run state for evaluating a graph built elsewhere.
+//
+// A graph's operations and constants (i.e. the model and its weights)
+// are only ever read by a context. Everything a run writes to lives in the
+// context instead: activations are kept in buffers from the context's own
+// allocator, and placeholders are fed per context.
+//
+// Thus N threads, each with their own ExecutionContext, can evaluate the
+// same graph at the same time without duplicating any weights, as long
+// as nobody modifies the graph in the meantime.
+//
+//----MEMORY PLAN----
+// The first run of a set of roots plans it: the operations are ordered so
+// each is evaluated once, and every activation is assigned a buffer. Once an
+// activation's last consumer has been evaluated its buffer is handed to the
+// activations that follow, so a run only holds the activations still needed.
+// The plan is kept, making the cost of every following run the computation.
+//
+//----CHECKPOINTS----
+// Training keeps the forward activations around until the backward pass
+// is done with them, which is what runs a deep model out of memory.
+// With checkpoints set, only the checkpoints (segment boundaries) of the
+// forward graph keep their activations. The segments' interior activations
+// are released after their last forward use, and the plan computes them again
+// from the nearest checkpoints once a backward operation needs them.
+//
+//----BATCHES----
+// A placeholder's leading dimension is treated as a batch dimension. Feeding
+// a placeholder fewer samples than the graph was built for shrinks the batch
+// dimension of the activations computed from it, so a partial batch only costs
+// what it computes. Each operation says which axis of its result, if any, a
+// parent's batch dimension carries on to (see Operation::batchAxis()), e.g. a
+// matmul keeps the rows of its left side, a transpose moves them, and a sum
+// over them doesn't keep them at all. Everything else keeps its shape, as does
+// anything computed from constants alone (e.g. cast weights). Placeholders
+// are fed independently, each with a batch size of its own.
+//
+// NOTE: Gradient operations (other than element-wise ones) keep their shapes,
+//       so partial batches are meant for inference.
+class ExecutionContext {
+    // An operation evaluated into the given buffer. Recomputed
+    // operations show up in more than one step.
+    struct Step {
+        Operation* op;
+        Buffer* out;
+    };
+
+    // Axis of an activation carrying the batch dimension of a placeholder.
+    struct Batch {
+        Operation* placeholder;
+        int axis;
+    };
+
+    struct Plan {
+        std::vector<Step> steps;
+
+        // Buffer holding each activation's latest result.
+        std::unordered_map<Operation*, Buffer*> buffers;
+
+        // Placeholders (along axis 0) and the activations carrying their
+        // batch dimension, i.e. that follow the batch size fed to them.
+        std::unordered_map<Operation*, Batch> batched;
+    };
+
+    // Keeps the context's allocations off of the graph's allocator,
+    // which isn't safe to use from several threads.
+    Allocator allocator_;
+
+    // Buffers fed to (or allocated for) placeholders.
+    std::unordered_map<Operation*, Buffer*> feeds_;
+
+    // Activation buffers, shared by every plan.
+    // Each is raw memory that is reshaped to the activation it holds.
+    std::vector<Buffer*> slots_;
+
+    std::map<std::vector<Operation*>, Plan> plans_;
+
+    // Plan of the last run.
+    Plan* plan_;
+
+    // Forward graph split by the checkpoints, and the activations
+    // of it that are recomputed. Both empty without checkpoints.
+    std::vector<Operation*> forward_;
+    std::unordered_set<Operation*> recomputed_;
+
+    // Batch size currently fed to each placeholder. Unfed
+    // placeholders have the batch size the graph was built for.
+    std::unordered_map<Operation*, int> batch_sizes_;
+
+    Plan& getPlan(std::vector<Operation*>& roots);
+
+    // Orders the operations to evaluate, recomputing what the checkpoints call for.
+    std::vector<Operation*> schedule(std::vector<Operation*>& roots);
+
+    // Frees every plan along with the activation buffers.
+    void clearPlans();
+
+    // Sets a placeholder's batch size from the number of elements fed to it.
+    void inferBatchSize(Operation* placeholder, uint64_t elements);
+
+    // Shapes an activation buffer as the operation's result, with the batch
+    // dimension (if it has one, see Plan::batched) at the fed batch size.
+    void fitActivation(Operation* op, Buffer* buf);
+
+  public:
+    ExecutionContext();
+
+    ~ExecutionContext();
+
+    // Fills this context's buffer for the given placeholder tensor.
+    // `values` may hold fewer samples than the placeholder.
+    template <typename CDType>
+    void feed(Tensor& placeholder, std::vector<CDType> values);
+
+    // Binds the given placeholder tensor to `buf` within this context.
+    // `buf` may hold fewer samples (i.e. a smaller leading dimension)
+    // than the placeholder.
+    void feed(Tensor& placeholder, Buffer* buf);
+
+    // Evaluates the graph leading up to `t`, each operation exactly once,
+    // and returns the buffer holding the result.
+    //
+    // NOTE: The returned buffer belongs to this context and is overwritten
+    //       by its next operate().
+    Buffer* operate(Tensor& t);
+
+    // Evaluates the graph leading up to all of the given roots at once.
+    // Their results can be retrieved with getBuffer().
+    void operate(std::vector<Operation*>& roots);
+
+    // Plans the given roots without evaluating anything, allocating the
+    // activation buffers their runs will need.
+    void plan(std::vector<Operation*>& roots);
+
+    // Keeps only the activations of `checkpoints` out of the graph leading
+    // up to `output` (the forward graph) for the rest of a run, recomputing the
+    // others when needed by operations outside of it (the backward graph).
+    // `output` itself is always kept.
+    void setCheckpoints(Operation* output, std::vector<Operation*>& checkpoints);
+
+    // Keeps every activation until its last use again.
+    void clearCheckpoints();
+
+    // Returns the buffer holding the given operation's result as of the last
+    // run. Only the results of that run's roots are sure to still be there,
+    // as the buffers of the other activations may have been reused.
+    // Constants return their own (shared) buffer.
+    Buffer* getBuffer(Operation* op);
+
+    Allocator* getAllocator();
+};
+
+} // namespace deeplib
+
+#include "core/execution_context.t.h"
+#endif
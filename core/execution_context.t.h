@@ -0,0 +1,15 @@
+namespace deeplib {
+
+template <typename CDType>
+void ExecutionContext::feed(Tensor& placeholder, std::vector<CDType> values) {
+    Operation* op = placeholder.getOperation();
+    assert(!op->getType().compare("placeholder"));
+
+    inferBatchSize(op, values.size());
+
+    Buffer* buf = getBuffer(op);
+    fitActivation(op, buf);
+    buf->fill<CDType>(values);
+}
+
+} // namespace deeplib
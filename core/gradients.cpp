@@ -0,0 +1,370 @@
+#include <cassert>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <unordered_set>
+#include "core/gradients.h"
+
+namespace deeplib {
+
+// Adds `grad` to `total` element-wise.
+template <typename GDType>
+static void accumulate(Buffer* total, Buffer* grad) {
+    GDType* total_data = total->getBufferDataAsTemplate<GDType>();
+    GDType* grad_data = grad->getBufferDataAsTemplate<GDType>();
+
+    // Written out as a sum, so 16 bit floats add up in FP32.
+    for (uint64_t i = 0; i < total->getElements(); i++)
+        total_data[i] = static_cast<GDType>(total_data[i] + grad_data[i]);
+}
+
+static void accumulate(Buffer* total, Buffer* grad) {
+    assert(total->getElements() == grad->getElements());
+
+    switch (total->getDataType()) {
+      case DataType::UINT8:
+        accumulate<uint8_t>(total, grad);
+        return;
+
+      case DataType::UINT16:
+        accumulate<uint16_t>(total, grad);
+        return;
+
+      case DataType::UINT32:
+        accumulate<uint32_t>(total, grad);
+        return;
+
+      case DataType::UINT64:
+        accumulate<uint64_t>(total, grad);
+        return;
+
+      case DataType::INT8:
+        accumulate<int8_t>(total, grad);
+        return;
+
+      case DataType::INT16:
+        accumulate<int16_t>(total, grad);
+        return;
+
+      case DataType::INT32:
+        accumulate<int32_t>(total, grad);
+        return;
+
+      case DataType::INT64:
+        accumulate<int64_t>(total, grad);
+        return;
+
+      case DataType::FLOAT32:
+        accumulate<float>(total, grad);
+        return;
+
+      case DataType::FLOAT64:
+        accumulate<double>(total, grad);
+        return;
+
+      case DataType::FLOAT16:
+        accumulate<float16>(total, grad);
+        return;
+
+      case DataType::BFLOAT16:
+        accumulate<bfloat16>(total, grad);
+        return;
+
+      default:
+        std::cout << "ERROR: bad data type!" << std::endl;
+        assert(false);
+    }
+}
+
+// Adds the rows of `grad` to the rows of `total` given by `indices`,
+// marking the rows touched for the first time.
+template <typename GDType>
+static void accumulateRows(Buffer* total, Buffer* grad, Buffer* indices,
+                           std::vector<uint64_t>& rows, std::vector<bool>& marked) {
+    GatherShape shape(total, indices, 0);
+    scatterAdd(total->getBufferDataAsTemplate<GDType>(), indices, grad->getBufferDataAsTemplate<GDType>(), shape);
+
+    withIndices(indices, [&](auto* idx) {
+        for (uint64_t j = 0; j < shape.indices; j++) {
+            if (!marked[idx[j]]) {
+                marked[idx[j]] = true;
+                rows.push_back(idx[j]);
+            }
+        }
+    });
+}
+
+Gradients::Gradients(Tensor& output, std::vector<Tensor*> parameters) {
+    allocator_ = output.getAllocator();
+    output_ = output.getOperation();
+
+    Operation* root = output_;
+    std::vector<Operation*> order = topologicalOrder(root);
+
+    for (Tensor* p : parameters)
+        parameters_.push_back(p->getOperation());
+
+    // Only operations depending on a parameter need a gradient.
+    std::unordered_set<Operation*> needs_gradient(parameters_.begin(), parameters_.end());
+    for (Operation* op : order) {
+        for (Operation* p : op->getParents()) {
+            if (needs_gradient.count(p))
+                needs_gradient.insert(op);
+        }
+    }
+
+    // d(output)/d(output) == 1
+    Buffer* seed_buf = allocator_->newBuffer(new Buffer(root->getBuffer()->getShape(), allocator_));
+    seed_buf->setDataType(root->getBuffer()->getDataType());
+
+    std::vector<double> ones(seed_buf->getElements(), 1);
+    seed_buf->fill<double>(ones);
+    seed_buf->pin();
+
+    std::unordered_map<Operation*, Operation*> grads;
+    grads[root] = allocator_->newOperation(new Constant(seed_buf));
+
+    // Children come before their parents in reverse, so each operation's
+    // gradient is complete by the time it's derived.
+    for (auto op = order.rbegin(); op != order.rend(); op++) {
+        if (!needs_gradient.count(*op) || !grads.count(*op))
+            continue;
+
+        std::vector<Operation*> parents = (*op)->getParents();
+        if (parents.empty())
+            continue;
+
+        // A fused activation's input is gone (see fuseActivations()).
+        if ((*op)->hasEpilogue()) {
+            std::cout << "ERROR: Can't derive " << (*op)->getType() << " with a fused activation!" << std::endl;
+            assert(false);
+        }
+
+        std::vector<Operation*> parent_grads = (*op)->derive(grads[*op], allocator_);
+
+        for (int i = 0; i < parents.size(); i++) {
+            Operation* p = parents[i];
+            if (parent_grads[i] == nullptr || !needs_gradient.count(p))
+                continue;
+
+            // Parents used more than once sum up their gradients.
+            if (grads.count(p)) {
+                Operation* sum = allocator_->newOperation(new Addition(grads[p], parent_grads[i]));
+
+                Buffer* sum_buf = allocator_->newBuffer(new Buffer(p->getBuffer()->getShape(), allocator_));
+                sum_buf->setDataType(p->getBuffer()->getDataType());
+                sum->setBuffer(sum_buf);
+
+                grads[p] = sum;
+            }
+            else
+                grads[p] = parent_grads[i];
+        }
+    }
+
+    for (Operation* p : parameters_) {
+        Operation* grad = grads.count(p) ? grads[p] : nullptr;
+        gradient_ops_.push_back(grad);
+
+        Buffer* buf = allocator_->newBuffer(new Buffer(p->getBuffer()->getShape(), allocator_));
+        buf->setDataType(p->getBuffer()->getDataType());
+        buf->initialize();
+
+        gradients_.push_back(buf);
+
+        // A parameter read once, by a Gather along its rows.
+        DataType dtype = buf->getDataType();
+        bool sparse = grad != nullptr && !grad->getType().compare("gather_gradient") &&
+                      static_cast<GatherGradient*>(grad)->getAxis() == 0 &&
+                      (dtype == DataType::FLOAT32 || dtype == DataType::FLOAT64);
+
+        if (sparse)
+            sparse_.push_back({ static_cast<GatherGradient*>(grad), {}, std::vector<bool>(buf->getShape()[0], false) });
+        else
+            sparse_.push_back({ nullptr, {}, {} });
+    }
+
+    // The parameters used last get their gradients first, so these are
+    // evaluated in that order. Otherwise the first parameters' gradients
+    // would wait on the whole backward graph, holding onto everything it
+    // produces until the rest are done.
+    std::unordered_set<Operation*> parameter_set(parameters_.begin(), parameters_.end());
+    for (auto op = order.rbegin(); op != order.rend(); op++) {
+        if (!parameter_set.count(*op) || !grads.count(*op))
+            continue;
+
+        // Sparse gradients are accumulated from the gathered rows' gradients
+        // and indices, rather than from a gradient as large as the table.
+        int i = std::find(parameters_.begin(), parameters_.end(), *op) - parameters_.begin();
+        if (sparse_[i].op != nullptr) {
+            for (Operation* p : sparse_[i].op->getParents())
+                roots_.push_back(p);
+        }
+        else
+            roots_.push_back(grads[*op]);
+    }
+}
+
+void Gradients::backward() {
+    context_.operate(roots_);
+
+    for (int i = 0; i < parameters_.size(); i++) {
+        if (gradient_ops_[i] == nullptr)
+            continue;
+
+        SparseGradient& sparse = sparse_[i];
+        if (sparse.op == nullptr) {
+            accumulate(gradients_[i], context_.getBuffer(gradient_ops_[i]));
+            continue;
+        }
+
+        std::vector<Operation*> parents = sparse.op->getParents();
+        Buffer* grad = context_.getBuffer(parents[0]);
+        Buffer* indices = context_.getBuffer(parents[1]);
+
+        if (gradients_[i]->getDataType() == DataType::FLOAT32)
+            accumulateRows<float>(gradients_[i], grad, indices, sparse.rows, sparse.marked);
+        else
+            accumulateRows<double>(gradients_[i], grad, indices, sparse.rows, sparse.marked);
+    }
+}
+
+void Gradients::checkpoint(std::vector<Tensor*> boundaries) {
+    checkpoints_.clear();
+    for (Tensor* t : boundaries)
+        checkpoints_.push_back(t->getOperation());
+
+    context_.setCheckpoints(output_, checkpoints_);
+}
+
+bool Gradients::checkpoint(uint64_t budget) {
+    Allocator* context_allocator = context_.getAllocator();
+
+    clearCheckpoints();
+    context_.plan(roots_);
+
+    uint64_t best_bytes = context_allocator->getBytesCurrentlyAllocated();
+    if (best_bytes <= budget)
+        return true;
+
+    // Forward activations and the bytes they take.
+    std::vector<Operation*> activations;
+    std::vector<uint64_t> sizes;
+    uint64_t total = 0;
+
+    for (Operation* op : topologicalOrder(output_)) {
+        if (op == output_ || !op->getType().compare("constant") || !op->getType().compare("placeholder"))
+            continue;
+
+        Buffer* buf = op->getBuffer();
+        activations.push_back(op);
+        sizes.push_back(dataSize(buf->getDataType(), buf->getElements()));
+        total += sizes.back();
+    }
+
+    std::vector<Operation*> best;
+
+    // Segments end where the activations seen so far reach the next
+    // even share of the total.
+    for (int segments = 2; segments <= activations.size(); segments++) {
+        std::vector<Operation*> candidate;
+        uint64_t seen = 0;
+
+        for (int i = 0; i < activations.size() && candidate.size() < segments - 1; i++) {
+            seen += sizes[i];
+            if (seen * segments >= total * (candidate.size() + 1))
+                candidate.push_back(activations[i]);
+        }
+
+        context_.setCheckpoints(output_, candidate);
+        context_.plan(roots_);
+
+        uint64_t bytes = context_allocator->getBytesCurrentlyAllocated();
+        if (bytes < best_bytes) {
+            best = candidate;
+            best_bytes = bytes;
+        }
+
+        if (bytes <= budget)
+            break;
+    }
+
+    if (best.empty())
+        clearCheckpoints();
+    else {
+        checkpoints_ = best;
+        context_.setCheckpoints(output_, checkpoints_);
+    }
+
+    return best_bytes <= budget;
+}
+
+void Gradients::clearCheckpoints() {
+    checkpoints_.clear();
+    context_.clearCheckpoints();
+}
+
+std::vector<Operation*>& Gradients::getCheckpoints() {
+    return checkpoints_;
+}
+
+void Gradients::zeroGradients() {
+    for (int i = 0; i < gradients_.size(); i++) {
+        Buffer* buf = gradients_[i];
+        char* data = buf->getBufferDataAsTemplate<char>();
+
+        if (sparse_[i].op == nullptr) {
+            memset(data, 0, buf->getSize());
+            continue;
+        }
+
+        // Only the touched rows can be non-zero.
+        uint64_t row_bytes = buf->getSize() / buf->getShape()[0];
+        for (uint64_t r : sparse_[i].rows)
+            memset(data + r * row_bytes, 0, row_bytes);
+
+        clearRows(i);
+    }
+}
+
+bool Gradients::isSparse(int parameter) {
+    return sparse_[parameter].op != nullptr;
+}
+
+std::vector<uint64_t>& Gradients::getRows(int parameter) {
+    return sparse_[parameter].rows;
+}
+
+void Gradients::clearRows(int parameter) {
+    SparseGradient& sparse = sparse_[parameter];
+
+    for (uint64_t r : sparse.rows)
+        sparse.marked[r] = false;
+
+    sparse.rows.clear();
+}
+
+Buffer* Gradients::getGradient(Tensor& parameter) {
+    for (int i = 0; i < parameters_.size(); i++) {
+        if (parameters_[i] == parameter.getOperation())
+            return gradients_[i];
+    }
+
+    std::cout << "ERROR: tensor is not a parameter of these gradients!" << std::endl;
+    assert(false);
+    return nullptr;
+}
+
+std::vector<Buffer*>& Gradients::getGradients() {
+    return gradients_;
+}
+
+std::vector<Operation*>& Gradients::getParameters() {
+    return parameters_;
+}
+
+ExecutionContext& Gradients::getContext() {
+    return context_;
+}
+
+} // namespace deeplib
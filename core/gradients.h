@@ -0,0 +1,127 @@
+#ifndef GRADIENTS
+#define GRADIENTS
+#include <vector>
+#include <unordered_map>
+#include "core/allocator.h"
+#include "core/buffer.h"
+#include "core/operations.h"
+#include "core/tensor.h"
+#include "core/execution_context.h"
+
+namespace deeplib {
+
+// Reverse-mode differentiation of a tensor with respect to a set of
+// parameters (usually Constants holding weights).
+//
+// On construction, the graph is walked backwards from the output and
+// every operation leading to a parameter derives the gradient operations
+// of its parents (see Operation::derive()). The output's own gradient is
+// seeded with ones, so a non-scalar output is differentiated as if summed.
+//
+// backward() evaluates the forward and backward graphs together through
+// an ExecutionContext. Its memory plan hands a forward activation's buffer
+// over to later operations as soon as the last gradient operation
+// needing it has run, so activations don't outlive their use.
+//
+// Gradients are accumulated into one buffer per parameter, i.e. each
+// backward() adds to them until zeroGradients() is called.
+//
+// Deep models may still not fit, as most forward activations are needed
+// by the backward graph. Checkpointing trades memory for computation:
+// only the marked activations of the forward graph (the boundaries of its
+// segments) are kept, and the rest are recomputed from them during the
+// backward pass (see ExecutionContext's CHECKPOINTS).
+//
+//----SPARSE GRADIENTS----
+// A parameter only read through a single Gather along axis 0 (e.g. an
+// embedding table) gets a sparse gradient: the backward graph stops at the
+// gathered rows' gradients and their indices, which backward() adds to the
+// rows they came from. The rows touched since the gradients were last zeroed
+// are listed (see getRows()), so neither accumulating nor applying the
+// gradient (see Optimizer) goes through the rest of the table.
+class Gradients {
+    Allocator* allocator_;
+
+    Operation* output_;
+
+    // Segment boundaries of the forward graph, if checkpointing.
+    std::vector<Operation*> checkpoints_;
+
+    std::vector<Operation*> parameters_;
+
+    // Gradient operation of each parameter (nullptr if the output
+    // doesn't depend on it) and the buffers they accumulate into.
+    std::vector<Operation*> gradient_ops_;
+    std::vector<Buffer*> gradients_;
+
+    // Sparse gradient of a parameter: the GatherGradient it stands for, and
+    // the rows touched so far, each marked so it's listed once.
+    struct SparseGradient {
+        GatherGradient* op;
+        std::vector<uint64_t> rows;
+        std::vector<bool> marked;
+    };
+
+    // Empty (op == nullptr) for dense gradients.
+    std::vector<SparseGradient> sparse_;
+
+    // Non-null gradient operations, evaluated together by backward().
+    std::vector<Operation*> roots_;
+
+    ExecutionContext context_;
+
+  public:
+    Gradients(Tensor& output, std::vector<Tensor*> parameters);
+
+    // Runs the forward and backward passes, adding the parameters'
+    // gradients to the accumulated ones.
+    //
+    // Placeholders are fed through getContext().
+    void backward();
+
+    // Splits the forward graph at the given tensors, recomputing
+    // the activations in between during backward().
+    void checkpoint(std::vector<Tensor*> boundaries);
+
+    // Picks the checkpoints itself, for a backward() whose context allocates
+    // at most `budget` bytes (as reported by the context's Allocator stats).
+    //
+    // Fewer segments recompute more at once, while more segments keep more
+    // boundaries, so segment counts are tried from none upward and the first
+    // to fit is kept. Returns false if none did. The checkpoints that came
+    // closest (if any beat keeping every activation) are still put in place,
+    // as the best that can be done.
+    bool checkpoint(uint64_t budget);
+
+    // Keeps every activation (i.e. turns checkpointing off).
+    void clearCheckpoints();
+
+    std::vector<Operation*>& getCheckpoints();
+
+    // Zeroes the accumulated gradients.
+    void zeroGradients();
+
+    // True if the given parameter (by index into getParameters())
+    // has a sparse gradient.
+    bool isSparse(int parameter);
+
+    // Rows of a parameter with a sparse gradient added to them since
+    // they were last cleared, in the order they were first touched.
+    std::vector<uint64_t>& getRows(int parameter);
+
+    // Forgets the touched rows of a parameter, for whoever zeroed them.
+    void clearRows(int parameter);
+
+    // Accumulated gradient of the given parameter.
+    Buffer* getGradient(Tensor& parameter);
+
+    std::vector<Buffer*>& getGradients();
+
+    std::vector<Operation*>& getParameters();
+
+    ExecutionContext& getContext();
+};
+
+} // namespace deeplib
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef HALF
+#define HALF
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+namespace deeplib {
+
+// 16 bit floating point storage types (DataType::FLOAT16 and BFLOAT16).
+//
+// Neither does arithmetic of its own: a value converts to float when read,
+// so kernels compute and accumulate in FP32 and only round back to 16 bits
+// when storing a result. Whole arrays are converted with widen() and
+// narrow(), which use the F16C instructions when the target has them
+// (e.g. -mf16c or -march=native), and plain bit manipulation otherwise.
+
+namespace half {
+
+// float -> IEEE half, rounding to nearest even. Out of range values become
+// +-inf, and NaN stays NaN (quiet).
+inline uint16_t fromFloat(float value) {
+#ifdef __F16C__
+    return _cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT);
+#else
+    uint32_t x;
+    std::memcpy(&x, &value, sizeof(x));
+
+    uint16_t sign = (x >> 16) & 0x8000;
+    uint32_t abs = x & 0x7fffffff;
+
+    if (abs >= 0x7f800000)
+        return sign | 0x7c00 | ((abs > 0x7f800000) ? 0x200 : 0);
+
+    // 65520 and above round to inf.
+    if (abs >= 0x477ff000)
+        return sign | 0x7c00;
+
+    // Below 2^-14, i.e. a subnormal half (or zero, below 2^-25).
+    if (abs < 0x38800000) {
+        if (abs < 0x33000000)
+            return sign;
+
+        uint32_t mantissa = (abs & 0x7fffff) | 0x800000;
+        int shift = 126 - (abs >> 23);
+
+        uint32_t bits = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (bits & 1)))
+            bits++;
+
+        return sign | bits;
+    }
+
+    // Rebias the exponent (127 -> 15) and drop 13 mantissa bits. A carry out
+    // of the mantissa correctly bumps the exponent.
+    uint32_t bits = (abs >> 13) - (112 << 10);
+    uint32_t rest = abs & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (bits & 1)))
+        bits++;
+
+    return sign | bits;
+#endif
+}
+
+inline float toFloat(uint16_t bits) {
+#ifdef __F16C__
+    return _cvtsh_ss(bits);
+#else
+    uint32_t sign = static_cast<uint32_t>(bits & 0x8000) << 16;
+    uint32_t exponent = (bits >> 10) & 0x1f;
+    uint32_t mantissa = bits & 0x3ff;
+
+    uint32_t x;
+    if (exponent == 0x1f)
+        x = sign | 0x7f800000 | (mantissa << 13);
+    else if (exponent != 0)
+        x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    else {
+        // Zero or subnormal: mantissa * 2^-24, exactly.
+        float value = mantissa * (1.0f / 16777216.0f);
+        return sign ? -value : value;
+    }
+
+    float value;
+    std::memcpy(&value, &x, sizeof(value));
+    return value;
+#endif
+}
+
+// float -> bfloat16, rounding to nearest even. NaN stays NaN (quiet).
+inline uint16_t fromFloatBrain(float value) {
+    uint32_t x;
+    std::memcpy(&x, &value, sizeof(x));
+
+    if ((x & 0x7fffffff) > 0x7f800000)
+        return (x >> 16) | 0x40;
+
+    return (x + 0x7fff + ((x >> 16) & 1)) >> 16;
+}
+
+inline float toFloatBrain(uint16_t bits) {
+    uint32_t x = static_cast<uint32_t>(bits) << 16;
+
+    float value;
+    std::memcpy(&value, &x, sizeof(value));
+    return value;
+}
+
+} // namespace half
+
+// IEEE 754 half precision: 1 sign, 5 exponent and 10 mantissa bits.
+// Normal values range over [6.1e-5, 65504], with 3 significant digits.
+struct float16 {
+    uint16_t bits;
+
+    float16() = default;
+    explicit float16(float value) : bits(half::fromFloat(value)) {}
+
+    operator float() const { return half::toFloat(bits); }
+};
+
+// The upper half of a float: 1 sign, 8 exponent and 7 mantissa bits.
+// Same range as float, with 2 significant digits.
+struct bfloat16 {
+    uint16_t bits;
+
+    bfloat16() = default;
+    explicit bfloat16(float value) : bits(half::fromFloatBrain(value)) {}
+
+    operator float() const { return half::toFloatBrain(bits); }
+};
+
+template <typename T>
+constexpr bool is_half_v = std::is_same_v<T, float16> || std::is_same_v<T, bfloat16>;
+
+// Float type a 16 bit type's values are computed in, the type itself otherwise.
+template <typename T>
+using compute_t = std::conditional_t<is_half_v<T>, float, T>;
+
+// dst[i] = src[i] for i in [0, n), converted to float.
+inline void widen(float* dst, const float16* src, uint64_t n) {
+    uint64_t i = 0;
+#ifdef __F16C__
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+    }
+#endif
+    for (; i < n; i++)
+        dst[i] = src[i];
+}
+
+inline void widen(float* dst, const bfloat16* src, uint64_t n) {
+    // Plain shifts, which the compiler vectorizes.
+    for (uint64_t i = 0; i < n; i++)
+        dst[i] = src[i];
+}
+
+// dst[i] = src[i] for i in [0, n), rounded to the nearest 16 bit value.
+inline void narrow(float16* dst, const float* src, uint64_t n) {
+    uint64_t i = 0;
+#ifdef __F16C__
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), h);
+    }
+#endif
+    for (; i < n; i++)
+        dst[i] = float16(src[i]);
+}
+
+inline void narrow(bfloat16* dst, const float* src, uint64_t n) {
+    for (uint64_t i = 0; i < n; i++)
+        dst[i] = bfloat16(src[i]);
+}
+
+} // namespace deeplib
+
+#endif
@@ -0,0 +1,103 @@
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include "core/kv_cache.h"
+#include "core/operations.h"
+
+namespace deeplib {
+
+KVCache::KVCache(std::vector<int> key_shape, std::vector<int> value_shape, DataType dtype, Allocator* a) {
+    assert(key_shape.size() >= 2 && key_shape.size() == value_shape.size());
+    assert(std::equal(key_shape.begin(), key_shape.end() - 1, value_shape.begin()));
+
+    keys_ = a->newBuffer(new Buffer(key_shape, a));
+    keys_->setDataType(dtype);
+    keys_->initialize();
+    keys_->pin();
+
+    values_ = a->newBuffer(new Buffer(value_shape, a));
+    values_->setDataType(dtype);
+    values_->initialize();
+    values_->pin();
+
+    key_op_ = a->newOperation(new Constant(keys_));
+    value_op_ = a->newOperation(new Constant(values_));
+
+    capacity_ = key_shape.rbegin()[1];
+    length_ = 0;
+    first_slot_ = 0;
+    position_ = 0;
+}
+
+void KVCache::write(Buffer* cache, Buffer* rows, int first_slot) {
+    std::vector<int>& shape = rows->getShape();
+
+    uint64_t row_size = shape.back() * dataTypeSize(cache->getDataType());
+    uint64_t n = shape.rbegin()[1];
+    uint64_t heads = rows->getElements() / (n * shape.back());
+
+    char* src = rows->getBufferDataAsTemplate<char>();
+    char* dst = cache->getBufferDataAsTemplate<char>();
+
+    // The rows of each head go into at most two runs of slots, as the ring wraps.
+    uint64_t before_wrap = std::min(n, static_cast<uint64_t>(capacity_ - first_slot));
+
+    for (uint64_t h = 0; h < heads; h++) {
+        char* head = dst + h * capacity_ * row_size;
+        char* head_rows = src + h * n * row_size;
+
+        std::memcpy(head + first_slot * row_size, head_rows, before_wrap * row_size);
+        std::memcpy(head, head_rows + before_wrap * row_size, (n - before_wrap) * row_size);
+    }
+
+    cache->bumpVersion();
+}
+
+void KVCache::append(Buffer* keys, Buffer* values) {
+    std::vector<int>& key_shape = keys->getShape();
+    std::vector<int>& value_shape = values->getShape();
+
+    assert(keys->getDataType() == keys_->getDataType() && values->getDataType() == values_->getDataType());
+    assert(key_shape.size() == keys_->getShape().size() && value_shape.size() == values_->getShape().size());
+    assert(key_shape.back() == keys_->getShape().back() && value_shape.back() == values_->getShape().back());
+    assert(std::equal(key_shape.begin(), key_shape.end() - 2, keys_->getShape().begin()));
+    assert(std::equal(value_shape.begin(), value_shape.end() - 1, key_shape.begin()));
+
+    int n = key_shape.rbegin()[1];
+    assert(n <= capacity_);
+
+    int slot = (first_slot_ + length_) % capacity_;
+
+    write(keys_, keys, slot);
+    write(values_, values, slot);
+
+    // Positions beyond the capacity push the oldest ones out.
+    int dropped = std::max(0, length_ + n - capacity_);
+    first_slot_ = (first_slot_ + dropped) % capacity_;
+    length_ += n - dropped;
+    position_ += n;
+}
+
+void KVCache::clear() {
+    length_ = 0;
+    first_slot_ = 0;
+    position_ = 0;
+
+    keys_->bumpVersion();
+    values_->bumpVersion();
+}
+
+Operation* KVCache::getKeys() { return key_op_; }
+
+Operation* KVCache::getValues() { return value_op_; }
+
+int KVCache::getCapacity() { return capacity_; }
+
+int KVCache::getLength() { return length_; }
+
+int KVCache::getFirstSlot() { return first_slot_; }
+
+uint64_t KVCache::getPosition() { return position_; }
+
+} // namespace deeplib
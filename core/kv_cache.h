@@ -0,0 +1,74 @@
+#ifndef KV_CACHE
+#define KV_CACHE
+#include <vector>
+#include "core/allocator.h"
+#include "core/buffer.h"
+#include "core/data_types.h"
+
+namespace deeplib {
+
+class Operation;
+
+// Keys and values of the positions an autoregressive model has already
+// seen, so every step only computes them for its new positions.
+//
+// Keys [..., capacity, d] and values [..., capacity, dv] are allocated up
+// front, their leading dimensions (e.g. batch and heads) being the model's.
+// append() copies a step's rows into the slots following the newest ones,
+// so nothing is ever moved or reallocated: appending costs the rows copied.
+// The slots form a ring. Once it's full, new positions overwrite the oldest
+// ones, keeping a sliding window of the last `capacity` positions.
+//
+// Attention over a cache (see attention() in op_functions.h) only reads the
+// positions held, oldest to newest, so a step's cost is bounded by the
+// capacity rather than growing with the sequence.
+//
+// Caches are created through Allocator::newKVCache(), which owns them.
+//
+// NOTE: append() writes into the buffers behind the cache's Constants, i.e.
+//       into the graph, so a graph reading a cache isn't read-only the way
+//       an ExecutionContext expects (see execution_context.h). Contexts
+//       sharing it mustn't run while it's appended to, and each sequence
+//       evaluated at once needs a cache (and graph) of its own.
+class KVCache {
+    Buffer* keys_;
+    Buffer* values_;
+
+    // Constants over keys_ and values_, for graphs to read them through.
+    Operation* key_op_;
+    Operation* value_op_;
+
+    int capacity_;
+
+    // Positions held, and the slot of the oldest one.
+    int length_;
+    int first_slot_;
+
+    // Positions ever appended.
+    uint64_t position_;
+
+    // Copies the rows of `rows` into the slots of `cache` from `first_slot` on.
+    void write(Buffer* cache, Buffer* rows, int first_slot);
+
+  public:
+    KVCache(std::vector<int> key_shape, std::vector<int> value_shape, DataType dtype, Allocator* a);
+
+    // Appends n positions: keys [..., n, d] and values [..., n, dv], with
+    // n no more than the capacity.
+    void append(Buffer* keys, Buffer* values);
+
+    // Forgets every position, e.g. to start a new sequence.
+    void clear();
+
+    Operation* getKeys();
+    Operation* getValues();
+
+    int getCapacity();
+    int getLength();
+    int getFirstSlot();
+    uint64_t getPosition();
+};
+
+} // namespace deeplib
+
+#endif
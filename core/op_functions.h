@@ -1,14 +1,25 @@
 #ifndef OP_FUNCTIONS
 #define OP_FUNCTIONS
 #include <string>
+#include <algorithm>
 #include "core/tensor.h"
 #include "core/operations.h"
+#include "core/quantization.h"
 
 namespace deeplib {
 
 // NOTE: It is assumed that the allocators of t1 and t2 are the same.
 //       this may change in the future.
 
+// Graph input to be filled (or rebound) with Tensor::feed() before operating.
+Tensor placeholder(std::vector<int> shape, DataType dtype, Allocator* a) {
+    Buffer* buf = a->newBuffer(new Buffer(shape, a));
+    buf->setDataType(dtype);
+    buf->initialize();
+
+    return Tensor(buf, a->newOperation(new Placeholder(buf)));
+}
+
 Tensor add(Tensor& t1, Tensor& t2) {
     assert(t1.getDataType() == t2.getDataType());
 
@@ -56,6 +67,9 @@ Tensor divide(Tensor& t1, Tensor& t2) {
 // Inputs must be at least 2D. Inputs of higher rank
 // will only be considered for their last two dimensions.
 //
+// A 2D t2 (e.g. a weight matrix) is multiplied with every
+// matrix in t1's leading dimensions.
+//
 // Shape is assumed to be in format [..., rows, columns]
 Tensor matmul(Tensor& t1, Tensor& t2) {
     assert(t1.getDataType() == t2.getDataType());
@@ -66,12 +80,15 @@ Tensor matmul(Tensor& t1, Tensor& t2) {
 
     // Shape requirements.
     assert(shape1.size() >= 2 && shape2.size() >= 2);
+    assert(shape2.size() == 2 || shape2.size() == shape1.size());
     for (int i = 0; i < shape1.size()-2; i++) {
-        assert(shape1[i] == shape2[i]);
+        if (shape2.size() > 2)
+            assert(shape1[i] == shape2[i]);
+
         new_shape.push_back(shape1[i]);
     }
 
-    assert(shape1[shape1.size()-2] == shape2[shape2.size()-1]);
+    assert(shape1[shape1.size()-1] == shape2[shape2.size()-2]);
 
     new_shape.push_back(shape1[shape1.size()-2]);
     new_shape.push_back(shape2[shape2.size()-1]);
@@ -81,22 +98,66 @@ Tensor matmul(Tensor& t1, Tensor& t2) {
             new MatrixMultiplication(t1.getOperation(), t2.getOperation())), new_shape);
 }
 
-// TODO: dilation_rate
-Tensor conv2d(Tensor& image, Tensor& kernel, std::string padding, int (&strides)[2]) {
-    assert(image.getDataType() == kernel.getDataType());
+// Product of a sparse matrix (or its transpose, if `transposed`) and t, a
+// matrix [k, n] or a vector [k]. See SparseMatrixMultiplication.
+Tensor matmul(SparseMatrix* s, Tensor& t, bool transposed = false) {
+    assert(t.getDataType() == s->getDataType());
+    std::vector<int>& shape = t.getShape();
+
+    int rows = transposed ? s->getColumns() : s->getRows();
+    int inner = transposed ? s->getRows() : s->getColumns();
+
+    assert((shape.size() == 1 || shape.size() == 2) && shape[0] == inner);
 
+    std::vector<int> new_shape = shape;
+    new_shape[0] = rows;
+
+    return Tensor(t,
+        t.getAllocator()->newOperation(
+            new SparseMatrixMultiplication(s, t.getOperation(), true, transposed)), new_shape);
+}
+
+// Product of t [..., m, k] and a sparse matrix (or its transpose, if `transposed`).
+Tensor matmul(Tensor& t, SparseMatrix* s, bool transposed = false) {
+    assert(t.getDataType() == s->getDataType());
+    std::vector<int>& shape = t.getShape();
+
+    int inner = transposed ? s->getColumns() : s->getRows();
+    int columns = transposed ? s->getRows() : s->getColumns();
+
+    assert(shape.size() >= 2 && shape.back() == inner);
+
+    std::vector<int> new_shape = shape;
+    new_shape.back() = columns;
+
+    return Tensor(t,
+        t.getAllocator()->newOperation(
+            new SparseMatrixMultiplication(s, t.getOperation(), false, transposed)), new_shape);
+}
+
+// Dense [rows, columns] tensor of a sparse matrix.
+Tensor toDense(SparseMatrix* s) {
+    Allocator* a = s->getAllocator();
+
+    std::vector<int> shape = { s->getRows(), s->getColumns() };
+    Buffer* buf = a->newBuffer(new Buffer(shape, a));
+    buf->setDataType(s->getDataType());
+
+    Operation* op = a->newOperation(new SparseToDense(s));
+    op->setBuffer(buf);
+
+    return Tensor(buf, op);
+}
+
+// Shape of conv2d()'s result.
+std::vector<int> conv2dShape(std::vector<int>& image_shape, std::vector<int>& kernel_shape,
+                             std::string padding, int (&strides)[2]) {
     assert(strides[0] >= 0 && strides[1] >= 0);
 
     std::string padding_values[2] = { "same", "valid" };
 
-    std::vector<int>& image_shape = image.getShape();
-    std::vector<int>& kernel_shape = kernel.getShape();
-
     std::vector<int> new_shape;
 
-    int kernel_offset_y = std::ceil(static_cast<float>(kernel_shape[0]) / 2) - 1;
-    int kernel_offset_x = std::ceil(static_cast<float>(kernel_shape[1]) / 2) - 1;
-
     assert(image_shape.size() >= 2 && kernel_shape.size() == 2);
     for (int i = 0; i < image_shape.size()-2; i++)
         new_shape.push_back(image_shape[i]);
@@ -116,14 +177,89 @@ Tensor conv2d(Tensor& image, Tensor& kernel, std::string padding, int (&strides)
         assert(false);
     }
 
+    return new_shape;
+}
+
+// TODO: dilation_rate
+Tensor conv2d(Tensor& image, Tensor& kernel, std::string padding, int (&strides)[2]) {
+    assert(image.getDataType() == kernel.getDataType());
+
+    std::vector<int> new_shape = conv2dShape(image.getShape(), kernel.getShape(), padding, strides);
+
     return Tensor(image, kernel,
         image.getAllocator()->newOperation(
             new Convolution2D(image.getOperation(), kernel.getOperation(), padding, strides)), new_shape);
 }
 
+// Transpose of conv2d with respect to its image: the result is shaped like
+// the images conv2d(..., kernel, padding, strides) maps to t's shape (the
+// smallest one with "valid" padding).
+Tensor conv2dTranspose(Tensor& t, Tensor& kernel, std::string padding, int (&strides)[2]) {
+    assert(t.getDataType() == kernel.getDataType());
+
+    assert(strides[0] > 0 && strides[1] > 0);
+
+    std::vector<int> new_shape = t.getShape();
+    std::vector<int>& kernel_shape = kernel.getShape();
+    int rank = new_shape.size();
+
+    assert(rank >= 2 && kernel_shape.size() == 2);
+
+    if (padding.compare("same") && padding.compare("valid")) {
+        std::cout << "ERROR: Invalid padding value. Must be either \"same\" or \"valid\"" << std::endl;
+        assert(false);
+    }
+
+    // NOTE: strides override padding, as with conv2d
+    if (!padding.compare("valid") || strides[0] > 1 || strides[1] > 1) {
+        new_shape[rank-2] = (new_shape[rank-2] - 1) * strides[0] + kernel_shape[0];
+        new_shape[rank-1] = (new_shape[rank-1] - 1) * strides[1] + kernel_shape[1];
+    }
+
+    return Tensor(t, kernel,
+        t.getAllocator()->newOperation(
+            new Convolution2DTranspose(t.getOperation(), kernel.getOperation(), padding, strides)), new_shape);
+}
+
+// Max or average of every window of the last two dimensions of image, with
+// the same padding and strides as conv2d.
+Tensor pool2d(Tensor& image, PoolingType pooling, int (&window)[2], std::string padding, int (&strides)[2]) {
+    assert(strides[0] > 0 && strides[1] > 0 && window[0] > 0 && window[1] > 0);
+
+    std::vector<int> new_shape = image.getShape();
+    int rank = new_shape.size();
+
+    assert(rank >= 2);
+
+    if (padding.compare("same") && padding.compare("valid")) {
+        std::cout << "ERROR: Invalid padding value. Must be either \"same\" or \"valid\"" << std::endl;
+        assert(false);
+    }
+
+    // NOTE: strides override padding, as with conv2d
+    if (!padding.compare("valid") || strides[0] > 1 || strides[1] > 1) {
+        new_shape[rank-2] = (new_shape[rank-2] - window[0]) / strides[0] + 1;
+        new_shape[rank-1] = (new_shape[rank-1] - window[1]) / strides[1] + 1;
+
+        assert(new_shape[rank-2] > 0 && new_shape[rank-1] > 0);
+    }
+
+    return Tensor(image,
+        image.getAllocator()->newOperation(
+            new Pooling2D(image.getOperation(), pooling, window, padding, strides)), new_shape);
+}
+
+Tensor maxPool2d(Tensor& image, int (&window)[2], std::string padding, int (&strides)[2]) {
+    return pool2d(image, PoolingType::MAX, window, padding, strides);
+}
+
+Tensor avgPool2d(Tensor& image, int (&window)[2], std::string padding, int (&strides)[2]) {
+    return pool2d(image, PoolingType::AVERAGE, window, padding, strides);
+}
+
 Tensor sqrt(Tensor& t) {
     DataType dtype = t.getDataType();
-    if (dtype < DataType::FLOAT32) {
+    if (!isFloatingPoint(dtype)) {
         std::cout << "ERROR: Data type of operation sqrt must be floating point!" << std::endl;
         assert(false);
     }
@@ -134,10 +270,12 @@ Tensor sqrt(Tensor& t) {
     }
 }
 
-Tensor cast(Tensor& t, DataType new_dtype) {
+// t converted to new_dtype. Narrowing conversions wrap around, or clamp
+// to new_dtype's range if `saturate` (see convert.h).
+Tensor cast(Tensor& t, DataType new_dtype, bool saturate = false) {
     return Tensor(t,
         t.getAllocator()->newOperation(
-            new Cast(t.getOperation())), new_dtype);
+            new Cast(t.getOperation(), saturate)), new_dtype);
 }
 
 Tensor exp(Tensor& t) {
@@ -146,5 +284,638 @@ Tensor exp(Tensor& t) {
             new Exponential(t.getOperation())));
 }
 
+Tensor log(Tensor& t) {
+    return Tensor(t,
+        t.getAllocator()->newOperation(
+            new Logarithm(t.getOperation())));
+}
+
+// Transposes every matrix in t, i.e. swaps its last two dimensions.
+Tensor transpose(Tensor& t) {
+    std::vector<int> new_shape = t.getShape();
+    assert(new_shape.size() >= 2);
+    std::swap(new_shape.rbegin()[0], new_shape.rbegin()[1]);
+
+    return Tensor(t,
+        t.getAllocator()->newOperation(
+            new Transpose(t.getOperation())), new_shape);
+}
+
+// Runs of consecutive axes of `shape` among `axes` (every axis if none are
+// given, counting negative ones from the back), as [first, last] pairs, and
+// the shape of the reduction over them in `final_shape`. Reduced axes are
+// kept with a size of 1 if `keepdims` is true, and dropped otherwise.
+std::vector<std::pair<int, int>> reductionRuns(std::vector<int>& shape, std::vector<int> axes, bool keepdims,
+                                               std::vector<int>& final_shape) {
+    int rank = shape.size();
+
+    if (axes.empty()) {
+        for (int i = 0; i < rank; i++)
+            axes.push_back(i);
+    }
+
+    for (int& axis : axes) {
+        if (axis < 0)
+            axis += rank;
+
+        assert(axis >= 0 && axis < rank);
+    }
+
+    std::sort(axes.begin(), axes.end());
+    axes.erase(std::unique(axes.begin(), axes.end()), axes.end());
+
+    std::vector<std::pair<int, int>> runs;
+    for (int axis : axes) {
+        if (!runs.empty() && runs.back().second == axis - 1)
+            runs.back().second = axis;
+        else
+            runs.push_back({ axis, axis });
+    }
+
+    final_shape.clear();
+    for (int i = 0; i < rank; i++) {
+        if (!std::binary_search(axes.begin(), axes.end(), i))
+            final_shape.push_back(shape[i]);
+        else if (keepdims)
+            final_shape.push_back(1);
+    }
+
+    if (final_shape.empty())
+        final_shape.push_back(1);
+
+    return runs;
+}
+
+// Reduces t over the given axes (see reductionRuns() for their rules).
+//
+// Each contiguous run of axes is reduced by an operation of its own.
+Tensor reduce(Tensor& t, std::vector<int> axes, bool keepdims, ReductionType reduction) {
+    std::vector<int> shape = t.getShape();
+
+    std::vector<int> final_shape;
+    std::vector<std::pair<int, int>> runs = reductionRuns(shape, axes, keepdims, final_shape);
+
+    assert(reduction != ReductionType::ARGMAX || runs.size() == 1);
+
+    // Later runs go first, keeping the axes of the earlier ones where they are.
+    // Operations before the last keep their axes, the last one shapes the result.
+    std::vector<Tensor> results;
+    results.reserve(runs.size());
+
+    Tensor* input = &t;
+    for (int r = runs.size() - 1; r >= 0; r--) {
+        for (int i = runs[r].first; i <= runs[r].second; i++)
+            shape[i] = 1;
+
+        std::vector<int> new_shape = (r == 0) ? final_shape : shape;
+
+        Operation* op = t.getAllocator()->newOperation(
+            new Reduction(input->getOperation(), reduction, runs[r].first, runs[r].second));
+
+        if (reduction == ReductionType::ARGMAX)
+            results.push_back(Tensor(*input, op, new_shape, DataType::INT64));
+        else
+            results.push_back(Tensor(*input, op, new_shape));
+
+        input = &results.back();
+    }
+
+    return results.back();
+}
+
+Tensor sum(Tensor& t, std::vector<int> axes = {}, bool keepdims = false) {
+    return reduce(t, axes, keepdims, ReductionType::SUM);
+}
+
+Tensor mean(Tensor& t, std::vector<int> axes = {}, bool keepdims = false) {
+    return reduce(t, axes, keepdims, ReductionType::MEAN);
+}
+
+Tensor max(Tensor& t, std::vector<int> axes = {}, bool keepdims = false) {
+    return reduce(t, axes, keepdims, ReductionType::MAX);
+}
+
+Tensor min(Tensor& t, std::vector<int> axes = {}, bool keepdims = false) {
+    return reduce(t, axes, keepdims, ReductionType::MIN);
+}
+
+// INT64 index of the first largest element along `axis`.
+Tensor argmax(Tensor& t, int axis, bool keepdims = false) {
+    return reduce(t, { axis }, keepdims, ReductionType::ARGMAX);
+}
+
+// Average of each image, i.e. of the last two dimensions.
+Tensor globalAvgPool2d(Tensor& image, bool keepdims = false) {
+    return mean(image, { -2, -1 }, keepdims);
+}
+
+// Softmax over the last axis.
+Tensor softmax(Tensor& t) {
+    assert(isFloatingPoint(t.getDataType()));
+
+    return Tensor(t,
+        t.getAllocator()->newOperation(
+            new Softmax(t.getOperation())));
+}
+
+// Log-softmax over the last axis, i.e. log(softmax(t)) without the
+// intermediate softmax (or its precision loss for very small results).
+Tensor logSoftmax(Tensor& t) {
+    assert(isFloatingPoint(t.getDataType()));
+
+    return Tensor(t,
+        t.getAllocator()->newOperation(
+            new Softmax(t.getOperation(), true)));
+}
+
+// Cross-entropy of `labels` (distributions over the last axis, e.g. one-hot)
+// against softmax(logits), one value per row. The result drops the last axis.
+Tensor softmaxCrossEntropy(Tensor& logits, Tensor& labels) {
+    assert(isFloatingPoint(logits.getDataType()));
+    assert(logits.getDataType() == labels.getDataType());
+    assert(logits.getShape() == labels.getShape());
+
+    std::vector<int> new_shape(logits.getShape().begin(), logits.getShape().end() - 1);
+    if (new_shape.empty())
+        new_shape.push_back(1);
+
+    return Tensor(logits, labels,
+        logits.getAllocator()->newOperation(
+            new SoftmaxCrossEntropy(logits.getOperation(), labels.getOperation())), new_shape);
+}
+
+// Element-wise activations. If `approximate`, they're computed through
+// vector_math.h instead of libm (see Activation for the errors involved),
+// and GELU takes its tanh form.
+Tensor activation(Tensor& t, ActivationType activation, bool approximate = false) {
+    assert(isFloatingPoint(t.getDataType()));
+
+    return Tensor(t,
+        t.getAllocator()->newOperation(
+            new Activation(t.getOperation(), activation, approximate)));
+}
+
+Tensor relu(Tensor& t) {
+    return activation(t, ActivationType::RELU);
+}
+
+Tensor sigmoid(Tensor& t, bool approximate = false) {
+    return activation(t, ActivationType::SIGMOID, approximate);
+}
+
+Tensor tanh(Tensor& t, bool approximate = false) {
+    return activation(t, ActivationType::TANH, approximate);
+}
+
+Tensor gelu(Tensor& t, bool approximate = false) {
+    return activation(t, ActivationType::GELU, approximate);
+}
+
+Tensor silu(Tensor& t, bool approximate = false) {
+    return activation(t, ActivationType::SILU, approximate);
+}
+
+// Scaled dot-product attention of q [..., queries, d] over k [..., keys, d]
+// and v [..., keys, dv], see Attention. A `scale` of 0 stands for 1 / sqrt(d).
+Tensor attention(Tensor& q, Tensor& k, Tensor& v, bool causal = false, double scale = 0) {
+    assert(isFloatingPoint(q.getDataType()));
+    assert(k.getDataType() == q.getDataType() && v.getDataType() == q.getDataType());
+
+    std::vector<int> new_shape = q.getShape();
+    std::vector<int>& k_shape = k.getShape();
+    std::vector<int>& v_shape = v.getShape();
+    int rank = new_shape.size();
+
+    assert(rank >= 2 && k_shape.size() == rank && v_shape.size() == rank);
+    assert(std::equal(new_shape.begin(), new_shape.end() - 2, k_shape.begin()));
+    assert(std::equal(new_shape.begin(), new_shape.end() - 2, v_shape.begin()));
+    assert(k_shape.back() == new_shape.back() && v_shape.rbegin()[1] == k_shape.rbegin()[1]);
+
+    if (scale == 0)
+        scale = 1 / std::sqrt(static_cast<double>(new_shape.back()));
+
+    new_shape.back() = v_shape.back();
+
+    return Tensor(q,
+        q.getAllocator()->newOperation(
+            new Attention(q.getOperation(), k.getOperation(), v.getOperation(), scale, causal)), new_shape);
+}
+
+// Attention of q [..., queries, d] over the positions held by a cache, whose
+// last `queries` positions are q's own (i.e. were appended for this step).
+Tensor attention(Tensor& q, KVCache* cache, bool causal = true, double scale = 0) {
+    Operation* keys = cache->getKeys();
+    Operation* values = cache->getValues();
+
+    assert(isFloatingPoint(q.getDataType()));
+    assert(keys->getBuffer()->getDataType() == q.getDataType());
+
+    std::vector<int> new_shape = q.getShape();
+    std::vector<int>& key_shape = keys->getBuffer()->getShape();
+    int rank = new_shape.size();
+
+    assert(rank >= 2 && key_shape.size() == rank);
+    assert(std::equal(new_shape.begin(), new_shape.end() - 2, key_shape.begin()));
+    assert(key_shape.back() == new_shape.back());
+
+    if (scale == 0)
+        scale = 1 / std::sqrt(static_cast<double>(new_shape.back()));
+
+    new_shape.back() = values->getBuffer()->getShape().back();
+
+    return Tensor(q,
+        q.getAllocator()->newOperation(
+            new Attention(q.getOperation(), keys, values, scale, causal, cache)), new_shape);
+}
+
+// Runs a recurrent layer over x [batch, time, input], giving the hidden state
+// of every step [batch, time, hidden]. See Recurrent for the weights' layout.
+Tensor recurrent(Tensor& x, Tensor& input_weights, Tensor& hidden_weights, Tensor& bias, RecurrentType recurrent) {
+    assert(isFloatingPoint(x.getDataType()));
+    assert(input_weights.getDataType() == x.getDataType() && hidden_weights.getDataType() == x.getDataType());
+    assert(bias.getDataType() == x.getDataType());
+
+    std::vector<int>& shape = x.getShape();
+    std::vector<int>& input_shape = input_weights.getShape();
+    std::vector<int>& hidden_shape = hidden_weights.getShape();
+
+    int hidden = hidden_shape[0];
+    int columns = ((recurrent == RecurrentType::LSTM) ? 4 : 3) * hidden;
+
+    assert(shape.size() == 3 && input_shape.size() == 2 && hidden_shape.size() == 2);
+    assert(input_shape[0] == shape[2] && input_shape[1] == columns && hidden_shape[1] == columns);
+    assert(bias.getBuffer()->getElements() == columns);
+
+    return Tensor(x,
+        x.getAllocator()->newOperation(
+            new Recurrent(x.getOperation(), input_weights.getOperation(), hidden_weights.getOperation(),
+                          bias.getOperation(), recurrent)), { shape[0], shape[1], hidden });
+}
+
+Tensor lstm(Tensor& x, Tensor& input_weights, Tensor& hidden_weights, Tensor& bias) {
+    return recurrent(x, input_weights, hidden_weights, bias, RecurrentType::LSTM);
+}
+
+Tensor gru(Tensor& x, Tensor& input_weights, Tensor& hidden_weights, Tensor& bias) {
+    return recurrent(x, input_weights, hidden_weights, bias, RecurrentType::GRU);
+}
+
+// Slices of t along `axis` picked by an INT32 or INT64 index tensor, the
+// result having t's shape with `axis` replaced by the indices' shape.
+Tensor gather(Tensor& t, Tensor& indices, int axis = 0) {
+    assert(indices.getDataType() == DataType::INT32 || indices.getDataType() == DataType::INT64);
+
+    std::vector<int>& shape = t.getShape();
+    if (axis < 0)
+        axis += shape.size();
+
+    assert(axis >= 0 && axis < shape.size());
+
+    std::vector<int> new_shape(shape.begin(), shape.begin() + axis);
+    for (int d : indices.getShape())
+        new_shape.push_back(d);
+    new_shape.insert(new_shape.end(), shape.begin() + axis + 1, shape.end());
+
+    return Tensor(t, indices,
+        t.getAllocator()->newOperation(
+            new Gather(t.getOperation(), indices.getOperation(), axis)), new_shape);
+}
+
+// Same as above, for a single dimension of indices.
+Tensor indexSelect(Tensor& t, int axis, Tensor& indices) {
+    assert(indices.getShape().size() == 1);
+
+    return gather(t, indices, axis);
+}
+
+// Rows of an embedding table [rows, ...] for every id, i.e. [ids..., ...].
+Tensor embedding(Tensor& table, Tensor& ids) {
+    return gather(table, ids, 0);
+}
+
+// t with the slices of `updates` added along `axis` at the positions given by
+// an INT32 or INT64 index tensor, repeated indices adding up. `updates` is
+// shaped like gather(t, indices, axis).
+Tensor scatterAdd(Tensor& t, Tensor& indices, Tensor& updates, int axis = 0) {
+    assert(indices.getDataType() == DataType::INT32 || indices.getDataType() == DataType::INT64);
+    assert(updates.getDataType() == t.getDataType());
+
+    std::vector<int>& shape = t.getShape();
+    if (axis < 0)
+        axis += shape.size();
+
+    assert(axis >= 0 && axis < shape.size());
+    assert(updates.getBuffer()->getElements() ==
+           t.getBuffer()->getElements() / shape[axis] * indices.getBuffer()->getElements());
+
+    return Tensor(t,
+        t.getAllocator()->newOperation(
+            new ScatterAdd(t.getOperation(), indices.getOperation(), updates.getOperation(), axis)), shape);
+}
+
+// Checks the parameters of a normalization of t: floating point, and one
+// element per element of t's last axis (or a single one, if `single_allowed`).
+void checkNormalization(Tensor& t, std::vector<Tensor*> parameters, bool single_allowed) {
+    assert(isFloatingPoint(t.getDataType()));
+
+    uint64_t channels = parameters[0]->getBuffer()->getElements();
+    assert(channels == t.getShape().back() || (single_allowed && channels == 1));
+
+    for (Tensor* p : parameters) {
+        assert(p->getDataType() == t.getDataType());
+        assert(p->getBuffer()->getElements() == channels);
+    }
+}
+
+// Normalizes every row of t's last axis to zero mean and unit variance,
+// then scales and shifts it (per element of the row).
+Tensor layerNorm(Tensor& t, Tensor& scale, Tensor& shift, double epsilon = 1e-5) {
+    checkNormalization(t, { &scale, &shift }, false);
+
+    return Tensor(t,
+        t.getAllocator()->newOperation(
+            new Normalization(t.getOperation(), scale.getOperation(), shift.getOperation(),
+                              NormalizationType::LAYER, epsilon)));
+}
+
+// Divides every row of t's last axis by its root mean square, then scales it.
+Tensor rmsNorm(Tensor& t, Tensor& scale, double epsilon = 1e-6) {
+    checkNormalization(t, { &scale }, false);
+
+    return Tensor(t,
+        t.getAllocator()->newOperation(
+            new Normalization(t.getOperation(), scale.getOperation(), nullptr,
+                              NormalizationType::RMS, epsilon)));
+}
+
+// Normalizes every channel (element of t's last axis, or all of t for
+// single element parameters) with the mean and variance it has over the
+// batch, then scales and shifts it.
+Tensor batchNorm(Tensor& t, Tensor& scale, Tensor& shift, double epsilon = 1e-5) {
+    checkNormalization(t, { &scale, &shift }, true);
+
+    return Tensor(t,
+        t.getAllocator()->newOperation(
+            new Normalization(t.getOperation(), scale.getOperation(), shift.getOperation(),
+                              NormalizationType::BATCH, epsilon)));
+}
+
+// Same as above, with a given mean and variance per channel (e.g. running
+// averages from training), for inference. See foldBatchNormalization().
+Tensor batchNorm(Tensor& t, Tensor& scale, Tensor& shift, Tensor& mean, Tensor& variance, double epsilon = 1e-5) {
+    checkNormalization(t, { &scale, &shift, &mean, &variance }, true);
+
+    return Tensor(t,
+        t.getAllocator()->newOperation(
+            new Normalization(t.getOperation(), scale.getOperation(), shift.getOperation(),
+                              mean.getOperation(), variance.getOperation(), epsilon)));
+}
+
+// Quantizes floating point t to INT8 or UINT8 with the given scales and
+// zero points (see Quantization), e.g. from a Calibrator.
+Tensor quantize(Tensor& t, DataType dtype, Quantization quantization) {
+    assert(isFloatingPoint(t.getDataType()));
+    assert(dtype == DataType::INT8 || dtype == DataType::UINT8);
+
+    Tensor result(t,
+        t.getAllocator()->newOperation(
+            new Quantize(t.getOperation(), quantization)), t.getShape(), dtype);
+
+    result.getBuffer()->setQuantization(quantization);
+
+    return result;
+}
+
+// Symmetric INT8 weights for the quantized products, quantized once from
+// t's current values (see weightQuantization()) into a new constant: later
+// changes to t aren't picked up.
+Tensor quantizeWeights(Tensor& t, int axis = -1) {
+    Tensor quantized = quantize(t, DataType::INT8, weightQuantization(t.getBuffer(), axis));
+    quantized.operate();
+
+    Buffer* buf = quantized.getBuffer();
+    return Tensor(buf, t.getAllocator()->newOperation(new Constant(buf)));
+}
+
+// FLOAT32 values of quantized t.
+Tensor dequantize(Tensor& t) {
+    assert(t.getBuffer()->isQuantized());
+
+    return Tensor(t,
+        t.getAllocator()->newOperation(
+            new Dequantize(t.getOperation())), t.getShape(), DataType::FLOAT32);
+}
+
+// Checks the operands of a quantized product, and quantizes its result
+// unless it's FLOAT32.
+void checkQuantized(Tensor& input, Tensor& weights, Tensor& result, Quantization& quantization) {
+    Quantization& input_quantization = input.getBuffer()->getQuantization();
+    Quantization& weight_quantization = weights.getBuffer()->getQuantization();
+
+    assert(input.getBuffer()->isQuantized() && input_quantization.axis == -1);
+
+    assert(weights.getDataType() == DataType::INT8 && weights.getBuffer()->isQuantized());
+    for (int32_t zero_point : weight_quantization.zero_points)
+        assert(zero_point == 0);
+
+    if (result.getDataType() != DataType::FLOAT32) {
+        assert(quantization.scales.size() == 1 && quantization.axis == -1);
+        result.getBuffer()->setQuantization(quantization);
+    }
+}
+
+// a [..., rows, inner] times weights [inner, columns], quantized as described
+// in QuantizedMatrixMultiplication: a with a single scale and zero point, the
+// weights symmetric INT8 with a single scale or one per column (axis 1).
+//
+// The result is FLOAT32, or quantized with `quantization` to INT8 or UINT8.
+Tensor quantizedMatmul(Tensor& a, Tensor& weights, DataType dtype = DataType::FLOAT32,
+                       Quantization quantization = {}) {
+    std::vector<int> new_shape = a.getShape();
+    std::vector<int>& weight_shape = weights.getShape();
+
+    assert(weight_shape.size() == 2 && new_shape.back() == weight_shape[0]);
+    assert(weights.getBuffer()->getQuantization().axis != 0);
+    new_shape.back() = weight_shape[1];
+
+    Tensor result(a,
+        a.getAllocator()->newOperation(
+            new QuantizedMatrixMultiplication(a.getOperation(), weights.getOperation(), quantization)),
+        new_shape, dtype);
+
+    checkQuantized(a, weights, result, quantization);
+
+    return result;
+}
+
+// conv2d() of quantized images with a symmetric INT8 kernel (single scale).
+// The result is FLOAT32, or quantized with `quantization` to INT8 or UINT8.
+Tensor quantizedConv2d(Tensor& image, Tensor& kernel, std::string padding, int (&strides)[2],
+                       DataType dtype = DataType::FLOAT32, Quantization quantization = {}) {
+    assert(kernel.getBuffer()->getQuantization().axis == -1);
+
+    std::vector<int> new_shape = conv2dShape(image.getShape(), kernel.getShape(), padding, strides);
+
+    Tensor result(image,
+        image.getAllocator()->newOperation(
+            new QuantizedConvolution2D(image.getOperation(), kernel.getOperation(), padding, strides,
+                                       quantization)),
+        new_shape, dtype);
+
+    checkQuantized(image, kernel, result, quantization);
+
+    return result;
+}
+
+// Element-wise comparison of t1 and t2 into a BOOL mask shaped like the
+// larger of the two, the other being a single element or a row repeated
+// across it (as in add()).
+Tensor compare(Tensor& t1, Tensor& t2, ComparisonType comparison) {
+    assert(t1.getDataType() == t2.getDataType());
+
+    bool first_larger = t1.getBuffer()->getElements() >= t2.getBuffer()->getElements();
+    Tensor& larger = first_larger ? t1 : t2;
+    Tensor& smaller = first_larger ? t2 : t1;
+    assert(larger.getBuffer()->getElements() % smaller.getBuffer()->getElements() == 0);
+
+    return Tensor(larger,
+        larger.getAllocator()->newOperation(
+            new Comparison(t1.getOperation(), t2.getOperation(), comparison)),
+        larger.getShape(), DataType::BOOL);
+}
+
+Tensor equal(Tensor& t1, Tensor& t2) {
+    return compare(t1, t2, ComparisonType::EQUAL);
+}
+
+Tensor notEqual(Tensor& t1, Tensor& t2) {
+    return compare(t1, t2, ComparisonType::NOT_EQUAL);
+}
+
+Tensor lessThan(Tensor& t1, Tensor& t2) {
+    return compare(t1, t2, ComparisonType::LESS);
+}
+
+Tensor lessEqual(Tensor& t1, Tensor& t2) {
+    return compare(t1, t2, ComparisonType::LESS_EQUAL);
+}
+
+Tensor greaterThan(Tensor& t1, Tensor& t2) {
+    return compare(t1, t2, ComparisonType::GREATER);
+}
+
+Tensor greaterEqual(Tensor& t1, Tensor& t2) {
+    return compare(t1, t2, ComparisonType::GREATER_EQUAL);
+}
+
+// Element-wise AND, OR or XOR of two BOOL masks, broadcasting like compare().
+Tensor logical(Tensor& t1, Tensor& t2, LogicalType logical) {
+    assert(logical != LogicalType::NOT);
+    assert(t1.getDataType() == DataType::BOOL && t2.getDataType() == DataType::BOOL);
+
+    bool first_larger = t1.getBuffer()->getElements() >= t2.getBuffer()->getElements();
+    Tensor& larger = first_larger ? t1 : t2;
+    Tensor& smaller = first_larger ? t2 : t1;
+    assert(larger.getBuffer()->getElements() % smaller.getBuffer()->getElements() == 0);
+
+    return Tensor(larger,
+        larger.getAllocator()->newOperation(
+            new Logical(t1.getOperation(), t2.getOperation(), logical)),
+        larger.getShape(), DataType::BOOL);
+}
+
+Tensor logicalAnd(Tensor& t1, Tensor& t2) {
+    return logical(t1, t2, LogicalType::AND);
+}
+
+Tensor logicalOr(Tensor& t1, Tensor& t2) {
+    return logical(t1, t2, LogicalType::OR);
+}
+
+Tensor logicalXor(Tensor& t1, Tensor& t2) {
+    return logical(t1, t2, LogicalType::XOR);
+}
+
+Tensor logicalNot(Tensor& t) {
+    assert(t.getDataType() == DataType::BOOL);
+
+    return Tensor(t,
+        t.getAllocator()->newOperation(
+            new Logical(t.getOperation(), nullptr, LogicalType::NOT)),
+        t.getShape(), DataType::BOOL);
+}
+
+// t1 where the BOOL condition is set and t2 elsewhere, see Select. The values
+// are shaped like the result or single elements, and the condition is
+// repeated across the result's leading dimensions if it's smaller.
+Tensor where(Tensor& condition, Tensor& t1, Tensor& t2) {
+    assert(condition.getDataType() == DataType::BOOL);
+    assert(t1.getDataType() == t2.getDataType());
+
+    uint64_t n1 = t1.getBuffer()->getElements(), n2 = t2.getBuffer()->getElements();
+    uint64_t mask_n = condition.getBuffer()->getElements();
+
+    std::vector<int> new_shape = (n1 >= n2) ? t1.getShape() : t2.getShape();
+    if (std::max(n1, n2) == 1)
+        new_shape = condition.getShape();
+
+    uint64_t n = std::max<uint64_t>(std::max(n1, n2), mask_n);
+    assert((n1 == 1 || n1 == n) && (n2 == 1 || n2 == n) && n % mask_n == 0);
+
+    return Tensor(t1,
+        t1.getAllocator()->newOperation(
+            new Select(condition.getOperation(), t1.getOperation(), t2.getOperation())),
+        new_shape);
+}
+
+// Reduces a BOOL mask over the given axes (as in reduce()), see MaskReduction.
+// COUNT gives INT64 counts, and ANY and ALL a BOOL mask.
+Tensor reduceMask(Tensor& mask, std::vector<int> axes, bool keepdims, MaskReductionType reduction) {
+    assert(mask.getDataType() == DataType::BOOL);
+
+    std::vector<int> shape = mask.getShape();
+
+    std::vector<int> final_shape;
+    std::vector<std::pair<int, int>> runs = reductionRuns(shape, axes, keepdims, final_shape);
+
+    DataType dtype = (reduction == MaskReductionType::COUNT) ? DataType::INT64 : DataType::BOOL;
+
+    // As in reduce(), with the counts of the first run summed up by the others.
+    std::vector<Tensor> results;
+    results.reserve(runs.size());
+
+    Tensor* input = &mask;
+    for (int r = runs.size() - 1; r >= 0; r--) {
+        for (int i = runs[r].first; i <= runs[r].second; i++)
+            shape[i] = 1;
+
+        std::vector<int> new_shape = (r == 0) ? final_shape : shape;
+
+        Operation* op;
+        if (input == &mask || reduction != MaskReductionType::COUNT)
+            op = new MaskReduction(input->getOperation(), reduction, runs[r].first, runs[r].second);
+        else
+            op = new Reduction(input->getOperation(), ReductionType::SUM, runs[r].first, runs[r].second);
+
+        results.push_back(Tensor(*input, mask.getAllocator()->newOperation(op), new_shape, dtype));
+        input = &results.back();
+    }
+
+    return results.back();
+}
+
+// Number of set elements of a BOOL mask.
+Tensor countTrue(Tensor& mask, std::vector<int> axes = {}, bool keepdims = false) {
+    return reduceMask(mask, axes, keepdims, MaskReductionType::COUNT);
+}
+
+Tensor any(Tensor& mask, std::vector<int> axes = {}, bool keepdims = false) {
+    return reduceMask(mask, axes, keepdims, MaskReductionType::ANY);
+}
+
+Tensor all(Tensor& mask, std::vector<int> axes = {}, bool keepdims = false) {
+    return reduceMask(mask, axes, keepdims, MaskReductionType::ALL);
+}
+
 } // namespace deeplib
 #endif
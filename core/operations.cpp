@@ -1,56 +1,217 @@
 #include <iostream>
 #include <cmath>
+#include <cstring>
 #include "core/operations.h"
+#include "core/utils.h"
 
 using std::string;
 
 namespace deeplib {
 
+// Operations with kernels of their own for FLOAT16 and BFLOAT16 data, which
+// convert it to FP32 as they go. Every other operation computes such data
+// through halfCompute()'s FP32 fallback.
+template <class Op>
+struct HalfKernels { static const bool value = false; };
+
+template <> struct HalfKernels<Addition> { static const bool value = true; };
+template <> struct HalfKernels<Subtraction> { static const bool value = true; };
+template <> struct HalfKernels<Multiplication> { static const bool value = true; };
+template <> struct HalfKernels<Division> { static const bool value = true; };
+template <> struct HalfKernels<Power> { static const bool value = true; };
+template <> struct HalfKernels<SquareRoot> { static const bool value = true; };
+template <> struct HalfKernels<Exponential> { static const bool value = true; };
+template <> struct HalfKernels<Logarithm> { static const bool value = true; };
+template <> struct HalfKernels<MatrixMultiplication> { static const bool value = true; };
+template <> struct HalfKernels<Cast> { static const bool value = true; };
+template <> struct HalfKernels<Activation> { static const bool value = true; };
+template <> struct HalfKernels<Reduction> { static const bool value = true; };
+template <> struct HalfKernels<Select> { static const bool value = true; };
+
+// Operations computing BOOL data (bit-packed, see bits.h) an element at a
+// time, through Buffer::getIndex<bool>() and setIndex<bool>(). The mask
+// operations work on whole words instead, and take no other data type.
+template <class Op>
+struct BoolKernels { static const bool value = false; };
+
+template <> struct BoolKernels<Cast> { static const bool value = true; };
+
+// FLOAT32 buffers the FP32 fallback widens into, one per input (and one for
+// the result), kept from one evaluate() to the next and only reallocated to
+// grow. Each thread has its own, as contexts may evaluate on several.
+class HalfScratch {
+    Allocator allocator_;
+    std::vector<Buffer*> buffers_;
+
+  public:
+    // FLOAT32 buffer number `slot`, shaped as given.
+    Buffer* get(int slot, std::vector<int>& shape) {
+        if (slot >= buffers_.size())
+            buffers_.resize(slot + 1, nullptr);
+
+        uint64_t elements = 1;
+        for (int d : shape)
+            elements *= d;
+
+        Buffer*& buf = buffers_[slot];
+        if (buf != nullptr && buf->getSize() >= elements * sizeof(float)) {
+            buf->reshape(shape);
+            return buf;
+        }
+
+        if (buf != nullptr)
+            allocator_.releaseBuffer(buf);
+
+        buf = allocator_.newBuffer(new Buffer(shape, &allocator_));
+        buf->setDataType(DataType::FLOAT32);
+        buf->initialize();
+
+        return buf;
+    }
+};
+
+static thread_local HalfScratch half_scratch;
+
+// Returns a FLOAT32 copy of `buf`, in scratch buffer `slot`, if it holds
+// 16 bit floats. Otherwise `buf` itself (which may be missing, i.e. nullptr).
+static Buffer* widened(Buffer* buf, int slot) {
+    if (buf == nullptr || !isHalfPrecision(buf->getDataType()))
+        return buf;
+
+    DataType dtype = buf->getDataType();
+    Buffer* wide = half_scratch.get(slot, buf->getShape());
+
+    float* data = wide->getBufferDataAsTemplate<float>();
+    if (dtype == DataType::FLOAT16)
+        widen(data, buf->getBufferDataAsTemplate<float16>(), buf->getElements());
+    else
+        widen(data, buf->getBufferDataAsTemplate<bfloat16>(), buf->getElements());
+
+    return wide;
+}
+
+// Runs `compute(result)`, a FP32 kernel over inputs widened into scratch
+// buffers 1 and up. A 16 bit `out` gets the result rounded from a FLOAT32 one
+// (scratch buffer 0), while any other (e.g. argmax's indices) is written
+// directly.
+template <class Compute>
+void computeInFloat(Buffer* out, Compute compute) {
+    DataType dtype = out->getDataType();
+    if (!isHalfPrecision(dtype)) {
+        compute(out);
+        return;
+    }
+
+    Buffer* result = half_scratch.get(0, out->getShape());
+
+    compute(result);
+
+    float* data = result->getBufferDataAsTemplate<float>();
+    if (dtype == DataType::FLOAT16)
+        narrow(out->getBufferDataAsTemplate<float16>(), data, out->getElements());
+    else
+        narrow(out->getBufferDataAsTemplate<bfloat16>(), data, out->getElements());
+}
+
+// Computes FLOAT16 (HDType = float16) or BFLOAT16 (bfloat16) data, natively
+// if the operation can, and in FP32 over widened copies of it otherwise.
+template <typename HDType, class Op>
+void halfCompute(Op* op, Buffer* out, Buffer* b1, Buffer* b2) {
+    if constexpr (HalfKernels<Op>::value)
+        op->template compute<HDType>(out, b1, b2);
+    else
+        computeInFloat(out, [&](Buffer* result) {
+            op->template compute<float>(result, widened(b1, 1), widened(b2, 2));
+        });
+}
+
+template <typename HDType, class Op>
+void halfCompute(Op* op, Buffer* out, Buffer* b1) {
+    if constexpr (HalfKernels<Op>::value)
+        op->template compute<HDType>(out, b1);
+    else
+        computeInFloat(out, [&](Buffer* result) {
+            op->template compute<float>(result, widened(b1, 1));
+        });
+}
+
+template <typename HDType, class Op>
+void halfCompute(Op* op, Buffer* out, std::vector<Buffer*>& inputs) {
+    if constexpr (HalfKernels<Op>::value)
+        op->template compute<HDType>(out, inputs);
+    else
+        computeInFloat(out, [&](Buffer* result) {
+            std::vector<Buffer*> wide_inputs;
+            for (int i = 0; i < inputs.size(); i++)
+                wide_inputs.push_back(widened(inputs[i], i + 1));
+
+            op->template compute<float>(result, wide_inputs);
+        });
+}
+
 // Feed an Operation type (not Operation itself though) in here along with the buffers
 // to avoid unnecessary repeating of the switch statements.
 // 
 // A better method than the previous in avoiding code bloat (I hope).
 template <class Op>
-void compTemplateChoice(Op* op, Buffer* b1, Buffer* b2, DataType dtype) {
+void compTemplateChoice(Op* op, Buffer* out, Buffer* b1, Buffer* b2, DataType dtype) {
     switch (dtype) {
       case DataType::UINT8:
-        op->template compute<uint8_t>(b1, b2);
+        op->template compute<uint8_t>(out, b1, b2);
         return;
 
       case DataType::UINT16:
-        op->template compute<uint16_t>(b1, b2);
+        op->template compute<uint16_t>(out, b1, b2);
         return;
 
       case DataType::UINT32:
-        op->template compute<uint32_t>(b1, b2);
+        op->template compute<uint32_t>(out, b1, b2);
         return;
 
       case DataType::UINT64:
-        op->template compute<uint64_t>(b1, b2);
+        op->template compute<uint64_t>(out, b1, b2);
         return;
 
       case DataType::INT8:
-        op->template compute<int8_t>(b1, b2);
+        op->template compute<int8_t>(out, b1, b2);
         return;
 
       case DataType::INT16:
-        op->template compute<int16_t>(b1, b2);
+        op->template compute<int16_t>(out, b1, b2);
         return;
 
       case DataType::INT32:
-        op->template compute<int32_t>(b1, b2);
+        op->template compute<int32_t>(out, b1, b2);
         return;
 
       case DataType::INT64:
-        op->template compute<int64_t>(b1, b2);
+        op->template compute<int64_t>(out, b1, b2);
         return;
             
       case DataType::FLOAT32:
-        op->template compute<float>(b1, b2);
+        op->template compute<float>(out, b1, b2);
         return;
 
       case DataType::FLOAT64:
-        op->template compute<double>(b1, b2);
+        op->template compute<double>(out, b1, b2);
+        return;
+
+      case DataType::FLOAT16:
+        halfCompute<float16>(op, out, b1, b2);
+        return;
+
+      case DataType::BFLOAT16:
+        halfCompute<bfloat16>(op, out, b1, b2);
+        return;
+
+      case DataType::BOOL:
+        if constexpr (BoolKernels<Op>::value) {
+            op->template compute<bool>(out, b1, b2);
+            return;
+        }
+
+        std::cout << "ERROR: BOOL data is only taken by casts and mask operations!" << std::endl;
+        assert(false);
         return;
 
       default:
@@ -61,409 +222,2382 @@ void compTemplateChoice(Op* op, Buffer* b1, Buffer* b2, DataType dtype) {
 
 // Overloaded for unary operations.
 template <class Op>
-void compTemplateChoice(Op* op, Buffer* b1, DataType dtype) {
+void compTemplateChoice(Op* op, Buffer* out, Buffer* b1, DataType dtype) {
+    switch (dtype) {
+      case DataType::UINT8:
+        op->template compute<uint8_t>(out, b1);
+        return;
+
+      case DataType::UINT16:
+        op->template compute<uint16_t>(out, b1);
+        return;
+
+      case DataType::UINT32:
+        op->template compute<uint32_t>(out, b1);
+        return;
+
+      case DataType::UINT64:
+        op->template compute<uint64_t>(out, b1);
+        return;
+
+      case DataType::INT8:
+        op->template compute<int8_t>(out, b1);
+        return;
+
+      case DataType::INT16:
+        op->template compute<int16_t>(out, b1);
+        return;
+
+      case DataType::INT32:
+        op->template compute<int32_t>(out, b1);
+        return;
+
+      case DataType::INT64:
+        op->template compute<int64_t>(out, b1);
+        return;
+            
+      case DataType::FLOAT32:
+        op->template compute<float>(out, b1);
+        return;
+
+      case DataType::FLOAT64:
+        op->template compute<double>(out, b1);
+        return;
+
+      case DataType::FLOAT16:
+        halfCompute<float16>(op, out, b1);
+        return;
+
+      case DataType::BFLOAT16:
+        halfCompute<bfloat16>(op, out, b1);
+        return;
+
+      case DataType::BOOL:
+        if constexpr (BoolKernels<Op>::value) {
+            op->template compute<bool>(out, b1);
+            return;
+        }
+
+        std::cout << "ERROR: BOOL data is only taken by casts and mask operations!" << std::endl;
+        assert(false);
+        return;
+
+      default:
+        std::cout << "ERROR: bad data type!" << std::endl;
+        assert(false);
+    }
+}
+
+// For operations taking more than two inputs.
+template <class Op>
+void compTemplateChoice(Op* op, Buffer* out, std::vector<Buffer*>& inputs, DataType dtype) {
     switch (dtype) {
       case DataType::UINT8:
-        op->template compute<uint8_t>(b1);
+        op->template compute<uint8_t>(out, inputs);
         return;
 
       case DataType::UINT16:
-        op->template compute<uint16_t>(b1);
+        op->template compute<uint16_t>(out, inputs);
         return;
 
       case DataType::UINT32:
-        op->template compute<uint32_t>(b1);
+        op->template compute<uint32_t>(out, inputs);
         return;
 
       case DataType::UINT64:
-        op->template compute<uint64_t>(b1);
+        op->template compute<uint64_t>(out, inputs);
+        return;
+
+      case DataType::INT8:
+        op->template compute<int8_t>(out, inputs);
+        return;
+
+      case DataType::INT16:
+        op->template compute<int16_t>(out, inputs);
+        return;
+
+      case DataType::INT32:
+        op->template compute<int32_t>(out, inputs);
+        return;
+
+      case DataType::INT64:
+        op->template compute<int64_t>(out, inputs);
+        return;
+
+      case DataType::FLOAT32:
+        op->template compute<float>(out, inputs);
+        return;
+
+      case DataType::FLOAT64:
+        op->template compute<double>(out, inputs);
+        return;
+
+      case DataType::FLOAT16:
+        halfCompute<float16>(op, out, inputs);
+        return;
+
+      case DataType::BFLOAT16:
+        halfCompute<bfloat16>(op, out, inputs);
+        return;
+
+      case DataType::BOOL:
+        if constexpr (BoolKernels<Op>::value) {
+            op->template compute<bool>(out, inputs);
+            return;
+        }
+
+        std::cout << "ERROR: BOOL data is only taken by casts and mask operations!" << std::endl;
+        assert(false);
+        return;
+
+      default:
+        std::cout << "ERROR: bad data type!" << std::endl;
+        assert(false);
+    }
+}
+
+// Same as above, for operations only defined over floating point data.
+template <class Op>
+void floatTemplateChoice(Op* op, Buffer* out, Buffer* b1, Buffer* b2, DataType dtype) {
+    switch (dtype) {
+      case DataType::FLOAT32:
+        op->template compute<float>(out, b1, b2);
+        return;
+
+      case DataType::FLOAT64:
+        op->template compute<double>(out, b1, b2);
+        return;
+
+      case DataType::FLOAT16:
+        halfCompute<float16>(op, out, b1, b2);
+        return;
+
+      case DataType::BFLOAT16:
+        halfCompute<bfloat16>(op, out, b1, b2);
+        return;
+
+      default:
+        std::cout << "ERROR: Data type must be floating point in " << op->getType() << "!" << std::endl;
+        assert(false);
+    }
+}
+
+// For operations taking more than two inputs.
+template <class Op>
+void floatTemplateChoice(Op* op, Buffer* out, std::vector<Buffer*>& inputs, DataType dtype) {
+    switch (dtype) {
+      case DataType::FLOAT32:
+        op->template compute<float>(out, inputs);
+        return;
+
+      case DataType::FLOAT64:
+        op->template compute<double>(out, inputs);
+        return;
+
+      case DataType::FLOAT16:
+        halfCompute<float16>(op, out, inputs);
+        return;
+
+      case DataType::BFLOAT16:
+        halfCompute<bfloat16>(op, out, inputs);
+        return;
+
+      default:
+        std::cout << "ERROR: Data type must be floating point in " << op->getType() << "!" << std::endl;
+        assert(false);
+    }
+}
+
+template <class Op>
+void floatTemplateChoice(Op* op, Buffer* out, Buffer* b1, DataType dtype) {
+    switch (dtype) {
+      case DataType::FLOAT32:
+        op->template compute<float>(out, b1);
+        return;
+
+      case DataType::FLOAT64:
+        op->template compute<double>(out, b1);
+        return;
+
+      case DataType::FLOAT16:
+        halfCompute<float16>(op, out, b1);
+        return;
+
+      case DataType::BFLOAT16:
+        halfCompute<bfloat16>(op, out, b1);
+        return;
+
+      default:
+        std::cout << "ERROR: Data type must be floating point in " << op->getType() << "!" << std::endl;
+        assert(false);
+    }
+}
+
+// Same as above, for operations over quantized (INT8 or UINT8) data.
+template <class Op>
+void quantizedTemplateChoice(Op* op, Buffer* out, Buffer* b1, Buffer* b2, DataType dtype) {
+    switch (dtype) {
+      case DataType::UINT8:
+        op->template compute<uint8_t>(out, b1, b2);
+        return;
+
+      case DataType::INT8:
+        op->template compute<int8_t>(out, b1, b2);
+        return;
+
+      default:
+        std::cout << "ERROR: Data type must be INT8 or UINT8 in " << op->getType() << "!" << std::endl;
+        assert(false);
+    }
+}
+
+template <class Op>
+void quantizedTemplateChoice(Op* op, Buffer* out, Buffer* b1, DataType dtype) {
+    switch (dtype) {
+      case DataType::UINT8:
+        op->template compute<uint8_t>(out, b1);
+        return;
+
+      case DataType::INT8:
+        op->template compute<int8_t>(out, b1);
         return;
 
-      case DataType::INT8:
-        op->template compute<int8_t>(b1);
-        return;
+      default:
+        std::cout << "ERROR: Data type must be INT8 or UINT8 in " << op->getType() << "!" << std::endl;
+        assert(false);
+    }
+}
+
+//-----------------------------------\\
+// class Operation;                  \\
+//-----------------------------------\\
+
+// Abstract operation graph node class.
+//
+// Each Operation has two key functions:
+//   - Operation.derive()
+//   - Operation.operate()
+//
+// derive() is the function corresponding to the
+// derivative of that specific operation.
+// e.g. Multiplication.derive == d/dx(x * x) == x*1 + 1*x == product rule
+//
+// operate() is a recursive used to actually enact the arithmetic
+// defined by the operation.
+// e.g. Multiply.operate() == x * y,
+//      where x == Operation.parent1_ and y == Operation.parent2_
+//
+// It should be noted that Constant.operate() retrieves the actual value,
+// acting as the end condition to the recursive function
+// as newly created Tensor<T> objects have a Constant as their operation. // TODO: review this last line
+//
+// This is never to be used directly.
+Operation::Operation() {
+    parent1_ = nullptr;
+    parent2_ = nullptr;
+    buffer_ = nullptr;
+
+    computed_ = false;
+    version_ = 0;
+    buffer_version_ = 0;
+    computed_buffer_ = nullptr;
+    separated_ = false;
+
+    has_epilogue_ = false;
+    epilogue_ = ActivationType::RELU;
+    epilogue_approximate_ = false;
+}
+
+Buffer* Operation::operate(bool incremental) {
+    std::vector<Operation*> parents = getParents();
+
+    std::vector<Buffer*> inputs;
+    for (Operation* p : parents)
+        inputs.push_back(p->operate(incremental));
+
+    if (incremental && !isStale())
+        return this->buffer_;
+
+    this->buffer_->initialize();
+    evaluate(this->buffer_, inputs);
+
+    version_++;
+    computed_ = true;
+    buffer_version_ = this->buffer_->getVersion();
+    computed_buffer_ = this->buffer_;
+
+    parent_versions_.clear();
+    for (Operation* p : parents)
+        parent_versions_.push_back(p->getVersion());
+
+    return this->buffer_;
+}
+
+bool Operation::isStale() {
+    if (!computed_ || computed_buffer_ != this->buffer_)
+        return true;
+
+    // Covers graph inputs whose buffers were refilled.
+    if (buffer_version_ != this->buffer_->getVersion())
+        return true;
+
+    std::vector<Operation*> parents = getParents();
+    for (int i = 0; i < parents.size(); i++) {
+        if (parents[i]->getVersion() != parent_versions_[i])
+            return true;
+    }
+
+    return false;
+}
+
+void Operation::invalidate() {
+    computed_ = false;
+}
+
+void Operation::setSeparated() {
+    separated_ = true;
+}
+
+bool Operation::isSeparated() {
+    return separated_;
+}
+
+std::vector<Operation*> Operation::getParents() {
+    std::vector<Operation*> parents;
+    if (parent1_ != nullptr)
+        parents.push_back(parent1_);
+
+    if (parent2_ != nullptr)
+        parents.push_back(parent2_);
+
+    for (Operation* p : extra_parents_)
+        parents.push_back(p);
+
+    return parents;
+}
+
+void Operation::replaceParent(Operation* old_parent, Operation* new_parent) {
+    if (parent1_ == old_parent)
+        parent1_ = new_parent;
+
+    if (parent2_ == old_parent)
+        parent2_ = new_parent;
+
+    for (Operation*& p : extra_parents_) {
+        if (p == old_parent)
+            p = new_parent;
+    }
+
+    // The parent versions recorded no longer line up,
+    // and the new parents may share buffers.
+    invalidate();
+    separated_ = false;
+}
+
+uint64_t Operation::getVersion() {
+    return version_;
+}
+
+Operation* Operation::newGradient(Operation* op, std::vector<int> shape, DataType dtype, Allocator* a) {
+    Buffer* buf = a->newBuffer(new Buffer(shape, a));
+    buf->setDataType(dtype);
+
+    a->newOperation(op);
+    op->setBuffer(buf);
+
+    return op;
+}
+
+Operation* Operation::newGradient(Operation* op, Operation* like, Allocator* a) {
+    Buffer* like_buf = like->getBuffer();
+    return newGradient(op, like_buf->getShape(), like_buf->getDataType(), a);
+}
+
+Operation* Operation::newScalar(double value, DataType dtype, Allocator* a) {
+    std::vector<int> shape = { 1 };
+    std::vector<double> values = { value };
+
+    Buffer* buf = a->newBuffer(new Buffer(shape, a));
+    buf->setDataType(dtype);
+    buf->fill<double>(values);
+    buf->pin();
+
+    return a->newOperation(new Constant(buf));
+}
+
+Operation* Operation::sumToParent(Operation* grad, Operation* parent, Allocator* a) {
+    uint64_t elements = parent->getBuffer()->getElements();
+    if (grad->getBuffer()->getElements() == elements)
+        return grad;
+
+    // Broadcasting repeats the parent across the leading dimensions
+    // (or everywhere, for a single element), so those are summed over.
+    std::vector<int>& grad_shape = grad->getBuffer()->getShape();
+
+    int last_axis = grad_shape.size() - 1;
+    uint64_t trailing = 1;
+    while (elements > 1 && trailing < elements)
+        trailing *= grad_shape[last_axis--];
+
+    assert(elements == 1 || trailing == elements);
+
+    return newGradient(new Reduction(grad, ReductionType::SUM, 0, last_axis), parent, a);
+}
+
+int Operation::batchAxis(int, int) {
+    return -1;
+}
+
+int Operation::elementWiseBatchAxis(int parent, int axis) {
+    std::vector<int>& shape = this->buffer_->getShape();
+    std::vector<int>& parent_shape = getParents()[parent]->getBuffer()->getShape();
+
+    int result_axis = axis + shape.size() - parent_shape.size();
+    if (result_axis < 0 || shape[result_axis] != parent_shape[axis])
+        return -1;
+
+    return result_axis;
+}
+
+string Operation::getType() {
+    return type_;
+}
+
+bool Operation::acceptsEpilogue() {
+    return false;
+}
+
+void Operation::setEpilogue(ActivationType activation, bool approximate) {
+    assert(acceptsEpilogue());
+
+    has_epilogue_ = true;
+    epilogue_ = activation;
+    epilogue_approximate_ = approximate;
+
+    invalidate();
+}
+
+bool Operation::hasEpilogue() {
+    return has_epilogue_;
+}
+
+void Operation::applyEpilogue(Buffer* out, uint64_t begin, uint64_t end) {
+    if (!has_epilogue_)
+        return;
+
+    switch (out->getDataType()) {
+      case DataType::FLOAT32: {
+        float* data = out->getBufferDataAsTemplate<float>();
+        activate<float>(data + begin, data + begin, end - begin, epilogue_, epilogue_approximate_);
+        return;
+      }
+
+      case DataType::FLOAT64: {
+        double* data = out->getBufferDataAsTemplate<double>();
+        activate<double>(data + begin, data + begin, end - begin, epilogue_, epilogue_approximate_);
+        return;
+      }
+
+      case DataType::FLOAT16: {
+        float16* data = out->getBufferDataAsTemplate<float16>();
+        activate<float16>(data + begin, data + begin, end - begin, epilogue_, epilogue_approximate_);
+        return;
+      }
+
+      case DataType::BFLOAT16: {
+        bfloat16* data = out->getBufferDataAsTemplate<bfloat16>();
+        activate<bfloat16>(data + begin, data + begin, end - begin, epilogue_, epilogue_approximate_);
+        return;
+      }
+
+      default:
+        std::cout << "ERROR: Data type must be floating point in " << type_ << "'s epilogue!" << std::endl;
+        assert(false);
+    }
+}
+
+// Child function.
+static void topologicalOrder(Operation* op, std::vector<Operation*>& order,
+                             std::unordered_set<Operation*>& visited) {
+    if (visited.count(op))
+        return;
+
+    visited.insert(op);
+    for (Operation* p : op->getParents())
+        topologicalOrder(p, order, visited);
+
+    order.push_back(op);
+}
+
+std::vector<Operation*> topologicalOrder(Operation* root) {
+    std::vector<Operation*> order;
+    std::unordered_set<Operation*> visited;
+    topologicalOrder(root, order, visited);
+
+    return order;
+}
+
+std::vector<Operation*> topologicalOrder(std::vector<Operation*>& roots) {
+    std::vector<Operation*> order;
+    std::unordered_set<Operation*> visited;
+    for (Operation* root : roots)
+        topologicalOrder(root, order, visited);
+
+    return order;
+}
+
+// batchAxis() of matrix products, [..., rows, inner] by [inner, columns] or
+// [..., inner, columns]: the leading dimensions and the rows of the first
+// operand, and the columns of the second, carry on. Inner dimensions don't.
+static int matrixProductBatchAxis(Operation* op, int parent, int axis) {
+    int rank = op->getBuffer()->getShape().size();
+    int parent_rank = op->getParents()[parent]->getBuffer()->getShape().size();
+
+    if (parent == 0)
+        return axis < parent_rank - 1 ? axis : -1;
+
+    if (axis == parent_rank - 1)
+        return rank - 1;
+
+    return (parent_rank > 2 && axis < parent_rank - 2) ? axis : -1;
+}
+
+// batchAxis() of operations over images: the leading dimensions of the
+// image (e.g. batch and channels) carry on, the image itself and the
+// kernel don't.
+static int imageBatchAxis(Operation* op, int parent, int axis) {
+    int rank = op->getParents()[0]->getBuffer()->getShape().size();
+    return (parent == 0 && axis < rank - 2) ? axis : -1;
+}
+
+// batchAxis() of reductions over [first_axis, last_axis]: the axes after
+// them move up, unless the result keeps the reduced axes.
+static int reducedBatchAxis(Operation* op, int first_axis, int last_axis, int axis) {
+    if (axis < first_axis)
+        return axis;
+
+    if (axis <= last_axis)
+        return -1;
+
+    int rank = op->getBuffer()->getShape().size();
+    int parent_rank = op->getParents()[0]->getBuffer()->getShape().size();
+
+    return rank == parent_rank ? axis : axis - (last_axis - first_axis + 1);
+}
+
+//-----------------------------------\\
+// class Addition;                   \\
+//-----------------------------------\\
+
+// Operation graph node for element-wise multiplication.
+Addition::Addition(Operation* p1, Operation* p2) {
+    this->parent1_ = p1;
+    this->parent2_ = p2;
+    this->type_ = "addition";
+}
+
+void Addition::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* Addition::getBuffer() { return this->buffer_; }
+
+int Addition::batchAxis(int parent, int axis) { return elementWiseBatchAxis(parent, axis); }
+
+bool Addition::acceptsEpilogue() { return true; }
+
+std::vector<Operation*> Addition::derive(Operation* grad, Allocator* a) {
+    return { sumToParent(grad, this->parent1_, a),
+             sumToParent(grad, this->parent2_, a) };
+}
+
+// NOTE: Broadcasting only supported for constants.
+//
+// Single-threaded approach.
+//
+// Element-wise multiplication - no shape change.
+void Addition::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* b1 = inputs[0];
+    Buffer* b2 = inputs[1];
+
+    DataType dtype = b1->getDataType();
+
+    compTemplateChoice<Addition>(this, out, b1, b2, dtype);
+}
+
+//-----------------------------------\\
+// class Subtraction;                \\
+//-----------------------------------\\
+
+// Operation graph node for element-wise division.
+Subtraction::Subtraction(Operation* p1, Operation* p2) {
+    this->parent1_ = p1;
+    this->parent2_ = p2;
+    this->type_ = "subtraction";
+}
+
+void Subtraction::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* Subtraction::getBuffer() { return this->buffer_; }
+
+int Subtraction::batchAxis(int parent, int axis) { return elementWiseBatchAxis(parent, axis); }
+
+bool Subtraction::acceptsEpilogue() { return true; }
+
+std::vector<Operation*> Subtraction::derive(Operation* grad, Allocator* a) {
+    DataType dtype = this->buffer_->getDataType();
+
+    Operation* negated = newGradient(new Multiplication(grad, newScalar(-1, dtype, a)), this, a);
+
+    return { sumToParent(grad, this->parent1_, a),
+             sumToParent(negated, this->parent2_, a) };
+}
+
+// NOTE: Broadcasting only supported for constants.
+//
+// Single-threaded approach.
+//
+// Element-wise multiplication - no shape change.
+void Subtraction::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* b1 = inputs[0];
+    Buffer* b2 = inputs[1];
+
+    DataType dtype = b1->getDataType();
+
+    compTemplateChoice<Subtraction>(this, out, b1, b2, dtype);
+}
+
+//-----------------------------------\\
+// class Multiplication;             \\
+//-----------------------------------\\
+
+// Operation graph node for element-wise multiplication.
+Multiplication::Multiplication(Operation* p1, Operation* p2) {
+    this->parent1_ = p1;
+    this->parent2_ = p2;
+    this->type_ = "multiplication";
+}
+
+void Multiplication::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* Multiplication::getBuffer() { return this->buffer_; }
+
+int Multiplication::batchAxis(int parent, int axis) { return elementWiseBatchAxis(parent, axis); }
+
+bool Multiplication::acceptsEpilogue() { return true; }
+
+std::vector<Operation*> Multiplication::derive(Operation* grad, Allocator* a) {
+    Operation* grad1 = newGradient(new Multiplication(grad, this->parent2_), this, a);
+    Operation* grad2 = newGradient(new Multiplication(grad, this->parent1_), this, a);
+
+    return { sumToParent(grad1, this->parent1_, a),
+             sumToParent(grad2, this->parent2_, a) };
+}
+
+// NOTE: Broadcasting only supported for constants.
+//
+// Single-threaded approach.
+//
+// Element-wise multiplication - no shape change.
+void Multiplication::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* b1 = inputs[0];
+    Buffer* b2 = inputs[1];
+
+    DataType dtype = b1->getDataType();
+
+    compTemplateChoice<Multiplication>(this, out, b1, b2, dtype);
+}
+
+//-----------------------------------\\
+// class Division;                   \\
+//-----------------------------------\\
+
+// Operation graph node for element-wise division.
+Division::Division(Operation* p1, Operation* p2) {
+    this->parent1_ = p1;
+    this->parent2_ = p2;
+    this->type_ = "division";
+}
+
+void Division::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* Division::getBuffer() { return this->buffer_; }
+
+int Division::batchAxis(int parent, int axis) { return elementWiseBatchAxis(parent, axis); }
+
+bool Division::acceptsEpilogue() { return true; }
+
+// d/dx (x / y) == 1 / y
+// d/dy (x / y) == -x / y^2 == -(x / y) / y
+std::vector<Operation*> Division::derive(Operation* grad, Allocator* a) {
+    DataType dtype = this->buffer_->getDataType();
+
+    Operation* grad1 = newGradient(new Division(grad, this->parent2_), this, a);
+
+    Operation* grad2 = newGradient(new Multiplication(grad, this), this, a);
+    grad2 = newGradient(new Division(grad2, this->parent2_), this, a);
+    grad2 = newGradient(new Multiplication(grad2, newScalar(-1, dtype, a)), this, a);
+
+    return { sumToParent(grad1, this->parent1_, a),
+             sumToParent(grad2, this->parent2_, a) };
+}
+
+// NOTE: Broadcasting only supported for constants.
+//
+// Single-threaded approach.
+//
+// Element-wise multiplication - no shape change.
+void Division::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* b1 = inputs[0];
+    Buffer* b2 = inputs[1];
+
+    DataType dtype = b1->getDataType();
+
+    compTemplateChoice<Division>(this, out, b1, b2, dtype);
+}
+
+//-----------------------------------\\
+// class MatrixMultiplication;       \\
+//-----------------------------------\\
+
+// Operation graph node for element-wise division.
+MatrixMultiplication::MatrixMultiplication(Operation* p1, Operation* p2) {
+    this->parent1_ = p1;
+    this->parent2_ = p2;
+    this->type_ = "matrix_multiplication";
+}
+
+void MatrixMultiplication::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* MatrixMultiplication::getBuffer() { return this->buffer_; }
+
+int MatrixMultiplication::batchAxis(int parent, int axis) {
+    return matrixProductBatchAxis(this, parent, axis);
+}
+
+bool MatrixMultiplication::acceptsEpilogue() { return true; }
+
+// d/dA (A @ B) == grad @ B^T
+// d/dB (A @ B) == A^T @ grad, summed over A's leading dimensions if B is shared by them.
+std::vector<Operation*> MatrixMultiplication::derive(Operation* grad, Allocator* a) {
+    DataType dtype = this->buffer_->getDataType();
+
+    std::vector<int> shape1 = this->parent1_->getBuffer()->getShape();
+    std::vector<int> shape2 = this->parent2_->getBuffer()->getShape();
+    std::vector<int>& out_shape = this->buffer_->getShape();
+
+    std::vector<int> transposed_shape2 = shape2;
+    std::swap(transposed_shape2.rbegin()[0], transposed_shape2.rbegin()[1]);
+
+    std::vector<int> transposed_shape1 = shape1;
+    std::swap(transposed_shape1.rbegin()[0], transposed_shape1.rbegin()[1]);
+
+    Operation* transposed2 = newGradient(new Transpose(this->parent2_), transposed_shape2, dtype, a);
+    Operation* grad1 = newGradient(new MatrixMultiplication(grad, transposed2), shape1, dtype, a);
+
+    std::vector<int> grad2_shape = transposed_shape1;
+    grad2_shape.back() = out_shape.back();
+
+    Operation* transposed1 = newGradient(new Transpose(this->parent1_), transposed_shape1, dtype, a);
+    Operation* grad2 = newGradient(new MatrixMultiplication(transposed1, grad), grad2_shape, dtype, a);
+
+    return { grad1, sumToParent(grad2, this->parent2_, a) };
+}
+
+void MatrixMultiplication::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* b1 = inputs[0];
+    Buffer* b2 = inputs[1];
+
+    DataType dtype = b1->getDataType();
+
+    compTemplateChoice<MatrixMultiplication>(this, out, b1, b2, dtype);
+}
+
+//-----------------------------------\\
+// class Convolution2D;              \\
+//-----------------------------------\\
+
+// Operation graph node for element-wise division.
+Convolution2D::Convolution2D(Operation* p1, Operation* p2, std::string padding, int (&strides)[2]) {
+    this->padding_ = padding;
+    this->strides_[0] = strides[0];
+    this->strides_[1] = strides[1];
+    this->parent1_ = p1;
+    this->parent2_ = p2;
+    this->type_ = "convolution2d";
+}
+
+void Convolution2D::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* Convolution2D::getBuffer() { return this->buffer_; }
+
+int Convolution2D::batchAxis(int parent, int axis) {
+    return imageBatchAxis(this, parent, axis);
+}
+
+bool Convolution2D::acceptsEpilogue() { return true; }
+
+std::vector<Operation*> Convolution2D::derive(Operation* grad, Allocator* a) {
+    Operation* grad1 = newGradient(
+        new Convolution2DInputGradient(grad, this->parent2_, this->padding_, this->strides_), this->parent1_, a);
+
+    Operation* grad2 = newGradient(
+        new Convolution2DKernelGradient(grad, this->parent1_, this->padding_, this->strides_), this->parent2_, a);
+
+    return { grad1, grad2 };
+}
+
+void Convolution2D::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* b1 = inputs[0];
+    Buffer* b2 = inputs[1];
+
+    DataType dtype = b1->getDataType();
+
+    compTemplateChoice<Convolution2D>(this, out, b1, b2, dtype);
+}
+
+//-----------------------------------\\
+// class Convolution2DTranspose;     \\
+//-----------------------------------\\
+
+Convolution2DTranspose::Convolution2DTranspose(Operation* p1, Operation* p2, std::string padding, int (&strides)[2]) {
+    bool strided = strides[0] > 1 || strides[1] > 1;
+
+    this->padding_ = strided ? "valid" : padding;
+    this->strides_[0] = strides[0];
+    this->strides_[1] = strides[1];
+    this->parent1_ = p1;
+    this->parent2_ = p2;
+    this->type_ = "convolution2d_transpose";
+}
+
+void Convolution2DTranspose::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* Convolution2DTranspose::getBuffer() { return this->buffer_; }
+
+int Convolution2DTranspose::batchAxis(int parent, int axis) {
+    return imageBatchAxis(this, parent, axis);
+}
+
+bool Convolution2DTranspose::acceptsEpilogue() { return true; }
+
+std::vector<Operation*> Convolution2DTranspose::derive(Operation* grad, Allocator* a) {
+    // The transpose of the transpose is the convolution itself, and the
+    // kernel's gradient is Convolution2D's with the image and result swapped.
+    Operation* grad1 = newGradient(
+        new Convolution2D(grad, this->parent2_, this->padding_, this->strides_), this->parent1_, a);
+
+    Operation* grad2 = newGradient(
+        new Convolution2DKernelGradient(this->parent1_, grad, this->padding_, this->strides_), this->parent2_, a);
+
+    return { grad1, grad2 };
+}
+
+void Convolution2DTranspose::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* b1 = inputs[0];
+    Buffer* b2 = inputs[1];
+
+    DataType dtype = b1->getDataType();
+
+    compTemplateChoice<Convolution2DTranspose>(this, out, b1, b2, dtype);
+}
+
+//-----------------------------------\\
+// class Power;                      \\
+//-----------------------------------\\
+
+Power::Power(Operation* p1, Operation* p2) {
+    this->parent1_ = p1;
+    this->parent2_ = p2;
+    this->type_ = "power";
+}
+
+void Power::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* Power::getBuffer() { return this->buffer_; }
+
+int Power::batchAxis(int parent, int axis) { return elementWiseBatchAxis(parent, axis); }
+
+// d/dx x^y == y * x^(y-1)
+// d/dy x^y == x^y * ln(x)
+std::vector<Operation*> Power::derive(Operation* grad, Allocator* a) {
+    DataType dtype = this->buffer_->getDataType();
+
+    Operation* exponent = newGradient(new Subtraction(this->parent2_, newScalar(1, dtype, a)), this->parent2_, a);
+    Operation* grad1 = newGradient(new Power(this->parent1_, exponent), this, a);
+    grad1 = newGradient(new Multiplication(grad1, this->parent2_), this, a);
+    grad1 = newGradient(new Multiplication(grad, grad1), this, a);
+
+    Operation* log = newGradient(new Logarithm(this->parent1_), this->parent1_, a);
+    Operation* grad2 = newGradient(new Multiplication(this, log), this, a);
+    grad2 = newGradient(new Multiplication(grad, grad2), this, a);
+
+    return { sumToParent(grad1, this->parent1_, a),
+             sumToParent(grad2, this->parent2_, a) };
+}
+
+// NOTE: broadcasting not yet supported
+//
+// element-wise multiplication - no shape change
+void Power::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* b1 = inputs[0];
+    Buffer* b2 = inputs[1];
+
+    DataType dtype = b1->getDataType();
+
+    compTemplateChoice<Power>(this, out, b1, b2, dtype);
+}
+
+//-----------------------------------\\
+// class Cast;                       \\
+//-----------------------------------\\
+
+Cast::Cast(Operation* p1, bool saturate) {
+    this->saturate_ = saturate;
+    this->parent1_ = p1;
+    this->parent2_ = nullptr;
+    this->type_ = "cast";
+}
+
+bool Cast::isSaturating() { return saturate_; }
+
+void Cast::setBuffer(Buffer* buf) {
+    this->buffer_ = buf;
+}
+
+Buffer* Cast::getBuffer() {
+    return this->buffer_;
+}
+
+int Cast::batchAxis(int parent, int axis) { return elementWiseBatchAxis(parent, axis); }
+
+std::vector<Operation*> Cast::derive(Operation* grad, Allocator* a) {
+    // Nothing flows into or out of a mask.
+    if (this->parent1_->getBuffer()->getDataType() == DataType::BOOL ||
+        this->buffer_->getDataType() == DataType::BOOL)
+        return { nullptr };
+
+    return { newGradient(new Cast(grad), this->parent1_, a) };
+}
+
+// Dispatches on the result's data type, and compute() on the parent's.
+void Cast::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* buf = inputs[0];
+
+    DataType dtype = out->getDataType();
+
+    compTemplateChoice<Cast>(this, out, buf, dtype);
+}
+
+//-----------------------------------\\
+// class SquareRoot;                 \\
+//-----------------------------------\\
+
+SquareRoot::SquareRoot(Operation* p1, bool promotion) {
+    this->parent1_ = p1;
+    this->parent2_ = nullptr;
+    this->type_ = "square_root";
+    this->promotion = promotion;
+}
+
+void SquareRoot::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* SquareRoot::getBuffer() { return this->buffer_; }
+
+int SquareRoot::batchAxis(int parent, int axis) { return elementWiseBatchAxis(parent, axis); }
+
+// d/dx sqrt(x) == 1 / (2 * sqrt(x))
+std::vector<Operation*> SquareRoot::derive(Operation* grad, Allocator* a) {
+    DataType dtype = this->buffer_->getDataType();
+
+    Operation* doubled = newGradient(new Multiplication(this, newScalar(2, dtype, a)), this, a);
+
+    return { newGradient(new Division(grad, doubled), this, a) };
+}
+
+// NOTE: broadcasting not yet supported
+//
+// element-wise multiplication - no shape change
+void SquareRoot::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* buf = inputs[0];
+
+    DataType dtype;
+    if (this->promotion)
+        dtype = DataType::FLOAT32;
+    else
+        dtype = out->getDataType();
+
+    compTemplateChoice<SquareRoot>(this, out, buf, dtype);
+}
+
+//-----------------------------------\\
+// class Exponential;                \\
+//-----------------------------------\\
+
+Exponential::Exponential(Operation* p1) {
+    this->parent1_ = p1;
+    this->parent2_ = nullptr;
+    this->type_ = "exponential";
+}
+
+void Exponential::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* Exponential::getBuffer() { return this->buffer_; }
+
+int Exponential::batchAxis(int parent, int axis) { return elementWiseBatchAxis(parent, axis); }
+
+std::vector<Operation*> Exponential::derive(Operation* grad, Allocator* a) {
+    return { newGradient(new Multiplication(grad, this), this, a) };
+}
+
+// NOTE: broadcasting not yet supported
+//
+// element-wise multiplication - no shape change
+void Exponential::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* buf = inputs[0];
+
+    DataType dtype = buf->getDataType();
+
+    compTemplateChoice<Exponential>(this, out, buf, dtype);
+}
+
+//-----------------------------------\\
+// class Logarithm;                  \\
+//-----------------------------------\\
+
+Logarithm::Logarithm(Operation* p1) {
+    this->parent1_ = p1;
+    this->parent2_ = nullptr;
+    this->type_ = "logarithm";
+}
+
+void Logarithm::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* Logarithm::getBuffer() { return this->buffer_; }
+
+int Logarithm::batchAxis(int parent, int axis) { return elementWiseBatchAxis(parent, axis); }
+
+std::vector<Operation*> Logarithm::derive(Operation* grad, Allocator* a) {
+    return { newGradient(new Division(grad, this->parent1_), this, a) };
+}
+
+void Logarithm::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* buf = inputs[0];
+
+    DataType dtype = buf->getDataType();
+
+    compTemplateChoice<Logarithm>(this, out, buf, dtype);
+}
+
+//-----------------------------------\\
+// class Transpose;                  \\
+//-----------------------------------\\
+
+Transpose::Transpose(Operation* p1) {
+    this->parent1_ = p1;
+    this->parent2_ = nullptr;
+    this->type_ = "transpose";
+}
+
+void Transpose::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* Transpose::getBuffer() { return this->buffer_; }
+
+int Transpose::batchAxis(int, int axis) {
+    int rank = this->buffer_->getShape().size();
+
+    if (axis == rank - 1)
+        return rank - 2;
+
+    if (axis == rank - 2)
+        return rank - 1;
+
+    return axis;
+}
+
+std::vector<Operation*> Transpose::derive(Operation* grad, Allocator* a) {
+    return { newGradient(new Transpose(grad), this->parent1_, a) };
+}
+
+void Transpose::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* buf = inputs[0];
+
+    DataType dtype = buf->getDataType();
+
+    compTemplateChoice<Transpose>(this, out, buf, dtype);
+}
+
+//-----------------------------------\\
+// class Activation;                 \\
+//-----------------------------------\\
+
+Activation::Activation(Operation* p1, ActivationType activation, bool approximate) {
+    string types[] = { "relu", "sigmoid", "tanh", "gelu", "silu" };
+
+    this->activation_ = activation;
+    this->approximate_ = approximate;
+    this->parent1_ = p1;
+    this->parent2_ = nullptr;
+    this->type_ = types[static_cast<int>(activation)];
+}
+
+void Activation::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* Activation::getBuffer() { return this->buffer_; }
+
+int Activation::batchAxis(int parent, int axis) { return elementWiseBatchAxis(parent, axis); }
+
+std::vector<Operation*> Activation::derive(Operation* grad, Allocator* a) {
+    return { newGradient(new ActivationGradient(grad, this->parent1_, activation_, approximate_), this->parent1_, a) };
+}
+
+void Activation::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* buf = inputs[0];
+
+    DataType dtype = buf->getDataType();
+
+    floatTemplateChoice<Activation>(this, out, buf, dtype);
+}
+
+ActivationType Activation::getActivationType() { return activation_; }
+
+bool Activation::isApproximate() { return approximate_; }
+
+//-----------------------------------\\
+// class ActivationGradient;         \\
+//-----------------------------------\\
+
+ActivationGradient::ActivationGradient(Operation* grad, Operation* input, ActivationType activation, bool approximate) {
+    this->activation_ = activation;
+    this->approximate_ = approximate;
+    this->parent1_ = grad;
+    this->parent2_ = input;
+    this->type_ = "activation_gradient";
+}
+
+void ActivationGradient::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* ActivationGradient::getBuffer() { return this->buffer_; }
+
+int ActivationGradient::batchAxis(int parent, int axis) { return elementWiseBatchAxis(parent, axis); }
+
+std::vector<Operation*> ActivationGradient::derive(Operation*, Allocator*) {
+    return { nullptr, nullptr };
+}
+
+void ActivationGradient::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* grad = inputs[0];
+    Buffer* input = inputs[1];
+
+    DataType dtype = grad->getDataType();
+
+    floatTemplateChoice<ActivationGradient>(this, out, grad, input, dtype);
+}
+
+//-----------------------------------\\
+// class Reduction;                  \\
+//-----------------------------------\\
+
+Reduction::Reduction(Operation* p1, ReductionType reduction, int first_axis, int last_axis) {
+    string types[] = { "sum", "mean", "max", "min", "argmax" };
+
+    this->reduction_ = reduction;
+    this->first_axis_ = first_axis;
+    this->last_axis_ = last_axis;
+    this->parent1_ = p1;
+    this->parent2_ = nullptr;
+    this->type_ = types[static_cast<int>(reduction)];
+}
+
+void Reduction::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* Reduction::getBuffer() { return this->buffer_; }
+
+int Reduction::batchAxis(int, int axis) {
+    return reducedBatchAxis(this, first_axis_, last_axis_, axis);
+}
+
+// SUM and MEAN spread the gradient back over the reduced elements, while
+// MAX and MIN hand it to the element that was picked.
+std::vector<Operation*> Reduction::derive(Operation* grad, Allocator* a) {
+    if (reduction_ == ReductionType::ARGMAX)
+        return { nullptr };
+
+    bool picks = reduction_ == ReductionType::MAX || reduction_ == ReductionType::MIN;
+    Operation* input = picks ? this->parent1_ : nullptr;
+
+    return { newGradient(new ReductionGradient(grad, input, reduction_, first_axis_, last_axis_), this->parent1_, a) };
+}
+
+void Reduction::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* buf = inputs[0];
+
+    DataType dtype = buf->getDataType();
+
+    compTemplateChoice<Reduction>(this, out, buf, dtype);
+}
+
+//-----------------------------------\\
+// class ReductionGradient;          \\
+//-----------------------------------\\
+
+ReductionGradient::ReductionGradient(Operation* grad, Operation* input, ReductionType reduction, int first_axis, int last_axis) {
+    this->reduction_ = reduction;
+    this->first_axis_ = first_axis;
+    this->last_axis_ = last_axis;
+    this->parent1_ = grad;
+    this->parent2_ = input;
+    this->type_ = "reduction_gradient";
+}
+
+void ReductionGradient::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* ReductionGradient::getBuffer() { return this->buffer_; }
+
+std::vector<Operation*> ReductionGradient::derive(Operation*, Allocator*) {
+    return { nullptr, nullptr };
+}
+
+void ReductionGradient::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* grad = inputs[0];
+    Buffer* input = (inputs.size() > 1) ? inputs[1] : nullptr;
+
+    DataType dtype = grad->getDataType();
+
+    compTemplateChoice<ReductionGradient>(this, out, grad, input, dtype);
+}
+
+//-----------------------------------\\
+// class Softmax;                    \\
+//-----------------------------------\\
+
+Softmax::Softmax(Operation* p1, bool log) {
+    this->log_ = log;
+    this->parent1_ = p1;
+    this->parent2_ = nullptr;
+    this->type_ = log ? "log_softmax" : "softmax";
+}
+
+void Softmax::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* Softmax::getBuffer() { return this->buffer_; }
+
+int Softmax::batchAxis(int parent, int axis) { return elementWiseBatchAxis(parent, axis); }
+
+std::vector<Operation*> Softmax::derive(Operation* grad, Allocator* a) {
+    return { newGradient(new SoftmaxGradient(grad, this, log_), this->parent1_, a) };
+}
+
+void Softmax::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* buf = inputs[0];
+
+    DataType dtype = buf->getDataType();
+
+    floatTemplateChoice<Softmax>(this, out, buf, dtype);
+}
+
+//-----------------------------------\\
+// class SoftmaxGradient;            \\
+//-----------------------------------\\
+
+SoftmaxGradient::SoftmaxGradient(Operation* grad, Operation* output, bool log) {
+    this->log_ = log;
+    this->parent1_ = grad;
+    this->parent2_ = output;
+    this->type_ = "softmax_gradient";
+}
+
+void SoftmaxGradient::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* SoftmaxGradient::getBuffer() { return this->buffer_; }
+
+int SoftmaxGradient::batchAxis(int parent, int axis) { return elementWiseBatchAxis(parent, axis); }
+
+std::vector<Operation*> SoftmaxGradient::derive(Operation*, Allocator*) {
+    return { nullptr, nullptr };
+}
+
+void SoftmaxGradient::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* grad = inputs[0];
+    Buffer* output = inputs[1];
+
+    DataType dtype = grad->getDataType();
+
+    floatTemplateChoice<SoftmaxGradient>(this, out, grad, output, dtype);
+}
+
+//-----------------------------------\\
+// class SoftmaxCrossEntropy;        \\
+//-----------------------------------\\
+
+SoftmaxCrossEntropy::SoftmaxCrossEntropy(Operation* logits, Operation* labels) {
+    this->parent1_ = logits;
+    this->parent2_ = labels;
+    this->type_ = "softmax_cross_entropy";
+}
+
+void SoftmaxCrossEntropy::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* SoftmaxCrossEntropy::getBuffer() { return this->buffer_; }
+
+// Rows keep their place, only the last axis is summed over.
+int SoftmaxCrossEntropy::batchAxis(int, int axis) {
+    int rank = parent1_->getBuffer()->getShape().size();
+    return axis < rank - 1 ? axis : -1;
+}
+
+// d/dlogits == softmax(logits) - labels, d/dlabels == -log_softmax(logits),
+// each scaled by the gradient of its row's loss.
+std::vector<Operation*> SoftmaxCrossEntropy::derive(Operation* grad, Allocator* a) {
+    Operation* logits = this->parent1_;
+    Operation* labels = this->parent2_;
+    DataType dtype = logits->getBuffer()->getDataType();
+
+    int last_axis = logits->getBuffer()->getShape().size() - 1;
+    Operation* rows = newGradient(
+        new ReductionGradient(grad, nullptr, ReductionType::SUM, last_axis, last_axis), logits, a);
+
+    Operation* softmax = newGradient(new Softmax(logits), logits, a);
+    Operation* diff = newGradient(new Subtraction(softmax, labels), logits, a);
+
+    Operation* log_softmax = newGradient(new Softmax(logits, true), logits, a);
+    Operation* negated = newGradient(new Multiplication(log_softmax, newScalar(-1, dtype, a)), logits, a);
+
+    return { newGradient(new Multiplication(rows, diff), logits, a),
+             newGradient(new Multiplication(rows, negated), labels, a) };
+}
+
+void SoftmaxCrossEntropy::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* logits = inputs[0];
+    Buffer* labels = inputs[1];
+
+    DataType dtype = logits->getDataType();
+
+    floatTemplateChoice<SoftmaxCrossEntropy>(this, out, logits, labels, dtype);
+}
+
+//-----------------------------------\\
+// class Normalization;              \\
+//-----------------------------------\\
+
+Normalization::Normalization(Operation* p1, Operation* scale, Operation* shift, NormalizationType normalization,
+                             double epsilon) {
+    string types[] = { "layer_norm", "rms_norm", "batch_norm" };
+
+    this->normalization_ = normalization;
+    this->epsilon_ = epsilon;
+    this->has_shift_ = shift != nullptr;
+    this->has_statistics_ = false;
+    this->parent1_ = p1;
+    this->parent2_ = scale;
+    this->type_ = types[static_cast<int>(normalization)];
+
+    if (has_shift_)
+        this->extra_parents_.push_back(shift);
+}
+
+Normalization::Normalization(Operation* p1, Operation* scale, Operation* shift, Operation* mean, Operation* variance,
+                             double epsilon)
+    : Normalization(p1, scale, shift, NormalizationType::BATCH, epsilon) {
+    this->has_statistics_ = true;
+    this->extra_parents_.push_back(mean);
+    this->extra_parents_.push_back(variance);
+}
+
+void Normalization::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* Normalization::getBuffer() { return this->buffer_; }
+
+// The statistics and the affine transform are per channel, so only the input has rows.
+int Normalization::batchAxis(int parent, int axis) {
+    return parent == 0 ? axis : -1;
+}
+
+std::vector<Operation*> Normalization::derive(Operation* grad, Allocator* a) {
+    std::vector<Operation*> grads = {
+        newGradient(new NormalizationGradient(grad, this, false), this->parent1_, a),
+        newGradient(new NormalizationGradient(grad, this, true), this->parent2_, a)
+    };
+
+    if (has_shift_)
+        grads.push_back(sumToParent(grad, getShift(), a));
+
+    if (has_statistics_) {
+        grads.push_back(nullptr);
+        grads.push_back(nullptr);
+    }
+
+    return grads;
+}
+
+void Normalization::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    DataType dtype = inputs[0]->getDataType();
+
+    floatTemplateChoice<Normalization>(this, out, inputs, dtype);
+}
+
+NormalizationType Normalization::getNormalizationType() { return normalization_; }
+
+double Normalization::getEpsilon() { return epsilon_; }
+
+bool Normalization::hasStatistics() { return has_statistics_; }
+
+Operation* Normalization::getShift() {
+    return has_shift_ ? this->extra_parents_[0] : nullptr;
+}
+
+Operation* Normalization::getMean() {
+    return has_statistics_ ? this->extra_parents_[has_shift_ ? 1 : 0] : nullptr;
+}
+
+Operation* Normalization::getVariance() {
+    return has_statistics_ ? this->extra_parents_[has_shift_ ? 2 : 1] : nullptr;
+}
+
+//-----------------------------------\\
+// class NormalizationGradient;      \\
+//-----------------------------------\\
+
+NormalizationGradient::NormalizationGradient(Operation* grad, Normalization* normalization, bool wrt_scale) {
+    std::vector<Operation*> parents = normalization->getParents();
+
+    this->normalization_ = normalization->getNormalizationType();
+    this->epsilon_ = normalization->getEpsilon();
+    this->has_statistics_ = normalization->hasStatistics();
+    this->wrt_scale_ = wrt_scale;
+    this->parent1_ = grad;
+    this->parent2_ = parents[0];
+    this->extra_parents_.push_back(parents[1]);
+    this->type_ = "normalization_gradient";
+
+    if (has_statistics_) {
+        this->extra_parents_.push_back(normalization->getMean());
+        this->extra_parents_.push_back(normalization->getVariance());
+    }
+}
+
+void NormalizationGradient::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* NormalizationGradient::getBuffer() { return this->buffer_; }
+
+std::vector<Operation*> NormalizationGradient::derive(Operation*, Allocator*) {
+    return std::vector<Operation*>(getParents().size(), nullptr);
+}
+
+void NormalizationGradient::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    DataType dtype = inputs[0]->getDataType();
+
+    floatTemplateChoice<NormalizationGradient>(this, out, inputs, dtype);
+}
+
+//-----------------------------------\\
+// class Attention;                  \\
+//-----------------------------------\\
+
+Attention::Attention(Operation* q, Operation* k, Operation* v, double scale, bool causal, KVCache* cache) {
+    this->scale_ = scale;
+    this->causal_ = causal;
+    this->cache_ = cache;
+    this->parent1_ = q;
+    this->parent2_ = k;
+    this->extra_parents_.push_back(v);
+    this->type_ = "attention";
+}
+
+void Attention::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* Attention::getBuffer() { return this->buffer_; }
+
+// Queries keep their place, and the leading dimensions are matched one to one.
+int Attention::batchAxis(int parent, int axis) {
+    int rank = this->buffer_->getShape().size();
+
+    if (parent == 0)
+        return axis < rank - 1 ? axis : -1;
+
+    return axis < rank - 2 ? axis : -1;
+}
+
+std::vector<Operation*> Attention::derive(Operation* grad, Allocator* a) {
+    std::vector<Operation*> parents = getParents();
+    std::vector<Operation*> grads;
+
+    if (cache_ != nullptr)
+        return { nullptr, nullptr, nullptr };
+
+    for (int wrt = 0; wrt < 3; wrt++)
+        grads.push_back(newGradient(new AttentionGradient(grad, this, wrt), parents[wrt], a));
+
+    return grads;
+}
+
+void Attention::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    DataType dtype = inputs[0]->getDataType();
+
+    floatTemplateChoice<Attention>(this, out, inputs, dtype);
+}
+
+double Attention::getScale() { return scale_; }
+
+bool Attention::isCausal() { return causal_; }
+
+KVCache* Attention::getCache() { return cache_; }
+
+//-----------------------------------\\
+// class AttentionGradient;          \\
+//-----------------------------------\\
+
+AttentionGradient::AttentionGradient(Operation* grad, Attention* attention, int wrt) {
+    std::vector<Operation*> parents = attention->getParents();
+
+    this->wrt_ = wrt;
+    this->scale_ = attention->getScale();
+    this->causal_ = attention->isCausal();
+    this->parent1_ = grad;
+    this->parent2_ = parents[0];
+    this->extra_parents_.push_back(parents[1]);
+    this->extra_parents_.push_back(parents[2]);
+    this->extra_parents_.push_back(attention);
+    this->type_ = "attention_gradient";
+}
+
+void AttentionGradient::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* AttentionGradient::getBuffer() { return this->buffer_; }
+
+std::vector<Operation*> AttentionGradient::derive(Operation*, Allocator*) {
+    return std::vector<Operation*>(getParents().size(), nullptr);
+}
+
+void AttentionGradient::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    DataType dtype = inputs[0]->getDataType();
+
+    floatTemplateChoice<AttentionGradient>(this, out, inputs, dtype);
+}
+
+//-----------------------------------\\
+// class Recurrent;                  \\
+//-----------------------------------\\
+
+Recurrent::Recurrent(Operation* x, Operation* input_weights, Operation* hidden_weights, Operation* bias,
+                     RecurrentType recurrent) {
+    string types[] = { "lstm", "gru" };
+
+    this->recurrent_ = recurrent;
+    this->parent1_ = x;
+    this->parent2_ = input_weights;
+    this->extra_parents_.push_back(hidden_weights);
+    this->extra_parents_.push_back(bias);
+    this->type_ = types[static_cast<int>(recurrent)];
+
+    for (int w = 0; w < 2; w++) {
+        this->packed_buffers_[w] = nullptr;
+        this->packed_versions_[w] = 0;
+    }
+}
+
+void Recurrent::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* Recurrent::getBuffer() { return this->buffer_; }
+
+// Batch and time of x carry on, the weights and bias have neither.
+int Recurrent::batchAxis(int parent, int axis) {
+    return (parent == 0 && axis < 2) ? axis : -1;
+}
+
+std::vector<Operation*> Recurrent::derive(Operation* grad, Allocator* a) {
+    std::vector<Operation*> parents = getParents();
+    std::vector<Operation*> grads;
+
+    uint64_t elements = 0;
+    for (Operation* p : parents)
+        elements += p->getBuffer()->getElements();
+
+    std::vector<int> shape = { static_cast<int>(elements) };
+    Operation* all = newGradient(new RecurrentGradient(grad, this), shape, getBuffer()->getDataType(), a);
+
+    uint64_t offset = 0;
+    for (Operation* p : parents) {
+        grads.push_back(newGradient(new Slice(all, offset), p, a));
+        offset += p->getBuffer()->getElements();
+    }
+
+    return grads;
+}
+
+void Recurrent::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    DataType dtype = inputs[0]->getDataType();
+
+    floatTemplateChoice<Recurrent>(this, out, inputs, dtype);
+}
+
+RecurrentType Recurrent::getRecurrentType() { return recurrent_; }
+
+//-----------------------------------\\
+// class RecurrentGradient;          \\
+//-----------------------------------\\
+
+RecurrentGradient::RecurrentGradient(Operation* grad, Recurrent* recurrent) {
+    std::vector<Operation*> parents = recurrent->getParents();
+
+    this->recurrent_ = recurrent->getRecurrentType();
+    this->layer_ = recurrent;
+    this->parent1_ = grad;
+    this->parent2_ = parents[0];
+    this->extra_parents_ = { parents[1], parents[2], parents[3] };
+    this->type_ = "recurrent_gradient";
+}
+
+void RecurrentGradient::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* RecurrentGradient::getBuffer() { return this->buffer_; }
+
+std::vector<Operation*> RecurrentGradient::derive(Operation*, Allocator*) {
+    return std::vector<Operation*>(getParents().size(), nullptr);
+}
+
+void RecurrentGradient::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    DataType dtype = inputs[0]->getDataType();
+
+    floatTemplateChoice<RecurrentGradient>(this, out, inputs, dtype);
+}
+
+//-----------------------------------\\
+// class Slice;                      \\
+//-----------------------------------\\
+
+Slice::Slice(Operation* p, uint64_t offset) {
+    this->offset_ = offset;
+    this->parent1_ = p;
+    this->type_ = "slice";
+}
+
+void Slice::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* Slice::getBuffer() { return this->buffer_; }
+
+std::vector<Operation*> Slice::derive(Operation*, Allocator*) {
+    return { nullptr };
+}
+
+void Slice::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    DataType dtype = inputs[0]->getDataType();
+
+    // Bit-packed data isn't sliced on byte boundaries.
+    assert(dtype != DataType::BOOL && out->getDataType() == dtype);
+    assert(offset_ + out->getElements() <= inputs[0]->getElements());
+
+    char* src = inputs[0]->getBufferDataAsTemplate<char>();
+    std::memcpy(out->getBufferDataAsTemplate<char>(), src + dataSize(dtype, offset_), dataSize(dtype, out->getElements()));
+}
+
+//-----------------------------------\\
+// class Convolution2DInputGradient; \\
+//-----------------------------------\\
+
+Convolution2DInputGradient::Convolution2DInputGradient(Operation* grad, Operation* kernel, std::string padding, int (&strides)[2]) {
+    this->padding_ = padding;
+    this->strides_[0] = strides[0];
+    this->strides_[1] = strides[1];
+    this->parent1_ = grad;
+    this->parent2_ = kernel;
+    this->type_ = "convolution2d_input_gradient";
+}
+
+void Convolution2DInputGradient::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* Convolution2DInputGradient::getBuffer() { return this->buffer_; }
+
+std::vector<Operation*> Convolution2DInputGradient::derive(Operation*, Allocator*) {
+    return { nullptr, nullptr };
+}
+
+void Convolution2DInputGradient::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* b1 = inputs[0];
+    Buffer* b2 = inputs[1];
+
+    DataType dtype = b1->getDataType();
+
+    compTemplateChoice<Convolution2DInputGradient>(this, out, b1, b2, dtype);
+}
+
+//-----------------------------------\\
+// class Convolution2DKernelGradient;\\
+//-----------------------------------\\
+
+Convolution2DKernelGradient::Convolution2DKernelGradient(Operation* grad, Operation* image, std::string padding, int (&strides)[2]) {
+    this->padding_ = padding;
+    this->strides_[0] = strides[0];
+    this->strides_[1] = strides[1];
+    this->parent1_ = grad;
+    this->parent2_ = image;
+    this->type_ = "convolution2d_kernel_gradient";
+}
+
+void Convolution2DKernelGradient::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* Convolution2DKernelGradient::getBuffer() { return this->buffer_; }
+
+std::vector<Operation*> Convolution2DKernelGradient::derive(Operation*, Allocator*) {
+    return { nullptr, nullptr };
+}
+
+void Convolution2DKernelGradient::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* b1 = inputs[0];
+    Buffer* b2 = inputs[1];
+
+    DataType dtype = b1->getDataType();
+
+    compTemplateChoice<Convolution2DKernelGradient>(this, out, b1, b2, dtype);
+}
+
+//-----------------------------------\\
+// class Pooling2D;                  \\
+//-----------------------------------\\
+
+Pooling2D::Pooling2D(Operation* p1, PoolingType pooling, int (&window)[2], std::string padding, int (&strides)[2]) {
+    string types[] = { "max_pool2d", "avg_pool2d" };
+
+    this->pooling_ = pooling;
+    this->window_[0] = window[0];
+    this->window_[1] = window[1];
+    this->strides_[0] = strides[0];
+    this->strides_[1] = strides[1];
+    this->padding_ = padding;
+    this->parent1_ = p1;
+    this->parent2_ = nullptr;
+    this->type_ = types[static_cast<int>(pooling)];
+}
+
+void Pooling2D::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* Pooling2D::getBuffer() { return this->buffer_; }
+
+int Pooling2D::batchAxis(int parent, int axis) {
+    return imageBatchAxis(this, parent, axis);
+}
+
+std::vector<Operation*> Pooling2D::derive(Operation* grad, Allocator* a) {
+    Operation* input = (pooling_ == PoolingType::MAX) ? this->parent1_ : nullptr;
+
+    return { newGradient(
+        new Pooling2DGradient(grad, input, pooling_, window_, padding_, strides_), this->parent1_, a) };
+}
+
+void Pooling2D::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* buf = inputs[0];
+
+    DataType dtype = buf->getDataType();
+
+    compTemplateChoice<Pooling2D>(this, out, buf, dtype);
+}
+
+//-----------------------------------\\
+// class Pooling2DGradient;          \\
+//-----------------------------------\\
+
+Pooling2DGradient::Pooling2DGradient(Operation* grad, Operation* input, PoolingType pooling, int (&window)[2],
+                                     std::string padding, int (&strides)[2]) {
+    this->pooling_ = pooling;
+    this->window_[0] = window[0];
+    this->window_[1] = window[1];
+    this->strides_[0] = strides[0];
+    this->strides_[1] = strides[1];
+    this->padding_ = padding;
+    this->parent1_ = grad;
+    this->parent2_ = input;
+    this->type_ = "pool2d_gradient";
+}
+
+void Pooling2DGradient::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* Pooling2DGradient::getBuffer() { return this->buffer_; }
+
+std::vector<Operation*> Pooling2DGradient::derive(Operation*, Allocator*) {
+    return { nullptr, nullptr };
+}
+
+void Pooling2DGradient::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* grad = inputs[0];
+    Buffer* input = (inputs.size() > 1) ? inputs[1] : nullptr;
+
+    DataType dtype = grad->getDataType();
+
+    compTemplateChoice<Pooling2DGradient>(this, out, grad, input, dtype);
+}
+
+//-----------------------------------\\
+// class Gather;                     \\
+//-----------------------------------\\
+
+Gather::Gather(Operation* table, Operation* indices, int axis) {
+    this->axis_ = axis;
+    this->parent1_ = table;
+    this->parent2_ = indices;
+    this->type_ = "gather";
+}
+
+void Gather::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* Gather::getBuffer() { return this->buffer_; }
+
+// The indices take the place of the table's `axis`.
+int Gather::batchAxis(int parent, int axis) {
+    if (parent == 1)
+        return axis_ + axis;
+
+    if (axis < axis_)
+        return axis;
+
+    if (axis == axis_)
+        return -1;
+
+    return axis + parent2_->getBuffer()->getShape().size() - 1;
+}
+
+std::vector<Operation*> Gather::derive(Operation* grad, Allocator* a) {
+    return { newGradient(new GatherGradient(grad, this->parent2_, axis_), this->parent1_, a), nullptr };
+}
+
+void Gather::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* table = inputs[0];
+    Buffer* indices = inputs[1];
+
+    DataType dtype = table->getDataType();
+
+    compTemplateChoice<Gather>(this, out, table, indices, dtype);
+}
+
+int Gather::getAxis() { return axis_; }
+
+//-----------------------------------\\
+// class GatherGradient;             \\
+//-----------------------------------\\
+
+GatherGradient::GatherGradient(Operation* grad, Operation* indices, int axis) {
+    this->axis_ = axis;
+    this->parent1_ = grad;
+    this->parent2_ = indices;
+    this->type_ = "gather_gradient";
+}
+
+void GatherGradient::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* GatherGradient::getBuffer() { return this->buffer_; }
+
+std::vector<Operation*> GatherGradient::derive(Operation*, Allocator*) {
+    return { nullptr, nullptr };
+}
+
+void GatherGradient::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* grad = inputs[0];
+    Buffer* indices = inputs[1];
+
+    DataType dtype = grad->getDataType();
+
+    compTemplateChoice<GatherGradient>(this, out, grad, indices, dtype);
+}
+
+int GatherGradient::getAxis() { return axis_; }
+
+//-----------------------------------\\
+// class ScatterAdd;                 \\
+//-----------------------------------\\
 
-      case DataType::INT16:
-        op->template compute<int16_t>(b1);
-        return;
+ScatterAdd::ScatterAdd(Operation* target, Operation* indices, Operation* updates, int axis) {
+    this->axis_ = axis;
+    this->parent1_ = target;
+    this->parent2_ = indices;
+    this->extra_parents_.push_back(updates);
+    this->type_ = "scatter_add";
+}
 
-      case DataType::INT32:
-        op->template compute<int32_t>(b1);
-        return;
+void ScatterAdd::setBuffer(Buffer* buf) { this->buffer_ = buf; }
 
-      case DataType::INT64:
-        op->template compute<int64_t>(b1);
-        return;
-            
-      case DataType::FLOAT32:
-        op->template compute<float>(b1);
-        return;
+Buffer* ScatterAdd::getBuffer() { return this->buffer_; }
 
-      case DataType::FLOAT64:
-        op->template compute<double>(b1);
-        return;
+// The target passes straight through, and every update
+// is gathered back from where it was added.
+std::vector<Operation*> ScatterAdd::derive(Operation* grad, Allocator* a) {
+    Operation* updates = this->extra_parents_[0];
 
-      default:
-        std::cout << "ERROR: bad data type!" << std::endl;
-        assert(false);
-    }
+    return { grad, nullptr, newGradient(new Gather(grad, this->parent2_, axis_), updates, a) };
 }
 
-//-----------------------------------\\
-// class Operation;                  \\
-//-----------------------------------\\
+void ScatterAdd::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    DataType dtype = inputs[0]->getDataType();
 
-// Abstract operation graph node class.
-//
-// Each Operation has two key functions:
-//   - Operation.derive()
-//   - Operation.operate()
-//
-// derive() is the function corresponding to the
-// derivative of that specific operation.
-// e.g. Multiplication.derive == d/dx(x * x) == x*1 + 1*x == product rule
-//
-// operate() is a recursive used to actually enact the arithmetic
-// defined by the operation.
-// e.g. Multiply.operate() == x * y,
-//      where x == Operation.parent1_ and y == Operation.parent2_
-//
-// It should be noted that Constant.operate() retrieves the actual value,
-// acting as the end condition to the recursive function
-// as newly created Tensor<T> objects have a Constant as their operation. // TODO: review this last line
-//
-// This is never to be used directly.
-Operation::Operation() {
-    parent1_ = nullptr;
-    parent2_ = nullptr;
-    buffer_ = nullptr;
+    compTemplateChoice<ScatterAdd>(this, out, inputs, dtype);
 }
 
 //-----------------------------------\\
-// class Addition;                   \\
+// class SparseToDense;              \\
 //-----------------------------------\\
 
-// Operation graph node for element-wise multiplication.
-Addition::Addition(Operation* p1, Operation* p2) {
-    this->parent1_ = p1;
-    this->parent2_ = p2;
-    this->type_ = "addition";
+SparseToDense::SparseToDense(SparseMatrix* sparse) {
+    this->sparse_ = sparse;
+    this->parent1_ = sparse->getRowIndices();
+    this->parent2_ = sparse->getColumnIndices();
+    this->extra_parents_.push_back(sparse->getValues());
+    this->type_ = "sparse_to_dense";
 }
 
-void Addition::setBuffer(Buffer* buf) { this->buffer_ = buf; }
-
-Buffer* Addition::getBuffer() { return this->buffer_; }
-
-void Addition::derive() {}
+void SparseToDense::setBuffer(Buffer* buf) { this->buffer_ = buf; }
 
-// NOTE: Broadcasting only supported for constants.
-//
-// Single-threaded approach.
-//
-// Element-wise multiplication - no shape change.
-Buffer* Addition::operate() {
-    this->buffer_->initialize();
+Buffer* SparseToDense::getBuffer() { return this->buffer_; }
 
-    Buffer* b1 = this->parent1_->operate();
-    Buffer* b2 = this->parent2_->operate();
+std::vector<Operation*> SparseToDense::derive(Operation*, Allocator*) {
+    return { nullptr, nullptr, nullptr };
+}
 
-    DataType dtype = b1->getDataType();
+void SparseToDense::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    DataType dtype = inputs[2]->getDataType();
 
-    compTemplateChoice<Addition>(this, b1, b2, dtype);
-    return this->buffer_;
+    floatTemplateChoice<SparseToDense>(this, out, inputs, dtype);
 }
 
 //-----------------------------------\\
-// class Subtraction;                \\
+// class SparseMatrixMultiplication; \\
 //-----------------------------------\\
 
-// Operation graph node for element-wise division.
-Subtraction::Subtraction(Operation* p1, Operation* p2) {
-    this->parent1_ = p1;
-    this->parent2_ = p2;
-    this->type_ = "subtraction";
+SparseMatrixMultiplication::SparseMatrixMultiplication(SparseMatrix* sparse, Operation* dense,
+                                                       bool sparse_first, bool transposed) {
+    this->sparse_ = sparse;
+    this->sparse_first_ = sparse_first;
+    this->transposed_ = transposed;
+    this->parent1_ = dense;
+    this->parent2_ = sparse->getRowIndices();
+    this->extra_parents_.push_back(sparse->getColumnIndices());
+    this->extra_parents_.push_back(sparse->getValues());
+    this->type_ = "sparse_matrix_multiplication";
 }
 
-void Subtraction::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+void SparseMatrixMultiplication::setBuffer(Buffer* buf) { this->buffer_ = buf; }
 
-Buffer* Subtraction::getBuffer() { return this->buffer_; }
+Buffer* SparseMatrixMultiplication::getBuffer() { return this->buffer_; }
 
-void Subtraction::derive() {}
+// Rows of D stay rows of D S and D S^T. Columns of D are the columns of S D
+// and S^T D (a vector has none).
+int SparseMatrixMultiplication::batchAxis(int parent, int axis) {
+    if (parent != 0)
+        return -1;
 
-// NOTE: Broadcasting only supported for constants.
-//
-// Single-threaded approach.
-//
-// Element-wise multiplication - no shape change.
-Buffer* Subtraction::operate() {
-    this->buffer_->initialize();
+    int rank = parent1_->getBuffer()->getShape().size();
 
-    Buffer* b1 = this->parent1_->operate();
-    Buffer* b2 = this->parent2_->operate();
+    if (sparse_first_)
+        return (rank == 2 && axis == 1) ? 1 : -1;
 
-    DataType dtype = b1->getDataType();
+    return axis < rank - 1 ? axis : -1;
+}
 
-    compTemplateChoice<Subtraction>(this, b1, b2, dtype);
-    return this->buffer_;
+// d/dD (S D) == S^T grad, d/dD (D S) == grad S^T, and the other way around.
+std::vector<Operation*> SparseMatrixMultiplication::derive(Operation* grad, Allocator* a) {
+    Operation* dense_grad = newGradient(
+        new SparseMatrixMultiplication(sparse_, grad, sparse_first_, !transposed_), this->parent1_, a);
+
+    return { dense_grad, nullptr, nullptr, nullptr };
+}
+
+void SparseMatrixMultiplication::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    DataType dtype = inputs[0]->getDataType();
+
+    floatTemplateChoice<SparseMatrixMultiplication>(this, out, inputs, dtype);
 }
 
 //-----------------------------------\\
-// class Multiplication;             \\
+// class Quantize;                   \\
 //-----------------------------------\\
 
-// Operation graph node for element-wise multiplication.
-Multiplication::Multiplication(Operation* p1, Operation* p2) {
+Quantize::Quantize(Operation* p1, Quantization quantization) {
+    this->quantization_ = quantization;
     this->parent1_ = p1;
-    this->parent2_ = p2;
-    this->type_ = "multiplication";
+    this->parent2_ = nullptr;
+    this->type_ = "quantize";
 }
 
-void Multiplication::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+void Quantize::setBuffer(Buffer* buf) { this->buffer_ = buf; }
 
-Buffer* Multiplication::getBuffer() { return this->buffer_; }
+Buffer* Quantize::getBuffer() { return this->buffer_; }
 
-void Multiplication::derive() {}
+int Quantize::batchAxis(int parent, int axis) { return elementWiseBatchAxis(parent, axis); }
 
-// NOTE: Broadcasting only supported for constants.
-//
-// Single-threaded approach.
-//
-// Element-wise multiplication - no shape change.
-Buffer* Multiplication::operate() {
-    this->buffer_->initialize();
+std::vector<Operation*> Quantize::derive(Operation*, Allocator*) {
+    return { nullptr };
+}
 
-    Buffer* b1 = this->parent1_->operate();
-    Buffer* b2 = this->parent2_->operate();
+void Quantize::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* buf = inputs[0];
 
-    DataType dtype = b1->getDataType();
+    DataType dtype = buf->getDataType();
 
-    compTemplateChoice<Multiplication>(this, b1, b2, dtype);
-    return this->buffer_;
+    floatTemplateChoice<Quantize>(this, out, buf, dtype);
 }
 
 //-----------------------------------\\
-// class Division;                   \\
+// class Dequantize;                 \\
 //-----------------------------------\\
 
-// Operation graph node for element-wise division.
-Division::Division(Operation* p1, Operation* p2) {
+Dequantize::Dequantize(Operation* p1) {
+    this->quantization_ = p1->getBuffer()->getQuantization();
     this->parent1_ = p1;
-    this->parent2_ = p2;
-    this->type_ = "division";
+    this->parent2_ = nullptr;
+    this->type_ = "dequantize";
 }
 
-void Division::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+void Dequantize::setBuffer(Buffer* buf) { this->buffer_ = buf; }
 
-Buffer* Division::getBuffer() { return this->buffer_; }
+Buffer* Dequantize::getBuffer() { return this->buffer_; }
 
-void Division::derive() {}
+int Dequantize::batchAxis(int parent, int axis) { return elementWiseBatchAxis(parent, axis); }
 
-// NOTE: Broadcasting only supported for constants.
-//
-// Single-threaded approach.
-//
-// Element-wise multiplication - no shape change.
-Buffer* Division::operate() {
-    this->buffer_->initialize();
+std::vector<Operation*> Dequantize::derive(Operation*, Allocator*) {
+    return { nullptr };
+}
 
-    Buffer* b1 = this->parent1_->operate();
-    Buffer* b2 = this->parent2_->operate();
+void Dequantize::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* buf = inputs[0];
 
-    DataType dtype = b1->getDataType();
+    DataType dtype = buf->getDataType();
 
-    compTemplateChoice<Division>(this, b1, b2, dtype);
-    return this->buffer_;
+    quantizedTemplateChoice<Dequantize>(this, out, buf, dtype);
 }
 
 //-----------------------------------\\
-// class MatrixMultiplication;       \\
+// class QuantizedMatrixMultiplication; \\
 //-----------------------------------\\
 
-// Operation graph node for element-wise division.
-MatrixMultiplication::MatrixMultiplication(Operation* p1, Operation* p2) {
+QuantizedMatrixMultiplication::QuantizedMatrixMultiplication(Operation* p1, Operation* p2,
+                                                             Quantization quantization) {
+    this->input_quantization_ = p1->getBuffer()->getQuantization();
+    this->weight_quantization_ = p2->getBuffer()->getQuantization();
+    this->quantization_ = quantization;
     this->parent1_ = p1;
     this->parent2_ = p2;
-    this->type_ = "matrix_multiplication";
+    this->type_ = "quantized_matrix_multiplication";
+
+    Buffer* w = p2->getBuffer();
+    assert(!p2->getType().compare("constant") && w->getDataType() == DataType::INT8);
+
+    uint64_t inner = w->getShape()[0];
+    uint64_t columns = w->getShape()[1];
+    this->weights_.resize(columns * inner);
+    this->weight_sums_.assign(columns, 0);
+
+    for (uint64_t k = 0; k < inner; k++) {
+        for (uint64_t c = 0; c < columns; c++) {
+            int8_t weight = w->getIndex<int8_t>(k * columns + c);
+
+            this->weights_[c * inner + k] = weight;
+            this->weight_sums_[c] += weight;
+        }
+    }
 }
 
-void MatrixMultiplication::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+void QuantizedMatrixMultiplication::setBuffer(Buffer* buf) { this->buffer_ = buf; }
 
-Buffer* MatrixMultiplication::getBuffer() { return this->buffer_; }
+Buffer* QuantizedMatrixMultiplication::getBuffer() { return this->buffer_; }
 
-void MatrixMultiplication::derive() {}
+int QuantizedMatrixMultiplication::batchAxis(int parent, int axis) {
+    return matrixProductBatchAxis(this, parent, axis);
+}
 
-Buffer* MatrixMultiplication::operate() {
-    this->buffer_->initialize();
+std::vector<Operation*> QuantizedMatrixMultiplication::derive(Operation*, Allocator*) {
+    return { nullptr, nullptr };
+}
 
-    Buffer* b1 = this->parent1_->operate();
-    Buffer* b2 = this->parent2_->operate();
+void QuantizedMatrixMultiplication::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* b1 = inputs[0];
+    Buffer* b2 = inputs[1];
 
     DataType dtype = b1->getDataType();
 
-    compTemplateChoice<MatrixMultiplication>(this, b1, b2, dtype);
-    return this->buffer_;
+    quantizedTemplateChoice<QuantizedMatrixMultiplication>(this, out, b1, b2, dtype);
 }
 
 //-----------------------------------\\
-// class Convolution2D;              \\
+// class QuantizedConvolution2D;     \\
 //-----------------------------------\\
 
-// Operation graph node for element-wise division.
-Convolution2D::Convolution2D(Operation* p1, Operation* p2, std::string padding, int (&strides)[2]) {
+QuantizedConvolution2D::QuantizedConvolution2D(Operation* p1, Operation* p2, std::string padding,
+                                               int (&strides)[2], Quantization quantization) {
     this->padding_ = padding;
     this->strides_[0] = strides[0];
     this->strides_[1] = strides[1];
+    this->input_quantization_ = p1->getBuffer()->getQuantization();
+    this->kernel_quantization_ = p2->getBuffer()->getQuantization();
+    this->quantization_ = quantization;
     this->parent1_ = p1;
     this->parent2_ = p2;
-    this->type_ = "convolution2d";
+    this->type_ = "quantized_convolution2d";
+
+    Buffer* k = p2->getBuffer();
+    assert(!p2->getType().compare("constant") && k->getDataType() == DataType::INT8);
+
+    const int8_t* kernel = k->getBufferDataAsTemplate<int8_t>();
+    this->kernel_.assign(kernel, kernel + k->getElements());
+    std::reverse(this->kernel_.begin(), this->kernel_.end());
+
+    this->kernel_sum_ = { std::accumulate(this->kernel_.begin(), this->kernel_.end(), 0) };
 }
 
-void Convolution2D::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+void QuantizedConvolution2D::setBuffer(Buffer* buf) { this->buffer_ = buf; }
 
-Buffer* Convolution2D::getBuffer() { return this->buffer_; }
+Buffer* QuantizedConvolution2D::getBuffer() { return this->buffer_; }
 
-void Convolution2D::derive() {}
+int QuantizedConvolution2D::batchAxis(int parent, int axis) {
+    return imageBatchAxis(this, parent, axis);
+}
 
-Buffer* Convolution2D::operate() {
-    this->buffer_->initialize();
+std::vector<Operation*> QuantizedConvolution2D::derive(Operation*, Allocator*) {
+    return { nullptr, nullptr };
+}
 
-    Buffer* b1 = this->parent1_->operate();
-    Buffer* b2 = this->parent2_->operate();
+void QuantizedConvolution2D::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* b1 = inputs[0];
+    Buffer* b2 = inputs[1];
 
     DataType dtype = b1->getDataType();
 
-    compTemplateChoice<Convolution2D>(this, b1, b2, dtype);
-    return this->buffer_;
+    quantizedTemplateChoice<QuantizedConvolution2D>(this, out, b1, b2, dtype);
 }
 
 //-----------------------------------\\
-// class Power;                      \\
+// class Comparison;                 \\
 //-----------------------------------\\
 
-Power::Power(Operation* p1, Operation* p2) {
+Comparison::Comparison(Operation* p1, Operation* p2, ComparisonType comparison) {
+    string types[] = { "equal", "not_equal", "less", "less_equal", "greater", "greater_equal" };
+
+    this->comparison_ = comparison;
     this->parent1_ = p1;
     this->parent2_ = p2;
-    this->type_ = "power";
+    this->type_ = types[static_cast<int>(comparison)];
 }
 
-void Power::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+void Comparison::setBuffer(Buffer* buf) { this->buffer_ = buf; }
 
-Buffer* Power::getBuffer() { return this->buffer_; }
+Buffer* Comparison::getBuffer() { return this->buffer_; }
 
-void Power::derive() {}
+int Comparison::batchAxis(int parent, int axis) { return elementWiseBatchAxis(parent, axis); }
 
-// NOTE: broadcasting not yet supported
-//
-// element-wise multiplication - no shape change
-Buffer* Power::operate() {
-    this->buffer_->initialize();
+std::vector<Operation*> Comparison::derive(Operation*, Allocator*) {
+    return { nullptr, nullptr };
+}
 
-    Buffer* b1 = this->parent1_->operate();
-    Buffer* b2 = this->parent2_->operate();
+void Comparison::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* b1 = inputs[0];
+    Buffer* b2 = inputs[1];
 
     DataType dtype = b1->getDataType();
 
-    compTemplateChoice<Power>(this, b1, b2, dtype);
-    return this->buffer_;
+    compTemplateChoice<Comparison>(this, out, b1, b2, dtype);
 }
 
 //-----------------------------------\\
-// class Cast;                       \\
+// class Logical;                    \\
 //-----------------------------------\\
 
-Cast::Cast(Operation* p1) {
+Logical::Logical(Operation* p1, Operation* p2, LogicalType logical) {
+    string types[] = { "logical_and", "logical_or", "logical_xor", "logical_not" };
+
+    this->logical_ = logical;
     this->parent1_ = p1;
-    this->parent2_ = nullptr;
-    this->type_ = "cast";
+    this->parent2_ = (logical == LogicalType::NOT) ? nullptr : p2;
+    this->type_ = types[static_cast<int>(logical)];
 }
 
-void Cast::setBuffer(Buffer* buf) {
-    this->buffer_ = buf;
+void Logical::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* Logical::getBuffer() { return this->buffer_; }
+
+int Logical::batchAxis(int parent, int axis) { return elementWiseBatchAxis(parent, axis); }
+
+std::vector<Operation*> Logical::derive(Operation*, Allocator*) {
+    if (logical_ == LogicalType::NOT)
+        return { nullptr };
+
+    return { nullptr, nullptr };
 }
 
-Buffer* Cast::getBuffer() {
-    return this->buffer_;
+void Logical::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* b1 = inputs[0];
+    Buffer* b2 = (logical_ == LogicalType::NOT) ? nullptr : inputs[1];
+
+    if (b1->getDataType() != DataType::BOOL || (b2 != nullptr && b2->getDataType() != DataType::BOOL)) {
+        std::cout << "ERROR: Data type must be BOOL in logical operations!" << std::endl;
+        assert(false);
+    }
+
+    compute(out, b1, b2);
 }
 
-void Cast::derive() {}
+void Logical::compute(Buffer* out, Buffer* b1, Buffer* b2) {
+    const uint64_t* x = b1->getBufferDataAsTemplate<uint64_t>();
+    uint64_t* result = out->getBufferDataAsTemplate<uint64_t>();
 
-// NOTE: broadcasting not yet supported
-//
-// element-wise multiplication - no shape change
-Buffer* Cast::operate() {
-    this->buffer_->initialize();
+    uint64_t n = out->getElements();
+    uint64_t words = bits::words(n);
 
-    Buffer* buf = this->parent1_->operate();
+    if (logical_ == LogicalType::NOT) {
+        for (uint64_t w = 0; w < words; w++)
+            result[w] = ~x[w];
 
-    DataType dtype = this->buffer_->getDataType();
+        return;
+    }
 
-    compTemplateChoice<Cast>(this, buf, dtype);
-    return this->buffer_;
+    const uint64_t* y = b2->getBufferDataAsTemplate<uint64_t>();
+    uint64_t n1 = b1->getElements(), n2 = b2->getElements();
+
+    // Masks of the same size go a word at a time, a single element standing
+    // for a word of copies of it. Rows repeated across the other side go a
+    // bit at a time.
+    if (n1 != n2 && n1 != 1 && n2 != 1) {
+        bits::pack(result, 0, n, [&](uint64_t i) {
+            bool p = bits::get(x, i % n1);
+            bool q = bits::get(y, i % n2);
+
+            if (logical_ == LogicalType::AND)
+                return p && q;
+            else if (logical_ == LogicalType::OR)
+                return p || q;
+            else
+                return p != q;
+        });
+
+        return;
+    }
+
+    uint64_t copies_x = -(x[0] & 1), copies_y = -(y[0] & 1);
+
+    for (uint64_t w = 0; w < words; w++) {
+        uint64_t p = (n1 < n2) ? copies_x : x[w];
+        uint64_t q = (n2 < n1) ? copies_y : y[w];
+
+        if (logical_ == LogicalType::AND)
+            result[w] = p & q;
+        else if (logical_ == LogicalType::OR)
+            result[w] = p | q;
+        else
+            result[w] = p ^ q;
+    }
 }
 
 //-----------------------------------\\
-// class SquareRoot;                 \\
+// class Select;                     \\
 //-----------------------------------\\
 
-SquareRoot::SquareRoot(Operation* p1, bool promotion) {
-    this->parent1_ = p1;
-    this->parent2_ = nullptr;
-    this->type_ = "square_root";
-    this->promotion = promotion;
+Select::Select(Operation* condition, Operation* p1, Operation* p2) {
+    this->parent1_ = condition;
+    this->parent2_ = p1;
+    this->extra_parents_ = { p2 };
+    this->type_ = "select";
 }
 
-void SquareRoot::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+void Select::setBuffer(Buffer* buf) { this->buffer_ = buf; }
 
-Buffer* SquareRoot::getBuffer() { return this->buffer_; }
+Buffer* Select::getBuffer() { return this->buffer_; }
 
-void SquareRoot::derive() {}
+int Select::batchAxis(int parent, int axis) { return elementWiseBatchAxis(parent, axis); }
 
-// NOTE: broadcasting not yet supported
-//
-// element-wise multiplication - no shape change
-Buffer* SquareRoot::operate() {
-    this->buffer_->initialize();
+// Each value gets the gradient where it was picked, and 0 elsewhere.
+std::vector<Operation*> Select::derive(Operation* grad, Allocator* a) {
+    Operation* p1 = this->parent2_;
+    Operation* p2 = this->extra_parents_[0];
 
-    Buffer* buf = this->parent1_->operate();
+    Operation* zero = newScalar(0, grad->getBuffer()->getDataType(), a);
 
-    DataType dtype;
-    if (this->promotion)
-        dtype = DataType::FLOAT32;
-    else
-        dtype = this->buffer_->getDataType();
+    Operation* grad1 = newGradient(new Select(this->parent1_, grad, zero), grad, a);
+    Operation* grad2 = newGradient(new Select(this->parent1_, zero, grad), grad, a);
 
-    compTemplateChoice<SquareRoot>(this, buf, dtype);
-    return this->buffer_;
+    return { nullptr, sumToParent(grad1, p1, a), sumToParent(grad2, p2, a) };
+}
+
+void Select::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    if (inputs[0]->getDataType() != DataType::BOOL) {
+        std::cout << "ERROR: Condition must be BOOL in select!" << std::endl;
+        assert(false);
+    }
+
+    DataType dtype = out->getDataType();
+
+    compTemplateChoice<Select>(this, out, inputs, dtype);
 }
 
 //-----------------------------------\\
-// class Exponential;                \\
+// class MaskReduction;              \\
 //-----------------------------------\\
 
-Exponential::Exponential(Operation* p1) {
+MaskReduction::MaskReduction(Operation* p1, MaskReductionType reduction, int first_axis, int last_axis) {
+    string types[] = { "count", "any", "all" };
+
+    this->reduction_ = reduction;
+    this->first_axis_ = first_axis;
+    this->last_axis_ = last_axis;
     this->parent1_ = p1;
     this->parent2_ = nullptr;
-    this->type_ = "exponential";
+    this->type_ = types[static_cast<int>(reduction)];
 }
 
-void Exponential::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+void MaskReduction::setBuffer(Buffer* buf) { this->buffer_ = buf; }
 
-Buffer* Exponential::getBuffer() { return this->buffer_; }
+Buffer* MaskReduction::getBuffer() { return this->buffer_; }
+
+int MaskReduction::batchAxis(int, int axis) {
+    return reducedBatchAxis(this, first_axis_, last_axis_, axis);
+}
 
-void Exponential::derive() {}
+std::vector<Operation*> MaskReduction::derive(Operation*, Allocator*) {
+    return { nullptr };
+}
 
-// NOTE: broadcasting not yet supported
-//
-// element-wise multiplication - no shape change
-Buffer* Exponential::operate() {
-    this->buffer_->initialize();
+void MaskReduction::evaluate(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* buf = inputs[0];
+
+    if (buf->getDataType() != DataType::BOOL) {
+        std::cout << "ERROR: Data type must be BOOL in mask reductions!" << std::endl;
+        assert(false);
+    }
 
-    Buffer* buf = this->parent1_->operate();
+    compute(out, buf);
+}
 
-    DataType dtype = buf->getDataType();
+void MaskReduction::compute(Buffer* out, Buffer* buf) {
+    uint64_t outer, extent, inner;
+    reductionExtents(buf->getShape(), first_axis_, last_axis_, outer, extent, inner);
+
+    const uint64_t* data = buf->getBufferDataAsTemplate<uint64_t>();
+
+    // Set elements over the reduced axes, for every element of the result.
+    std::vector<int64_t> counts(outer * inner, 0);
+
+    bool parallel = buf->getElements() >= mask_parallel_threshold;
+    forEachRange(outer, parallel, [&](uint64_t first, uint64_t last) {
+        for (uint64_t o = first; o < last; o++) {
+            uint64_t start = o * extent * inner;
+
+            if (inner == 1) {
+                counts[o] = bits::count(data, start, start + extent);
+                continue;
+            }
+
+            for (uint64_t e = 0; e < extent; e++) {
+                bits::forEachWord(data, start + e * inner, start + (e + 1) * inner,
+                                  [&](uint64_t offset, uint64_t word, uint64_t n) {
+                    int64_t* c = counts.data() + o * inner + offset;
+                    for (uint64_t k = 0; k < n; k++)
+                        c[k] += (word >> k) & 1;
+                });
+            }
+        }
+    });
+
+    if (reduction_ == MaskReductionType::COUNT) {
+        std::copy(counts.begin(), counts.end(), out->getBufferDataAsTemplate<int64_t>());
+        return;
+    }
 
-    compTemplateChoice<Exponential>(this, buf, dtype);
-    return this->buffer_;
+    int64_t all = extent;
+    bits::pack(out->getBufferDataAsTemplate<uint64_t>(), 0, counts.size(), [&](uint64_t i) {
+        return (reduction_ == MaskReductionType::ANY) ? counts[i] > 0 : counts[i] == all;
+    });
 }
 
 //-----------------------------------\\
@@ -479,12 +2613,43 @@ void Constant::setBuffer(Buffer* buf) { this->buffer_ = buf; }
 
 Buffer* Constant::getBuffer() { return this->buffer_; }
 
-void Constant::derive() {
+std::vector<Operation*> Constant::derive(Operation*, Allocator*) {
+    return {};
+}
+
+// The buffer already holds the data, so there's nothing to compute.
+void Constant::evaluate(Buffer*, std::vector<Buffer*>&) {
     return;
 }
 
-Buffer* Constant::operate() {
-    return this->buffer_;
+//-----------------------------------\\
+// class Placeholder;                \\
+//-----------------------------------\\
+
+Placeholder::Placeholder(Buffer* buf) {
+    this->buffer_ = buf;
+    this->type_ = "placeholder";
+}
+
+void Placeholder::setBuffer(Buffer* buf) { this->buffer_ = buf; }
+
+Buffer* Placeholder::getBuffer() { return this->buffer_; }
+
+void Placeholder::bind(Buffer* buf) {
+    assert(buf->getDataType() == this->buffer_->getDataType());
+    assert(compare(buf->getShape(), this->buffer_->getShape()));
+
+    buf->pin();
+    this->buffer_ = buf;
+}
+
+std::vector<Operation*> Placeholder::derive(Operation*, Allocator*) {
+    return {};
+}
+
+// The buffer already holds the data, so there's nothing to compute.
+void Placeholder::evaluate(Buffer*, std::vector<Buffer*>&) {
+    return;
 }
 
 } // namespace deeplib
@@ -2,6 +2,8 @@
 #define OPERATIONS
 #include <iostream>
 #include <cmath>
+#include <mutex>
+#include <unordered_set>
 #include "core/buffer.h"
 
 using std::string;
@@ -10,6 +12,10 @@ namespace deeplib {
 
 class Buffer;
 class Allocator;
+class KVCache;
+class SparseMatrix;
+
+enum class ActivationType { RELU, SIGMOID, TANH, GELU, SILU };
 
 // Abstract operation graph node class.
 //
@@ -21,8 +27,13 @@ class Allocator;
 // derivative of that specific operation.
 // e.g. Multiplication.derive == d/dx(x * x) == x*1 + 1*x == product rule
 //
+// Given the operation computing the gradient of this operation's result,
+// derive() builds the operations computing the gradients of its parents
+// (see Gradients for the backward pass putting these together).
+//
 // operate() is a recursive used to actually enact the arithmetic
-// defined by the operation.
+// defined by the operation. It operates the parents and then hands
+// their buffers to evaluate(), which each operation defines.
 // e.g. Multiply.operate() == x * y,
 //      where x == Operation.parent1_ and y == Operation.parent2_
 //
@@ -30,6 +41,13 @@ class Allocator;
 // acting as the end condition to the recursive function
 // as newly created Tensor<T> objects have a Constant as their operation. // TODO: review this last line
 //
+//----INCREMENTAL MODE----
+// Every operation keeps a version counter that is bumped whenever it
+// recomputes its buffer, along with the versions of its parents at the
+// time. When operated incrementally, an operation whose parents (and
+// buffer) haven't changed since it last computed returns its buffer as is,
+// so only the operations downstream of a changed input are recomputed.
+//
 // This is never to be used directly.
 class Operation {
     friend class Allocator;
@@ -41,24 +59,146 @@ class Operation {
     Operation* parent1_;
     Operation* parent2_;
 
+    // Inputs past the first two, for operations taking more of them
+    // (e.g. the shift of a Normalization). getParents() lists them last.
+    std::vector<Operation*> extra_parents_;
+
     Buffer* buffer_;
 
+    // Incremental mode bookkeeping.
+    // See the class comment above for details.
+    bool computed_;
+    uint64_t version_;
+    uint64_t buffer_version_;
+    Buffer* computed_buffer_;
+    std::vector<uint64_t> parent_versions_;
+
+    // Set once the graph leading up to this operation has a buffer per
+    // operation (see Tensor::operate()).
+    bool separated_;
+
+    // Activation applied to the result as it's written (see setEpilogue()).
+    bool has_epilogue_;
+    ActivationType epilogue_;
+    bool epilogue_approximate_;
+
+    // Returns true if the operation has to be recomputed
+    // for its buffer to reflect the current state of its parents.
+    bool isStale();
+
+    // Applies the epilogue, if any, to elements [begin, end) of `out`.
+    void applyEpilogue(Buffer* out, uint64_t begin, uint64_t end);
+
+    // Runs f(begin, end) over consecutive blocks of [0, n), applying the
+    // epilogue to each block of `out` right after, while it's still in cache.
+    template <typename F>
+    void forEachBlock(Buffer* out, uint64_t n, F f);
+
+    // Element-wise kernels over 16 bit floats (T), which widen their inputs
+    // into FP32 blocks on the stack and round each block of the result back
+    // as it's done, going through forEachBlock(). The binary one computes
+    // f(x, y) an element at a time, broadcasting a single element of either
+    // side or a shorter side repeated across the longer one. The unary one
+    // calls f(block, count) to compute a block in place.
+    template <typename T, typename F>
+    void halfElementWise(Buffer* out, Buffer* b1, Buffer* b2, F f);
+
+    template <typename T, typename F>
+    void halfElementWise(Buffer* out, Buffer* buf, F f);
+
+    // Helpers for derive().
+
+    // Registers a gradient operation under `a`, along with a buffer
+    // describing its result. The buffer is never allocated by the graph, as
+    // gradients are evaluated through an ExecutionContext.
+    static Operation* newGradient(Operation* op, std::vector<int> shape, DataType dtype, Allocator* a);
+
+    // Same as above, with the shape and data type of `like`'s result.
+    static Operation* newGradient(Operation* op, Operation* like, Allocator* a);
+
+    // Constant holding a single value, e.g. the 2 in d/dx sqrt(x) == 1 / (2 * sqrt(x)).
+    static Operation* newScalar(double value, DataType dtype, Allocator* a);
+
+    // Sums a gradient over the elements `parent` was broadcast across.
+    // Returns `grad` as is if there was no broadcasting.
+    static Operation* sumToParent(Operation* grad, Operation* parent, Allocator* a);
+
+    // batchAxis() of element-wise operations: the same axis of the result
+    // (counting from the last), unless the parent is broadcast along it.
+    int elementWiseBatchAxis(int parent, int axis);
+
   public:
     Operation();
 
     Operation(Operation* p1, Operation* p2);
     Operation(Buffer* buf);
 
+    virtual ~Operation() {}
+
     virtual void setBuffer(Buffer* buf) = 0;
     virtual Buffer* getBuffer() = 0;
 
-    virtual void derive() = 0;
+    // Returns the gradient operations of the parents, in the order of
+    // getParents(), given `grad`, the gradient of this operation's result.
+    // A parent no gradient flows to gets nullptr.
+    virtual std::vector<Operation*> derive(Operation* grad, Allocator* a) = 0;
+
+    // Recursively operates the parents, then this operation.
+    // If `incremental` is true, up to date operations are skipped.
+    Buffer* operate(bool incremental=false);
+
+    // Computes this operation's result into `out` from the
+    // (already operated) buffers of its parents.
+    //
+    // Implementations must not modify the operation itself, so that
+    // several ExecutionContexts can evaluate it at the same time.
+    virtual void evaluate(Buffer* out, std::vector<Buffer*>& inputs) = 0;
+
+    // Forgets the last computation, forcing the
+    // next incremental operate() to recompute.
+    void invalidate();
+
+    // Marks the graph leading up to this operation as no longer sharing
+    // buffers, so incremental operates of it don't walk it again.
+    void setSeparated();
+    bool isSeparated();
 
-    virtual Buffer* operate() = 0;
+    std::vector<Operation*> getParents();
+
+    // Takes every input from `old_parent` from `new_parent` instead,
+    // for graph passes (see passes.h) rewiring the graph.
+    void replaceParent(Operation* old_parent, Operation* new_parent);
+
+    uint64_t getVersion();
 
     string getType();
+
+    // True for operations applying an epilogue set with setEpilogue().
+    virtual bool acceptsEpilogue();
+
+    // Has the activation applied to every element of the result by the
+    // operation itself, instead of by an Activation after it (see
+    // fuseActivations() in passes.h).
+    void setEpilogue(ActivationType activation, bool approximate);
+
+    bool hasEpilogue();
+
+    // Axis of the result that axis `axis` of the given parent (an index into
+    // getParents()) carries on to, or -1 if it doesn't make it through as is,
+    // e.g. because it's reduced or contracted over. ExecutionContext follows
+    // the batch dimension of placeholders through the graph with this.
+    //
+    // Nothing carries on by default.
+    virtual int batchAxis(int parent, int axis);
 };
 
+// Returns every operation `root` depends on (including itself),
+// each listed after all of its parents.
+std::vector<Operation*> topologicalOrder(Operation* root);
+
+// Same as above, for everything any of the given roots depend on.
+std::vector<Operation*> topologicalOrder(std::vector<Operation*>& roots);
+
 class Addition : public Operation {
   public:
     Addition(Operation* p1, Operation* p2);
@@ -66,16 +206,19 @@ class Addition : public Operation {
     void setBuffer(Buffer* buf);
     Buffer* getBuffer();
 
-    void derive();
+    int batchAxis(int parent, int axis);
 
-    // NOTE: broadcasting not yet supported
-    //
-    // element-wise multiplication - no shape change
-    //template <typename OpDType>
-    Buffer* operate();
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    bool acceptsEpilogue();
+
+    // Element-wise addition - no shape change. A single element is added
+    // to every element of the other side, and a side matching the trailing
+    // dimensions of the other (e.g. a bias) to every row of it.
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
 
     template <typename OpDType>
-    void compute(Buffer* b1, Buffer* b2);
+    void compute(Buffer* out, Buffer* b1, Buffer* b2);
 };
 
 class Subtraction : public Operation {
@@ -85,12 +228,16 @@ class Subtraction : public Operation {
     void setBuffer(Buffer* buf);
     Buffer* getBuffer();
 
-    void derive();
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    bool acceptsEpilogue();
 
-    Buffer* operate();
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
 
     template <typename OpDType>
-    void compute(Buffer* b1, Buffer* b2);
+    void compute(Buffer* out, Buffer* b1, Buffer* b2);
 };
 
 
@@ -101,16 +248,19 @@ class Multiplication : public Operation {
     void setBuffer(Buffer* buf);
     Buffer* getBuffer();
 
-    void derive();
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    bool acceptsEpilogue();
 
     // NOTE: broadcasting not yet supported
     //
     // element-wise multiplication - no shape change
-    //template <typename OpDType>
-    Buffer* operate();
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
 
     template <typename OpDType>
-    void compute(Buffer* b1, Buffer* b2);
+    void compute(Buffer* out, Buffer* b1, Buffer* b2);
 };
 
 class Division : public Operation {
@@ -120,12 +270,16 @@ class Division : public Operation {
     void setBuffer(Buffer* buf);
     Buffer* getBuffer();
 
-    void derive();
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    bool acceptsEpilogue();
 
-    Buffer* operate();
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
 
     template <typename OpDType>
-    void compute(Buffer* b1, Buffer* b2);
+    void compute(Buffer* out, Buffer* b1, Buffer* b2);
 };
 
 class MatrixMultiplication : public Operation {
@@ -135,12 +289,16 @@ class MatrixMultiplication : public Operation {
     void setBuffer(Buffer* buf);
     Buffer* getBuffer();
 
-    void derive();
+    int batchAxis(int parent, int axis);
 
-    Buffer* operate();
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    bool acceptsEpilogue();
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
 
     template <typename OpDType>
-    void compute(Buffer* b1, Buffer* b2);
+    void compute(Buffer* out, Buffer* b1, Buffer* b2);
 };
 
 class Convolution2D : public Operation {
@@ -153,12 +311,45 @@ class Convolution2D : public Operation {
     void setBuffer(Buffer* buf);
     Buffer* getBuffer();
 
-    void derive();
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    bool acceptsEpilogue();
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, Buffer* b1, Buffer* b2);
+};
+
+// Transpose of Convolution2D with respect to its image (sometimes called a
+// deconvolution): every pixel of parent1 is scattered through the kernel into
+// the image Convolution2D would have made it out of, with the same padding
+// and strides. As with conv2d, strides override padding, so with strides
+// above 1 padding is always "valid".
+//
+// Images are split across ThreadPool::shared() when there's enough work.
+class Convolution2DTranspose : public Operation {
+    int strides_[2];
+    std::string padding_;
+
+  public:
+    Convolution2DTranspose(Operation* p1, Operation* p2, std::string padding, int (&strides)[2]);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    bool acceptsEpilogue();
 
-    Buffer* operate();
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
 
     template <typename OpDType>
-    void compute(Buffer* b1, Buffer* b2);
+    void compute(Buffer* out, Buffer* b1, Buffer* b2);
 };
 
 class Power : public Operation {
@@ -168,28 +359,46 @@ class Power : public Operation {
     void setBuffer(Buffer* buf);
     Buffer* getBuffer();
 
-    void derive();
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
 
     // Element-wise raising to a power - no shape change
-    Buffer* operate();
+    //
+    // With vector math on (see config.h), a single exponent is special
+    // cased: integers up to 4 in magnitude (any non-negative one for integer
+    // data) are taken by repeated multiplication (see vmath::powi()), and
+    // 0.5 and -0.5 through sqrt(). Anything else goes through vmath::pow().
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
 
     template <typename OpDType>
-    void compute(Buffer* b1, Buffer* b2);
+    void compute(Buffer* out, Buffer* b1, Buffer* b2);
 };
 
+// Converts its parent to the data type of its buffer, a whole array at a
+// time with the kernels of convert.h (or bits.h, to and from BOOL). Narrowing
+// conversions wrap around unless `saturate`, in which case out of range
+// values are clamped (see convert.h). Large arrays are split across
+// ThreadPool::shared().
 class Cast : public Operation {
+    bool saturate_;
+
   public:
-    Cast(Operation* buf);
+    Cast(Operation* buf, bool saturate=false);
+
+    bool isSaturating();
 
     void setBuffer(Buffer* buf);
     Buffer* getBuffer();
 
-    void derive();
+    int batchAxis(int parent, int axis);
 
-    Buffer* operate();
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
 
     template <typename OpDType>
-    void compute(Buffer* buf);
+    void compute(Buffer* out, Buffer* buf);
 };
 
 class SquareRoot : public Operation {
@@ -203,12 +412,14 @@ class SquareRoot : public Operation {
     void setBuffer(Buffer* buf);
     Buffer* getBuffer();
 
-    void derive();
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
 
-    Buffer* operate();
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
 
     template <typename OpDType>
-    void compute(Buffer* buf);
+    void compute(Buffer* out, Buffer* buf);
 };
 
 class Exponential : public Operation {
@@ -218,25 +429,1035 @@ class Exponential : public Operation {
     void setBuffer(Buffer* buf);
     Buffer* getBuffer();
 
-    void derive();
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
 
     // Element-wise exp() function - no shape change.
-    Buffer* operate();
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
 
     template <typename OpDType>
-    void compute(Buffer* buf);
+    void compute(Buffer* out, Buffer* buf);
 };
 
-class Constant : public Operation {
+class Logarithm : public Operation {
   public:
-    Constant(Buffer* buf);
+    Logarithm(Operation* p);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    // Element-wise natural log - no shape change.
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, Buffer* buf);
+};
+
+// Swaps the last two dimensions, i.e. transposes every matrix in the tensor.
+class Transpose : public Operation {
+  public:
+    Transpose(Operation* p);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, Buffer* buf);
+};
+
+// Element-wise activation function - no shape change.
+//
+// Approximate activations go through vector_math.h, and are vectorized:
+// sigmoid and tanh are within 3 ULP of the exact result (see vmath::sigmoid()
+// and vmath::tanh()), and SiLU within 4. GELU's approximation is the tanh form,
+// 0.5x * (1 + tanh(sqrt(2/pi) * (x + 0.044715x^3))), which is a different
+// function (at most 4.7e-4 from the exact one) computed as x * sigmoid(2 * ...).
+// Exact activations are computed with libm, GELU as 0.5x * erfc(-x / sqrt(2)).
+// ReLU is the same either way.
+//
+// Large inputs are split across ThreadPool::shared().
+//
+// NOTE: Only floating point data types are supported.
+class Activation : public Operation {
+    ActivationType activation_;
+    bool approximate_;
+
+  public:
+    Activation(Operation* p, ActivationType activation, bool approximate=false);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, Buffer* buf);
+
+    ActivationType getActivationType();
+    bool isApproximate();
+};
+
+// Gradient of Activation with respect to its parent, given the
+// gradient of the activation's result and the activation's input.
+class ActivationGradient : public Operation {
+    ActivationType activation_;
+    bool approximate_;
+
+  public:
+    ActivationGradient(Operation* grad, Operation* input, ActivationType activation, bool approximate);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    int batchAxis(int parent, int axis);
+
+    // NOTE: Higher order gradients aren't supported.
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, Buffer* b1, Buffer* b2);
+};
+
+enum class ReductionType { SUM, MEAN, MAX, MIN, ARGMAX };
+
+// Reduces the contiguous run of axes [first_axis, last_axis] of its parent,
+// e.g. a SUM over axes [1, 2] of a [2, 3, 4, 5] tensor yields 2x5 sums of
+// 12 elements each. ARGMAX yields the INT64 (flat) index over the reduced
+// axes of the first largest element. Whether the reduced axes are kept is
+// up to the shape of the buffer, which holds the same elements either way.
+//
+// Rows that are contiguous in memory (nothing after last_axis) are reduced
+// with simd::reduce(), while otherwise whole rows of the trailing axes are
+// accumulated into the output at once. Large reductions are split across
+// ThreadPool::shared(), across the output elements or (if there are too few
+// of those) into chunks of the reduced axes, whose partial results are
+// then combined pairwise. In deterministic mode (see config.h) long
+// reductions are always chunked the same way, whatever the thread count.
+//
+// 16 bit floats are widened a block at a time and reduced in FP32, the
+// results only being rounded to 16 bits as they're written.
+//
+// NOTE: ARGMAX is only split across output elements.
+class Reduction : public Operation {
+    ReductionType reduction_;
+    int first_axis_;
+    int last_axis_;
+
+    template <typename OpDType, class Combine>
+    void reduce(OpDType* out, OpDType* in, uint64_t outer, uint64_t extent, uint64_t inner,
+                Combine combine, bool from_zero);
+
+    template <typename OpDType>
+    void argmax(int64_t* out, OpDType* in, uint64_t outer, uint64_t extent, uint64_t inner);
+
+  public:
+    Reduction(Operation* p, ReductionType reduction, int first_axis, int last_axis);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, Buffer* buf);
+};
+
+// Gradient of a Reduction (other than ARGMAX) with respect to its parent,
+// given the gradient of the reduction's result. Its buffer is shaped like
+// the reduction's parent, which MAX and MIN also need as `input` to find
+// the elements the gradient flows to.
+class ReductionGradient : public Operation {
+    ReductionType reduction_;
+    int first_axis_;
+    int last_axis_;
+
+  public:
+    ReductionGradient(Operation* grad, Operation* input, ReductionType reduction, int first_axis, int last_axis);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    // NOTE: Higher order gradients aren't supported.
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, Buffer* b1, Buffer* b2);
+};
+
+// Softmax over the last axis, or log-softmax if `log` is true.
+//
+// Each row is read once to find its max and the sum of exp(x - max), with
+// the sum rescaled whenever a later block raises the max. exp() comes from
+// vector_math.h, and is only taken once per element: a softmax keeps the
+// exponentials in its result and then rescales them in place, while a
+// log-softmax has no need for them past the sum. Rows are split across
+// ThreadPool::shared() when there are enough elements.
+//
+// NOTE: Only floating point data types are supported.
+class Softmax : public Operation {
+    bool log_;
+
+  public:
+    Softmax(Operation* p, bool log=false);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, Buffer* buf);
+};
+
+// Gradient of Softmax with respect to its parent, given the gradient
+// of the softmax's result and that result itself.
+class SoftmaxGradient : public Operation {
+    bool log_;
+
+  public:
+    SoftmaxGradient(Operation* grad, Operation* output, bool log);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    int batchAxis(int parent, int axis);
+
+    // NOTE: Higher order gradients aren't supported.
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, Buffer* b1, Buffer* b2);
+};
+
+// Cross-entropy between `labels` and the softmax of `logits` over their
+// last axis, i.e. -sum(labels * log_softmax(logits)) for every row, without
+// the softmax ever being written out: the row's max, sum of exponentials
+// and the label-weighted sums are all gathered in a single pass.
+//
+// Labels are expected to be distributions over the last axis (e.g. one-hot),
+// which the gradient with respect to the logits, softmax(logits) - labels,
+// relies on.
+//
+// NOTE: Only floating point data types are supported.
+class SoftmaxCrossEntropy : public Operation {
+  public:
+    SoftmaxCrossEntropy(Operation* logits, Operation* labels);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, Buffer* b1, Buffer* b2);
+};
+
+enum class NormalizationType { LAYER, RMS, BATCH };
+
+// Normalizes its input and applies a per channel affine transform,
+// y == (x - mean) / sqrt(variance + epsilon) * scale + shift.
+//
+// The channels are the elements of `scale` (and of `shift`, `mean` and
+// `variance`), which run along the input's last axis, or are a single
+// one covering all of it (e.g. a Convolution2D's feature map).
+//
+// LAYER statistics are taken over every row of channels, and RMS takes the
+// mean as 0 (and has no shift). BATCH statistics are taken per channel over
+// all rows, or come from `mean` and `variance` (e.g. running averages from
+// training) for inference.
+//
+// Rows are read once for their statistics (sum and sum of squares about the
+// first element, see simd::moments()) and once more to write the result.
+//
+// NOTE: Only floating point data types are supported.
+class Normalization : public Operation {
+    NormalizationType normalization_;
+    double epsilon_;
+    bool has_shift_;
+    bool has_statistics_;
+
+  public:
+    // Extra parents: [shift], [mean, variance], each pair only if given.
+    Normalization(Operation* p, Operation* scale, Operation* shift, NormalizationType normalization,
+                  double epsilon);
+
+    // Inference mode batch normalization.
+    Normalization(Operation* p, Operation* scale, Operation* shift, Operation* mean, Operation* variance,
+                  double epsilon);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    int batchAxis(int parent, int axis);
+
+    // No gradients flow to given statistics.
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, std::vector<Buffer*>& inputs);
+
+    NormalizationType getNormalizationType();
+    double getEpsilon();
+    bool hasStatistics();
+
+    // nullptr if not given.
+    Operation* getShift();
+    Operation* getMean();
+    Operation* getVariance();
+};
+
+// Gradient of Normalization with respect to its input or, if `wrt_scale`
+// is true, its scale, given the gradient of the normalization's result.
+// Statistics are recomputed from the input rather than kept around.
+//
+// Parents: grad, input, scale, then the mean and variance if given.
+class NormalizationGradient : public Operation {
+    NormalizationType normalization_;
+    double epsilon_;
+    bool has_statistics_;
+    bool wrt_scale_;
+
+  public:
+    NormalizationGradient(Operation* grad, Normalization* normalization, bool wrt_scale);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    // NOTE: Higher order gradients aren't supported.
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, std::vector<Buffer*>& inputs);
+};
+
+// Scaled dot-product attention, softmax(q k^T * scale) v, over the last two
+// dimensions of q [..., queries, d], k [..., keys, d] and v [..., keys, dv].
+// The leading dimensions (e.g. batch and heads) are matched one to one.
+//
+// The scores are never written out: attention_query_block queries at a time
+// are scored against attention_key_block keys at a time, keeping each
+// query's running max and sum of exponentials (an online softmax) and
+// rescaling what has been accumulated into the result whenever the max
+// grows. Memory thus stays linear in the sequence length.
+//
+// With `causal`, query i only sees keys up to i + keys - queries, so the last
+// query sees every key (queries appended to a key cache line up with it),
+// and key blocks no query of a block sees are skipped.
+//
+// Over a KVCache, k and v are the cache's keys and values, of which only
+// the positions held are read, oldest to newest.
+//
+// Query blocks of every batch and head are split across ThreadPool::shared().
+//
+// NOTE: Only floating point data types are supported.
+class Attention : public Operation {
+    double scale_;
+    bool causal_;
+    KVCache* cache_;
+
+  public:
+    // Extra parents: v.
+    Attention(Operation* q, Operation* k, Operation* v, double scale, bool causal, KVCache* cache = nullptr);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    int batchAxis(int parent, int axis);
+
+    // NOTE: Attention over a cache has no gradients.
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, std::vector<Buffer*>& inputs);
+
+    double getScale();
+    bool isCausal();
+
+    // nullptr if not over a cache.
+    KVCache* getCache();
+};
+
+// Gradient of Attention with respect to its q (wrt == 0), k (1) or v (2),
+// given the gradient of the attention's result. Scores are recomputed block
+// by block, once for every query's softmax statistics and once more for the
+// gradient, so memory stays linear in the sequence length here too.
+//
+// Parents: grad, q, k, v, and the attention's result.
+class AttentionGradient : public Operation {
+    int wrt_;
+    double scale_;
+    bool causal_;
+
+  public:
+    AttentionGradient(Operation* grad, Attention* attention, int wrt);
 
     void setBuffer(Buffer* buf);
     Buffer* getBuffer();
 
-    void derive();
+    // NOTE: Higher order gradients aren't supported.
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, std::vector<Buffer*>& inputs);
+};
+
+enum class RecurrentType { LSTM, GRU };
+
+// A recurrent layer run over a whole sequence x [batch, time, input], giving
+// the hidden state of every step [batch, time, hidden], from zero states.
+//
+// Weights are [input, gates * hidden] and [hidden, gates * hidden], and the
+// bias [gates * hidden], with the gates side by side in the order:
+//   LSTM: input, forget, cell, output
+//   GRU:  reset, update, new
+// The GRU's bias is added to its input projection only, i.e. its new gate is
+// tanh(x W_n + b_n + r * (h W_hn)).
+//
+// The input projections of all steps (and the bias) are a single matrix
+// multiplication up front. Both weights are packed into panels of
+// recurrent_panel columns, which a step's product with the hidden state goes
+// through with its accumulators in registers. The gates' nonlinearities and
+// the state updates are then a single pass over each row of gates.
+//
+// The graph's own weights stay packed from run to run, and are only packed
+// again once their buffers' versions change (e.g. after an optimizer step).
+// Fed weights are packed on every run.
+//
+// NOTE: Only floating point data types are supported.
+class Recurrent : public Operation {
+    RecurrentType recurrent_;
+
+    // Packed input (0) and hidden (1) weights, along with the
+    // buffers and the versions of them they were packed from.
+    std::vector<char> packed_[2];
+    Buffer* packed_buffers_[2];
+    uint64_t packed_versions_[2];
+
+    // Contexts running the graph at once may pack at the same time.
+    std::mutex packing_;
+
+  public:
+    // Extra parents: bias.
+    Recurrent(Operation* x, Operation* input_weights, Operation* hidden_weights, Operation* bias,
+              RecurrentType recurrent);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, std::vector<Buffer*>& inputs);
+
+    // Input (weights == 0) or hidden (1) weights read from `buf` for a run,
+    // packed into panels. Weights other than the graph's own are packed
+    // into `scratch`.
+    template <typename T>
+    const T* packedWeights(int weights, Buffer* buf, int rows, int columns, std::vector<T>& scratch);
+
+    RecurrentType getRecurrentType();
+};
+
+// Gradients of Recurrent with respect to its x, input weights, hidden weights
+// and bias, given the gradient of its result, through backpropagation in time.
+// The sequence is run forwards again for the gates and states each step's
+// gradient needs, once for all four gradients: they're flattened and laid out
+// one after the other in that order, for Slices to pick them out.
+//
+// Parents: grad, x, input weights, hidden weights, bias.
+class RecurrentGradient : public Operation {
+    RecurrentType recurrent_;
+
+    // Layer whose packed weights the forward run goes through.
+    Recurrent* layer_;
+
+  public:
+    RecurrentGradient(Operation* grad, Recurrent* recurrent);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    // NOTE: Higher order gradients aren't supported.
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, std::vector<Buffer*>& inputs);
+};
+
+// Elements [offset, offset + n) of its parent, n being the elements of the
+// result, e.g. one of several results an operation computes at once.
+class Slice : public Operation {
+    uint64_t offset_;
+
+  public:
+    Slice(Operation* p, uint64_t offset);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    // NOTE: Higher order gradients aren't supported.
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+};
+
+// Gradient of Convolution2D with respect to its image,
+// given the gradient of the convolution's result and the kernel.
+class Convolution2DInputGradient : public Operation {
+    int strides_[2];
+    std::string padding_;
+
+  public:
+    Convolution2DInputGradient(Operation* grad, Operation* kernel, std::string padding, int (&strides)[2]);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    // NOTE: Higher order gradients aren't supported.
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, Buffer* b1, Buffer* b2);
+};
+
+// Gradient of Convolution2D with respect to its kernel,
+// given the gradient of the convolution's result and the image.
+class Convolution2DKernelGradient : public Operation {
+    int strides_[2];
+    std::string padding_;
+
+  public:
+    Convolution2DKernelGradient(Operation* grad, Operation* image, std::string padding, int (&strides)[2]);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    // NOTE: Higher order gradients aren't supported.
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, Buffer* b1, Buffer* b2);
+};
+
+enum class PoolingType { MAX, AVERAGE };
+
+// Max or average over a window sliding across the last two dimensions (the
+// image) - the leading ones (e.g. batch and channels) are kept as they are.
+// The window's positions and the result's shape follow Convolution2D's
+// padding and strides: with "same" padding and unit strides the window is
+// centered on every pixel (and the image keeps its size), otherwise it only
+// covers the image, moving by the strides. Averages only count the pixels
+// of the window inside the image.
+//
+// The window is taken one dimension at a time: along rows, then (after a
+// transpose) along columns. Sums are kept running as the window slides,
+// and maxima of windows longer than pooling_direct_window in a monotonic
+// deque, so the cost per pixel doesn't grow with the window. Images are
+// split across ThreadPool::shared() when there are enough pixels.
+class Pooling2D : public Operation {
+    PoolingType pooling_;
+    int window_[2];
+    int strides_[2];
+    std::string padding_;
+
+  public:
+    Pooling2D(Operation* p, PoolingType pooling, int (&window)[2], std::string padding, int (&strides)[2]);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, Buffer* buf);
+};
+
+// Gradient of Pooling2D with respect to its parent, given the gradient of the
+// pooling's result and, for MAX, the pooling's input (the gradient goes to
+// the first largest pixel of every window).
+//
+// NOTE: Windows are gone through one by one, at a cost per pixel of the window's size.
+class Pooling2DGradient : public Operation {
+    PoolingType pooling_;
+    int window_[2];
+    int strides_[2];
+    std::string padding_;
+
+  public:
+    Pooling2DGradient(Operation* grad, Operation* input, PoolingType pooling, int (&window)[2],
+                      std::string padding, int (&strides)[2]);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    // NOTE: Higher order gradients aren't supported.
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, Buffer* b1, Buffer* b2);
+};
+
+// Picks slices of a table along `axis` by an integer (INT32 or INT64) index
+// tensor, e.g. the rows of an embedding table for a batch of ids. The result's
+// shape is the table's with `axis` replaced by the indices' shape.
+//
+// Rows are copied whole, the ones a few indices ahead being prefetched since
+// lookups into a large table rarely hit the cache. Indices are split across
+// ThreadPool::shared() when there's enough to copy.
+//
+// The table's gradient is a GatherGradient. Along axis 0 of a parameter,
+// Gradients keeps it sparse (see Gradients).
+class Gather : public Operation {
+    int axis_;
+
+  public:
+    Gather(Operation* table, Operation* indices, int axis);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, Buffer* b1, Buffer* b2);
+
+    int getAxis();
+};
+
+// Gradient of Gather with respect to its table, given the gradient of the
+// gather's result: that gradient's slices added up at the slices of the
+// table they were gathered from, and zero everywhere else.
+//
+// Parents: grad, indices.
+class GatherGradient : public Operation {
+    int axis_;
+
+  public:
+    GatherGradient(Operation* grad, Operation* indices, int axis);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    // NOTE: Higher order gradients aren't supported.
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, Buffer* b1, Buffer* b2);
+
+    int getAxis();
+};
+
+// The target with the slices of `updates` added to it along `axis`, at the
+// positions given by an integer (INT32 or INT64) index tensor. Repeated
+// indices add up. `updates` is shaped like Gather's result would be.
+//
+// Slices of the target are split across ThreadPool::shared(), each task going
+// through all of the indices for the ones it holds, so no two threads ever
+// add to the same slice.
+//
+// Extra parents: updates.
+class ScatterAdd : public Operation {
+    int axis_;
+
+  public:
+    ScatterAdd(Operation* target, Operation* indices, Operation* updates, int axis);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, std::vector<Buffer*>& inputs);
+};
+
+// Dense [rows, columns] result of a SparseMatrix.
+//
+// Parents: the matrix's row indices, column indices and values.
+class SparseToDense : public Operation {
+    SparseMatrix* sparse_;
+
+  public:
+    SparseToDense(SparseMatrix* sparse);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    // NOTE: Sparse matrices hold inputs, so no gradients flow to them.
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, std::vector<Buffer*>& inputs);
+};
+
+// Product of a SparseMatrix S [rows, columns] and a dense operand D, going
+// through S's non-zero elements only. Depending on `sparse_first` and
+// `transposed`, one of:
+//   - S D,   with D [columns, n], or a vector [columns]
+//   - S^T D, with D [rows, n], or a vector [rows]
+//   - D S,   with D [..., m, rows]
+//   - D S^T, with D [..., m, columns]
+// The gradient of each is one of the others, so gradients flow to D
+// (though not to S, whose elements are inputs rather than weights).
+//
+// S D adds up the rows of D picked by every row of S (or, for a vector,
+// takes their dot products), D S and D S^T go through S once per row of D.
+// These are split across ThreadPool::shared() by rows of the result. S^T D
+// adds every row of D to several rows of the result, so it's split by
+// columns of the result instead.
+//
+// Parents: D, then S's row indices, column indices and values.
+class SparseMatrixMultiplication : public Operation {
+    SparseMatrix* sparse_;
+    bool sparse_first_;
+    bool transposed_;
+
+  public:
+    SparseMatrixMultiplication(SparseMatrix* sparse, Operation* dense, bool sparse_first, bool transposed);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, std::vector<Buffer*>& inputs);
+};
+
+// Real valued data quantized to INT8 or UINT8 (the result's data type):
+//   q = clamp(round(x / scales[c]) + zero_points[c])
+// with the rounding to nearest even, and c as in Quantization.
+//
+// NOTE: Quantized graphs are meant for inference, so no gradients flow
+//       through this or any of the quantized operations below.
+class Quantize : public Operation {
+    Quantization quantization_;
+
+  public:
+    Quantize(Operation* p1, Quantization quantization);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, Buffer* buf);
+};
+
+// FLOAT32 values of quantized data, as given by its parent's quantization.
+class Dequantize : public Operation {
+    Quantization quantization_;
+
+  public:
+    Dequantize(Operation* p1);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename QDType>
+    void compute(Buffer* out, Buffer* buf);
+};
+
+// Matrix multiplication of quantized data: parent1 [..., rows, inner]
+// (INT8 or UINT8, one scale and zero point) by parent2 [inner, columns]
+// (symmetric INT8 weights, i.e. zero points of 0, with a single scale or
+// one per column).
+//
+// Products are summed up in INT32 and only turned into the result in the
+// epilogue: real values for a FLOAT32 result, requantized to the given
+// quantization for an INT8 or UINT8 one. Weights are laid out column by
+// column, so every element of the result is a dot product of contiguous
+// 8 bit data (vpdpbusd with AVX-VNNI, pmaddwd-style otherwise).
+//
+// The weights must be a Constant (e.g. from quantizeWeights()), and are laid
+// out (and their columns summed) once on construction: later changes to
+// them aren't picked up.
+//
+// Rows are split across ThreadPool::shared() when there's enough work.
+class QuantizedMatrixMultiplication : public Operation {
+    Quantization input_quantization_;
+    Quantization weight_quantization_;
+    Quantization quantization_;
+
+    // The weights column by column [columns, inner], and their sums.
+    std::vector<int8_t> weights_;
+    std::vector<int32_t> weight_sums_;
+
+  public:
+    // `quantization` is the result's, ignored if it is FLOAT32.
+    QuantizedMatrixMultiplication(Operation* p1, Operation* p2, Quantization quantization);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename QDType>
+    void compute(Buffer* out, Buffer* b1, Buffer* b2);
+};
+
+// Convolution2D of quantized images (INT8 or UINT8, one scale and zero
+// point) with a symmetric INT8 kernel, with the same padding and strides
+// rules. Padding stands for real zeros, i.e. the images' zero point.
+//
+// As with QuantizedMatrixMultiplication, every output pixel is a dot product
+// of 8 bit data summed up in INT32: the image patches under the kernel are
+// gathered one output row at a time. The result is FLOAT32, or requantized.
+//
+// As with the weights above, the kernel must be a Constant, and is prepared
+// once on construction.
+class QuantizedConvolution2D : public Operation {
+    int strides_[2];
+    std::string padding_;
+
+    Quantization input_quantization_;
+    Quantization kernel_quantization_;
+    Quantization quantization_;
+
+    // The kernel reversed, as convolving flips it, and its sum.
+    std::vector<int8_t> kernel_;
+    std::vector<int32_t> kernel_sum_;
+
+  public:
+    QuantizedConvolution2D(Operation* p1, Operation* p2, std::string padding, int (&strides)[2],
+                           Quantization quantization);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename QDType>
+    void compute(Buffer* out, Buffer* b1, Buffer* b2);
+};
+
+enum class ComparisonType { EQUAL, NOT_EQUAL, LESS, LESS_EQUAL, GREATER, GREATER_EQUAL };
+
+// Element-wise comparison of its parents into a BOOL mask, broadcasting like
+// Addition (a single element, or a row repeated across the other side).
+//
+// A word's worth of comparisons is made into bytes and then folded into bits
+// (see bits.h), so the comparisons themselves are vectorized. Large masks
+// are split across ThreadPool::shared(), on word boundaries.
+//
+// NOTE: Masks have no gradient, and neither do the operations below
+//       working on them (other than Select's values).
+class Comparison : public Operation {
+    ComparisonType comparison_;
+
+    template <typename OpDType, class Compare>
+    void compare(Buffer* out, Buffer* b1, Buffer* b2, Compare compare);
+
+  public:
+    Comparison(Operation* p1, Operation* p2, ComparisonType comparison);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, Buffer* b1, Buffer* b2);
+};
+
+enum class LogicalType { AND, OR, XOR, NOT };
+
+// Element-wise logic over BOOL masks, a whole word at a time. NOT only has
+// parent1, and the others broadcast like Comparison.
+class Logical : public Operation {
+    LogicalType logical_;
+
+  public:
+    Logical(Operation* p1, Operation* p2, LogicalType logical);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    void compute(Buffer* out, Buffer* b1, Buffer* b2);
+};
+
+// Element-wise choice between two values by a BOOL mask (parent1): parent2's
+// element where the mask is set, and the extra parent's otherwise. Either
+// value may be a single element (e.g. the -inf filling masked out attention
+// scores), and the mask may be repeated across the leading dimensions of
+// the result (e.g. one [queries, keys] mask for every head).
+//
+// The gradient goes to the value that was picked for each element.
+class Select : public Operation {
+  public:
+    Select(Operation* condition, Operation* p1, Operation* p2);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    template <typename OpDType>
+    void compute(Buffer* out, std::vector<Buffer*>& inputs);
+};
+
+enum class MaskReductionType { COUNT, ANY, ALL };
+
+// Reduces the axes [first_axis, last_axis] of a BOOL mask like Reduction:
+// the INT64 number of set elements (COUNT), or whether any or all of them
+// are set (a BOOL result). Contiguous runs of bits are counted a word at a
+// time with popcount.
+class MaskReduction : public Operation {
+    MaskReductionType reduction_;
+    int first_axis_;
+    int last_axis_;
+
+  public:
+    MaskReduction(Operation* p1, MaskReductionType reduction, int first_axis, int last_axis);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    int batchAxis(int parent, int axis);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+
+    void compute(Buffer* out, Buffer* buf);
+};
+
+class Constant : public Operation {
+  public:
+    Constant(Buffer* buf);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
+
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
+};
+
+// Graph input whose data is supplied between calls to operate().
+//
+// Unlike a Constant, a Placeholder's buffer can be refilled or rebound
+// to another buffer without rebuilding the graph, so the same graph
+// (and every buffer already allocated under it) can be re-executed
+// on new data.
+class Placeholder : public Operation {
+  public:
+    Placeholder(Buffer* buf);
+
+    void setBuffer(Buffer* buf);
+    Buffer* getBuffer();
+
+    // Rebinds the placeholder to a different buffer.
+    // The new buffer must match the old one in shape and data type.
+    void bind(Buffer* buf);
+
+    std::vector<Operation*> derive(Operation* grad, Allocator* a);
 
-    Buffer* operate();
+    void evaluate(Buffer* out, std::vector<Buffer*>& inputs);
 };
 
 } // namespace deeplib
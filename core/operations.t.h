@@ -1,77 +1,269 @@
 #include <cmath>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <type_traits>
+#include <functional>
+#include "core/simd.h"
+#include "core/convert.h"
+#include "core/vector_math.h"
+#include "core/config.h"
+#include "core/thread_pool.h"
+#include "core/kv_cache.h"
+#include "core/sparse.h"
 
 namespace deeplib {
 
 // NOTE: Only broadcasting with constants is supported right now.
 // NOTE: How long will STL math functions be used?
 
+// Elements an operation writes before applying its epilogue to them.
+const uint64_t epilogue_block = 1 << 11;
+
+template <typename F>
+void Operation::forEachBlock(Buffer* out, uint64_t n, F f) {
+    if (!has_epilogue_) {
+        f(0, n);
+        return;
+    }
+
+    for (uint64_t begin = 0; begin < n; begin += epilogue_block) {
+        uint64_t end = std::min(n, begin + epilogue_block);
+
+        f(begin, end);
+        applyEpilogue(out, begin, end);
+    }
+}
+
+// 16 bit floats an element-wise operation works on at a time, widened into
+// FP32 blocks on the stack.
+const uint64_t elementwise_half_block = 256;
+
+// Widens elements [begin, begin + count) of a 16 bit operand of n elements
+// into `block`, a single element standing for every one of them and a
+// shorter operand being a row repeated across the longer one.
+template <typename T>
+void widenOperand(float* block, const T* src, uint64_t n, uint64_t begin, uint64_t count) {
+    if (n == 1)
+        std::fill(block, block + count, static_cast<float>(src[0]));
+    else if (begin + count <= n)
+        widen(block, src + begin, count);
+    else {
+        for (uint64_t k = 0; k < count; k++)
+            block[k] = src[(begin + k) % n];
+    }
+}
+
+template <typename T, typename F>
+void Operation::halfElementWise(Buffer* out, Buffer* b1, Buffer* b2, F f) {
+    const T* x = b1->getBufferDataAsTemplate<T>();
+    const T* y = b2->getBufferDataAsTemplate<T>();
+    T* o = out->getBufferDataAsTemplate<T>();
+
+    forEachBlock(out, out->getElements(), [&](uint64_t begin, uint64_t end) {
+        float a[elementwise_half_block], b[elementwise_half_block];
+
+        for (uint64_t i = begin; i < end; i += elementwise_half_block) {
+            uint64_t count = std::min(elementwise_half_block, end - i);
+
+            widenOperand(a, x, b1->getElements(), i, count);
+            widenOperand(b, y, b2->getElements(), i, count);
+
+            for (uint64_t k = 0; k < count; k++)
+                a[k] = f(a[k], b[k]);
+
+            narrow(o + i, a, count);
+        }
+    });
+}
+
+template <typename T, typename F>
+void Operation::halfElementWise(Buffer* out, Buffer* buf, F f) {
+    const T* x = buf->getBufferDataAsTemplate<T>();
+    T* o = out->getBufferDataAsTemplate<T>();
+
+    forEachBlock(out, out->getElements(), [&](uint64_t begin, uint64_t end) {
+        float block[elementwise_half_block];
+
+        for (uint64_t i = begin; i < end; i += elementwise_half_block) {
+            uint64_t count = std::min(elementwise_half_block, end - i);
+
+            widen(block, x + i, count);
+            f(block, count);
+            narrow(o + i, block, count);
+        }
+    });
+}
+
+// Splits `items` into one contiguous range per task, running
+// them all on the calling thread if `parallel` is false.
+template <typename F>
+void forEachRange(uint64_t items, bool parallel, F f) {
+    ThreadPool& pool = ThreadPool::shared();
+
+    uint64_t tasks = parallel ? std::min<uint64_t>(items, pool.getThreads() * 4) : 1;
+    if (tasks <= 1) {
+        f(0, items);
+        return;
+    }
+
+    pool.run(tasks, [&](int t) {
+        f(items * t / tasks, items * (t + 1) / tasks);
+    });
+}
+
 template <typename OpDType>
-void Addition::compute(Buffer* b1, Buffer* b2) {
-    if (b1->getElements() == 1) {
-        for (uint64_t i = 0; i < b2->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, b1->getIndex<OpDType>(0) + b2->getIndex<OpDType>(i));
+void Addition::compute(Buffer* out, Buffer* b1, Buffer* b2) {
+    if constexpr (is_half_v<OpDType>)
+        halfElementWise<OpDType>(out, b1, b2, [](float x, float y) { return x + y; });
+    else if (b1->getElements() == 1) {
+        forEachBlock(out, b2->getElements(), [&](uint64_t begin, uint64_t end) {
+            for (uint64_t i = begin; i < end; i++)
+                out->setIndex<OpDType>(i, b1->getIndex<OpDType>(0) + b2->getIndex<OpDType>(i));
+        });
     }
     else if (b2->getElements() == 1) {
-        for (uint64_t i = 0; i < b1->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, b1->getIndex<OpDType>(i) + b2->getIndex<OpDType>(0));
+        forEachBlock(out, b1->getElements(), [&](uint64_t begin, uint64_t end) {
+            for (uint64_t i = begin; i < end; i++)
+                out->setIndex<OpDType>(i, b1->getIndex<OpDType>(i) + b2->getIndex<OpDType>(0));
+        });
+    }
+    else if (b1->getElements() != b2->getElements()) {
+        // The smaller side is a row repeated across the larger one.
+        Buffer* rows = (b1->getElements() > b2->getElements()) ? b1 : b2;
+        Buffer* row = (rows == b1) ? b2 : b1;
+        uint64_t n = row->getElements();
+
+        forEachBlock(out, rows->getElements(), [&](uint64_t begin, uint64_t end) {
+            for (uint64_t i = begin; i < end; i++)
+                out->setIndex<OpDType>(i, rows->getIndex<OpDType>(i) + row->getIndex<OpDType>(i % n));
+        });
     }
     else {
-        for (uint64_t i = 0; i < b1->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, b1->getIndex<OpDType>(i) + b2->getIndex<OpDType>(i));
+        forEachBlock(out, b1->getElements(), [&](uint64_t begin, uint64_t end) {
+            for (uint64_t i = begin; i < end; i++)
+                out->setIndex<OpDType>(i, b1->getIndex<OpDType>(i) + b2->getIndex<OpDType>(i));
+        });
     }
 }
 
 template <typename OpDType>
-void Subtraction::compute(Buffer* b1, Buffer* b2) {
-    if (b1->getElements() == 1) {
-        for (uint64_t i = 0; i < b2->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, b1->getIndex<OpDType>(0) - b2->getIndex<OpDType>(i));
+void Subtraction::compute(Buffer* out, Buffer* b1, Buffer* b2) {
+    if constexpr (is_half_v<OpDType>)
+        halfElementWise<OpDType>(out, b1, b2, [](float x, float y) { return x - y; });
+    else if (b1->getElements() == 1) {
+        forEachBlock(out, b2->getElements(), [&](uint64_t begin, uint64_t end) {
+            for (uint64_t i = begin; i < end; i++)
+                out->setIndex<OpDType>(i, b1->getIndex<OpDType>(0) - b2->getIndex<OpDType>(i));
+        });
     }
     else if (b2->getElements() == 1) {
-        for (uint64_t i = 0; i < b1->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, b1->getIndex<OpDType>(i) - b2->getIndex<OpDType>(0));
+        forEachBlock(out, b1->getElements(), [&](uint64_t begin, uint64_t end) {
+            for (uint64_t i = begin; i < end; i++)
+                out->setIndex<OpDType>(i, b1->getIndex<OpDType>(i) - b2->getIndex<OpDType>(0));
+        });
     }
     else {
-        for (uint64_t i = 0; i < b1->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, b1->getIndex<OpDType>(i) - b2->getIndex<OpDType>(i));
+        forEachBlock(out, b1->getElements(), [&](uint64_t begin, uint64_t end) {
+            for (uint64_t i = begin; i < end; i++)
+                out->setIndex<OpDType>(i, b1->getIndex<OpDType>(i) - b2->getIndex<OpDType>(i));
+        });
     }
 }
 
 template <typename OpDType>
-void Multiplication::compute(Buffer* b1, Buffer* b2) {
-    if (b1->getElements() == 1) {
-        for (uint64_t i = 0; i < b2->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, b1->getIndex<OpDType>(0) * b2->getIndex<OpDType>(i));
+void Multiplication::compute(Buffer* out, Buffer* b1, Buffer* b2) {
+    if constexpr (is_half_v<OpDType>)
+        halfElementWise<OpDType>(out, b1, b2, [](float x, float y) { return x * y; });
+    else if (b1->getElements() == 1) {
+        forEachBlock(out, b2->getElements(), [&](uint64_t begin, uint64_t end) {
+            for (uint64_t i = begin; i < end; i++)
+                out->setIndex<OpDType>(i, b1->getIndex<OpDType>(0) * b2->getIndex<OpDType>(i));
+        });
     }
     else if (b2->getElements() == 1) {
-        for (uint64_t i = 0; i < b1->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, b1->getIndex<OpDType>(i) * b2->getIndex<OpDType>(0));
+        forEachBlock(out, b1->getElements(), [&](uint64_t begin, uint64_t end) {
+            for (uint64_t i = begin; i < end; i++)
+                out->setIndex<OpDType>(i, b1->getIndex<OpDType>(i) * b2->getIndex<OpDType>(0));
+        });
     }
     else {
-        for (uint64_t i = 0; i < b1->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, b1->getIndex<OpDType>(i) * b2->getIndex<OpDType>(i));
+        forEachBlock(out, b1->getElements(), [&](uint64_t begin, uint64_t end) {
+            for (uint64_t i = begin; i < end; i++)
+                out->setIndex<OpDType>(i, b1->getIndex<OpDType>(i) * b2->getIndex<OpDType>(i));
+        });
     }
 }
 
 template <typename OpDType>
-void Division::compute(Buffer* b1, Buffer* b2) {
-    if (b1->getElements() == 1) {
-        for (uint64_t i = 0; i < b2->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, static_cast<OpDType>(b1->getIndex<OpDType>(0) / b2->getIndex<OpDType>(i)));
+void Division::compute(Buffer* out, Buffer* b1, Buffer* b2) {
+    if constexpr (is_half_v<OpDType>)
+        halfElementWise<OpDType>(out, b1, b2, [](float x, float y) { return x / y; });
+    else if (b1->getElements() == 1) {
+        forEachBlock(out, b2->getElements(), [&](uint64_t begin, uint64_t end) {
+            for (uint64_t i = begin; i < end; i++)
+                out->setIndex<OpDType>(i, static_cast<OpDType>(b1->getIndex<OpDType>(0) / b2->getIndex<OpDType>(i)));
+        });
     }
     else if (b2->getElements() == 1) {
-        for (uint64_t i = 0; i < b1->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, static_cast<OpDType>(b1->getIndex<OpDType>(i) / b2->getIndex<OpDType>(0)));
+        forEachBlock(out, b1->getElements(), [&](uint64_t begin, uint64_t end) {
+            for (uint64_t i = begin; i < end; i++)
+                out->setIndex<OpDType>(i, static_cast<OpDType>(b1->getIndex<OpDType>(i) / b2->getIndex<OpDType>(0)));
+        });
     }
     else {
-        for (uint64_t i = 0; i < b1->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, static_cast<OpDType>(b1->getIndex<OpDType>(i) / b2->getIndex<OpDType>(i)));
+        forEachBlock(out, b1->getElements(), [&](uint64_t begin, uint64_t end) {
+            for (uint64_t i = begin; i < end; i++)
+                out->setIndex<OpDType>(i, static_cast<OpDType>(b1->getIndex<OpDType>(i) / b2->getIndex<OpDType>(i)));
+        });
+    }
+}
+
+// Rows of A, and columns of B, the 16 bit matrix multiplication works on at a time.
+const int matmul_half_rows = 4;
+const int matmul_half_block = 256;
+
+// c = a b for FLOAT16 or BFLOAT16 matrices a [rows, inner] and b [inner, columns].
+//
+// Blocks of c's rows are accumulated in FP32 on the stack, adding up
+// a[r, v] * b[v, block] for every v. Each row of b is widened once for
+// matmul_half_rows rows of a, and c is only rounded to 16 bits at the end.
+template <typename T>
+void halfMatmul(T* c, const T* a, const T* b, int rows, int inner, int columns) {
+    const int row_count = matmul_half_rows;
+
+    float acc[row_count][matmul_half_block];
+    float b_row[matmul_half_block];
+
+    for (int r0 = 0; r0 < rows; r0 += row_count) {
+        int block_rows = std::min(row_count, rows - r0);
+
+        for (int c0 = 0; c0 < columns; c0 += matmul_half_block) {
+            int count = std::min(matmul_half_block, columns - c0);
+
+            for (int r = 0; r < block_rows; r++)
+                std::fill(acc[r], acc[r] + count, 0.0f);
+
+            for (int v = 0; v < inner; v++) {
+                widen(b_row, b + static_cast<uint64_t>(v) * columns + c0, count);
+
+                for (int r = 0; r < block_rows; r++) {
+                    float scale = a[static_cast<uint64_t>(r0 + r) * inner + v];
+                    for (int k = 0; k < count; k++)
+                        acc[r][k] += scale * b_row[k];
+                }
+            }
+
+            for (int r = 0; r < block_rows; r++)
+                narrow(c + static_cast<uint64_t>(r0 + r) * columns + c0, acc[r], count);
+        }
     }
 }
 
 // Naive matrix multiplication algorithm.
 template <typename OpDType>
-void MatrixMultiplication::compute(Buffer* b1, Buffer* b2) {
+void MatrixMultiplication::compute(Buffer* out, Buffer* b1, Buffer* b2) {
     std::vector<int>& shape1 = b1->getShape();
     std::vector<int>& shape2 = b2->getShape();
 
@@ -83,13 +275,16 @@ void MatrixMultiplication::compute(Buffer* b1, Buffer* b2) {
     for (int i = 0; i < shape1.size()-2; i++)
         matrix_count *= shape1[i];
 
+    // A rank 2 right hand side (e.g. weights) is shared by every matrix of b1.
+    bool shared_rhs = (shape2.size() == 2);
+
     for (int i = 0; i < matrix_count; i++) {
         int start_indices[3] = { matrix_sizes[0]*i,
-                                 matrix_sizes[1]*i,
+                                 shared_rhs ? 0 : matrix_sizes[1]*i,
                                  matrix_sizes[2]*i };
 
         int in_cols1 = shape1[shape1.size()-1];
-        int in_cols2 = shape2[shape2.size()-2];
+        int in_cols2 = shape2[shape2.size()-1];
 
         // Output rows and columns.
         int out_rows = shape1[shape1.size()-2];
@@ -97,17 +292,29 @@ void MatrixMultiplication::compute(Buffer* b1, Buffer* b2) {
 
         int vec_length = shape1[shape1.size()-1];
 
-        for (int r = 0; r < out_rows; r++) {
-            for (int c = 0; c < out_cols; c++) {
-                OpDType vecdot = 0;
-                for (int v = 0; v < vec_length; v++) {
-                    OpDType v1, v2;
-                    v1 = b1->getIndex<OpDType>(start_indices[0]+r*in_cols1+v);
-                    v2 = b2->getIndex<OpDType>(start_indices[1]+v*in_cols2+c);
-                    vecdot += v1 * v2;
+        if constexpr (is_half_v<OpDType>) {
+            halfMatmul<OpDType>(out->getBufferDataAsTemplate<OpDType>() + start_indices[2],
+                                b1->getBufferDataAsTemplate<OpDType>() + start_indices[0],
+                                b2->getBufferDataAsTemplate<OpDType>() + start_indices[1],
+                                out_rows, vec_length, out_cols);
+
+            applyEpilogue(out, start_indices[2], start_indices[2]+matrix_sizes[2]);
+        }
+        else {
+            for (int r = 0; r < out_rows; r++) {
+                for (int c = 0; c < out_cols; c++) {
+                    OpDType vecdot = 0;
+                    for (int v = 0; v < vec_length; v++) {
+                        OpDType v1, v2;
+                        v1 = b1->getIndex<OpDType>(start_indices[0]+r*in_cols1+v);
+                        v2 = b2->getIndex<OpDType>(start_indices[1]+v*in_cols2+c);
+                        vecdot += v1 * v2;
+                    }
+
+                    out->setIndex<OpDType>(start_indices[2]+r*out_cols+c, vecdot);
                 }
 
-                this->buffer_->setIndex<OpDType>(start_indices[2]+r*out_cols+c, vecdot);
+                applyEpilogue(out, start_indices[2]+r*out_cols, start_indices[2]+(r+1)*out_cols);
             }
         }
     }
@@ -115,20 +322,21 @@ void MatrixMultiplication::compute(Buffer* b1, Buffer* b2) {
 
 // NOTE: kernel shape (i.e. b2->getShape()) will always be ND for ConvolutionND
 template <typename OpDType>
-void Convolution2D::compute(Buffer* b1, Buffer* b2) {
+void Convolution2D::compute(Buffer* out, Buffer* b1, Buffer* b2) {
     std::vector<int>& b1_shape = b1->getShape();
     std::vector<int> image_shape;
     for (int s = b1_shape.size()-2; s < b1_shape.size(); s++)
         image_shape.push_back(b1_shape[s]);
 
     std::vector<int>& kernel_shape = b2->getShape();
-    std::vector<int>& output_shape = this->buffer_->getShape();
+    std::vector<int>& output_shape = out->getShape();
 
     int (&strides)[2] = this->strides_;
 
+    // NOTE: strides override padding, as in conv2dShape()
     bool padded;
     int padding_offset_y[2], padding_offset_x[2];
-    if (!this->padding_.compare("same")) {
+    if (!this->padding_.compare("same") && strides[0] == 1 && strides[1] == 1) {
         padded = true;
 
         padding_offset_y[0] = std::ceil(static_cast<float>(kernel_shape[0] - 1) / 2);
@@ -147,18 +355,18 @@ void Convolution2D::compute(Buffer* b1, Buffer* b2) {
         padding_offset_x[1] = 0;
     }
 
+    // The kernel is shared by every image in b1's leading (batch) dimensions.
     int matrix_count = 1;
-    int matrix_sizes[3] = { b1_shape[b1_shape.size()-2]*b1_shape[b1_shape.size()-1],
-                            kernel_shape[b1_shape.size()-2]*kernel_shape[kernel_shape.size()-1],
-                            b1_shape[b1_shape.size()-2]*kernel_shape[kernel_shape.size()-1] };
+    int matrix_sizes[2] = { b1_shape[b1_shape.size()-2]*b1_shape[b1_shape.size()-1],
+                            output_shape[output_shape.size()-2]*output_shape[output_shape.size()-1] };
 
     for (int i = 0; i < b1_shape.size()-2; i++)
         matrix_count *= b1_shape[i];
 
     for (int i = 0; i < matrix_count; i++) {
         int start_indices[3] = { matrix_sizes[0]*i,
-                                 matrix_sizes[1]*i,
-                                 matrix_sizes[2]*i };
+                                 0,
+                                 matrix_sizes[1]*i };
 
         // oy and ox refer to the position of the top left corner of the kernel as it slides across the image.
         for (int oy = 0-padding_offset_y[0]; oy < image_shape[0]-kernel_shape[0]+1+padding_offset_y[1]; oy+=strides[0]) {
@@ -199,108 +407,2946 @@ void Convolution2D::compute(Buffer* b1, Buffer* b2) {
                     out_x = std::floor(ox / strides[1]);
                 }
 
-                this->buffer_->setIndex<OpDType>(start_indices[2]+out_y*output_shape[1]+out_x, local_sum);
+                out->setIndex<OpDType>(start_indices[2]+out_y*output_shape.back()+out_x, local_sum);
             }
         }
+
+        applyEpilogue(out, start_indices[2], start_indices[2]+matrix_sizes[1]);
     }
 }
 
+// Largest integer exponent (in magnitude) floating point data is raised to
+// by repeated multiplication, past which the error would pass libm's.
+const int64_t power_max_multiplications = 4;
+
 template <typename OpDType>
-void Power::compute(Buffer* b1, Buffer* b2) {
-    if (b1->getElements() == 1) {
-        for (uint64_t i = 0; i < b2->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, std::pow(b1->getIndex<OpDType>(0), b2->getIndex<OpDType>(i)));
-    }
-    else if (b2->getElements() == 1) {
-        for (uint64_t i = 0; i < b1->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, std::pow(b1->getIndex<OpDType>(i), b2->getIndex<OpDType>(0)));
+void Power::compute(Buffer* out, Buffer* b1, Buffer* b2) {
+    if constexpr (is_half_v<OpDType>) {
+        halfElementWise<OpDType>(out, b1, b2, [](float x, float y) { return std::pow(x, y); });
     }
     else {
-        for (uint64_t i = 0; i < b1->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, std::pow(b1->getIndex<OpDType>(i), b2->getIndex<OpDType>(i)));
+        if (!isVectorMath()) {
+            if (b1->getElements() == 1) {
+                for (uint64_t i = 0; i < b2->getElements(); i++)
+                    out->setIndex<OpDType>(i, std::pow(b1->getIndex<OpDType>(0), b2->getIndex<OpDType>(i)));
+            }
+            else if (b2->getElements() == 1) {
+                for (uint64_t i = 0; i < b1->getElements(); i++)
+                    out->setIndex<OpDType>(i, std::pow(b1->getIndex<OpDType>(i), b2->getIndex<OpDType>(0)));
+            }
+            else {
+                for (uint64_t i = 0; i < b1->getElements(); i++)
+                    out->setIndex<OpDType>(i, std::pow(b1->getIndex<OpDType>(i), b2->getIndex<OpDType>(i)));
+            }
+
+            return;
+        }
+
+        OpDType* o = out->getBufferDataAsTemplate<OpDType>();
+        OpDType* x = b1->getBufferDataAsTemplate<OpDType>();
+        OpDType* y = b2->getBufferDataAsTemplate<OpDType>();
+        uint64_t n = out->getElements();
+
+        // A single exponent gets the cheapest exact enough way there is.
+        if (b2->getElements() == 1 && b1->getElements() == n) {
+            double exponent = static_cast<double>(y[0]);
+            bool integer = exponent == std::floor(exponent);
+
+            if constexpr (std::is_floating_point<OpDType>::value) {
+                if (integer && std::fabs(exponent) <= power_max_multiplications) {
+                    vmath::powi<OpDType>(o, x, n, static_cast<int64_t>(exponent));
+                    return;
+                }
+
+                if (exponent == 0.5) {
+                    vmath::sqrt<OpDType>(o, x, n);
+                    return;
+                }
+
+                if (exponent == -0.5) {
+                    vmath::sqrt<OpDType>(o, x, n);
+                    for (uint64_t i = 0; i < n; i++)
+                        o[i] = 1 / o[i];
+
+                    return;
+                }
+            }
+            else if (exponent >= 0) {
+                vmath::powi<OpDType>(o, x, n, static_cast<int64_t>(exponent));
+                return;
+            }
+        }
+
+        vmath::pow<OpDType>(o, x, b1->getElements(), y, b2->getElements(), n);
     }
 }
 
 template <typename OpDType>
-void SquareRoot::compute(Buffer* buf) {
-    switch (buf->getDataType()) {
-      case DataType::FLOAT32:
-        for (uint64_t i = 0; i < buf->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, (std::sqrt(buf->getIndex<float>(i))));
-        return;
+void SquareRoot::compute(Buffer* out, Buffer* buf) {
+    if constexpr (is_half_v<OpDType>) {
+        halfElementWise<OpDType>(out, buf, [](float* block, uint64_t n) { vmath::sqrt<float>(block, block, n); });
+    }
+    else {
+        switch (buf->getDataType()) {
+          case DataType::FLOAT32:
+            if constexpr (std::is_same<OpDType, float>::value) {
+                vmath::sqrt<float>(out->getBufferDataAsTemplate<float>(), buf->getBufferDataAsTemplate<float>(),
+                                   buf->getElements());
+                return;
+            }
 
-      case DataType::FLOAT64:
-        for (uint64_t i = 0; i < buf->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, (std::sqrt(buf->getIndex<double>(i))));
-        return;
+            for (uint64_t i = 0; i < buf->getElements(); i++)
+                out->setIndex<OpDType>(i, (std::sqrt(buf->getIndex<float>(i))));
+            return;
 
-      default:
-        std::cout << "ERROR: Data type must be floating point in sqrt!" << std::endl;
-        assert(false);
+          case DataType::FLOAT64:
+            if constexpr (std::is_same<OpDType, double>::value) {
+                vmath::sqrt<double>(out->getBufferDataAsTemplate<double>(), buf->getBufferDataAsTemplate<double>(),
+                                    buf->getElements());
+                return;
+            }
+
+            for (uint64_t i = 0; i < buf->getElements(); i++)
+                out->setIndex<OpDType>(i, (std::sqrt(buf->getIndex<double>(i))));
+            return;
+
+          default:
+            std::cout << "ERROR: Data type must be floating point in sqrt!" << std::endl;
+            assert(false);
+        }
     }
 }
 
 template <typename OpDType>
-void Exponential::compute(Buffer* buf) {
-    for (uint64_t i = 0; i < buf->getElements(); i++)
-        this->buffer_->setIndex<OpDType>(i, static_cast<OpDType>(std::exp(buf->getIndex<OpDType>(i))));
+void Exponential::compute(Buffer* out, Buffer* buf) {
+    if constexpr (is_half_v<OpDType>) {
+        halfElementWise<OpDType>(out, buf, [&](float* block, uint64_t n) {
+            if (isVectorMath())
+                vmath::exp<float>(block, block, n);
+            else {
+                for (uint64_t i = 0; i < n; i++)
+                    block[i] = std::exp(block[i]);
+            }
+        });
+    }
+    else {
+        if (isVectorMath()) {
+            vmath::exp<OpDType>(out->getBufferDataAsTemplate<OpDType>(), buf->getBufferDataAsTemplate<OpDType>(),
+                                buf->getElements());
+            return;
+        }
+
+        for (uint64_t i = 0; i < buf->getElements(); i++)
+            out->setIndex<OpDType>(i, static_cast<OpDType>(std::exp(buf->getIndex<OpDType>(i))));
+    }
 }
 
-// NOTE: OpDType refers to this->buffer_->dtype.
+// NOTE: OpDType refers to out->dtype.
 //       Another switch statement is done in
+// Elements below which a cast isn't worth splitting across threads.
+const uint64_t cast_parallel_threshold = 1 << 16;
+
+// Converts buf's data (of C++ type From) into out's (To, where bool stands for
+// BOOL data). Work is split on whole words of bits, so threads never share
+// one of a BOOL result.
+template <typename To, typename From>
+void castFrom(Buffer* out, Buffer* buf, bool saturate) {
+    const From* src = buf->getBufferDataAsTemplate<From>();
+    uint64_t n = buf->getElements();
+
+    forEachRange(bits::words(n), n >= cast_parallel_threshold, [&](uint64_t first, uint64_t last) {
+        uint64_t begin = first * 64, end = std::min(n, last * 64);
+
+        if constexpr (std::is_same<To, bool>::value) {
+            bits::pack(out->getBufferDataAsTemplate<uint64_t>(), begin, end, [&](uint64_t i) {
+                return static_cast<compute_t<From>>(src[i]) != 0;
+            });
+        }
+        else
+            convert::array(out->getBufferDataAsTemplate<To>() + begin, src + begin, end - begin, saturate);
+    });
+}
+
+// Same as above, from BOOL data.
+template <typename To>
+void castFromBits(Buffer* out, Buffer* buf) {
+    const uint64_t* data = buf->getBufferDataAsTemplate<uint64_t>();
+    uint64_t n = buf->getElements();
+
+    if constexpr (std::is_same<To, bool>::value) {
+        std::copy(data, data + bits::words(n), out->getBufferDataAsTemplate<uint64_t>());
+        return;
+    }
+    else {
+        To* dst = out->getBufferDataAsTemplate<To>();
+
+        forEachRange(bits::words(n), n >= cast_parallel_threshold, [&](uint64_t first, uint64_t last) {
+            uint64_t begin = first * 64, end = std::min(n, last * 64);
+
+            bits::forEachWord(data, begin, end, [&](uint64_t offset, uint64_t word, uint64_t count) {
+                To* d = dst + begin + offset;
+                for (uint64_t k = 0; k < count; k++)
+                    d[k] = static_cast<To>(static_cast<compute_t<To>>((word >> k) & 1));
+            });
+        });
+    }
+}
+
 template <typename OpDType>
-void Cast::compute(Buffer* buf) {
+void Cast::compute(Buffer* out, Buffer* buf) {
     switch (buf->getDataType()) {
       case DataType::UINT8:
-        for (uint64_t i = 0; i < buf->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, static_cast<OpDType>(buf->getIndex<uint16_t>(i)));
+        castFrom<OpDType, uint8_t>(out, buf, saturate_);
         return;
 
       case DataType::UINT16:
-        for (uint64_t i = 0; i < buf->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, static_cast<OpDType>(buf->getIndex<uint16_t>(i)));
+        castFrom<OpDType, uint16_t>(out, buf, saturate_);
         return;
 
       case DataType::UINT32:
-        for (uint64_t i = 0; i < buf->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, static_cast<OpDType>(buf->getIndex<uint32_t>(i)));
+        castFrom<OpDType, uint32_t>(out, buf, saturate_);
         return;
 
       case DataType::UINT64:
-        for (uint64_t i = 0; i < buf->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, static_cast<OpDType>(buf->getIndex<uint64_t>(i)));
+        castFrom<OpDType, uint64_t>(out, buf, saturate_);
         return;
 
       case DataType::INT8:
-        for (uint64_t i = 0; i < buf->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, static_cast<OpDType>(buf->getIndex<int8_t>(i)));
+        castFrom<OpDType, int8_t>(out, buf, saturate_);
         return;
 
       case DataType::INT16:
-        for (uint64_t i = 0; i < buf->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, static_cast<OpDType>(buf->getIndex<int16_t>(i)));
+        castFrom<OpDType, int16_t>(out, buf, saturate_);
         return;
 
       case DataType::INT32:
-        for (uint64_t i = 0; i < buf->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, static_cast<OpDType>(buf->getIndex<int32_t>(i)));
+        castFrom<OpDType, int32_t>(out, buf, saturate_);
         return;
 
       case DataType::INT64:
-        for (uint64_t i = 0; i < buf->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, static_cast<OpDType>(buf->getIndex<int64_t>(i)));
+        castFrom<OpDType, int64_t>(out, buf, saturate_);
         return;
 
       case DataType::FLOAT32:
-        for (uint64_t i = 0; i < buf->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, static_cast<OpDType>(buf->getIndex<float>(i)));
+        castFrom<OpDType, float>(out, buf, saturate_);
         return;
 
       case DataType::FLOAT64:
+        castFrom<OpDType, double>(out, buf, saturate_);
+        return;
+
+      case DataType::FLOAT16:
+        castFrom<OpDType, float16>(out, buf, saturate_);
+        return;
+
+      case DataType::BFLOAT16:
+        castFrom<OpDType, bfloat16>(out, buf, saturate_);
+        return;
+
+      case DataType::BOOL:
+        castFromBits<OpDType>(out, buf);
+        return;
+
+      default:
+        std::cout << "ERROR: bad data type, nothing cast!" << std::endl;
+        assert(false);
+    }
+}
+
+template <typename OpDType>
+void Logarithm::compute(Buffer* out, Buffer* buf) {
+    if constexpr (is_half_v<OpDType>) {
+        halfElementWise<OpDType>(out, buf, [&](float* block, uint64_t n) {
+            if (isVectorMath())
+                vmath::log<float>(block, block, n);
+            else {
+                for (uint64_t i = 0; i < n; i++)
+                    block[i] = std::log(block[i]);
+            }
+        });
+    }
+    else {
+        if (isVectorMath()) {
+            vmath::log<OpDType>(out->getBufferDataAsTemplate<OpDType>(), buf->getBufferDataAsTemplate<OpDType>(),
+                                buf->getElements());
+            return;
+        }
+
         for (uint64_t i = 0; i < buf->getElements(); i++)
-            this->buffer_->setIndex<OpDType>(i, static_cast<OpDType>(buf->getIndex<double>(i)));
+            out->setIndex<OpDType>(i, static_cast<OpDType>(std::log(buf->getIndex<OpDType>(i))));
+    }
+}
+
+template <typename OpDType>
+void Transpose::compute(Buffer* out, Buffer* buf) {
+    std::vector<int>& shape = buf->getShape();
+
+    int rows = shape[shape.size()-2];
+    int cols = shape[shape.size()-1];
+
+    uint64_t matrix_count = buf->getElements() / (rows * cols);
+
+    for (uint64_t i = 0; i < matrix_count; i++) {
+        uint64_t start = i * rows * cols;
+
+        for (int r = 0; r < rows; r++) {
+            for (int c = 0; c < cols; c++)
+                out->setIndex<OpDType>(start+c*rows+r, buf->getIndex<OpDType>(start+r*cols+c));
+        }
+    }
+}
+
+// Elements below which a reduction isn't worth splitting across threads.
+const uint64_t reduction_parallel_threshold = 1 << 15;
+
+// Length of the chunks the reduced axes are split into in deterministic mode.
+const uint64_t reduction_deterministic_chunk = 1 << 13;
+
+// Splits `shape` into the number of elements before (outer), across (extent)
+// and after (inner) the axes [first_axis, last_axis].
+inline void reductionExtents(std::vector<int>& shape, int first_axis, int last_axis,
+                             uint64_t& outer, uint64_t& extent, uint64_t& inner) {
+    outer = 1;
+    extent = 1;
+    inner = 1;
+
+    for (int i = 0; i < shape.size(); i++) {
+        if (i < first_axis)
+            outer *= shape[i];
+        else if (i <= last_axis)
+            extent *= shape[i];
+        else
+            inner *= shape[i];
+    }
+}
+
+// Elements below which an activation isn't worth splitting across threads.
+const uint64_t activation_parallel_threshold = 1 << 14;
+
+// 16 bit floats activated at a time, widened into a FP32 block on the stack.
+const uint64_t activation_half_block = 256;
+
+// Activations of a single element, and their derivatives, through
+// vector_math.h if `Approximate` and libm otherwise.
+template <typename T, bool Approximate>
+struct Activations {
+    static constexpr T gelu_scale = 0.7978845608028654;      // sqrt(2 / pi)
+    static constexpr T gelu_cubic = 0.044715;
+    static constexpr T normal_density = 0.3989422804014327;  // 1 / sqrt(2 * pi)
+
+    static T sigmoid(T x) {
+        if constexpr (Approximate)
+            return vmath::sigmoid(x);
+        else
+            return 1 / (1 + std::exp(-x));
+    }
+
+    static T tanh(T x) {
+        if constexpr (Approximate)
+            return vmath::tanh(x);
+        else
+            return std::tanh(x);
+    }
+
+    // 0.5 * (1 + tanh(z)) == sigmoid(2z), which doesn't
+    // cancel out for large negative x.
+    static T gelu(T x) {
+        if constexpr (Approximate)
+            return x * sigmoid(2 * gelu_scale * (x + gelu_cubic * x * x * x));
+        else
+            return T(0.5) * x * std::erfc(-x * T(M_SQRT1_2));
+    }
+
+    static T silu(T x) {
+        return x * sigmoid(x);
+    }
+
+    static T geluDerivative(T x) {
+        if constexpr (Approximate) {
+            T s = sigmoid(2 * gelu_scale * (x + gelu_cubic * x * x * x));
+            return s + x * 2 * s * (1 - s) * gelu_scale * (1 + 3 * gelu_cubic * x * x);
+        }
+        else {
+            T cdf = T(0.5) * std::erfc(-x * T(M_SQRT1_2));
+            return cdf + x * normal_density * std::exp(T(-0.5) * x * x);
+        }
+    }
+};
+
+// dst[i] = activation(src[i]) for i in [0, n). `dst` may be `src`.
+template <typename T, bool Approximate>
+void activate(T* dst, const T* src, uint64_t n, ActivationType activation) {
+    using A = Activations<T, Approximate>;
+
+    switch (activation) {
+      case ActivationType::RELU:
+        // NaN is passed on.
+        for (uint64_t i = 0; i < n; i++)
+            dst[i] = (src[i] < 0) ? 0 : src[i];
+        return;
+
+      case ActivationType::SIGMOID:
+        for (uint64_t i = 0; i < n; i++)
+            dst[i] = A::sigmoid(src[i]);
+        return;
+
+      case ActivationType::TANH:
+        for (uint64_t i = 0; i < n; i++)
+            dst[i] = A::tanh(src[i]);
+        return;
+
+      case ActivationType::GELU:
+        for (uint64_t i = 0; i < n; i++)
+            dst[i] = A::gelu(src[i]);
+        return;
+
+      case ActivationType::SILU:
+        for (uint64_t i = 0; i < n; i++)
+            dst[i] = A::silu(src[i]);
+        return;
+    }
+}
+
+template <typename T>
+void activate(T* dst, const T* src, uint64_t n, ActivationType activation, bool approximate) {
+    if constexpr (is_half_v<T>) {
+        float block[activation_half_block];
+        for (uint64_t i = 0; i < n; i += activation_half_block) {
+            uint64_t count = std::min(activation_half_block, n - i);
+
+            widen(block, src + i, count);
+            activate<float>(block, block, count, activation, approximate);
+            narrow(dst + i, block, count);
+        }
+    }
+    else if (approximate)
+        activate<T, true>(dst, src, n, activation);
+    else
+        activate<T, false>(dst, src, n, activation);
+}
+
+// dst[i] = grad[i] * activation'(x[i]) for i in [0, n).
+template <typename T, bool Approximate>
+void activationGradient(T* dst, const T* grad, const T* x, uint64_t n, ActivationType activation) {
+    using A = Activations<T, Approximate>;
+
+    switch (activation) {
+      case ActivationType::RELU:
+        for (uint64_t i = 0; i < n; i++)
+            dst[i] = (x[i] > 0) ? grad[i] : 0;
+        return;
+
+      case ActivationType::SIGMOID:
+        for (uint64_t i = 0; i < n; i++) {
+            T s = A::sigmoid(x[i]);
+            dst[i] = grad[i] * s * (1 - s);
+        }
+        return;
+
+      case ActivationType::TANH:
+        for (uint64_t i = 0; i < n; i++) {
+            T t = A::tanh(x[i]);
+            dst[i] = grad[i] * (1 - t * t);
+        }
+        return;
+
+      case ActivationType::GELU:
+        for (uint64_t i = 0; i < n; i++)
+            dst[i] = grad[i] * A::geluDerivative(x[i]);
+        return;
+
+      case ActivationType::SILU:
+        for (uint64_t i = 0; i < n; i++) {
+            T s = A::sigmoid(x[i]);
+            dst[i] = grad[i] * s * (1 + x[i] * (1 - s));
+        }
+        return;
+    }
+}
+
+template <typename OpDType>
+void Activation::compute(Buffer* out, Buffer* buf) {
+    uint64_t n = buf->getElements();
+    OpDType* in = buf->getBufferDataAsTemplate<OpDType>();
+    OpDType* o = out->getBufferDataAsTemplate<OpDType>();
+
+    forEachRange(n, n >= activation_parallel_threshold, [&](uint64_t begin, uint64_t end) {
+        activate<OpDType>(o + begin, in + begin, end - begin, activation_, approximate_);
+    });
+}
+
+template <typename OpDType>
+void ActivationGradient::compute(Buffer* out, Buffer* b1, Buffer* b2) {
+    uint64_t n = b1->getElements();
+    OpDType* grad = b1->getBufferDataAsTemplate<OpDType>();
+    OpDType* x = b2->getBufferDataAsTemplate<OpDType>();
+    OpDType* o = out->getBufferDataAsTemplate<OpDType>();
+
+    forEachRange(n, n >= activation_parallel_threshold, [&](uint64_t begin, uint64_t end) {
+        if (approximate_)
+            activationGradient<OpDType, true>(o + begin, grad + begin, x + begin, end - begin, activation_);
+        else
+            activationGradient<OpDType, false>(o + begin, grad + begin, x + begin, end - begin, activation_);
+    });
+}
+
+template <typename OpDType>
+void Reduction::compute(Buffer* out, Buffer* buf) {
+    uint64_t outer, extent, inner;
+    reductionExtents(buf->getShape(), first_axis_, last_axis_, outer, extent, inner);
+
+    OpDType* in = buf->getBufferDataAsTemplate<OpDType>();
+
+    if (reduction_ == ReductionType::ARGMAX) {
+        argmax<OpDType>(out->getBufferDataAsTemplate<int64_t>(), in, outer, extent, inner);
         return;
     }
+
+    OpDType* o = out->getBufferDataAsTemplate<OpDType>();
+
+    switch (reduction_) {
+      case ReductionType::SUM:
+      case ReductionType::MEAN:
+        reduce<OpDType>(o, in, outer, extent, inner, simd::Add(), true);
+        break;
+
+      case ReductionType::MAX:
+        reduce<OpDType>(o, in, outer, extent, inner, simd::Max(), false);
+        break;
+
+      case ReductionType::MIN:
+        reduce<OpDType>(o, in, outer, extent, inner, simd::Min(), false);
+        break;
+
+      default:
+        break;
+    }
+
+    // 16 bit means are divided before they're rounded (see reduce()).
+    if constexpr (!is_half_v<OpDType>) {
+        if (reduction_ == ReductionType::MEAN) {
+            for (uint64_t i = 0; i < outer * inner; i++)
+                o[i] /= static_cast<OpDType>(extent);
+        }
+    }
+}
+
+// Elements of a row 16 bit floats are reduced in at a time, widened into
+// FP32 blocks on the stack.
+const uint64_t reduction_half_block = 256;
+
+// `from_zero` starts every result at 0 rather than at its first element,
+// for combinations (i.e. sums) that have it as their identity.
+//
+// 16 bit data (OpDType) is combined in FP32 (Acc): rows are widened a block
+// at a time, and results (means divided by now) are rounded as they're
+// written. Columns are split into blocks small enough for the stack then.
+template <typename OpDType, class Combine>
+void Reduction::reduce(OpDType* out, OpDType* in, uint64_t outer, uint64_t extent, uint64_t inner,
+                       Combine combine, bool from_zero) {
+    typedef compute_t<OpDType> Acc;
+    constexpr bool half = is_half_v<OpDType>;
+
+    uint64_t threads = ThreadPool::shared().getThreads();
+    bool parallel = outer * extent * inner >= reduction_parallel_threshold && threads > 1;
+
+    // Rows of `inner` elements are split into blocks, so a few long rows
+    // still make for enough items to go around.
+    const uint64_t block = half ? reduction_half_block : 4096;
+    uint64_t blocks = (inner + block - 1) / block;
+
+    // Too few output elements to keep every thread busy, so the reduced
+    // axes are split into chunks too, one per thread.
+    //
+    // In deterministic mode the chunks have a fixed length instead, so the
+    // partial results (and the tree combining them) don't depend on the
+    // number of threads, or on whether there are enough output elements.
+    uint64_t chunks = 1;
+    if (isDeterministic())
+        chunks = (extent + reduction_deterministic_chunk - 1) / reduction_deterministic_chunk;
+    else if (parallel && outer * blocks < threads)
+        chunks = std::min<uint64_t>(threads, extent);
+
+    auto chunkBegin = [&](uint64_t c) {
+        if (isDeterministic())
+            return std::min(c * reduction_deterministic_chunk, extent);
+
+        return extent * c / chunks;
+    };
+
+    // Combines rows [begin, end) of the reduced axes into `dst` (of `inner`
+    // elements, starting at column j0 of the row of `outer` index o).
+    auto reduceRows = [&](Acc* dst, uint64_t o, uint64_t begin, uint64_t end, uint64_t j0, uint64_t n) {
+        OpDType* src = in + o * extent * inner + j0;
+
+        if constexpr (half) {
+            float row[reduction_half_block];
+
+            if (inner == 1) {
+                // simd::reduce() starts every lane at its `init`, so each
+                // block starts afresh and is then combined with the others.
+                float result = 0;
+                for (uint64_t r = begin; r < end; r += reduction_half_block) {
+                    uint64_t count = std::min(reduction_half_block, end - r);
+
+                    widen(row, src + r, count);
+                    float block_result = simd::reduce(row, count, from_zero ? 0.0f : row[0], combine);
+
+                    result = (r == begin) ? block_result : combine(result, block_result);
+                }
+
+                *dst = result;
+                return;
+            }
+
+            widen(dst, src + begin * inner, n);
+            for (uint64_t r = begin + 1; r < end; r++) {
+                widen(row, src + r * inner, n);
+                simd::accumulate(dst, row, n, combine);
+            }
+        }
+        else {
+            if (inner == 1) {
+                OpDType init = from_zero ? 0 : src[begin];
+                *dst = simd::reduce(src + begin, end - begin, init, combine);
+                return;
+            }
+
+            for (uint64_t j = 0; j < n; j++)
+                dst[j] = src[begin * inner + j];
+
+            for (uint64_t r = begin + 1; r < end; r++)
+                simd::accumulate(dst, src + r * inner, n, combine);
+        }
+    };
+
+    // Writes n FP32 results of 16 bit data, as the reduction ends them.
+    Acc divisor = (reduction_ == ReductionType::MEAN) ? static_cast<Acc>(extent) : 1;
+    auto store = [&](OpDType* dst, Acc* results, uint64_t n) {
+        if constexpr (half) {
+            for (uint64_t j = 0; j < n; j++)
+                results[j] /= divisor;
+
+            narrow(dst, results, n);
+        }
+    };
+
+    if (chunks == 1) {
+        forEachRange(outer * blocks, parallel, [&](uint64_t first, uint64_t last) {
+            for (uint64_t item = first; item < last; item++) {
+                uint64_t o = item / blocks;
+                uint64_t j0 = (item % blocks) * block;
+                uint64_t n = std::min(block, inner - j0);
+
+                if constexpr (half) {
+                    float results[reduction_half_block];
+
+                    reduceRows(results, o, 0, extent, j0, n);
+                    store(out + o * inner + j0, results, n);
+                }
+                else
+                    reduceRows(out + o * inner + j0, o, 0, extent, j0, n);
+            }
+        });
+
+        return;
+    }
+
+    // One partial row per chunk, folded together pairwise.
+    std::vector<Acc> partials(outer * chunks * inner);
+
+    forEachRange(outer * chunks, parallel, [&](uint64_t first, uint64_t last) {
+        for (uint64_t task = first; task < last; task++) {
+            uint64_t o = task / chunks;
+            uint64_t c = task % chunks;
+
+            // Blocks of columns, for the stack of the 16 bit rows.
+            for (uint64_t j0 = 0; j0 < inner; j0 += block)
+                reduceRows(&partials[task * inner + j0], o, chunkBegin(c), chunkBegin(c + 1), j0,
+                           std::min(block, inner - j0));
+        }
+    });
+
+    for (uint64_t o = 0; o < outer; o++) {
+        Acc* rows = &partials[o * chunks * inner];
+
+        for (uint64_t stride = 1; stride < chunks; stride *= 2) {
+            for (uint64_t c = 0; c + stride < chunks; c += 2 * stride)
+                simd::accumulate(rows + c * inner, rows + (c + stride) * inner, inner, combine);
+        }
+
+        if constexpr (half)
+            store(out + o * inner, rows, inner);
+        else {
+            for (uint64_t j = 0; j < inner; j++)
+                out[o * inner + j] = rows[j];
+        }
+    }
+}
+
+template <typename OpDType>
+void Reduction::argmax(int64_t* out, OpDType* in, uint64_t outer, uint64_t extent, uint64_t inner) {
+    bool parallel = outer * extent * inner >= reduction_parallel_threshold;
+
+    forEachRange(outer, parallel, [&](uint64_t first, uint64_t last) {
+        std::vector<OpDType> best(inner);
+
+        for (uint64_t o = first; o < last; o++) {
+            OpDType* src = in + o * extent * inner;
+            int64_t* dst = out + o * inner;
+
+            for (uint64_t j = 0; j < inner; j++) {
+                best[j] = src[j];
+                dst[j] = 0;
+            }
+
+            for (uint64_t r = 1; r < extent; r++) {
+                for (uint64_t j = 0; j < inner; j++) {
+                    if (src[r * inner + j] > best[j]) {
+                        best[j] = src[r * inner + j];
+                        dst[j] = r;
+                    }
+                }
+            }
+        }
+    });
+}
+
+template <typename OpDType>
+void ReductionGradient::compute(Buffer* out, Buffer* b1, Buffer* b2) {
+    uint64_t outer, extent, inner;
+    reductionExtents(out->getShape(), first_axis_, last_axis_, outer, extent, inner);
+
+    OpDType* o = out->getBufferDataAsTemplate<OpDType>();
+    OpDType* grad = b1->getBufferDataAsTemplate<OpDType>();
+
+    if (reduction_ == ReductionType::SUM || reduction_ == ReductionType::MEAN) {
+        OpDType scale = (reduction_ == ReductionType::MEAN) ? static_cast<OpDType>(extent) : 1;
+
+        for (uint64_t i = 0; i < outer; i++) {
+            for (uint64_t r = 0; r < extent; r++) {
+                for (uint64_t j = 0; j < inner; j++)
+                    o[(i * extent + r) * inner + j] = grad[i * inner + j] / scale;
+            }
+        }
+
+        return;
+    }
+
+    // The first element picked by the reduction gets the gradient.
+    OpDType* in = b2->getBufferDataAsTemplate<OpDType>();
+    bool picks_max = reduction_ == ReductionType::MAX;
+
+    for (uint64_t i = 0; i < outer * extent * inner; i++)
+        o[i] = 0;
+
+    for (uint64_t i = 0; i < outer; i++) {
+        for (uint64_t j = 0; j < inner; j++) {
+            uint64_t picked = i * extent * inner + j;
+
+            for (uint64_t r = 1; r < extent; r++) {
+                uint64_t index = (i * extent + r) * inner + j;
+                if (picks_max ? in[index] > in[picked] : in[index] < in[picked])
+                    picked = index;
+            }
+
+            o[picked] = grad[i * inner + j];
+        }
+    }
+}
+
+// Elements of a row a softmax handles at a time.
+const uint64_t softmax_block = 256;
+
+// Running state of a row read by softmaxRow(): its max so far, the sum of
+// exp(x - max) and, for cross-entropy, the sums of p and p * (x - max) for
+// label weights p. The sums are kept relative to the current max and are
+// shifted along with it.
+template <typename T>
+struct SoftmaxRowState {
+    T max = 0;
+    T sum = 0;
+    T weights = 0;
+    T weighted = 0;
+};
+
+// One pass over a row of n elements, weighting them by `labels` if given.
+//
+// If `exps` is given, the exponentials of each block are left there, taken
+// relative to the max at the time, which goes to `block_maxes`. Otherwise
+// they only live on the stack. `exps` may be `x`.
+template <typename T>
+SoftmaxRowState<T> softmaxRow(const T* x, const T* labels, uint64_t n, T* exps, T* block_maxes) {
+    SoftmaxRowState<T> state;
+    T scratch[softmax_block];
+
+    for (uint64_t b = 0; b < n; b += softmax_block) {
+        uint64_t len = std::min(softmax_block, n - b);
+        T* shifted = (exps != nullptr) ? exps + b : scratch;
+
+        T block_max = simd::reduce(x + b, len, x[b], simd::Max());
+        if (b == 0)
+            state.max = block_max;
+        else if (block_max > state.max) {
+            state.sum *= vmath::exp(state.max - block_max);
+            state.weighted -= (block_max - state.max) * state.weights;
+            state.max = block_max;
+        }
+
+        if (block_maxes != nullptr)
+            block_maxes[b / softmax_block] = state.max;
+
+        for (uint64_t j = 0; j < len; j++)
+            shifted[j] = x[b + j] - state.max;
+
+        if (labels != nullptr) {
+            for (uint64_t j = 0; j < len; j++) {
+                state.weights += labels[b + j];
+                state.weighted += labels[b + j] * shifted[j];
+            }
+        }
+
+        vmath::exp(shifted, shifted, len);
+        state.sum += simd::reduce(shifted, len, T(0), simd::Add());
+    }
+
+    return state;
+}
+
+template <typename OpDType>
+void Softmax::compute(Buffer* out, Buffer* buf) {
+    uint64_t elements = buf->getElements();
+    uint64_t n = buf->getShape().back();
+    uint64_t rows = elements / n;
+
+    OpDType* in = buf->getBufferDataAsTemplate<OpDType>();
+    OpDType* o = out->getBufferDataAsTemplate<OpDType>();
+
+    bool parallel = elements >= reduction_parallel_threshold;
+
+    forEachRange(rows, parallel, [&](uint64_t first, uint64_t last) {
+        std::vector<OpDType> block_maxes((n + softmax_block - 1) / softmax_block);
+
+        for (uint64_t r = first; r < last; r++) {
+            OpDType* x = in + r * n;
+            OpDType* y = o + r * n;
+
+            // log_softmax(x) == (x - max) - log(sum)
+            if (log_) {
+                SoftmaxRowState<OpDType> state = softmaxRow<OpDType>(x, nullptr, n, nullptr, nullptr);
+
+                OpDType log_sum = std::log(state.sum);
+                for (uint64_t j = 0; j < n; j++)
+                    y[j] = (x[j] - state.max) - log_sum;
+
+                continue;
+            }
+
+            // The exponentials are already in y, each block only has to be
+            // brought from its own max to the row's and normalized.
+            SoftmaxRowState<OpDType> state = softmaxRow<OpDType>(x, nullptr, n, y, block_maxes.data());
+
+            for (uint64_t b = 0; b < n; b += softmax_block) {
+                uint64_t len = std::min(softmax_block, n - b);
+                OpDType scale = vmath::exp(block_maxes[b / softmax_block] - state.max) / state.sum;
+
+                for (uint64_t j = 0; j < len; j++)
+                    y[b + j] *= scale;
+            }
+        }
+    });
+}
+
+// b1 is the gradient of the softmax's result, b2 the result.
+//
+// softmax:     dx == y * (g - sum(g * y))
+// log-softmax: dx == g - exp(y) * sum(g)
+template <typename OpDType>
+void SoftmaxGradient::compute(Buffer* out, Buffer* b1, Buffer* b2) {
+    uint64_t elements = out->getElements();
+    uint64_t n = out->getShape().back();
+    uint64_t rows = elements / n;
+
+    OpDType* o = out->getBufferDataAsTemplate<OpDType>();
+    OpDType* grad = b1->getBufferDataAsTemplate<OpDType>();
+    OpDType* output = b2->getBufferDataAsTemplate<OpDType>();
+
+    bool parallel = elements >= reduction_parallel_threshold;
+
+    forEachRange(rows, parallel, [&](uint64_t first, uint64_t last) {
+        for (uint64_t r = first; r < last; r++) {
+            OpDType* g = grad + r * n;
+            OpDType* y = output + r * n;
+            OpDType* dx = o + r * n;
+
+            if (log_) {
+                OpDType total = simd::reduce(g, n, OpDType(0), simd::Add());
+
+                vmath::exp(dx, y, n);
+                for (uint64_t j = 0; j < n; j++)
+                    dx[j] = g[j] - dx[j] * total;
+
+                continue;
+            }
+
+            OpDType dot = 0;
+            for (uint64_t j = 0; j < n; j++)
+                dot += g[j] * y[j];
+
+            for (uint64_t j = 0; j < n; j++)
+                dx[j] = y[j] * (g[j] - dot);
+        }
+    });
+}
+
+// b1 holds the logits, b2 the labels.
+//
+// -sum(p * log_softmax(x)) == sum(p) * log(sum(exp(x - max))) - sum(p * (x - max))
+template <typename OpDType>
+void SoftmaxCrossEntropy::compute(Buffer* out, Buffer* b1, Buffer* b2) {
+    uint64_t elements = b1->getElements();
+    uint64_t n = b1->getShape().back();
+    uint64_t rows = elements / n;
+
+    OpDType* o = out->getBufferDataAsTemplate<OpDType>();
+    OpDType* logits = b1->getBufferDataAsTemplate<OpDType>();
+    OpDType* labels = b2->getBufferDataAsTemplate<OpDType>();
+
+    bool parallel = elements >= reduction_parallel_threshold;
+
+    forEachRange(rows, parallel, [&](uint64_t first, uint64_t last) {
+        for (uint64_t r = first; r < last; r++) {
+            SoftmaxRowState<OpDType> state = softmaxRow<OpDType>(logits + r * n, labels + r * n, n, nullptr, nullptr);
+            o[r] = state.weights * std::log(state.sum) - state.weighted;
+        }
+    });
+}
+
+// Rows a batch normalization accumulates per task when gathering its statistics.
+const uint64_t normalization_chunk = 1 << 10;
+
+// Mean and 1 / sqrt(variance + epsilon) of a row of n elements.
+// RMS normalization takes the mean to be 0.
+template <typename T>
+void rowStatistics(const T* x, uint64_t n, bool rms, T epsilon, T& mean, T& rstd) {
+    T shift = rms ? 0 : x[0];
+    T sum, sum_sq;
+    simd::moments(x, n, shift, sum, sum_sq);
+
+    T shifted_mean = rms ? 0 : sum / n;
+    T variance = std::max<T>(sum_sq / n - shifted_mean * shifted_mean, 0);
+
+    mean = shift + shifted_mean;
+    rstd = 1 / std::sqrt(variance + epsilon);
+}
+
+// Mean and 1 / sqrt(variance + epsilon) of each of the `channels` columns
+// of x, taken from `mean_in` and `variance_in` if given.
+//
+// Otherwise rows are accumulated in fixed chunks (across threads if there
+// are enough of them) and the chunks added up in order, so the result
+// doesn't depend on the number of threads.
+template <typename T>
+void channelStatistics(const T* x, uint64_t rows, uint64_t channels, T epsilon,
+                       const T* mean_in, const T* variance_in, T* mean, T* rstd) {
+    if (mean_in != nullptr) {
+        for (uint64_t c = 0; c < channels; c++) {
+            mean[c] = mean_in[c];
+            rstd[c] = 1 / std::sqrt(variance_in[c] + epsilon);
+        }
+
+        return;
+    }
+
+    if (channels == 1) {
+        rowStatistics(x, rows, false, epsilon, mean[0], rstd[0]);
+        return;
+    }
+
+    uint64_t chunks = (rows + normalization_chunk - 1) / normalization_chunk;
+    std::vector<T> sums(chunks * channels * 2, 0);
+
+    forEachRange(chunks, rows * channels >= reduction_parallel_threshold, [&](uint64_t first, uint64_t last) {
+        for (uint64_t k = first; k < last; k++) {
+            T* sum = &sums[k * channels * 2];
+            T* sum_sq = sum + channels;
+
+            for (uint64_t r = k * normalization_chunk; r < std::min(rows, (k + 1) * normalization_chunk); r++) {
+                for (uint64_t c = 0; c < channels; c++) {
+                    T d = x[r * channels + c] - x[c];
+                    sum[c] += d;
+                    sum_sq[c] += d * d;
+                }
+            }
+        }
+    });
+
+    for (uint64_t c = 0; c < channels; c++) {
+        T sum = 0, sum_sq = 0;
+        for (uint64_t k = 0; k < chunks; k++) {
+            sum += sums[k * channels * 2 + c];
+            sum_sq += sums[k * channels * 2 + channels + c];
+        }
+
+        T shifted_mean = sum / rows;
+        T variance = std::max<T>(sum_sq / rows - shifted_mean * shifted_mean, 0);
+
+        mean[c] = x[c] + shifted_mean;
+        rstd[c] = 1 / std::sqrt(variance + epsilon);
+    }
+}
+
+// inputs: x, scale, then the shift, mean and variance if given.
+template <typename OpDType>
+void Normalization::compute(Buffer* out, std::vector<Buffer*>& inputs) {
+    uint64_t elements = inputs[0]->getElements();
+    uint64_t channels = inputs[1]->getElements();
+    uint64_t rows = elements / channels;
+
+    OpDType* x = inputs[0]->getBufferDataAsTemplate<OpDType>();
+    OpDType* scale = inputs[1]->getBufferDataAsTemplate<OpDType>();
+    OpDType* shift = has_shift_ ? inputs[2]->getBufferDataAsTemplate<OpDType>() : nullptr;
+    OpDType* y = out->getBufferDataAsTemplate<OpDType>();
+
+    OpDType epsilon = static_cast<OpDType>(epsilon_);
+    bool parallel = elements >= reduction_parallel_threshold;
+
+    if (normalization_ != NormalizationType::BATCH) {
+        bool rms = normalization_ == NormalizationType::RMS;
+
+        forEachRange(rows, parallel, [&](uint64_t first, uint64_t last) {
+            for (uint64_t r = first; r < last; r++) {
+                OpDType* xr = x + r * channels;
+                OpDType* yr = y + r * channels;
+
+                OpDType mean, rstd;
+                rowStatistics(xr, channels, rms, epsilon, mean, rstd);
+
+                for (uint64_t c = 0; c < channels; c++)
+                    yr[c] = (xr[c] - mean) * rstd * scale[c];
+
+                if (shift != nullptr) {
+                    for (uint64_t c = 0; c < channels; c++)
+                        yr[c] += shift[c];
+                }
+            }
+        });
+
+        return;
+    }
+
+    OpDType* mean_in = nullptr;
+    OpDType* variance_in = nullptr;
+    if (has_statistics_) {
+        mean_in = inputs[has_shift_ ? 3 : 2]->getBufferDataAsTemplate<OpDType>();
+        variance_in = inputs[has_shift_ ? 4 : 3]->getBufferDataAsTemplate<OpDType>();
+    }
+
+    std::vector<OpDType> mean(channels), rstd(channels);
+    channelStatistics(x, rows, channels, epsilon, mean_in, variance_in, mean.data(), rstd.data());
+
+    // y == x * a + b, per channel.
+    std::vector<OpDType> a(channels), b(channels);
+    for (uint64_t c = 0; c < channels; c++) {
+        a[c] = rstd[c] * scale[c];
+        b[c] = ((shift != nullptr) ? shift[c] : 0) - mean[c] * a[c];
+    }
+
+    forEachRange(rows, parallel, [&](uint64_t first, uint64_t last) {
+        for (uint64_t r = first; r < last; r++) {
+            for (uint64_t c = 0; c < channels; c++)
+                y[r * channels + c] = x[r * channels + c] * a[c] + b[c];
+        }
+    });
+}
+
+// inputs: the gradient of the normalization's result, its input, scale,
+// then the mean and variance if given.
+//
+// With x' == (x - mean) * rstd and g' == g * scale:
+//   d/dx     == rstd * (g' - mean(g') - x' * mean(g' * x')), the means over
+//               what the statistics were taken over (mean(g') is 0 for RMS),
+//               or just g' * rstd for given statistics
+//   d/dscale == sum(g * x') over the rows
+template <typename OpDType>
+void NormalizationGradient::compute(Buffer* out, std::vector<Buffer*>& inputs) {
+    uint64_t elements = inputs[1]->getElements();
+    uint64_t channels = inputs[2]->getElements();
+    uint64_t rows = elements / channels;
+
+    OpDType* g = inputs[0]->getBufferDataAsTemplate<OpDType>();
+    OpDType* x = inputs[1]->getBufferDataAsTemplate<OpDType>();
+    OpDType* scale = inputs[2]->getBufferDataAsTemplate<OpDType>();
+    OpDType* o = out->getBufferDataAsTemplate<OpDType>();
+
+    OpDType epsilon = static_cast<OpDType>(epsilon_);
+    bool parallel = elements >= reduction_parallel_threshold;
+
+    if (normalization_ != NormalizationType::BATCH) {
+        bool rms = normalization_ == NormalizationType::RMS;
+
+        if (wrt_scale_) {
+            for (uint64_t c = 0; c < channels; c++)
+                o[c] = 0;
+
+            for (uint64_t r = 0; r < rows; r++) {
+                OpDType mean, rstd;
+                rowStatistics(x + r * channels, channels, rms, epsilon, mean, rstd);
+
+                for (uint64_t c = 0; c < channels; c++)
+                    o[c] += g[r * channels + c] * (x[r * channels + c] - mean) * rstd;
+            }
+
+            return;
+        }
+
+        forEachRange(rows, parallel, [&](uint64_t first, uint64_t last) {
+            for (uint64_t r = first; r < last; r++) {
+                OpDType* xr = x + r * channels;
+                OpDType* gr = g + r * channels;
+                OpDType* dx = o + r * channels;
+
+                OpDType mean, rstd;
+                rowStatistics(xr, channels, rms, epsilon, mean, rstd);
+
+                OpDType g_sum = 0, gx_sum = 0;
+                for (uint64_t c = 0; c < channels; c++) {
+                    g_sum += gr[c] * scale[c];
+                    gx_sum += gr[c] * scale[c] * (xr[c] - mean) * rstd;
+                }
+
+                OpDType g_mean = rms ? 0 : g_sum / channels;
+                OpDType gx_mean = gx_sum / channels;
+
+                for (uint64_t c = 0; c < channels; c++) {
+                    OpDType normalized = (xr[c] - mean) * rstd;
+                    dx[c] = rstd * (gr[c] * scale[c] - g_mean - normalized * gx_mean);
+                }
+            }
+        });
+
+        return;
+    }
+
+    OpDType* mean_in = has_statistics_ ? inputs[3]->getBufferDataAsTemplate<OpDType>() : nullptr;
+    OpDType* variance_in = has_statistics_ ? inputs[4]->getBufferDataAsTemplate<OpDType>() : nullptr;
+
+    std::vector<OpDType> mean(channels), rstd(channels);
+    channelStatistics(x, rows, channels, epsilon, mean_in, variance_in, mean.data(), rstd.data());
+
+    // sum(g) and sum(g * x') per channel, over the rows.
+    std::vector<OpDType> g_sum(channels, 0), gx_sum(channels, 0);
+    for (uint64_t r = 0; r < rows; r++) {
+        for (uint64_t c = 0; c < channels; c++) {
+            uint64_t i = r * channels + c;
+            g_sum[c] += g[i];
+            gx_sum[c] += g[i] * (x[i] - mean[c]) * rstd[c];
+        }
+    }
+
+    if (wrt_scale_) {
+        for (uint64_t c = 0; c < channels; c++)
+            o[c] = gx_sum[c];
+
+        return;
+    }
+
+    // y == x * a + b for given statistics, which nothing else depends on.
+    std::vector<OpDType> g_mean(channels, 0), gx_mean(channels, 0);
+    if (!has_statistics_) {
+        for (uint64_t c = 0; c < channels; c++) {
+            g_mean[c] = g_sum[c] * scale[c] / rows;
+            gx_mean[c] = gx_sum[c] * scale[c] / rows;
+        }
+    }
+
+    forEachRange(rows, parallel, [&](uint64_t first, uint64_t last) {
+        for (uint64_t r = first; r < last; r++) {
+            for (uint64_t c = 0; c < channels; c++) {
+                uint64_t i = r * channels + c;
+                OpDType normalized = (x[i] - mean[c]) * rstd[c];
+                o[i] = rstd[c] * (g[i] * scale[c] - g_mean[c] - normalized * gx_mean[c]);
+            }
+        }
+    });
+}
+
+// Calls f(output_index, image_index, kernel_index) for every product of an
+// image and kernel element Convolution2D::compute() sums into an output,
+// following the same padding and strides.
+template <typename F>
+void forEachConvolutionTap(std::vector<int>& image_full_shape, std::vector<int>& kernel_shape,
+                           std::vector<int>& output_shape, std::string& padding, int (&strides)[2], F f) {
+    int image_shape[2] = { image_full_shape.rbegin()[1], image_full_shape.rbegin()[0] };
+
+    // NOTE: strides override padding, as in conv2dShape()
+    bool padded;
+    int padding_offset_y[2], padding_offset_x[2];
+    if (!padding.compare("same") && strides[0] == 1 && strides[1] == 1) {
+        padded = true;
+
+        padding_offset_y[0] = std::ceil(static_cast<float>(kernel_shape[0] - 1) / 2);
+        padding_offset_y[1] = std::floor(static_cast<float>(kernel_shape[0] - 1) / 2);
+
+        padding_offset_x[0] = std::ceil(static_cast<float>(kernel_shape[1] - 1) / 2);
+        padding_offset_x[1] = std::floor(static_cast<float>(kernel_shape[1] - 1) / 2);
+    }
+    else {
+        padded = false;
+
+        padding_offset_y[0] = 0;
+        padding_offset_y[1] = 0;
+
+        padding_offset_x[0] = 0;
+        padding_offset_x[1] = 0;
+    }
+
+    int matrix_count = 1;
+    int matrix_sizes[2] = { image_shape[0]*image_shape[1],
+                            output_shape.rbegin()[1]*output_shape.rbegin()[0] };
+
+    for (int i = 0; i < image_full_shape.size()-2; i++)
+        matrix_count *= image_full_shape[i];
+
+    for (int i = 0; i < matrix_count; i++) {
+        for (int oy = 0-padding_offset_y[0]; oy < image_shape[0]-kernel_shape[0]+1+padding_offset_y[1]; oy+=strides[0]) {
+            for (int ox = 0-padding_offset_x[0]; ox < image_shape[1]-kernel_shape[1]+1+padding_offset_x[1]; ox+=strides[1]) {
+                int out_y, out_x;
+                if (padded && strides[0] == 1 && strides[1] == 1) {
+                    out_y = oy + padding_offset_y[0];
+                    out_x = ox + padding_offset_x[0];
+                }
+                else {
+                    out_y = std::floor(oy / strides[0]);
+                    out_x = std::floor(ox / strides[1]);
+                }
+
+                int output_index = matrix_sizes[1]*i+out_y*output_shape.back()+out_x;
+
+                for (int ky = kernel_shape[0]-1, iy = oy; iy < oy+kernel_shape[0]; ky--, iy++) {
+                    for (int kx = kernel_shape[1]-1, ix = ox; ix < ox+kernel_shape[1]; kx--, ix++) {
+                        if (iy < 0 || iy >= image_shape[0] || ix < 0 || ix >= image_shape[1])
+                            continue;
+
+                        f(output_index, matrix_sizes[0]*i+iy*image_shape[1]+ix, ky*kernel_shape[1]+kx);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// b1 is the gradient of the convolution's result, b2 the kernel.
+template <typename OpDType>
+void Convolution2DInputGradient::compute(Buffer* out, Buffer* b1, Buffer* b2) {
+    for (uint64_t i = 0; i < out->getElements(); i++)
+        out->setIndex<OpDType>(i, 0);
+
+    OpDType* image_grad = out->getBufferDataAsTemplate<OpDType>();
+    OpDType* grad = b1->getBufferDataAsTemplate<OpDType>();
+    OpDType* kernel = b2->getBufferDataAsTemplate<OpDType>();
+
+    forEachConvolutionTap(out->getShape(), b2->getShape(), b1->getShape(), this->padding_, this->strides_,
+        [&](int output_index, int image_index, int kernel_index) {
+            image_grad[image_index] += grad[output_index] * kernel[kernel_index];
+        });
+}
+
+// b1 is the gradient of the convolution's result, b2 the image.
+template <typename OpDType>
+void Convolution2DKernelGradient::compute(Buffer* out, Buffer* b1, Buffer* b2) {
+    for (uint64_t i = 0; i < out->getElements(); i++)
+        out->setIndex<OpDType>(i, 0);
+
+    OpDType* kernel_grad = out->getBufferDataAsTemplate<OpDType>();
+    OpDType* grad = b1->getBufferDataAsTemplate<OpDType>();
+    OpDType* image = b2->getBufferDataAsTemplate<OpDType>();
+
+    forEachConvolutionTap(b2->getShape(), out->getShape(), b1->getShape(), this->padding_, this->strides_,
+        [&](int output_index, int image_index, int kernel_index) {
+            kernel_grad[kernel_index] += grad[output_index] * image[image_index];
+        });
+}
+
+// Multiply-adds past which Convolution2DTranspose splits its images across threads.
+const uint64_t convolution_parallel_threshold = 1 << 16;
+
+template <typename OpDType>
+void Convolution2DTranspose::compute(Buffer* out, Buffer* b1, Buffer* b2) {
+    std::vector<int>& input_shape = b1->getShape();
+    std::vector<int>& kernel_shape = b2->getShape();
+    std::vector<int>& output_shape = out->getShape();
+
+    int rows = input_shape.rbegin()[1], columns = input_shape.back();
+    int out_rows = output_shape.rbegin()[1], out_columns = output_shape.back();
+    int kernel_rows = kernel_shape[0], kernel_columns = kernel_shape[1];
+
+    // Where the kernel's top left corner is, in the result, for the first
+    // pixel - ceil((kernel - 1) / 2) before it with "same" padding, as in
+    // Convolution2D (strides are 1 then).
+    int offset_y = 0, offset_x = 0;
+    if (!this->padding_.compare("same") && this->strides_[0] == 1 && this->strides_[1] == 1) {
+        offset_y = kernel_rows / 2;
+        offset_x = kernel_columns / 2;
+    }
+
+    // Convolution2D flips the kernel, so its transpose scatters through the flipped one.
+    OpDType* kernel = b2->getBufferDataAsTemplate<OpDType>();
+    std::vector<OpDType> flipped(kernel_rows * kernel_columns);
+    for (int i = 0; i < flipped.size(); i++)
+        flipped[i] = kernel[flipped.size() - 1 - i];
+
+    uint64_t input_size = static_cast<uint64_t>(rows) * columns;
+    uint64_t output_size = static_cast<uint64_t>(out_rows) * out_columns;
+    uint64_t images = b1->getElements() / input_size;
+
+    OpDType* in = b1->getBufferDataAsTemplate<OpDType>();
+    OpDType* o = out->getBufferDataAsTemplate<OpDType>();
+
+    bool parallel = b1->getElements() * flipped.size() >= convolution_parallel_threshold;
+
+    forEachRange(images, parallel, [&](uint64_t first, uint64_t last) {
+        std::fill(o + first * output_size, o + last * output_size, static_cast<OpDType>(0));
+
+        for (uint64_t i = first; i < last; i++) {
+            OpDType* image = o + i * output_size;
+            OpDType* pixels = in + i * input_size;
+
+            for (int y = 0; y < rows; y++) {
+                int oy = y * this->strides_[0] - offset_y;
+                int first_ky = std::max(0, -oy), last_ky = std::min(kernel_rows, out_rows - oy);
+
+                for (int x = 0; x < columns; x++) {
+                    int ox = x * this->strides_[1] - offset_x;
+                    int first_kx = std::max(0, -ox), last_kx = std::min(kernel_columns, out_columns - ox);
+
+                    OpDType pixel = pixels[y * columns + x];
+
+                    for (int ky = first_ky; ky < last_ky; ky++) {
+                        OpDType* row = image + (oy + ky) * out_columns + ox;
+                        OpDType* kernel_row = &flipped[ky * kernel_columns];
+
+                        for (int kx = first_kx; kx < last_kx; kx++)
+                            row[kx] += pixel * kernel_row[kx];
+                    }
+                }
+            }
+
+            applyEpilogue(out, i * output_size, (i + 1) * output_size);
+        }
+    });
+}
+
+// Windows up to this long are taken element by element, longer ones through
+// a monotonic deque.
+const int pooling_direct_window = 8;
+const uint64_t pooling_parallel_threshold = 1 << 14;
+
+// Where a pooling window goes along one dimension of the image: output j
+// covers the elements [j * stride - offset, j * stride - offset + window),
+// clipped to [0, n).
+struct PoolingAxis {
+    int n, out_n, window, stride, offset;
+
+    int begin(int j) { return std::max(0, j * stride - offset); }
+    int end(int j) { return std::min(n, j * stride - offset + window); }
+};
+
+// Axes of the rows (0) and columns (1) of image_shape, with the result's
+// shape as built by conv2d.
+inline void poolingAxes(std::vector<int>& image_shape, int (&window)[2], std::string& padding,
+                        int (&strides)[2], PoolingAxis (&axes)[2]) {
+    bool padded = !padding.compare("same") && strides[0] == 1 && strides[1] == 1;
+
+    for (int i = 0; i < 2; i++) {
+        PoolingAxis& axis = axes[i];
+
+        axis.n = image_shape.rbegin()[1-i];
+        axis.window = window[i];
+        axis.stride = strides[i];
+
+        if (padded) {
+            axis.out_n = axis.n;
+            // ceil((window - 1) / 2), as Convolution2D pads before the image.
+            axis.offset = window[i] / 2;
+        }
+        else {
+            axis.out_n = (axis.n - window[i]) / strides[i] + 1;
+            axis.offset = 0;
+        }
+    }
+}
+
+// dst[j] = largest of the elements of src in window j of axis. deque has room
+// for axis.n indices.
+template <typename T>
+void windowMax(T* dst, const T* src, PoolingAxis& axis, int* deque) {
+    if (axis.window <= pooling_direct_window) {
+        for (int j = 0; j < axis.out_n; j++) {
+            int end = axis.end(j);
+
+            T largest = src[axis.begin(j)];
+            for (int i = axis.begin(j) + 1; i < end; i++)
+                largest = std::max(largest, src[i]);
+
+            dst[j] = largest;
+        }
+        return;
+    }
+
+    // Indices of decreasing elements, the window's largest at the head.
+    int head = 0, tail = 0, next = 0;
+    for (int j = 0; j < axis.out_n; j++) {
+        int begin = axis.begin(j), end = axis.end(j);
+
+        if (next < begin) {
+            head = tail = 0;
+            next = begin;
+        }
+
+        for (; next < end; next++) {
+            while (tail > head && src[deque[tail-1]] <= src[next])
+                tail--;
+
+            deque[tail++] = next;
+        }
+
+        while (deque[head] < begin)
+            head++;
+
+        dst[j] = src[deque[head]];
+    }
+}
+
+// dst[j] = sum of the elements of src in window j of axis.
+template <typename T, typename Sum>
+void windowSum(Sum* dst, const T* src, PoolingAxis& axis) {
+    Sum sum = 0;
+    int first = 0, next = 0;
+    for (int j = 0; j < axis.out_n; j++) {
+        int begin = axis.begin(j), end = axis.end(j);
+
+        if (next <= begin) {
+            sum = 0;
+            first = next = begin;
+        }
+
+        for (; next < end; next++)
+            sum += src[next];
+
+        for (; first < begin; first++)
+            sum -= src[first];
+
+        dst[j] = sum;
+    }
+}
+
+// Writes the rows x columns matrix src as a columns x rows one.
+template <typename In, typename Out>
+void transposeMatrix(Out* dst, const In* src, int rows, int columns) {
+    for (int y = 0; y < rows; y++) {
+        for (int x = 0; x < columns; x++)
+            dst[x * rows + y] = src[y * columns + x];
+    }
+}
+
+template <typename OpDType>
+void Pooling2D::compute(Buffer* out, Buffer* buf) {
+    PoolingAxis axes[2];
+    poolingAxes(buf->getShape(), window_, padding_, strides_, axes);
+
+    PoolingAxis& rows = axes[0];
+    PoolingAxis& columns = axes[1];
+
+    uint64_t image_size = static_cast<uint64_t>(rows.n) * columns.n;
+    uint64_t output_size = static_cast<uint64_t>(rows.out_n) * columns.out_n;
+    uint64_t images = buf->getElements() / image_size;
+
+    OpDType* in = buf->getBufferDataAsTemplate<OpDType>();
+    OpDType* o = out->getBufferDataAsTemplate<OpDType>();
+
+    // Integers are summed as int64_t, so averages round towards zero.
+    typedef typename std::conditional<std::is_floating_point<OpDType>::value, double, int64_t>::type Sum;
+
+    forEachRange(images, buf->getElements() >= pooling_parallel_threshold, [&](uint64_t first, uint64_t last) {
+        std::vector<int> deque(std::max(rows.n, columns.n));
+
+        if (pooling_ == PoolingType::MAX) {
+            std::vector<OpDType> across(rows.n * columns.out_n), transposed(across.size());
+            std::vector<OpDType> pooled(output_size);
+
+            for (uint64_t i = first; i < last; i++) {
+                for (int y = 0; y < rows.n; y++)
+                    windowMax(&across[y * columns.out_n], in + i * image_size + y * columns.n, columns, deque.data());
+
+                transposeMatrix(transposed.data(), across.data(), rows.n, columns.out_n);
+
+                for (int x = 0; x < columns.out_n; x++)
+                    windowMax(&pooled[x * rows.out_n], &transposed[x * rows.n], rows, deque.data());
+
+                transposeMatrix(o + i * output_size, pooled.data(), columns.out_n, rows.out_n);
+            }
+        }
+        else {
+            std::vector<Sum> across(rows.n * columns.out_n), transposed(across.size());
+            std::vector<Sum> pooled(output_size);
+
+            for (uint64_t i = first; i < last; i++) {
+                for (int y = 0; y < rows.n; y++)
+                    windowSum(&across[y * columns.out_n], in + i * image_size + y * columns.n, columns);
+
+                transposeMatrix(transposed.data(), across.data(), rows.n, columns.out_n);
+
+                for (int x = 0; x < columns.out_n; x++) {
+                    windowSum(&pooled[x * rows.out_n], &transposed[x * rows.n], rows);
+
+                    int width = columns.end(x) - columns.begin(x);
+                    for (int y = 0; y < rows.out_n; y++)
+                        pooled[x * rows.out_n + y] /= static_cast<Sum>(width) * (rows.end(y) - rows.begin(y));
+                }
+
+                transposeMatrix(o + i * output_size, pooled.data(), columns.out_n, rows.out_n);
+            }
+        }
+    });
+}
+
+// b1 is the gradient of the pooling's result, b2 its input (MAX only).
+template <typename OpDType>
+void Pooling2DGradient::compute(Buffer* out, Buffer* b1, Buffer* b2) {
+    PoolingAxis axes[2];
+    poolingAxes(out->getShape(), window_, padding_, strides_, axes);
+
+    PoolingAxis& rows = axes[0];
+    PoolingAxis& columns = axes[1];
+
+    uint64_t image_size = static_cast<uint64_t>(rows.n) * columns.n;
+    uint64_t output_size = static_cast<uint64_t>(rows.out_n) * columns.out_n;
+    uint64_t images = out->getElements() / image_size;
+
+    OpDType* grad = b1->getBufferDataAsTemplate<OpDType>();
+    OpDType* o = out->getBufferDataAsTemplate<OpDType>();
+
+    forEachRange(images, out->getElements() >= pooling_parallel_threshold, [&](uint64_t first, uint64_t last) {
+        std::fill(o + first * image_size, o + last * image_size, static_cast<OpDType>(0));
+
+        for (uint64_t i = first; i < last; i++) {
+            OpDType* image_grad = o + i * image_size;
+
+            for (int y = 0; y < rows.out_n; y++) {
+                for (int x = 0; x < columns.out_n; x++) {
+                    OpDType g = grad[i * output_size + y * columns.out_n + x];
+
+                    if (pooling_ == PoolingType::MAX) {
+                        OpDType* image = b2->getBufferDataAsTemplate<OpDType>() + i * image_size;
+
+                        int largest = rows.begin(y) * columns.n + columns.begin(x);
+                        for (int iy = rows.begin(y); iy < rows.end(y); iy++) {
+                            for (int ix = columns.begin(x); ix < columns.end(x); ix++) {
+                                if (image[iy * columns.n + ix] > image[largest])
+                                    largest = iy * columns.n + ix;
+                            }
+                        }
+
+                        image_grad[largest] += g;
+                    }
+                    else {
+                        int count = (rows.end(y) - rows.begin(y)) * (columns.end(x) - columns.begin(x));
+                        OpDType share = g / static_cast<OpDType>(count);
+
+                        for (int iy = rows.begin(y); iy < rows.end(y); iy++) {
+                            for (int ix = columns.begin(x); ix < columns.end(x); ix++)
+                                image_grad[iy * columns.n + ix] += share;
+                        }
+                    }
+                }
+            }
+        }
+    });
+}
+
+// Queries and keys Attention scores against each other at a time.
+const int attention_query_block = 32;
+const int attention_key_block = 64;
+// Query blocks with fewer queries (e.g. decoding a token at a time) score
+// keys straight from their rows, rather than transposing them first.
+const int attention_transpose_queries = 4;
+// Multiply-adds past which attention splits its blocks across threads.
+const uint64_t attention_parallel_threshold = 1 << 16;
+
+// The operands of an Attention, with every leading dimension taken as a head.
+//
+// Key j of a head (and its value) is in row keyRow(j) of the head's
+// key_rows, which wrap around from first_slot for a KVCache.
+struct AttentionShape {
+    uint64_t heads;
+    int queries, keys, depth, value_depth;
+    int key_rows, first_slot;
+    bool causal;
+
+    AttentionShape(Buffer* q, Buffer* k, Buffer* v, bool causal, KVCache* cache) {
+        this->queries = q->getShape().rbegin()[1];
+        this->key_rows = k->getShape().rbegin()[1];
+        this->keys = (cache != nullptr) ? cache->getLength() : key_rows;
+        this->first_slot = (cache != nullptr) ? cache->getFirstSlot() : 0;
+        this->depth = q->getShape().back();
+        this->value_depth = v->getShape().back();
+        this->heads = q->getElements() / (static_cast<uint64_t>(queries) * depth);
+        this->causal = causal;
+    }
+
+    int queryBlocks() { return (queries + attention_query_block - 1) / attention_query_block; }
+
+    uint64_t work() { return heads * queries * keys * (depth + value_depth); }
+
+    // Query i sees keys [0, visible(i)).
+    int visible(int i) { return causal ? std::max(0, std::min(keys, i + keys - queries + 1)) : keys; }
+
+    int keyRow(int j) {
+        int row = first_slot + j;
+        return (row < key_rows) ? row : row - key_rows;
+    }
+};
+
+// Writes keys [first_key, first_key + n) of a head's rows of `columns`
+// elements as a columns x n matrix.
+template <typename T>
+void transposeKeys(T* dst, const T* src, AttentionShape& shape, int first_key, int n, int columns) {
+    for (int j = 0; j < n; j++) {
+        const T* row = src + shape.keyRow(first_key + j) * columns;
+
+        for (int c = 0; c < columns; c++)
+            dst[c * n + j] = row[c];
+    }
+}
+
+// Scratch space of a thread going through attention blocks.
+template <typename T>
+struct AttentionTile {
+    std::vector<T> keys;      // A block of keys, transposed.
+    std::vector<T> values;    // A block of values, transposed (gradients only).
+    std::vector<T> scores;    // A query's scores against the block.
+    std::vector<T> products;  // Its gradient's products with the values.
+    std::vector<T> max;       // Softmax statistics of each query of a block.
+    std::vector<T> sum;
+    std::vector<T> dots;      // Gradient of each query's result . the result.
+
+    AttentionTile(AttentionShape& shape)
+        : keys(shape.depth * attention_key_block), values(shape.value_depth * attention_key_block),
+          scores(attention_key_block), products(attention_key_block), max(attention_query_block),
+          sum(attention_query_block), dots(attention_query_block) {}
+};
+
+// scores[j] = scale * q . k_j for the first n keys of a block, kept
+// transposed in `keys` (depth rows of `stride` elements).
+template <typename T>
+void attentionScores(T* scores, const T* q, const T* keys, int n, int stride, int depth, T scale) {
+    std::fill(scores, scores + n, T(0));
+
+    for (int c = 0; c < depth; c++) {
+        T factor = q[c] * scale;
+        const T* key = keys + c * stride;
+
+        for (int j = 0; j < n; j++)
+            scores[j] += factor * key[j];
+    }
+}
+
+// Results of the queries [first_query, first_query + attention_query_block)
+// of a head, accumulated one block of keys at a time (see Attention).
+template <typename T>
+void attentionBlock(T* o, T* q, T* k, T* v, AttentionShape& shape, int first_query, T scale,
+                    AttentionTile<T>& tile) {
+    int queries = std::min(attention_query_block, shape.queries - first_query);
+    int last_key = shape.visible(first_query + queries - 1);
+
+    bool transposed = queries >= attention_transpose_queries;
+
+    std::fill(o + first_query * shape.value_depth, o + (first_query + queries) * shape.value_depth, T(0));
+    std::fill(tile.sum.begin(), tile.sum.end(), T(0));
+
+    for (int first_key = 0; first_key < last_key; first_key += attention_key_block) {
+        int keys = std::min(attention_key_block, last_key - first_key);
+
+        if (transposed)
+            transposeKeys(tile.keys.data(), k, shape, first_key, keys, shape.depth);
+
+        for (int i = 0; i < queries; i++) {
+            int n = std::min(keys, shape.visible(first_query + i) - first_key);
+            if (n <= 0)
+                continue;
+
+            T* scores = tile.scores.data();
+            T* query = q + (first_query + i) * shape.depth;
+            T* y = o + (first_query + i) * shape.value_depth;
+
+            if (transposed)
+                attentionScores(scores, query, tile.keys.data(), n, keys, shape.depth, scale);
+            else {
+                for (int j = 0; j < n; j++)
+                    scores[j] = scale * simd::dot(query, k + shape.keyRow(first_key + j) * shape.depth, shape.depth);
+            }
+
+            // What has been accumulated so far is relative to the old max.
+            T block_max = simd::reduce(scores, n, scores[0], simd::Max());
+            if (first_key == 0)
+                tile.max[i] = block_max;
+            else if (block_max > tile.max[i]) {
+                T correction = vmath::exp(tile.max[i] - block_max);
+
+                tile.sum[i] *= correction;
+                for (int c = 0; c < shape.value_depth; c++)
+                    y[c] *= correction;
+
+                tile.max[i] = block_max;
+            }
+
+            for (int j = 0; j < n; j++)
+                scores[j] -= tile.max[i];
+
+            vmath::exp(scores, scores, n);
+            tile.sum[i] += simd::reduce(scores, n, T(0), simd::Add());
+
+            for (int j = 0; j < n; j++) {
+                T* value = v + shape.keyRow(first_key + j) * shape.value_depth;
+
+                for (int c = 0; c < shape.value_depth; c++)
+                    y[c] += scores[j] * value[c];
+            }
+        }
+    }
+
+    // Queries which see no keys are left at 0.
+    for (int i = 0; i < queries; i++) {
+        T* y = o + (first_query + i) * shape.value_depth;
+        T inverse = (tile.sum[i] > 0) ? 1 / tile.sum[i] : T(0);
+
+        for (int c = 0; c < shape.value_depth; c++)
+            y[c] *= inverse;
+    }
+}
+
+// The log of the sum of exponentials of every query's scores of a block,
+// into tile.max, gathered as attentionBlock() does.
+template <typename T>
+void attentionLogSums(T* q, T* k, AttentionShape& shape, int first_query, T scale, AttentionTile<T>& tile) {
+    int queries = std::min(attention_query_block, shape.queries - first_query);
+    int last_key = shape.visible(first_query + queries - 1);
+
+    std::fill(tile.sum.begin(), tile.sum.end(), T(0));
+
+    for (int first_key = 0; first_key < last_key; first_key += attention_key_block) {
+        int keys = std::min(attention_key_block, last_key - first_key);
+        transposeKeys(tile.keys.data(), k, shape, first_key, keys, shape.depth);
+
+        for (int i = 0; i < queries; i++) {
+            int n = std::min(keys, shape.visible(first_query + i) - first_key);
+            if (n <= 0)
+                continue;
+
+            T* scores = tile.scores.data();
+            attentionScores(scores, q + (first_query + i) * shape.depth, tile.keys.data(), n, keys,
+                            shape.depth, scale);
+
+            T block_max = simd::reduce(scores, n, scores[0], simd::Max());
+            if (first_key == 0)
+                tile.max[i] = block_max;
+            else if (block_max > tile.max[i]) {
+                tile.sum[i] *= vmath::exp(tile.max[i] - block_max);
+                tile.max[i] = block_max;
+            }
+
+            for (int j = 0; j < n; j++)
+                scores[j] -= tile.max[i];
+
+            vmath::exp(scores, scores, n);
+            tile.sum[i] += simd::reduce(scores, n, T(0), simd::Add());
+        }
+    }
+
+    for (int i = 0; i < queries; i++)
+        tile.max[i] += std::log(tile.sum[i]);
+}
+
+// Adds what the queries [first_query, first_query + attention_query_block)
+// of a head contribute to the gradient with respect to q (wrt == 0), k (1)
+// or v (2) into out. With p the softmax of the scores s and g the gradient
+// of the result o:
+//
+// dv_j == sum_i p_ij g_i
+// ds_ij == p_ij * (g_i . v_j - g_i . o_i) * scale
+// dq_i == sum_j ds_ij k_j,  dk_j == sum_i ds_ij q_i
+template <typename T>
+void attentionGradientBlock(T* out, int wrt, T* grad, T* q, T* k, T* v, T* o, AttentionShape& shape,
+                            int first_query, T scale, AttentionTile<T>& tile) {
+    int queries = std::min(attention_query_block, shape.queries - first_query);
+    int last_key = shape.visible(first_query + queries - 1);
+
+    attentionLogSums(q, k, shape, first_query, scale, tile);
+
+    for (int i = 0; wrt != 2 && i < queries; i++) {
+        T* g = grad + (first_query + i) * shape.value_depth;
+        T* y = o + (first_query + i) * shape.value_depth;
+
+        tile.dots[i] = 0;
+        for (int c = 0; c < shape.value_depth; c++)
+            tile.dots[i] += g[c] * y[c];
+    }
+
+    for (int first_key = 0; first_key < last_key; first_key += attention_key_block) {
+        int keys = std::min(attention_key_block, last_key - first_key);
+        transposeKeys(tile.keys.data(), k, shape, first_key, keys, shape.depth);
+
+        if (wrt != 2)
+            transposeKeys(tile.values.data(), v, shape, first_key, keys, shape.value_depth);
+
+        for (int i = 0; i < queries; i++) {
+            int n = std::min(keys, shape.visible(first_query + i) - first_key);
+            if (n <= 0)
+                continue;
+
+            T* p = tile.scores.data();
+            T* g = grad + (first_query + i) * shape.value_depth;
+
+            attentionScores(p, q + (first_query + i) * shape.depth, tile.keys.data(), n, keys,
+                            shape.depth, scale);
+
+            for (int j = 0; j < n; j++)
+                p[j] -= tile.max[i];
+
+            vmath::exp(p, p, n);
+
+            if (wrt == 2) {
+                for (int j = 0; j < n; j++) {
+                    T* dv = out + shape.keyRow(first_key + j) * shape.value_depth;
+
+                    for (int c = 0; c < shape.value_depth; c++)
+                        dv[c] += p[j] * g[c];
+                }
+                continue;
+            }
+
+            T* ds = tile.products.data();
+            attentionScores(ds, g, tile.values.data(), n, keys, shape.value_depth, T(1));
+
+            for (int j = 0; j < n; j++)
+                ds[j] = p[j] * (ds[j] - tile.dots[i]) * scale;
+
+            if (wrt == 0) {
+                T* dq = out + (first_query + i) * shape.depth;
+
+                for (int j = 0; j < n; j++) {
+                    T* key = k + shape.keyRow(first_key + j) * shape.depth;
+
+                    for (int c = 0; c < shape.depth; c++)
+                        dq[c] += ds[j] * key[c];
+                }
+            }
+            else {
+                T* query = q + (first_query + i) * shape.depth;
+
+                for (int j = 0; j < n; j++) {
+                    T* dk = out + shape.keyRow(first_key + j) * shape.depth;
+
+                    for (int c = 0; c < shape.depth; c++)
+                        dk[c] += ds[j] * query[c];
+                }
+            }
+        }
+    }
+}
+
+template <typename OpDType>
+void Attention::compute(Buffer* out, std::vector<Buffer*>& inputs) {
+    AttentionShape shape(inputs[0], inputs[1], inputs[2], causal_, cache_);
+
+    OpDType* q = inputs[0]->getBufferDataAsTemplate<OpDType>();
+    OpDType* k = inputs[1]->getBufferDataAsTemplate<OpDType>();
+    OpDType* v = inputs[2]->getBufferDataAsTemplate<OpDType>();
+    OpDType* o = out->getBufferDataAsTemplate<OpDType>();
+
+    uint64_t blocks = shape.queryBlocks();
+
+    forEachRange(shape.heads * blocks, shape.work() >= attention_parallel_threshold, [&](uint64_t first, uint64_t last) {
+        AttentionTile<OpDType> tile(shape);
+
+        for (uint64_t item = first; item < last; item++) {
+            uint64_t h = item / blocks;
+
+            attentionBlock<OpDType>(o + h * shape.queries * shape.value_depth, q + h * shape.queries * shape.depth,
+                                    k + h * shape.key_rows * shape.depth, v + h * shape.key_rows * shape.value_depth,
+                                    shape, (item % blocks) * attention_query_block, scale_, tile);
+        }
+    });
+}
+
+// inputs: the gradient of the attention's result, q, k, v and the result.
+template <typename OpDType>
+void AttentionGradient::compute(Buffer* out, std::vector<Buffer*>& inputs) {
+    AttentionShape shape(inputs[1], inputs[2], inputs[3], causal_, nullptr);
+
+    OpDType* grad = inputs[0]->getBufferDataAsTemplate<OpDType>();
+    OpDType* q = inputs[1]->getBufferDataAsTemplate<OpDType>();
+    OpDType* k = inputs[2]->getBufferDataAsTemplate<OpDType>();
+    OpDType* v = inputs[3]->getBufferDataAsTemplate<OpDType>();
+    OpDType* o = inputs[4]->getBufferDataAsTemplate<OpDType>();
+    OpDType* d = out->getBufferDataAsTemplate<OpDType>();
+
+    uint64_t out_head = out->getElements() / shape.heads;
+
+    // Every query block of a head adds to all of dk and dv, so those are only
+    // split by head, while dq is split by query block as well.
+    uint64_t blocks = (wrt_ == 0) ? shape.queryBlocks() : 1;
+
+    std::fill(d, d + out->getElements(), static_cast<OpDType>(0));
+
+    forEachRange(shape.heads * blocks, 2 * shape.work() >= attention_parallel_threshold, [&](uint64_t first, uint64_t last) {
+        AttentionTile<OpDType> tile(shape);
+
+        for (uint64_t item = first; item < last; item++) {
+            uint64_t h = item / blocks;
+
+            int first_query = (item % blocks) * attention_query_block;
+            int last_query = (wrt_ == 0) ? first_query + 1 : shape.queries;
+
+            for (; first_query < last_query; first_query += attention_query_block) {
+                attentionGradientBlock<OpDType>(d + h * out_head, wrt_,
+                                                grad + h * shape.queries * shape.value_depth,
+                                                q + h * shape.queries * shape.depth, k + h * shape.key_rows * shape.depth,
+                                                v + h * shape.key_rows * shape.value_depth,
+                                                o + h * shape.queries * shape.value_depth,
+                                                shape, first_query, scale_, tile);
+            }
+        }
+    });
+}
+
+// Columns of a packed weight panel, i.e. the accumulators a row keeps in registers.
+const int recurrent_panel = 16;
+// Multiply-adds past which a recurrent layer's products are split across threads.
+const uint64_t recurrent_parallel_threshold = 1 << 15;
+
+struct RecurrentShape {
+    int batch, time, input, hidden, gates;
+
+    RecurrentShape(Buffer* x, Buffer* hidden_weights, RecurrentType recurrent) {
+        this->batch = x->getShape()[0];
+        this->time = x->getShape()[1];
+        this->input = x->getShape()[2];
+        this->hidden = hidden_weights->getShape()[0];
+        this->gates = (recurrent == RecurrentType::LSTM) ? 4 : 3;
+    }
+
+    int columns() { return gates * hidden; }
+    int panels() { return (columns() + recurrent_panel - 1) / recurrent_panel; }
+};
+
+// Gates and states of a recurrent layer's steps, kept for its gradient: the
+// activated gates [time, batch, gates * hidden] and either the LSTM's cell
+// state or the GRU's hidden projection of its new gate [time, batch, hidden].
+template <typename T>
+struct RecurrentTrace {
+    std::vector<T> gates;
+    std::vector<T> states;
+};
+
+// Packs the rows x columns matrix w into panels of recurrent_panel columns,
+// each of them rows x recurrent_panel (the last one padded with zeros).
+template <typename T>
+void packPanels(std::vector<T>& packed, const T* w, int rows, int columns) {
+    int panels = (columns + recurrent_panel - 1) / recurrent_panel;
+    packed.assign(static_cast<uint64_t>(panels) * rows * recurrent_panel, T(0));
+
+    for (int p = 0; p < panels; p++) {
+        int width = std::min(recurrent_panel, columns - p * recurrent_panel);
+
+        for (int r = 0; r < rows; r++) {
+            for (int j = 0; j < width; j++)
+                packed[(static_cast<uint64_t>(p) * rows + r) * recurrent_panel + j] = w[r * columns + p * recurrent_panel + j];
+        }
+    }
+}
+
+// c[i] = a[i] w (+ bias) for rows [first_row, last_row) of a, only for the
+// columns of panels [first_panel, last_panel) of w, as packed by packPanels().
+template <typename T>
+void panelProduct(T* c, const T* a, const T* packed, const T* bias, int depth, int columns,
+                  uint64_t first_row, uint64_t last_row, int first_panel, int last_panel) {
+    for (uint64_t i = first_row; i < last_row; i++) {
+        const T* row = a + i * depth;
+
+        for (int p = first_panel; p < last_panel; p++) {
+            int first_column = p * recurrent_panel;
+            int width = std::min(recurrent_panel, columns - first_column);
+            const T* panel = packed + static_cast<uint64_t>(p) * depth * recurrent_panel;
+
+            T acc[recurrent_panel] = {};
+            for (int j = 0; bias != nullptr && j < width; j++)
+                acc[j] = bias[first_column + j];
+
+            for (int k = 0; k < depth; k++) {
+                T factor = row[k];
+                const T* w = panel + k * recurrent_panel;
+
+                for (int j = 0; j < recurrent_panel; j++)
+                    acc[j] += factor * w[j];
+            }
+
+            for (int j = 0; j < width; j++)
+                c[i * columns + first_column + j] = acc[j];
+        }
+    }
+}
+
+template <typename T>
+const T* Recurrent::packedWeights(int weights, Buffer* buf, int rows, int columns, std::vector<T>& scratch) {
+    const T* w = buf->getBufferDataAsTemplate<T>();
+
+    // Fed weights may change from run to run (and context to context).
+    if (buf != getParents()[weights + 1]->getBuffer()) {
+        packPanels(scratch, w, rows, columns);
+        return scratch.data();
+    }
+
+    std::lock_guard<std::mutex> lock(packing_);
+
+    std::vector<char>& packed = packed_[weights];
+    if (packed_buffers_[weights] != buf || packed_versions_[weights] != buf->getVersion() || packed.empty()) {
+        packPanels(scratch, w, rows, columns);
+        packed.assign(reinterpret_cast<char*>(scratch.data()), reinterpret_cast<char*>(scratch.data() + scratch.size()));
+
+        packed_buffers_[weights] = buf;
+        packed_versions_[weights] = buf->getVersion();
+    }
+
+    return reinterpret_cast<const T*>(packed.data());
+}
+
+// Runs a recurrent layer over x, writing every step's hidden state to
+// h_out [batch, time, hidden], and its gates and states to `trace` if given.
+// The weights are packed by packPanels().
+template <typename T>
+void recurrentForward(T* h_out, RecurrentType recurrent, const T* x, const T* packed_input,
+                      const T* packed_hidden, const T* bias, RecurrentShape& shape, RecurrentTrace<T>* trace) {
+    int H = shape.hidden;
+    int columns = shape.columns();
+    int panels = shape.panels();
+    uint64_t rows = static_cast<uint64_t>(shape.batch) * shape.time;
+
+    // Input projections of every step, [batch * time, columns].
+    std::vector<T> projections(rows * columns);
+    forEachRange(rows, rows * shape.input * columns >= recurrent_parallel_threshold, [&](uint64_t first, uint64_t last) {
+        panelProduct(projections.data(), x, packed_input, bias, shape.input, columns, first, last, 0, panels);
+    });
+
+    std::vector<T> h(shape.batch * H, T(0)), c(shape.batch * H, T(0)), tanh_c(H);
+    std::vector<T> products(shape.batch * columns);
+
+    bool parallel = static_cast<uint64_t>(shape.batch) * H * columns >= recurrent_parallel_threshold;
+
+    for (int t = 0; t < shape.time; t++) {
+        forEachRange(panels, parallel, [&](uint64_t first, uint64_t last) {
+            panelProduct(products.data(), h.data(), packed_hidden, static_cast<const T*>(nullptr), H, columns,
+                         0, shape.batch, first, last);
+        });
+
+        for (int b = 0; b < shape.batch; b++) {
+            T* gates = &products[b * columns];
+            const T* projection = &projections[(static_cast<uint64_t>(b) * shape.time + t) * columns];
+            T* state = (trace != nullptr) ? &trace->states[(static_cast<uint64_t>(t) * shape.batch + b) * H] : nullptr;
+            T* hb = &h[b * H];
+
+            if (recurrent == RecurrentType::LSTM) {
+                T* cb = &c[b * H];
+
+                for (int j = 0; j < columns; j++)
+                    gates[j] += projection[j];
+
+                activate<T, false>(gates, gates, 2 * H, ActivationType::SIGMOID);
+                activate<T, false>(gates + 2 * H, gates + 2 * H, H, ActivationType::TANH);
+                activate<T, false>(gates + 3 * H, gates + 3 * H, H, ActivationType::SIGMOID);
+
+                for (int u = 0; u < H; u++)
+                    cb[u] = gates[H + u] * cb[u] + gates[u] * gates[2 * H + u];
+
+                activate<T, false>(tanh_c.data(), cb, H, ActivationType::TANH);
+
+                for (int u = 0; u < H; u++)
+                    hb[u] = gates[3 * H + u] * tanh_c[u];
+
+                if (state != nullptr)
+                    std::copy(cb, cb + H, state);
+            }
+            else {
+                // The reset gate applies to the new gate's hidden projection alone.
+                if (state != nullptr)
+                    std::copy(gates + 2 * H, gates + 3 * H, state);
+
+                for (int j = 0; j < 2 * H; j++)
+                    gates[j] += projection[j];
+
+                activate<T, false>(gates, gates, 2 * H, ActivationType::SIGMOID);
+
+                for (int u = 0; u < H; u++)
+                    gates[2 * H + u] = projection[2 * H + u] + gates[u] * gates[2 * H + u];
+
+                activate<T, false>(gates + 2 * H, gates + 2 * H, H, ActivationType::TANH);
+
+                for (int u = 0; u < H; u++)
+                    hb[u] = (1 - gates[H + u]) * gates[2 * H + u] + gates[H + u] * hb[u];
+            }
+
+            if (trace != nullptr)
+                std::copy(gates, gates + columns, &trace->gates[(static_cast<uint64_t>(t) * shape.batch + b) * columns]);
+
+            std::copy(hb, hb + H, h_out + (static_cast<uint64_t>(b) * shape.time + t) * H);
+        }
+    }
+}
+
+template <typename OpDType>
+void Recurrent::compute(Buffer* out, std::vector<Buffer*>& inputs) {
+    RecurrentShape shape(inputs[0], inputs[2], recurrent_);
+
+    std::vector<OpDType> scratch_input, scratch_hidden;
+    const OpDType* packed_input = packedWeights(0, inputs[1], shape.input, shape.columns(), scratch_input);
+    const OpDType* packed_hidden = packedWeights(1, inputs[2], shape.hidden, shape.columns(), scratch_hidden);
+
+    recurrentForward<OpDType>(out->getBufferDataAsTemplate<OpDType>(), recurrent_,
+                              inputs[0]->getBufferDataAsTemplate<OpDType>(), packed_input, packed_hidden,
+                              inputs[3]->getBufferDataAsTemplate<OpDType>(), shape, nullptr);
+}
+
+// inputs: the gradient of the layer's result, x, the input and hidden weights and the bias.
+//
+// Going back from the last step, with dh the gradient of a step's hidden
+// state (from its result and the following step), the gradients of its
+// gates' pre-activations are worked out from the trace. They then give the
+// previous step's dh through the hidden weights, and the step's share of
+// every gradient.
+template <typename OpDType>
+void RecurrentGradient::compute(Buffer* out, std::vector<Buffer*>& inputs) {
+    typedef OpDType T;
+    using A = Activations<T, false>;
+
+    RecurrentShape shape(inputs[1], inputs[3], recurrent_);
+
+    int H = shape.hidden;
+    int columns = shape.columns();
+    uint64_t steps = static_cast<uint64_t>(shape.batch) * shape.time;
+
+    T* grad = inputs[0]->getBufferDataAsTemplate<T>();
+    T* x = inputs[1]->getBufferDataAsTemplate<T>();
+    T* input_weights = inputs[2]->getBufferDataAsTemplate<T>();
+    T* hidden_weights = inputs[3]->getBufferDataAsTemplate<T>();
+    T* bias = inputs[4]->getBufferDataAsTemplate<T>();
+
+    // The gradients, laid out one after the other.
+    T* dx = out->getBufferDataAsTemplate<T>();
+    T* d_input_weights = dx + inputs[1]->getElements();
+    T* d_hidden_weights = d_input_weights + inputs[2]->getElements();
+    T* d_bias = d_hidden_weights + inputs[3]->getElements();
+
+    std::vector<T> hs(steps * H);
+    RecurrentTrace<T> trace;
+    trace.gates.resize(steps * columns);
+    trace.states.resize(steps * H);
+
+    std::vector<T> scratch_input, scratch_hidden;
+    const T* packed_input = layer_->packedWeights(0, inputs[2], shape.input, columns, scratch_input);
+    const T* packed_hidden = layer_->packedWeights(1, inputs[3], H, columns, scratch_hidden);
+
+    recurrentForward<T>(hs.data(), recurrent_, x, packed_input, packed_hidden, bias, shape, &trace);
+
+    std::fill(dx, dx + out->getElements(), T(0));
+
+    std::vector<T> dh(shape.batch * H, T(0)), dh_prev(shape.batch * H), dc(shape.batch * H, T(0));
+    std::vector<T> da_x(columns), da_h(columns), direct(H, T(0)), zeros(H, T(0));
+
+    for (int t = shape.time - 1; t >= 0; t--) {
+        for (int b = 0; b < shape.batch; b++) {
+            uint64_t step = static_cast<uint64_t>(b) * shape.time + t;
+            uint64_t traced = static_cast<uint64_t>(t) * shape.batch + b;
+
+            const T* g = grad + step * H;
+            const T* gates = &trace.gates[traced * columns];
+            const T* h_prev = (t > 0) ? &hs[(step - 1) * H] : zeros.data();
+            T* dhb = &dh[b * H];
+
+            for (int u = 0; u < H; u++)
+                dhb[u] += g[u];
+
+            if (recurrent_ == RecurrentType::LSTM) {
+                const T* cell = &trace.states[traced * H];
+                const T* c_prev = (t > 0) ? &trace.states[(traced - shape.batch) * H] : zeros.data();
+                T* dcb = &dc[b * H];
+
+                for (int u = 0; u < H; u++) {
+                    T i = gates[u], f = gates[H + u], n = gates[2 * H + u], o = gates[3 * H + u];
+                    T tc = A::tanh(cell[u]);
+                    T dcu = dhb[u] * o * (1 - tc * tc) + dcb[u];
+
+                    da_x[u] = dcu * n * i * (1 - i);
+                    da_x[H + u] = dcu * c_prev[u] * f * (1 - f);
+                    da_x[2 * H + u] = dcu * i * (1 - n * n);
+                    da_x[3 * H + u] = dhb[u] * tc * o * (1 - o);
+
+                    dcb[u] = dcu * f;
+                }
+
+                std::copy(da_x.begin(), da_x.end(), da_h.begin());
+            }
+            else {
+                const T* hidden_new = &trace.states[traced * H];
+
+                for (int u = 0; u < H; u++) {
+                    T r = gates[u], z = gates[H + u], n = gates[2 * H + u];
+                    T dan = dhb[u] * (1 - z) * (1 - n * n);
+
+                    da_x[u] = dan * hidden_new[u] * r * (1 - r);
+                    da_x[H + u] = dhb[u] * (h_prev[u] - n) * z * (1 - z);
+                    da_x[2 * H + u] = dan;
+
+                    da_h[u] = da_x[u];
+                    da_h[H + u] = da_x[H + u];
+                    da_h[2 * H + u] = dan * r;
+
+                    direct[u] = dhb[u] * z;
+                }
+            }
+
+            for (int k = 0; k < H; k++)
+                dh_prev[b * H + k] = direct[k] + simd::dot(da_h.data(), hidden_weights + k * columns, columns);
+
+            for (int m = 0; m < shape.input; m++) {
+                T xm = x[step * shape.input + m];
+                T* row = d_input_weights + m * columns;
+
+                dx[step * shape.input + m] = simd::dot(da_x.data(), input_weights + m * columns, columns);
+                for (int j = 0; j < columns; j++)
+                    row[j] += xm * da_x[j];
+            }
+
+            for (int k = 0; k < H; k++) {
+                T hk = h_prev[k];
+                T* row = d_hidden_weights + k * columns;
+
+                for (int j = 0; j < columns; j++)
+                    row[j] += hk * da_h[j];
+            }
+
+            for (int j = 0; j < columns; j++)
+                d_bias[j] += da_x[j];
+        }
+
+        dh.swap(dh_prev);
+    }
+}
+
+// Indices ahead of the one being copied whose rows are prefetched.
+const uint64_t gather_prefetch_distance = 8;
+// Cache lines of a row prefetched, past which the hardware prefetcher has caught on.
+const uint64_t gather_prefetch_lines = 8;
+// Elements copied or added past which a gather or scatter is split across threads.
+const uint64_t gather_parallel_threshold = 1 << 15;
+
+// Calls f with the data of an INT32 or INT64 index buffer.
+template <typename F>
+void withIndices(Buffer* indices, F f) {
+    switch (indices->getDataType()) {
+      case DataType::INT32:
+        f(indices->getBufferDataAsTemplate<int32_t>());
+        return;
+
+      case DataType::INT64:
+        f(indices->getBufferDataAsTemplate<int64_t>());
+        return;
+
+      default:
+        std::cout << "ERROR: Indices must be INT32 or INT64!" << std::endl;
+        assert(false);
+    }
+}
+
+// A table gathered from (or scattered to) along an axis, as `outer` blocks
+// of `rows` slices of `inner` elements, picked by `indices` indices.
+struct GatherShape {
+    uint64_t outer = 1, rows, inner = 1, indices;
+
+    GatherShape(Buffer* table, Buffer* indices, int axis) {
+        std::vector<int>& shape = table->getShape();
+
+        for (int i = 0; i < axis; i++)
+            outer *= shape[i];
+        for (int i = axis + 1; i < shape.size(); i++)
+            inner *= shape[i];
+
+        this->rows = shape[axis];
+        this->indices = indices->getElements();
+    }
+
+    // Slice of the table the given index stands for.
+    template <typename I>
+    uint64_t row(I index) {
+        if (static_cast<uint64_t>(index) >= rows) {
+            std::cout << "ERROR: Index " << index << " out of range for " << rows << " rows!" << std::endl;
+            assert(false);
+        }
+
+        return index;
+    }
+};
+
+template <typename T>
+void prefetchRow(const T* row, uint64_t inner) {
+    const char* bytes = reinterpret_cast<const char*>(row);
+    uint64_t lines = std::min(gather_prefetch_lines, (inner * sizeof(T) + 63) / 64);
+
+    for (uint64_t l = 0; l < lines; l++)
+        __builtin_prefetch(bytes + l * 64);
+}
+
+// dst[o, idx[j]] += updates[o, j] for the slices [first, last) of dst,
+// counted across its blocks (i.e. slice r of block o is o * rows + r).
+// Every index is gone through, only the ones in range being added.
+template <typename T, typename I>
+void scatterRows(T* dst, const T* updates, const I* idx, GatherShape& shape, uint64_t first, uint64_t last) {
+    uint64_t rows = shape.rows, inner = shape.inner;
+
+    for (uint64_t o = first / rows; o * rows < last; o++) {
+        uint64_t low = std::max(first, o * rows) - o * rows;
+        uint64_t high = std::min(last, (o + 1) * rows) - o * rows;
+
+        T* block = dst + o * rows * inner;
+        const T* source = updates + o * shape.indices * inner;
+
+        for (uint64_t j = 0; j < shape.indices; j++) {
+            uint64_t r = shape.row(idx[j]);
+            if (r < low || r >= high)
+                continue;
+
+            T* row = block + r * inner;
+            const T* update = source + j * inner;
+            for (uint64_t k = 0; k < inner; k++)
+                row[k] += update[k];
+        }
+    }
+}
+
+// Adds the slices of `updates` to dst at `indices`, see ScatterAdd.
+template <typename T>
+void scatterAdd(T* dst, Buffer* indices, const T* updates, GatherShape& shape) {
+    bool parallel = shape.outer * shape.indices * shape.inner >= gather_parallel_threshold;
+
+    withIndices(indices, [&](auto* idx) {
+        forEachRange(shape.outer * shape.rows, parallel, [&](uint64_t first, uint64_t last) {
+            scatterRows(dst, updates, idx, shape, first, last);
+        });
+    });
+}
+
+template <typename OpDType>
+void Gather::compute(Buffer* out, Buffer* b1, Buffer* b2) {
+    GatherShape shape(b1, b2, axis_);
+
+    const OpDType* table = b1->getBufferDataAsTemplate<OpDType>();
+    OpDType* result = out->getBufferDataAsTemplate<OpDType>();
+
+    uint64_t n = shape.indices, rows = shape.rows, inner = shape.inner;
+    bool parallel = shape.outer * n * inner >= gather_parallel_threshold;
+
+    withIndices(b2, [&](auto* idx) {
+        forEachRange(shape.outer * n, parallel, [&](uint64_t first, uint64_t last) {
+            for (uint64_t i = first; i < last; i++) {
+                uint64_t ahead = i + gather_prefetch_distance;
+                if (ahead < last && static_cast<uint64_t>(idx[ahead % n]) < rows)
+                    prefetchRow(table + ((ahead / n) * rows + idx[ahead % n]) * inner, inner);
+
+                const OpDType* row = table + ((i / n) * rows + shape.row(idx[i % n])) * inner;
+                std::copy(row, row + inner, result + i * inner);
+            }
+        });
+    });
+}
+
+template <typename OpDType>
+void GatherGradient::compute(Buffer* out, Buffer* b1, Buffer* b2) {
+    GatherShape shape(out, b2, axis_);
+
+    OpDType* result = out->getBufferDataAsTemplate<OpDType>();
+    std::fill(result, result + out->getElements(), OpDType(0));
+
+    scatterAdd(result, b2, b1->getBufferDataAsTemplate<OpDType>(), shape);
+}
+
+template <typename OpDType>
+void ScatterAdd::compute(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* target = inputs[0];
+    GatherShape shape(target, inputs[1], axis_);
+
+    const OpDType* source = target->getBufferDataAsTemplate<OpDType>();
+    OpDType* result = out->getBufferDataAsTemplate<OpDType>();
+    if (result != source)
+        std::copy(source, source + target->getElements(), result);
+
+    scatterAdd(result, inputs[1], inputs[2]->getBufferDataAsTemplate<OpDType>(), shape);
+}
+
+// Multiply-adds past which a sparse product is split across threads.
+const uint64_t sparse_parallel_threshold = 1 << 15;
+// Columns of the result a task of S^T D goes through at least.
+const uint64_t sparse_column_block = 16;
+
+// Elements of a SparseMatrix by row: row r holds elements [offsets[r],
+// offsets[r + 1]). The rows of a COO matrix are counted into offsets here.
+template <typename T>
+struct SparseRows {
+    int rows, columns;
+    uint64_t non_zeros;
+
+    const int64_t* offsets;
+    const int32_t* column_indices;
+    const T* values;
+
+    std::vector<int64_t> counted;
+
+    SparseRows(SparseMatrix* sparse, Buffer* row_buf, Buffer* column_buf, Buffer* value_buf) {
+        this->rows = sparse->getRows();
+        this->columns = sparse->getColumns();
+        this->non_zeros = value_buf->getElements();
+        this->column_indices = column_buf->getBufferDataAsTemplate<int32_t>();
+        this->values = value_buf->getBufferDataAsTemplate<T>();
+
+        if (sparse->getFormat() == SparseFormat::CSR) {
+            this->offsets = row_buf->getBufferDataAsTemplate<int64_t>();
+            return;
+        }
+
+        const int32_t* row_indices = row_buf->getBufferDataAsTemplate<int32_t>();
+
+        counted.assign(rows + 1, 0);
+        for (uint64_t e = 0; e < non_zeros; e++)
+            counted[row_indices[e] + 1]++;
+
+        std::partial_sum(counted.begin(), counted.end(), counted.begin());
+        this->offsets = counted.data();
+    }
+};
+
+template <typename OpDType>
+void SparseToDense::compute(Buffer* out, std::vector<Buffer*>& inputs) {
+    SparseRows<OpDType> s(sparse_, inputs[0], inputs[1], inputs[2]);
+
+    OpDType* result = out->getBufferDataAsTemplate<OpDType>();
+    uint64_t columns = s.columns;
+
+    forEachRange(s.rows, s.rows * columns >= sparse_parallel_threshold, [&](uint64_t first, uint64_t last) {
+        std::fill(result + first * columns, result + last * columns, OpDType(0));
+
+        for (uint64_t r = first; r < last; r++) {
+            for (int64_t e = s.offsets[r]; e < s.offsets[r + 1]; e++)
+                result[r * columns + s.column_indices[e]] = s.values[e];
+        }
+    });
+}
+
+template <typename OpDType>
+void SparseMatrixMultiplication::compute(Buffer* out, std::vector<Buffer*>& inputs) {
+    SparseRows<OpDType> s(sparse_, inputs[1], inputs[2], inputs[3]);
+
+    const OpDType* dense = inputs[0]->getBufferDataAsTemplate<OpDType>();
+    OpDType* result = out->getBufferDataAsTemplate<OpDType>();
+
+    const int64_t* offsets = s.offsets;
+    const int32_t* columns = s.column_indices;
+    const OpDType* values = s.values;
+
+    // S D: every row of the result adds up the rows of D its elements pick.
+    if (sparse_first_ && !transposed_) {
+        uint64_t n = inputs[0]->getElements() / s.columns;
+        bool parallel = s.non_zeros * n >= sparse_parallel_threshold;
+
+        forEachRange(s.rows, parallel, [&](uint64_t first, uint64_t last) {
+            for (uint64_t r = first; r < last; r++) {
+                OpDType* row = result + r * n;
+
+                if (n == 1) {
+                    OpDType sum = 0;
+                    for (int64_t e = offsets[r]; e < offsets[r + 1]; e++)
+                        sum += values[e] * dense[columns[e]];
+
+                    row[0] = sum;
+                    continue;
+                }
+
+                std::fill(row, row + n, OpDType(0));
+                for (int64_t e = offsets[r]; e < offsets[r + 1]; e++) {
+                    OpDType value = values[e];
+                    const OpDType* picked = dense + static_cast<uint64_t>(columns[e]) * n;
+
+                    for (uint64_t j = 0; j < n; j++)
+                        row[j] += value * picked[j];
+                }
+            }
+        });
+    }
+
+    // S^T D: every row of D is added to the rows of the result its row of
+    // S has elements in, so tasks take columns of the result to not collide.
+    else if (sparse_first_) {
+        uint64_t n = inputs[0]->getElements() / s.rows;
+        uint64_t blocks = (n + sparse_column_block - 1) / sparse_column_block;
+        bool parallel = s.non_zeros * n >= sparse_parallel_threshold;
+
+        forEachRange(blocks, parallel, [&](uint64_t first, uint64_t last) {
+            uint64_t begin = first * sparse_column_block;
+            uint64_t end = std::min(n, last * sparse_column_block);
+
+            for (uint64_t c = 0; c < s.columns; c++)
+                std::fill(result + c * n + begin, result + c * n + end, OpDType(0));
+
+            for (uint64_t r = 0; r < s.rows; r++) {
+                const OpDType* row = dense + r * n;
+
+                for (int64_t e = offsets[r]; e < offsets[r + 1]; e++) {
+                    OpDType value = values[e];
+                    OpDType* target = result + static_cast<uint64_t>(columns[e]) * n;
+
+                    for (uint64_t j = begin; j < end; j++)
+                        target[j] += value * row[j];
+                }
+            }
+        });
+    }
+
+    // D S: every element of a row of D scales the row of S it picks.
+    else if (!transposed_) {
+        uint64_t m = inputs[0]->getElements() / s.rows;
+        bool parallel = m * s.non_zeros >= sparse_parallel_threshold;
+
+        forEachRange(m, parallel, [&](uint64_t first, uint64_t last) {
+            for (uint64_t i = first; i < last; i++) {
+                const OpDType* row = dense + i * s.rows;
+                OpDType* target = result + i * s.columns;
+
+                std::fill(target, target + s.columns, OpDType(0));
+                for (uint64_t r = 0; r < s.rows; r++) {
+                    OpDType factor = row[r];
+                    if (factor == 0)
+                        continue;
+
+                    for (int64_t e = offsets[r]; e < offsets[r + 1]; e++)
+                        target[columns[e]] += factor * values[e];
+                }
+            }
+        });
+    }
+
+    // D S^T: the dot products of every row of D with the rows of S.
+    else {
+        uint64_t m = inputs[0]->getElements() / s.columns;
+        bool parallel = m * s.non_zeros >= sparse_parallel_threshold;
+
+        forEachRange(m, parallel, [&](uint64_t first, uint64_t last) {
+            for (uint64_t i = first; i < last; i++) {
+                const OpDType* row = dense + i * s.columns;
+                OpDType* target = result + i * s.rows;
+
+                for (uint64_t r = 0; r < s.rows; r++) {
+                    OpDType sum = 0;
+                    for (int64_t e = offsets[r]; e < offsets[r + 1]; e++)
+                        sum += values[e] * row[columns[e]];
+
+                    target[r] = sum;
+                }
+            }
+        });
+    }
+}
+
+// Elements past which quantizing or dequantizing is split across threads.
+const uint64_t quantize_parallel_threshold = 1 << 15;
+// Multiply-adds past which a quantized product is split across threads.
+const uint64_t quantized_parallel_threshold = 1 << 16;
+// Bytes of weights a quantized matrix multiplication goes through for a
+// block of rows before moving on to the next columns, so they stay in cache.
+const uint64_t quantized_weight_block = 1 << 17;
+
+// Calls f with the data of an INT8 or UINT8 buffer.
+template <typename F>
+void withQuantized(Buffer* buf, F f) {
+    switch (buf->getDataType()) {
+      case DataType::UINT8:
+        f(buf->getBufferDataAsTemplate<uint8_t>());
+        return;
+
+      case DataType::INT8:
+        f(buf->getBufferDataAsTemplate<int8_t>());
+        return;
+
+      default:
+        std::cout << "ERROR: Quantized data must be INT8 or UINT8!" << std::endl;
+        assert(false);
+    }
+}
+
+// Calls f with the data of a quantized product's result, either real
+// valued (FLOAT32) or quantized.
+template <typename F>
+void withQuantizedResult(Buffer* buf, F f) {
+    if (buf->getDataType() == DataType::FLOAT32)
+        f(buf->getBufferDataAsTemplate<float>());
+    else
+        withQuantized(buf, f);
+}
+
+// A buffer split along its quantization axis: `outer` blocks of `channels`
+// runs of `inner` elements, every run sharing a scale and zero point.
+struct QuantizedShape {
+    uint64_t outer = 1, channels = 1, inner = 1;
+
+    QuantizedShape(std::vector<int>& shape, Quantization& quantization) {
+        int axis = quantization.axis;
+        for (int d = 0; d < shape.size(); d++) {
+            if (axis < 0 || d > axis)
+                inner *= shape[d];
+            else if (d < axis)
+                outer *= shape[d];
+            else
+                channels = shape[d];
+        }
+
+        assert(quantization.scales.size() == channels);
+    }
+};
+
+// Rounds x to the nearest integer in Q's range (ties to even), clamping it
+// first, by adding and subtracting 1.5 * 2^23 as in vector_math.h. This
+// keeps quantizing loops free of libm calls, so they vectorize.
+template <typename Q>
+Q quantizeValue(float x) {
+    const float low = std::numeric_limits<Q>::min();
+    const float high = std::numeric_limits<Q>::max();
+    const float round = 12582912.0f;
+
+    // NaN clamps to the low end.
+    float clamped = (x > low) ? x : low;
+    clamped = (clamped < high) ? clamped : high;
+
+    return static_cast<Q>(static_cast<int32_t>((clamped + round) - round));
+}
+
+// Quantized inputs of the 8 bit dot products, which take unsigned data:
+// INT8 data is shifted by 128 (its sign bit flipped), along with its zero
+// point, which leaves the real values it stands for the same.
+template <typename QDType>
+const uint8_t* unsignedData(const QDType* data, uint64_t n, std::vector<uint8_t>& shifted) {
+    if constexpr (std::is_same<QDType, uint8_t>::value)
+        return data;
+    else {
+        shifted.resize(n);
+        for (uint64_t i = 0; i < n; i++)
+            shifted[i] = static_cast<uint8_t>(data[i]) ^ 0x80;
+
+        return shifted.data();
+    }
+}
+
+// Output stage (epilogue) of the quantized products. Column c's INT32 sum of
+// (unsigned) inputs times weights is corrected for the inputs' zero point,
+// i.e. less zero point * the sum of the column's weights, and scaled by the
+// input and weight scales into a real value. That is the result if it's
+// FLOAT32, otherwise it is requantized with the result's scale and zero point.
+struct Requantization {
+    std::vector<int32_t> offsets;
+    std::vector<float> multipliers;
+    float zero_point = 0;
+
+    Requantization(Quantization& input, bool signed_input, Quantization& weights,
+                   std::vector<int32_t>& weight_sums, Quantization& result, bool quantized_result) {
+        int32_t input_zero_point = input.zero_points[0] + (signed_input ? 128 : 0);
+        float scale = quantized_result ? input.scales[0] / result.scales[0] : input.scales[0];
+
+        for (uint64_t c = 0; c < weight_sums.size(); c++) {
+            float weight_scale = weights.scales[(weights.scales.size() > 1) ? c : 0];
+
+            offsets.push_back(input_zero_point * weight_sums[c]);
+            multipliers.push_back(scale * weight_scale);
+        }
+
+        if (quantized_result)
+            zero_point = result.zero_points[0];
+    }
+
+    template <typename T>
+    T apply(int32_t sum, uint64_t c) const {
+        float real = static_cast<float>(sum - offsets[c]) * multipliers[c];
+
+        if constexpr (std::is_same<T, float>::value)
+            return real;
+        else
+            return quantizeValue<T>(real + zero_point);
+    }
+};
+
+template <typename OpDType>
+void Quantize::compute(Buffer* out, Buffer* buf) {
+    QuantizedShape shape(buf->getShape(), quantization_);
+
+    const OpDType* in = buf->getBufferDataAsTemplate<OpDType>();
+    bool parallel = buf->getElements() >= quantize_parallel_threshold;
+
+    withQuantized(out, [&](auto* q) {
+        using Q = std::remove_pointer_t<decltype(q)>;
+
+        forEachRange(shape.outer * shape.channels, parallel, [&](uint64_t first, uint64_t last) {
+            for (uint64_t run = first; run < last; run++) {
+                uint64_t c = run % shape.channels;
+                float scale = quantization_.scales[c];
+                float zero_point = quantization_.zero_points[c];
+
+                for (uint64_t i = run * shape.inner; i < (run + 1) * shape.inner; i++)
+                    q[i] = quantizeValue<Q>(static_cast<float>(in[i]) / scale + zero_point);
+            }
+        });
+    });
+}
+
+template <typename QDType>
+void Dequantize::compute(Buffer* out, Buffer* buf) {
+    QuantizedShape shape(buf->getShape(), quantization_);
+
+    const QDType* q = buf->getBufferDataAsTemplate<QDType>();
+    float* result = out->getBufferDataAsTemplate<float>();
+    bool parallel = buf->getElements() >= quantize_parallel_threshold;
+
+    forEachRange(shape.outer * shape.channels, parallel, [&](uint64_t first, uint64_t last) {
+        for (uint64_t run = first; run < last; run++) {
+            uint64_t c = run % shape.channels;
+            float scale = quantization_.scales[c];
+            float zero_point = quantization_.zero_points[c];
+
+            for (uint64_t i = run * shape.inner; i < (run + 1) * shape.inner; i++)
+                result[i] = (static_cast<float>(q[i]) - zero_point) * scale;
+        }
+    });
+}
+
+template <typename QDType>
+void QuantizedMatrixMultiplication::compute(Buffer* out, Buffer* b1, Buffer* b2) {
+    uint64_t inner = b1->getShape().back();
+    uint64_t columns = b2->getShape().back();
+    uint64_t rows = b1->getElements() / inner;
+
+    assert(weights_.size() == columns * inner);
+
+    std::vector<uint8_t> shifted;
+    const uint8_t* a = unsignedData(b1->getBufferDataAsTemplate<QDType>(), b1->getElements(), shifted);
+
+    bool quantized_result = out->getDataType() != DataType::FLOAT32;
+    Requantization requantization(input_quantization_, std::is_signed<QDType>::value, weight_quantization_,
+                                  weight_sums_, quantization_, quantized_result);
+
+    uint64_t block_columns = std::max<uint64_t>(1, quantized_weight_block / inner);
+    bool parallel = rows * columns * inner >= quantized_parallel_threshold;
+
+    withQuantizedResult(out, [&](auto* result) {
+        using R = std::remove_pointer_t<decltype(result)>;
+
+        forEachRange(rows, parallel, [&](uint64_t first, uint64_t last) {
+            for (uint64_t c0 = 0; c0 < columns; c0 += block_columns) {
+                uint64_t c1 = std::min(columns, c0 + block_columns);
+
+                for (uint64_t r = first; r < last; r++) {
+                    for (uint64_t c = c0; c < c1; c++) {
+                        int32_t sum = simd::dot(a + r * inner, weights_.data() + c * inner, inner);
+                        result[r * columns + c] = requantization.template apply<R>(sum, c);
+                    }
+                }
+            }
+        });
+    });
+}
+
+template <typename QDType>
+void QuantizedConvolution2D::compute(Buffer* out, Buffer* b1, Buffer* b2) {
+    std::vector<int>& image_shape = b1->getShape();
+    std::vector<int>& kernel_shape = b2->getShape();
+    std::vector<int>& output_shape = out->getShape();
+
+    int height = image_shape.rbegin()[1], width = image_shape.back();
+    int kernel_height = kernel_shape[0], kernel_width = kernel_shape[1];
+    int out_height = output_shape.rbegin()[1], out_width = output_shape.back();
+    uint64_t patch_size = static_cast<uint64_t>(kernel_height) * kernel_width;
+
+    // As in Convolution2D, strides override padding. The kernel's top left
+    // corner starts ceil((kernel size - 1) / 2) pixels before the image.
+    bool padded = !padding_.compare("same") && strides_[0] == 1 && strides_[1] == 1;
+    int offset_y = padded ? kernel_height / 2 : 0;
+    int offset_x = padded ? kernel_width / 2 : 0;
+
+    assert(kernel_.size() == patch_size);
+
+    bool signed_input = std::is_signed<QDType>::value;
+    bool quantized_result = out->getDataType() != DataType::FLOAT32;
+    Requantization requantization(input_quantization_, signed_input, kernel_quantization_,
+                                  kernel_sum_, quantization_, quantized_result);
+
+    // Padding holds the (unsigned) zero point, which stands for 0.
+    uint8_t padding = input_quantization_.zero_points[0] + (signed_input ? 128 : 0);
+
+    const QDType* images = b1->getBufferDataAsTemplate<QDType>();
+    uint64_t image_count = b1->getElements() / (static_cast<uint64_t>(height) * width);
+    uint64_t out_rows = image_count * out_height;
+
+    bool parallel = out_rows * out_width * patch_size >= quantized_parallel_threshold;
+
+    withQuantizedResult(out, [&](auto* result) {
+        using R = std::remove_pointer_t<decltype(result)>;
+
+        forEachRange(out_rows, parallel, [&](uint64_t first, uint64_t last) {
+            // The patches under the kernel for one row of the output.
+            std::vector<uint8_t> patches(out_width * patch_size);
+
+            for (uint64_t row = first; row < last; row++) {
+                const QDType* image = images + (row / out_height) * height * width;
+                int oy = (row % out_height) * strides_[0] - offset_y;
+
+                for (int j = 0; j < out_width; j++) {
+                    uint8_t* patch = patches.data() + j * patch_size;
+                    int ox = j * strides_[1] - offset_x;
+
+                    for (int dy = 0; dy < kernel_height; dy++) {
+                        int iy = oy + dy;
+                        for (int dx = 0; dx < kernel_width; dx++) {
+                            int ix = ox + dx;
+                            bool inside = iy >= 0 && iy < height && ix >= 0 && ix < width;
+
+                            uint8_t value = padding;
+                            if (inside)
+                                value = static_cast<uint8_t>(image[iy * width + ix]) ^ (signed_input ? 0x80 : 0);
+
+                            patch[dy * kernel_width + dx] = value;
+                        }
+                    }
+                }
+
+                for (int j = 0; j < out_width; j++) {
+                    int32_t sum = simd::dot(patches.data() + j * patch_size, kernel_.data(), patch_size);
+                    result[row * out_width + j] = requantization.template apply<R>(sum, 0);
+                }
+            }
+        });
+    });
+}
+
+
+// Elements below which a mask operation isn't worth splitting across threads.
+const uint64_t mask_parallel_threshold = 1 << 16;
+
+template <typename OpDType>
+void Comparison::compute(Buffer* out, Buffer* b1, Buffer* b2) {
+    switch (comparison_) {
+      case ComparisonType::EQUAL:
+        compare<OpDType>(out, b1, b2, std::equal_to<OpDType>());
+        return;
+
+      case ComparisonType::NOT_EQUAL:
+        compare<OpDType>(out, b1, b2, std::not_equal_to<OpDType>());
+        return;
+
+      case ComparisonType::LESS:
+        compare<OpDType>(out, b1, b2, std::less<OpDType>());
+        return;
+
+      case ComparisonType::LESS_EQUAL:
+        compare<OpDType>(out, b1, b2, std::less_equal<OpDType>());
+        return;
+
+      case ComparisonType::GREATER:
+        compare<OpDType>(out, b1, b2, std::greater<OpDType>());
+        return;
+
+      case ComparisonType::GREATER_EQUAL:
+        compare<OpDType>(out, b1, b2, std::greater_equal<OpDType>());
+        return;
+    }
+}
+
+template <typename OpDType, class Compare>
+void Comparison::compare(Buffer* out, Buffer* b1, Buffer* b2, Compare compare) {
+    const OpDType* x = b1->getBufferDataAsTemplate<OpDType>();
+    const OpDType* y = b2->getBufferDataAsTemplate<OpDType>();
+    uint64_t* result = out->getBufferDataAsTemplate<uint64_t>();
+
+    uint64_t n1 = b1->getElements(), n2 = b2->getElements();
+    uint64_t n = std::max(n1, n2);
+
+    forEachRange(bits::words(n), n >= mask_parallel_threshold, [&](uint64_t first, uint64_t last) {
+        uint64_t begin = first * 64, end = std::min(n, last * 64);
+
+        if (n1 == n2)
+            bits::pack(result, begin, end, [&](uint64_t i) { return compare(x[i], y[i]); });
+        else if (n2 == 1) {
+            OpDType value = y[0];
+            bits::pack(result, begin, end, [&](uint64_t i) { return compare(x[i], value); });
+        }
+        else if (n1 == 1) {
+            OpDType value = x[0];
+            bits::pack(result, begin, end, [&](uint64_t i) { return compare(value, y[i]); });
+        }
+        // The smaller side is a row repeated across the larger one.
+        else if (n1 > n2)
+            bits::pack(result, begin, end, [&](uint64_t i) { return compare(x[i], y[i % n2]); });
+        else
+            bits::pack(result, begin, end, [&](uint64_t i) { return compare(x[i % n1], y[i]); });
+    });
+}
+
+// out[i] = (bit k of mask) ? a[i] : b[i] for the n elements of a run of the
+// mask, where a single element value (`Single`) is the same for every i.
+template <typename T, bool SingleA, bool SingleB>
+void selectRun(T* out, const uint64_t* mask, uint64_t first_bit, uint64_t n, const T* a, const T* b) {
+    bits::forEachWord(mask, first_bit, first_bit + n, [&](uint64_t offset, uint64_t word, uint64_t count) {
+        T* o = out + offset;
+        const T* x = SingleA ? a : a + offset;
+        const T* y = SingleB ? b : b + offset;
+
+        for (uint64_t k = 0; k < count; k++)
+            o[k] = ((word >> k) & 1) ? x[SingleA ? 0 : k] : y[SingleB ? 0 : k];
+    });
+}
+
+template <typename OpDType>
+void Select::compute(Buffer* out, std::vector<Buffer*>& inputs) {
+    Buffer* condition = inputs[0];
+    Buffer* b1 = inputs[1];
+    Buffer* b2 = inputs[2];
+
+    const uint64_t* mask = condition->getBufferDataAsTemplate<uint64_t>();
+    const OpDType* a = b1->getBufferDataAsTemplate<OpDType>();
+    const OpDType* b = b2->getBufferDataAsTemplate<OpDType>();
+    OpDType* result = out->getBufferDataAsTemplate<OpDType>();
+
+    uint64_t n = out->getElements();
+    uint64_t mask_n = condition->getElements();
+    bool single_a = b1->getElements() == 1, single_b = b2->getElements() == 1;
+
+    auto run = (single_a && single_b) ? selectRun<OpDType, true, true>
+             : single_a ? selectRun<OpDType, true, false>
+             : single_b ? selectRun<OpDType, false, true>
+             : selectRun<OpDType, false, false>;
+
+    forEachRange(n, n >= mask_parallel_threshold, [&](uint64_t begin, uint64_t end) {
+        // Runs end wherever the mask starts over.
+        for (uint64_t i = begin; i < end;) {
+            uint64_t first_bit = i % mask_n;
+            uint64_t count = std::min(end - i, mask_n - first_bit);
+
+            run(result + i, mask, first_bit, count, single_a ? a : a + i, single_b ? b : b + i);
+            i += count;
+        }
+    });
 }
 
 } // namespace deeplib
@@ -0,0 +1,184 @@
+#include <cassert>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "core/optimizers.h"
+
+namespace deeplib {
+
+// Elements updated by a single task. Large enough to be worth a task,
+// small enough for a single large parameter to be split across threads.
+static const uint64_t chunk_elements = 1 << 14;
+
+//-----------------------------------\\
+// class Optimizer;                  \\
+//-----------------------------------\\
+
+Optimizer::Optimizer(Gradients& gradients, ThreadPool* pool) {
+    pool_ = (pool == nullptr) ? &ThreadPool::shared() : pool;
+    source_ = &gradients;
+    steps_ = 0;
+
+    std::vector<Operation*>& parameters = gradients.getParameters();
+    for (int i = 0; i < parameters.size(); i++) {
+        Buffer* param = parameters[i]->getBuffer();
+        DataType dtype = param->getDataType();
+
+        assert(dtype == DataType::FLOAT32 || dtype == DataType::FLOAT64);
+
+        parameters_.push_back(param);
+        gradients_.push_back(gradients.getGradients()[i]);
+
+        if (gradients.isSparse(i))
+            continue;
+
+        for (uint64_t begin = 0; begin < param->getElements(); begin += chunk_elements)
+            chunks_.push_back({ i, begin, std::min(begin + chunk_elements, param->getElements()), false });
+    }
+
+    dense_chunks_ = chunks_.size();
+
+    // Room for the sparse chunks of a step touching every row, so step()
+    // never grows chunks_.
+    uint64_t sparse_chunks = 0;
+    for (int i = 0; i < parameters_.size(); i++) {
+        if (gradients.isSparse(i))
+            sparse_chunks += (parameters_[i]->getShape()[0] + sparseChunkRows(i) - 1) / sparseChunkRows(i);
+    }
+
+    chunks_.reserve(dense_chunks_ + sparse_chunks);
+
+    job_ = [this](int c) {
+        Chunk& chunk = chunks_[c];
+        if (!chunk.rows) {
+            update(chunk.parameter, chunk.begin, chunk.end);
+            return;
+        }
+
+        std::vector<uint64_t>& rows = source_->getRows(chunk.parameter);
+        uint64_t row_elements = parameters_[chunk.parameter]->getElements() / parameters_[chunk.parameter]->getShape()[0];
+
+        for (uint64_t r = chunk.begin; r < chunk.end; r++)
+            update(chunk.parameter, rows[r] * row_elements, (rows[r] + 1) * row_elements);
+    };
+}
+
+uint64_t Optimizer::sparseChunkRows(int parameter) {
+    uint64_t row_elements = parameters_[parameter]->getElements() / parameters_[parameter]->getShape()[0];
+
+    return std::max<uint64_t>(1, chunk_elements / std::max<uint64_t>(1, row_elements));
+}
+
+Buffer* Optimizer::newMoment(int parameter) {
+    Buffer* param = parameters_[parameter];
+    Allocator* a = param->getAllocator();
+
+    Buffer* moment = a->newBuffer(new Buffer(param->getShape(), a));
+    moment->setDataType(param->getDataType());
+    moment->initialize();
+
+    return moment;
+}
+
+void Optimizer::step() {
+    steps_++;
+
+    // Touched rows change from step to step, so
+    // the sparse gradients are split up here.
+    chunks_.resize(dense_chunks_);
+    for (int i = 0; i < parameters_.size(); i++) {
+        if (!source_->isSparse(i))
+            continue;
+
+        uint64_t rows = source_->getRows(i).size();
+        uint64_t chunk_rows = sparseChunkRows(i);
+
+        for (uint64_t begin = 0; begin < rows; begin += chunk_rows)
+            chunks_.push_back({ i, begin, std::min(begin + chunk_rows, rows), true });
+    }
+
+    prepare();
+    pool_->run(chunks_.size(), job_);
+
+    // The touched rows have been zeroed along with the rest.
+    for (int i = 0; i < parameters_.size(); i++) {
+        if (source_->isSparse(i))
+            source_->clearRows(i);
+    }
+
+    // Graphs evaluated incrementally need to see the new values.
+    for (Buffer* param : parameters_)
+        param->bumpVersion();
+}
+
+uint64_t Optimizer::getSteps() {
+    return steps_;
+}
+
+//-----------------------------------\\
+// class SGD;                        \\
+//-----------------------------------\\
+
+SGD::SGD(Gradients& gradients, double learning_rate, double momentum, ThreadPool* pool)
+    : Optimizer(gradients, pool) {
+    learning_rate_ = learning_rate;
+    momentum_ = momentum;
+
+    if (momentum_ != 0) {
+        for (int i = 0; i < parameters_.size(); i++)
+            velocities_.push_back(newMoment(i));
+    }
+}
+
+void SGD::update(int parameter, uint64_t begin, uint64_t end) {
+    if (parameters_[parameter]->getDataType() == DataType::FLOAT32)
+        updateAs<float>(parameter, begin, end);
+    else
+        updateAs<double>(parameter, begin, end);
+}
+
+//-----------------------------------\\
+// class Adam;                       \\
+//-----------------------------------\\
+
+Adam::Adam(Gradients& gradients, double learning_rate, double beta1, double beta2,
+           double epsilon, double weight_decay, ThreadPool* pool)
+    : Optimizer(gradients, pool) {
+    learning_rate_ = learning_rate;
+    beta1_ = beta1;
+    beta2_ = beta2;
+    epsilon_ = epsilon;
+    weight_decay_ = weight_decay;
+
+    correction1_ = 1;
+    correction2_ = 1;
+
+    for (int i = 0; i < parameters_.size(); i++) {
+        first_moments_.push_back(newMoment(i));
+        second_moments_.push_back(newMoment(i));
+    }
+}
+
+// The bias corrections only depend on the step, so they're
+// worked out once here rather than for every element.
+void Adam::prepare() {
+    correction1_ = 1 / (1 - std::pow(beta1_, steps_));
+    correction2_ = 1 / (1 - std::pow(beta2_, steps_));
+}
+
+void Adam::update(int parameter, uint64_t begin, uint64_t end) {
+    if (parameters_[parameter]->getDataType() == DataType::FLOAT32)
+        updateAs<float>(parameter, begin, end);
+    else
+        updateAs<double>(parameter, begin, end);
+}
+
+//-----------------------------------\\
+// class AdamW;                      \\
+//-----------------------------------\\
+
+AdamW::AdamW(Gradients& gradients, double learning_rate, double weight_decay,
+             double beta1, double beta2, double epsilon, ThreadPool* pool)
+    : Adam(gradients, learning_rate, beta1, beta2, epsilon, weight_decay, pool) {}
+
+} // namespace deeplib
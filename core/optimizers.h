@@ -0,0 +1,148 @@
+#ifndef OPTIMIZERS
+#define OPTIMIZERS
+#include <vector>
+#include <functional>
+#include "core/buffer.h"
+#include "core/gradients.h"
+#include "core/thread_pool.h"
+
+namespace deeplib {
+
+// Updates the parameters of a Gradients object with their accumulated
+// gradients, in place.
+//
+// Rather than building the update out of graph operations (a pass and a
+// buffer per elementwise op), each optimizer has a fused kernel making one
+// pass over a parameter, its gradient and its moments. The gradient is zeroed
+// within the same pass, ready for the next backward().
+//
+// Parameters are split into chunks which are updated across the threads of
+// a ThreadPool. Moments and room for the chunks of every row of the sparse
+// gradients are allocated on construction, so step() allocates nothing.
+//
+// Parameters with sparse gradients (see Gradients) only have the rows their
+// gradients touched updated, i.e. the moments (and weight decay) of the other
+// rows are left as they are until they're next looked up, as is usual for
+// embedding tables.
+//
+// Only FLOAT32 and FLOAT64 parameters are supported.
+class Optimizer {
+    // Part of a parameter updated by a single task: elements [begin, end),
+    // or for a sparse gradient, its touched rows [begin, end).
+    struct Chunk {
+        int parameter;
+        uint64_t begin;
+        uint64_t end;
+        bool rows;
+    };
+
+    // Chunks of the dense gradients, followed by the current step's
+    // chunks of the sparse ones.
+    std::vector<Chunk> chunks_;
+    uint64_t dense_chunks_;
+
+    Gradients* source_;
+
+    // Updates the chunk with the given index.
+    std::function<void(int)> job_;
+
+    ThreadPool* pool_;
+
+    // Touched rows of a sparse gradient updated by a single task.
+    uint64_t sparseChunkRows(int parameter);
+
+  protected:
+    std::vector<Buffer*> parameters_;
+    std::vector<Buffer*> gradients_;
+
+    // Steps taken so far, including the current one.
+    uint64_t steps_;
+
+    // Allocates a zeroed buffer shaped like the given parameter's.
+    Buffer* newMoment(int parameter);
+
+    // Called once per step, before any update().
+    virtual void prepare() {}
+
+    // Updates elements [begin, end) of the given parameter.
+    virtual void update(int parameter, uint64_t begin, uint64_t end) = 0;
+
+  public:
+    // `pool` defaults to ThreadPool::shared().
+    Optimizer(Gradients& gradients, ThreadPool* pool = nullptr);
+
+    virtual ~Optimizer() {}
+
+    // Applies (and zeroes) the gradients accumulated since the last step.
+    void step();
+
+    uint64_t getSteps();
+};
+
+// Stochastic gradient descent with (optional) momentum:
+//     v = momentum * v + g
+//     p = p - learning_rate * v
+class SGD : public Optimizer {
+    double learning_rate_;
+    double momentum_;
+
+    // Empty without momentum.
+    std::vector<Buffer*> velocities_;
+
+    template <typename ODType>
+    void updateAs(int parameter, uint64_t begin, uint64_t end);
+
+  protected:
+    void update(int parameter, uint64_t begin, uint64_t end);
+
+  public:
+    SGD(Gradients& gradients, double learning_rate, double momentum = 0, ThreadPool* pool = nullptr);
+};
+
+// Adam, with bias-corrected first (m) and second (v) moments:
+//     m = beta1 * m + (1 - beta1) * g
+//     v = beta2 * v + (1 - beta2) * g^2
+//     p = p - learning_rate * m_hat / (sqrt(v_hat) + epsilon)
+//
+// A non-zero `weight_decay` is decoupled from the gradient (i.e. AdamW):
+//     p = p - learning_rate * weight_decay * p
+class Adam : public Optimizer {
+    double learning_rate_;
+    double beta1_;
+    double beta2_;
+    double epsilon_;
+    double weight_decay_;
+
+    // Bias corrections of the current step, i.e. 1 / (1 - beta^t).
+    double correction1_;
+    double correction2_;
+
+    std::vector<Buffer*> first_moments_;
+    std::vector<Buffer*> second_moments_;
+
+    template <typename ODType>
+    void updateAs(int parameter, uint64_t begin, uint64_t end);
+
+  protected:
+    void prepare();
+
+    void update(int parameter, uint64_t begin, uint64_t end);
+
+  public:
+    Adam(Gradients& gradients, double learning_rate = 0.001,
+         double beta1 = 0.9, double beta2 = 0.999, double epsilon = 1e-8,
+         double weight_decay = 0, ThreadPool* pool = nullptr);
+};
+
+// Adam with decoupled weight decay.
+class AdamW : public Adam {
+  public:
+    AdamW(Gradients& gradients, double learning_rate = 0.001, double weight_decay = 0.01,
+          double beta1 = 0.9, double beta2 = 0.999, double epsilon = 1e-8,
+          ThreadPool* pool = nullptr);
+};
+
+} // namespace deeplib
+
+#include "core/optimizers.t.h"
+#endif
@@ -0,0 +1,55 @@
+#include <cmath>
+
+namespace deeplib {
+
+template <typename ODType>
+void SGD::updateAs(int parameter, uint64_t begin, uint64_t end) {
+    ODType* p = parameters_[parameter]->getBufferDataAsTemplate<ODType>();
+    ODType* g = gradients_[parameter]->getBufferDataAsTemplate<ODType>();
+
+    const ODType lr = learning_rate_;
+
+    if (velocities_.empty()) {
+        for (uint64_t i = begin; i < end; i++) {
+            p[i] -= lr * g[i];
+            g[i] = 0;
+        }
+
+        return;
+    }
+
+    ODType* v = velocities_[parameter]->getBufferDataAsTemplate<ODType>();
+    const ODType momentum = momentum_;
+
+    for (uint64_t i = begin; i < end; i++) {
+        v[i] = momentum * v[i] + g[i];
+        p[i] -= lr * v[i];
+        g[i] = 0;
+    }
+}
+
+template <typename ODType>
+void Adam::updateAs(int parameter, uint64_t begin, uint64_t end) {
+    ODType* p = parameters_[parameter]->getBufferDataAsTemplate<ODType>();
+    ODType* g = gradients_[parameter]->getBufferDataAsTemplate<ODType>();
+    ODType* m = first_moments_[parameter]->getBufferDataAsTemplate<ODType>();
+    ODType* v = second_moments_[parameter]->getBufferDataAsTemplate<ODType>();
+
+    const ODType lr = learning_rate_;
+    const ODType beta1 = beta1_;
+    const ODType beta2 = beta2_;
+    const ODType epsilon = epsilon_;
+    const ODType decay = 1 - learning_rate_ * weight_decay_;
+    const ODType correction1 = correction1_;
+    const ODType correction2 = correction2_;
+
+    for (uint64_t i = begin; i < end; i++) {
+        m[i] = beta1 * m[i] + (1 - beta1) * g[i];
+        v[i] = beta2 * v[i] + (1 - beta2) * g[i] * g[i];
+
+        p[i] = decay * p[i] - lr * (m[i] * correction1) / (std::sqrt(v[i] * correction2) + epsilon);
+        g[i] = 0;
+    }
+}
+
+} // namespace deeplib
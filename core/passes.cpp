@@ -0,0 +1,360 @@
+#include <cmath>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <iostream>
+#include "core/passes.h"
+#include "core/allocator.h"
+
+namespace deeplib {
+
+static bool isConstant(Operation* op) {
+    return op != nullptr && !op->getType().compare("constant");
+}
+
+static std::vector<double> valuesOf(Operation* op) {
+    std::vector<double> values(op->getBuffer()->getElements());
+    op->getBuffer()->copyTo(values);
+
+    return values;
+}
+
+// Pinned Constant holding `values`, shaped like `shape`.
+static Operation* newConstant(std::vector<double>& values, std::vector<int> shape, DataType dtype, Allocator* a) {
+    Buffer* buf = a->newBuffer(new Buffer(shape, a));
+    buf->setDataType(dtype);
+    buf->fill<double>(values);
+    buf->pin();
+
+    return a->newOperation(new Constant(buf));
+}
+
+// Operations taking each operation of `order` as a parent.
+static std::unordered_map<Operation*, std::vector<Operation*>> consumersOf(std::vector<Operation*>& order) {
+    std::unordered_map<Operation*, std::vector<Operation*>> consumers;
+    for (Operation* op : order) {
+        for (Operation* p : op->getParents())
+            consumers[p].push_back(op);
+    }
+
+    return consumers;
+}
+
+//-----------------------------------\\
+// Batch normalization folding       \\
+//-----------------------------------\\
+
+Operation* foldBatchNormalization(Operation* root) {
+    std::vector<Operation*> order = topologicalOrder(root);
+
+    std::unordered_map<Operation*, std::vector<Operation*>> consumers = consumersOf(order);
+
+    auto onlyFeeds = [&](Operation* op, Operation* consumer) {
+        for (Operation* c : consumers[op]) {
+            if (c != consumer)
+                return false;
+        }
+
+        return true;
+    };
+
+    for (Operation* op : order) {
+        if (op->getType().compare("batch_norm"))
+            continue;
+
+        Normalization* norm = static_cast<Normalization*>(op);
+        if (!norm->hasStatistics())
+            continue;
+
+        std::vector<Operation*> parents = norm->getParents();
+        Operation* scale = parents[1];
+        Operation* shift = norm->getShift();
+
+        if (!isConstant(scale) || (shift != nullptr && !isConstant(shift)) ||
+            !isConstant(norm->getMean()) || !isConstant(norm->getVariance()))
+            continue;
+
+        // [producer -> [bias addition ->]] normalization
+        Operation* producer = parents[0];
+        Operation* bias_add = nullptr;
+        Operation* bias = nullptr;
+
+        if (!producer->getType().compare("addition")) {
+            std::vector<Operation*> terms = producer->getParents();
+            if (terms.size() != 2 || isConstant(terms[0]) == isConstant(terms[1]))
+                continue;
+
+            bias_add = producer;
+            bias = isConstant(terms[0]) ? terms[0] : terms[1];
+            producer = isConstant(terms[0]) ? terms[1] : terms[0];
+        }
+
+        bool matmul = !producer->getType().compare("matrix_multiplication");
+        bool conv = !producer->getType().compare("convolution2d");
+        if (!matmul && !conv)
+            continue;
+
+        Operation* weights = producer->getParents()[1];
+        if (!isConstant(weights))
+            continue;
+
+        if (!onlyFeeds(producer, bias_add != nullptr ? bias_add : norm) ||
+            (bias_add != nullptr && !onlyFeeds(bias_add, norm)))
+            continue;
+
+        // Channels run along the last axis of the weights
+        // (a convolution's single kernel makes a single channel).
+        uint64_t channels = scale->getBuffer()->getElements();
+        std::vector<int>& weights_shape = weights->getBuffer()->getShape();
+
+        if (conv && channels != 1)
+            continue;
+
+        if (matmul && (weights_shape.size() != 2 || (channels != 1 && channels != weights_shape.back())))
+            continue;
+
+        std::vector<double> scales = valuesOf(scale);
+        std::vector<double> means = valuesOf(norm->getMean());
+        std::vector<double> variances = valuesOf(norm->getVariance());
+        std::vector<double> shifts = (shift != nullptr) ? valuesOf(shift) : std::vector<double>(channels, 0);
+
+        std::vector<double> a(channels), b(channels);
+        for (uint64_t c = 0; c < channels; c++) {
+            a[c] = scales[c] / std::sqrt(variances[c] + norm->getEpsilon());
+            b[c] = shifts[c] - means[c] * a[c];
+        }
+
+        Allocator* allocator = norm->getBuffer()->getAllocator();
+        DataType dtype = norm->getBuffer()->getDataType();
+
+        std::vector<double> folded_weights = valuesOf(weights);
+        for (uint64_t i = 0; i < folded_weights.size(); i++)
+            folded_weights[i] *= a[i % channels];
+
+        producer->replaceParent(weights,
+            newConstant(folded_weights, weights_shape, dtype, allocator));
+
+        // The bias covers at least every channel, so a single element
+        // bias in front of several channels is spread out over them.
+        Operation* replacement = bias_add;
+        std::vector<double> folded_bias;
+        std::vector<int> bias_shape = scale->getBuffer()->getShape();
+
+        if (bias != nullptr && bias->getBuffer()->getElements() >= channels) {
+            folded_bias = valuesOf(bias);
+            bias_shape = bias->getBuffer()->getShape();
+        }
+        else
+            folded_bias.assign(channels, (bias != nullptr) ? valuesOf(bias)[0] : 0);
+
+        for (uint64_t i = 0; i < folded_bias.size(); i++)
+            folded_bias[i] = folded_bias[i] * a[i % channels] + b[i % channels];
+
+        Operation* folded = newConstant(folded_bias, bias_shape, dtype, allocator);
+
+        if (bias_add != nullptr)
+            bias_add->replaceParent(bias, folded);
+        else
+            replacement = allocator->newOperation(new Addition(producer, folded));
+
+        replacement->setBuffer(norm->getBuffer());
+
+        for (Operation* c : consumers[norm])
+            c->replaceParent(norm, replacement);
+
+        consumers[replacement] = consumers[norm];
+
+        if (norm == root)
+            root = replacement;
+    }
+
+    return root;
+}
+
+void foldBatchNormalization(Tensor& output) {
+    Operation* root = foldBatchNormalization(output.getOperation());
+
+    if (root != output.getOperation())
+        output.setOperation(root);
+}
+
+//-----------------------------------\\
+// Activation fusion                 \\
+//-----------------------------------\\
+
+Operation* fuseActivations(Operation* root) {
+    std::vector<Operation*> order = topologicalOrder(root);
+
+    std::unordered_map<Operation*, std::vector<Operation*>> consumers = consumersOf(order);
+
+    for (Operation* op : order) {
+        Activation* activation = dynamic_cast<Activation*>(op);
+        if (activation == nullptr)
+            continue;
+
+        Operation* producer = activation->getParents()[0];
+        if (!producer->acceptsEpilogue() || producer->hasEpilogue())
+            continue;
+
+        DataType dtype = producer->getBuffer()->getDataType();
+        if (!isFloatingPoint(dtype))
+            continue;
+
+        if (consumers[producer].size() != 1)
+            continue;
+
+        producer->setEpilogue(activation->getActivationType(), activation->isApproximate());
+        producer->setBuffer(activation->getBuffer());
+
+        for (Operation* c : consumers[activation])
+            c->replaceParent(activation, producer);
+
+        consumers[producer] = consumers[activation];
+
+        if (activation == root)
+            root = producer;
+    }
+
+    return root;
+}
+
+void fuseActivations(Tensor& output) {
+    Operation* root = fuseActivations(output.getOperation());
+
+    if (root != output.getOperation())
+        output.setOperation(root);
+}
+
+//-----------------------------------\\
+// Cast folding                      \\
+//-----------------------------------\\
+
+// Significant bits of a data type's values, and whether they can be negative
+// or fractional. Floats also have the largest exponent they reach.
+struct Precision {
+    int digits;
+    bool is_signed;
+    bool is_float;
+    int max_exponent;
+};
+
+static Precision precisionOf(DataType dtype) {
+    switch (dtype) {
+      case DataType::BOOL:     return { 1, false, false, 0 };
+      case DataType::UINT8:    return { 8, false, false, 0 };
+      case DataType::INT8:     return { 7, true, false, 0 };
+      case DataType::UINT16:   return { 16, false, false, 0 };
+      case DataType::INT16:    return { 15, true, false, 0 };
+      case DataType::UINT32:   return { 32, false, false, 0 };
+      case DataType::INT32:    return { 31, true, false, 0 };
+      case DataType::UINT64:   return { 64, false, false, 0 };
+      case DataType::INT64:    return { 63, true, false, 0 };
+      case DataType::FLOAT16:  return { 11, true, true, 15 };
+      case DataType::BFLOAT16: return { 8, true, true, 127 };
+      case DataType::FLOAT32:  return { 24, true, true, 127 };
+      case DataType::FLOAT64:  return { 53, true, true, 1023 };
+
+      default:
+        std::cout << "ERROR: bad data type!" << std::endl;
+        assert(false);
+        return { 0, false, false, 0 };
+    }
+}
+
+bool convertsExactly(DataType from, DataType to) {
+    if (from == to || from == DataType::BOOL)
+        return true;
+
+    if (to == DataType::BOOL)
+        return false;
+
+    Precision f = precisionOf(from);
+    Precision t = precisionOf(to);
+
+    if (f.is_signed && !t.is_signed)
+        return false;
+
+    if (f.is_float)
+        return t.is_float && f.digits <= t.digits && f.max_exponent <= t.max_exponent;
+
+    return f.digits <= t.digits;
+}
+
+Operation* foldCasts(Operation* root) {
+    std::vector<Operation*> order = topologicalOrder(root);
+
+    std::unordered_map<Operation*, std::vector<Operation*>> consumers = consumersOf(order);
+
+    for (Operation* op : order) {
+        Cast* cast = dynamic_cast<Cast*>(op);
+        if (cast == nullptr)
+            continue;
+
+        Operation* input = cast->getParents()[0];
+        DataType from = input->getBuffer()->getDataType();
+        DataType to = cast->getBuffer()->getDataType();
+
+        Operation* replacement = nullptr;
+
+        if (isConstant(input)) {
+            Allocator* allocator = cast->getBuffer()->getAllocator();
+
+            Buffer* buf = allocator->newBuffer(new Buffer(cast->getBuffer()->getShape(), allocator));
+            buf->setDataType(to);
+            buf->initialize();
+            buf->pin();
+
+            std::vector<Buffer*> inputs = { input->getBuffer() };
+            cast->evaluate(buf, inputs);
+
+            replacement = allocator->newOperation(new Constant(buf));
+        }
+        else if (from == to)
+            replacement = input;
+        else {
+            // Cast -> Cast, the inner one exact. Floats converted to integers
+            // always saturate, so integers wrapping through a float don't
+            // go through in one step.
+            Cast* inner = dynamic_cast<Cast*>(input);
+            if (inner == nullptr)
+                continue;
+
+            Operation* source = inner->getParents()[0];
+            DataType source_dtype = source->getBuffer()->getDataType();
+
+            bool wraps = isFloatingPoint(from) && !isFloatingPoint(source_dtype) && !isFloatingPoint(to) &&
+                         to != DataType::BOOL && !cast->isSaturating();
+
+            if (!convertsExactly(source_dtype, from) || wraps)
+                continue;
+
+            cast->replaceParent(inner, source);
+
+            consumers[source].push_back(cast);
+            std::vector<Operation*>& inner_consumers = consumers[inner];
+            inner_consumers.erase(std::find(inner_consumers.begin(), inner_consumers.end(), cast));
+
+            continue;
+        }
+
+        for (Operation* c : consumers[cast])
+            c->replaceParent(cast, replacement);
+
+        std::vector<Operation*>& replacement_consumers = consumers[replacement];
+        replacement_consumers.insert(replacement_consumers.end(), consumers[cast].begin(), consumers[cast].end());
+
+        if (cast == root)
+            root = replacement;
+    }
+
+    return root;
+}
+
+void foldCasts(Tensor& output) {
+    Operation* root = foldCasts(output.getOperation());
+
+    if (root != output.getOperation())
+        output.setOperation(root);
+}
+
+} // namespace deeplib
@@ -0,0 +1,75 @@
+#ifndef PASSES
+#define PASSES
+#include "core/operations.h"
+#include "core/tensor.h"
+
+namespace deeplib {
+
+// Graph rewrites, run on a finished graph before it's operated.
+//
+// A pass only sees the graph hanging off the root it's given, so none of
+// that graph's operations may feed anything outside of it.
+
+// Folds inference mode batch normalizations (those given a mean and variance)
+// into the MatrixMultiplication or Convolution2D right before them, i.e. per
+// channel
+//   (x @ w + bias) * a + b == x @ (w * a) + (bias * a + b),
+// where a == scale / sqrt(variance + epsilon) and b == shift - mean * a.
+//
+// The normalization is replaced by the bias Addition, which is added if
+// there wasn't one and takes over the normalization's buffer. Folding needs
+// the weights, bias and normalization parameters to be Constants, and the
+// matrix multiplication or convolution (and its bias Addition) to feed
+// nothing but the normalization, as these are rewired. The Constants
+// themselves are left as they are, the folded values get Constants of their own.
+//
+// Returns the root of the rewritten graph, which is `root` unless it was folded.
+Operation* foldBatchNormalization(Operation* root);
+
+// Same as above, pointing `output` at its new operation if need be.
+void foldBatchNormalization(Tensor& output);
+
+// Fuses every Activation into the operation right before it, which then
+// applies the activation to its result block by block as it's written
+// (see Operation::setEpilogue()), sparing the activation's own pass over
+// memory and its buffer.
+//
+// The operation before the activation has to be an Addition, Subtraction,
+// Multiplication, Division, MatrixMultiplication or Convolution2D of
+// floating point data, feeding nothing but the activation, and takes over
+// the activation's buffer. As the activation's input is gone, gradients
+// can't be taken through the fused graph.
+//
+// Returns the root of the rewritten graph, which is `root` unless it was fused.
+Operation* fuseActivations(Operation* root);
+
+// Same as above, pointing `output` at its new operation if need be.
+void fuseActivations(Tensor& output);
+
+// Takes Casts out of the graph where their conversion can be done once, or
+// in the same step as another one, instead of through a buffer of its own
+// on every operate:
+//   - a Cast of a Constant becomes a Constant of the converted values (e.g.
+//     the integer constants cast to FLOAT32 up front in test.cpp),
+//   - a Cast to the data type its input already has is dropped,
+//   - a Cast of an exact Cast (e.g. INT32 -> FLOAT64, see convertsExactly())
+//     converts the inner Cast's input directly, leaving the inner Cast to
+//     any other consumers it has.
+//
+// Consumers are rewired to the new Constant or the Cast's input. Folded
+// Constants are converted from the values the Constant has at the time, so
+// later changes to it aren't picked up, and, as with the other passes, no
+// gradient flows back to it through the folded graph.
+//
+// Returns the root of the rewritten graph, which is `root` unless it was folded.
+Operation* foldCasts(Operation* root);
+
+// Same as above, pointing `output` at its new operation if need be.
+void foldCasts(Tensor& output);
+
+// True if every value of data type `from` is exactly representable in `to`.
+bool convertsExactly(DataType from, DataType to);
+
+} // namespace deeplib
+
+#endif
@@ -0,0 +1,107 @@
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <vector>
+#include "core/quantization.h"
+#include "core/operations.h"
+
+namespace deeplib {
+
+Quantization rangeQuantization(float min, float max, DataType dtype) {
+    assert(dtype == DataType::INT8 || dtype == DataType::UINT8);
+    assert(min <= max);
+
+    float low = (dtype == DataType::INT8) ? -128 : 0;
+    float high = (dtype == DataType::INT8) ? 127 : 255;
+
+    min = std::min(min, 0.0f);
+    max = std::max(max, 0.0f);
+
+    float scale = (max - min) / (high - low);
+    if (scale == 0)
+        scale = 1;
+
+    float zero_point = std::round(low - min / scale);
+    zero_point = std::min(std::max(zero_point, low), high);
+
+    Quantization quantization;
+    quantization.scales = { scale };
+    quantization.zero_points = { static_cast<int32_t>(zero_point) };
+
+    return quantization;
+}
+
+Quantization weightQuantization(Buffer* buf, int axis) {
+    std::vector<int>& shape = buf->getShape();
+    assert(axis >= -1 && axis < static_cast<int>(shape.size()));
+
+    Quantization quantization;
+    quantization.axis = axis;
+    quantization.scales.assign((axis < 0) ? 1 : shape[axis], 0);
+    quantization.zero_points.assign(quantization.scales.size(), 0);
+
+    std::vector<float> values(buf->getElements());
+    buf->copyTo(values);
+
+    QuantizedShape s(shape, quantization);
+    for (uint64_t run = 0; run < s.outer * s.channels; run++) {
+        float& scale = quantization.scales[run % s.channels];
+        for (uint64_t i = run * s.inner; i < (run + 1) * s.inner; i++)
+            scale = std::max(scale, std::abs(values[i]) / 127);
+    }
+
+    // All-zero channels can have any scale.
+    for (float& scale : quantization.scales) {
+        if (scale == 0)
+            scale = 1;
+    }
+
+    return quantization;
+}
+
+Calibrator::Calibrator(std::vector<Tensor*> observed) {
+    for (Tensor* t : observed) {
+        assert(isFloatingPoint(t->getDataType()));
+        observed_.push_back(t->getOperation());
+    }
+
+    reset();
+}
+
+void Calibrator::observe() {
+    context_.operate(observed_);
+
+    for (int i = 0; i < observed_.size(); i++) {
+        Buffer* buf = context_.getBuffer(observed_[i]);
+
+        std::vector<float> values(buf->getElements());
+        buf->copyTo(values);
+
+        for (float x : values) {
+            min_[i] = std::min(min_[i], x);
+            max_[i] = std::max(max_[i], x);
+        }
+    }
+}
+
+void Calibrator::reset() {
+    min_.assign(observed_.size(), std::numeric_limits<float>::infinity());
+    max_.assign(observed_.size(), -std::numeric_limits<float>::infinity());
+}
+
+ExecutionContext& Calibrator::getContext() { return context_; }
+
+float Calibrator::getMin(int i) { return min_[i]; }
+
+float Calibrator::getMax(int i) { return max_[i]; }
+
+Quantization Calibrator::getQuantization(int i, DataType dtype) {
+    // Nothing observed yet.
+    if (min_[i] > max_[i])
+        return rangeQuantization(0, 0, dtype);
+
+    return rangeQuantization(min_[i], max_[i], dtype);
+}
+
+} // namespace deeplib
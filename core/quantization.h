@@ -0,0 +1,57 @@
+#ifndef QUANTIZATION
+#define QUANTIZATION
+#include <vector>
+#include "core/buffer.h"
+#include "core/data_types.h"
+#include "core/execution_context.h"
+#include "core/tensor.h"
+
+namespace deeplib {
+
+// Quantization of real values in [min, max] to INT8 or UINT8 (one scale and
+// zero point), spreading the range over every value of the data type. The
+// range is widened to include 0 first, so that 0 (e.g. padding, or the
+// result of a ReLU) is represented exactly.
+Quantization rangeQuantization(float min, float max, DataType dtype);
+
+// Symmetric INT8 quantization (zero points of 0) of the buffer's current
+// values, e.g. trained weights: one scale per index of `axis` (per channel),
+// or a single one with axis -1, mapping the largest magnitude to 127.
+Quantization weightQuantization(Buffer* buf, int axis = -1);
+
+// Records the range of values tensors of a graph take over sample inputs,
+// to choose the quantization of their quantized counterparts (calibration).
+//
+// Every observe() evaluates the observed tensors once and widens their
+// ranges with the values they hold. Sample inputs are fed to getContext()'s
+// placeholders, or filled into the graph's constants, before each call.
+class Calibrator {
+    std::vector<Operation*> observed_;
+
+    std::vector<float> min_;
+    std::vector<float> max_;
+
+    ExecutionContext context_;
+
+  public:
+    Calibrator(std::vector<Tensor*> observed);
+
+    void observe();
+
+    // Forgets the ranges observed so far.
+    void reset();
+
+    // Context the samples are evaluated in.
+    ExecutionContext& getContext();
+
+    // Range of observed tensor i so far.
+    float getMin(int i);
+    float getMax(int i);
+
+    // rangeQuantization() of observed tensor i's range.
+    Quantization getQuantization(int i, DataType dtype);
+};
+
+} // namespace deeplib
+
+#endif
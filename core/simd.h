@@ -0,0 +1,154 @@
+#ifndef SIMD
+#define SIMD
+#include <cstdint>
+
+namespace deeplib {
+namespace simd {
+
+// Building blocks for kernels reducing or accumulating contiguous data.
+//
+// No intrinsics are used, rather the loops are laid out for the compiler
+// to map onto whatever vector registers the target has: the accumulators
+// of reduce() are independent of each other, so each one becomes a lane of
+// a vector register, and accumulate() is a plain element-wise loop.
+
+// Accumulators kept side by side by reduce(), i.e. 32 bytes worth
+// (one AVX register, or two SSE/NEON ones).
+template <typename T>
+struct Lanes {
+    static const int count = (32 / sizeof(T) < 4) ? 4 : 32 / sizeof(T);
+};
+
+struct Add {
+    template <typename T>
+    T operator()(T a, T b) const { return a + b; }
+};
+
+struct Max {
+    template <typename T>
+    T operator()(T a, T b) const { return (b > a) ? b : a; }
+};
+
+struct Min {
+    template <typename T>
+    T operator()(T a, T b) const { return (b < a) ? b : a; }
+};
+
+// Combines data[0] ... data[n-1] into `init`.
+//
+// Lane k accumulates every Lanes<T>::count-th element starting at k, and the
+// lanes are then folded together pairwise (the horizontal step). The order
+// of the combinations only depends on n, so results are the same on every target.
+template <typename T, class Combine>
+T reduce(const T* data, uint64_t n, T init, Combine combine) {
+    const int lanes = Lanes<T>::count;
+
+    T acc[lanes];
+    for (int k = 0; k < lanes; k++)
+        acc[k] = init;
+
+    uint64_t i = 0;
+    for (; i + lanes <= n; i += lanes) {
+        for (int k = 0; k < lanes; k++)
+            acc[k] = combine(acc[k], data[i + k]);
+    }
+
+    for (; i < n; i++)
+        acc[0] = combine(acc[0], data[i]);
+
+    for (int width = lanes / 2; width > 0; width /= 2) {
+        for (int k = 0; k < width; k++)
+            acc[k] = combine(acc[k], acc[k + width]);
+    }
+
+    return acc[0];
+}
+
+// Sums of (data[i] - shift) and of its square for i in [0, n), in lanes
+// like reduce(). A shift near the mean (e.g. data[0]) keeps the variance,
+// sum_sq / n - (sum / n)^2, from cancelling out.
+template <typename T>
+void moments(const T* data, uint64_t n, T shift, T& sum, T& sum_sq) {
+    const int lanes = Lanes<T>::count;
+
+    T s[lanes], sq[lanes];
+    for (int k = 0; k < lanes; k++) {
+        s[k] = 0;
+        sq[k] = 0;
+    }
+
+    uint64_t i = 0;
+    for (; i + lanes <= n; i += lanes) {
+        for (int k = 0; k < lanes; k++) {
+            T d = data[i + k] - shift;
+            s[k] += d;
+            sq[k] += d * d;
+        }
+    }
+
+    for (; i < n; i++) {
+        T d = data[i] - shift;
+        s[0] += d;
+        sq[0] += d * d;
+    }
+
+    for (int width = lanes / 2; width > 0; width /= 2) {
+        for (int k = 0; k < width; k++) {
+            s[k] += s[k + width];
+            sq[k] += sq[k + width];
+        }
+    }
+
+    sum = s[0];
+    sum_sq = sq[0];
+}
+
+// Sum of a[i] * b[i] for i in [0, n), in lanes like reduce().
+template <typename T>
+T dot(const T* a, const T* b, uint64_t n) {
+    const int lanes = Lanes<T>::count;
+
+    T acc[lanes];
+    for (int k = 0; k < lanes; k++)
+        acc[k] = 0;
+
+    uint64_t i = 0;
+    for (; i + lanes <= n; i += lanes) {
+        for (int k = 0; k < lanes; k++)
+            acc[k] += a[i + k] * b[i + k];
+    }
+
+    for (; i < n; i++)
+        acc[0] += a[i] * b[i];
+
+    for (int width = lanes / 2; width > 0; width /= 2) {
+        for (int k = 0; k < width; k++)
+            acc[k] += acc[k + width];
+    }
+
+    return acc[0];
+}
+
+// Sum of a[i] * b[i] for i in [0, n) over 8 bit integers, in INT32. Integer
+// sums are exact in any order, so this is left as a plain loop, which GCC
+// recognizes as a dot product: vpdpbusd with AVX-VNNI (-mavxvnni), and
+// widening multiplies into 32 bit lanes otherwise.
+inline int32_t dot(const uint8_t* a, const int8_t* b, uint64_t n) {
+    int32_t sum = 0;
+    for (uint64_t i = 0; i < n; i++)
+        sum += static_cast<int32_t>(a[i]) * static_cast<int32_t>(b[i]);
+
+    return sum;
+}
+
+// dst[i] = combine(dst[i], src[i]) for i in [0, n).
+template <typename T, class Combine>
+void accumulate(T* dst, const T* src, uint64_t n, Combine combine) {
+    for (uint64_t i = 0; i < n; i++)
+        dst[i] = combine(dst[i], src[i]);
+}
+
+} // namespace simd
+} // namespace deeplib
+
+#endif
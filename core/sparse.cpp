@@ -0,0 +1,253 @@
+#include <cassert>
+#include <algorithm>
+#include <numeric>
+#include <vector>
+#include "core/sparse.h"
+#include "core/operations.h"
+
+namespace deeplib {
+
+SparseMatrix::SparseMatrix(int rows, int columns, DataType dtype, SparseFormat format, Allocator* a) {
+    assert(dtype == DataType::FLOAT32 || dtype == DataType::FLOAT64);
+
+    format_ = format;
+    rows_ = rows;
+    columns_ = columns;
+    dtype_ = dtype;
+    allocator_ = a;
+    non_zeros_ = 0;
+
+    row_buf_ = newStorage((format == SparseFormat::CSR) ? rows + 1 : 1, (format == SparseFormat::CSR) ? DataType::INT64 : DataType::INT32);
+    column_buf_ = newStorage(1, DataType::INT32);
+    value_buf_ = newStorage(1, dtype);
+
+    row_op_ = a->newOperation(new Constant(row_buf_));
+    column_op_ = a->newOperation(new Constant(column_buf_));
+    value_op_ = a->newOperation(new Constant(value_buf_));
+
+    // No elements, i.e. every row is empty.
+    resize(0);
+}
+
+Buffer* SparseMatrix::newStorage(uint64_t capacity, DataType dtype) {
+    std::vector<int> shape = { static_cast<int>(capacity) };
+
+    Buffer* buf = allocator_->newBuffer(new Buffer(shape, allocator_));
+    buf->setDataType(dtype);
+    buf->initialize();
+    buf->pin();
+
+    return buf;
+}
+
+void SparseMatrix::resize(uint64_t non_zeros) {
+    // Outgrown buffers are replaced by ones twice as large (or as large as
+    // needed), so assigning a growing number of elements reallocates rarely.
+    uint64_t capacity = value_buf_->getSize() / dataTypeSize(dtype_);
+    if (non_zeros > capacity) {
+        capacity = std::max(non_zeros, 2 * capacity);
+
+        Buffer* old_bufs[] = { column_buf_, value_buf_ };
+
+        column_buf_ = newStorage(capacity, DataType::INT32);
+        value_buf_ = newStorage(capacity, dtype_);
+        column_op_->setBuffer(column_buf_);
+        value_op_->setBuffer(value_buf_);
+
+        if (format_ == SparseFormat::COO) {
+            allocator_->releaseBuffer(row_buf_);
+            row_buf_ = newStorage(capacity, DataType::INT32);
+            row_op_->setBuffer(row_buf_);
+        }
+
+        for (Buffer* buf : old_bufs)
+            allocator_->releaseBuffer(buf);
+    }
+
+    non_zeros_ = non_zeros;
+
+    std::vector<int> shape = { static_cast<int>(non_zeros) };
+    column_buf_->reshape(shape);
+    value_buf_->reshape(shape);
+    if (format_ == SparseFormat::COO)
+        row_buf_->reshape(shape);
+
+    row_buf_->bumpVersion();
+    column_buf_->bumpVersion();
+    value_buf_->bumpVersion();
+}
+
+template <typename SDType>
+void SparseMatrix::store(std::vector<int>& rows, std::vector<int>& columns, std::vector<SDType>& values) {
+    resize(values.size());
+
+    std::copy(columns.begin(), columns.end(), column_buf_->getBufferDataAsTemplate<int32_t>());
+    std::copy(values.begin(), values.end(), value_buf_->getBufferDataAsTemplate<SDType>());
+
+    if (format_ == SparseFormat::COO) {
+        std::copy(rows.begin(), rows.end(), row_buf_->getBufferDataAsTemplate<int32_t>());
+        return;
+    }
+
+    // Counts the elements of every row, then sums them up into offsets.
+    int64_t* offsets = row_buf_->getBufferDataAsTemplate<int64_t>();
+    std::fill(offsets, offsets + rows_ + 1, 0);
+
+    for (int r : rows)
+        offsets[r + 1]++;
+
+    std::partial_sum(offsets, offsets + rows_ + 1, offsets);
+}
+
+template <typename SDType>
+void SparseMatrix::load(std::vector<int>& rows, std::vector<int>& columns, std::vector<SDType>& values) {
+    int32_t* column_data = column_buf_->getBufferDataAsTemplate<int32_t>();
+    SDType* value_data = value_buf_->getBufferDataAsTemplate<SDType>();
+
+    columns.assign(column_data, column_data + non_zeros_);
+    values.assign(value_data, value_data + non_zeros_);
+
+    if (format_ == SparseFormat::COO) {
+        int32_t* row_data = row_buf_->getBufferDataAsTemplate<int32_t>();
+        rows.assign(row_data, row_data + non_zeros_);
+        return;
+    }
+
+    int64_t* offsets = row_buf_->getBufferDataAsTemplate<int64_t>();
+
+    rows.resize(non_zeros_);
+    for (int r = 0; r < rows_; r++)
+        std::fill(rows.begin() + offsets[r], rows.begin() + offsets[r + 1], r);
+}
+
+template <typename SDType>
+void SparseMatrix::assignAs(Buffer* dense) {
+    SDType* data = dense->getBufferDataAsTemplate<SDType>();
+
+    std::vector<int> rows, columns;
+    std::vector<SDType> values;
+
+    for (int r = 0; r < rows_; r++) {
+        for (int c = 0; c < columns_; c++) {
+            SDType value = data[static_cast<uint64_t>(r) * columns_ + c];
+            if (value == 0)
+                continue;
+
+            rows.push_back(r);
+            columns.push_back(c);
+            values.push_back(value);
+        }
+    }
+
+    store(rows, columns, values);
+}
+
+template <typename SDType>
+void SparseMatrix::assignAs(std::vector<int>& rows, std::vector<int>& columns, std::vector<double>& values) {
+    std::vector<uint64_t> order(values.size());
+    std::iota(order.begin(), order.end(), 0);
+
+    std::sort(order.begin(), order.end(), [&](uint64_t i, uint64_t j) {
+        return rows[i] < rows[j] || (rows[i] == rows[j] && columns[i] < columns[j]);
+    });
+
+    std::vector<int> sorted_rows, sorted_columns;
+    std::vector<SDType> sorted_values;
+
+    for (uint64_t i : order) {
+        assert(rows[i] >= 0 && rows[i] < rows_ && columns[i] >= 0 && columns[i] < columns_);
+
+        bool repeated = !sorted_rows.empty() && sorted_rows.back() == rows[i] && sorted_columns.back() == columns[i];
+        if (repeated) {
+            sorted_values.back() += values[i];
+            continue;
+        }
+
+        sorted_rows.push_back(rows[i]);
+        sorted_columns.push_back(columns[i]);
+        sorted_values.push_back(values[i]);
+    }
+
+    store(sorted_rows, sorted_columns, sorted_values);
+}
+
+void SparseMatrix::assign(Buffer* dense) {
+    assert(dense->getDataType() == dtype_);
+    assert(dense->getElements() == static_cast<uint64_t>(rows_) * columns_);
+
+    if (dtype_ == DataType::FLOAT32)
+        assignAs<float>(dense);
+    else
+        assignAs<double>(dense);
+}
+
+void SparseMatrix::assign(std::vector<int>& rows, std::vector<int>& columns, std::vector<double>& values) {
+    assert(rows.size() == values.size() && columns.size() == values.size());
+
+    if (dtype_ == DataType::FLOAT32)
+        assignAs<float>(rows, columns, values);
+    else
+        assignAs<double>(rows, columns, values);
+}
+
+void SparseMatrix::assign(SparseMatrix* other) {
+    assert(other->getRows() == rows_ && other->getColumns() == columns_);
+    assert(other->getDataType() == dtype_);
+
+    std::vector<int> rows, columns;
+
+    // Both keep their elements in the same order,
+    // so only the rows are stored differently.
+    if (dtype_ == DataType::FLOAT32) {
+        std::vector<float> values;
+        other->load(rows, columns, values);
+        store(rows, columns, values);
+    }
+    else {
+        std::vector<double> values;
+        other->load(rows, columns, values);
+        store(rows, columns, values);
+    }
+}
+
+void SparseMatrix::copyTo(Buffer* dense) {
+    assert(dense->getDataType() == dtype_);
+    assert(dense->getElements() == static_cast<uint64_t>(rows_) * columns_);
+
+    std::vector<int> rows, columns;
+    std::vector<double> values;
+
+    if (dtype_ == DataType::FLOAT32) {
+        std::vector<float> float_values;
+        load(rows, columns, float_values);
+        values.assign(float_values.begin(), float_values.end());
+    }
+    else
+        load(rows, columns, values);
+
+    std::vector<double> data(dense->getElements(), 0);
+    for (uint64_t i = 0; i < values.size(); i++)
+        data[static_cast<uint64_t>(rows[i]) * columns_ + columns[i]] = values[i];
+
+    dense->fill<double>(data);
+}
+
+SparseFormat SparseMatrix::getFormat() { return format_; }
+
+int SparseMatrix::getRows() { return rows_; }
+
+int SparseMatrix::getColumns() { return columns_; }
+
+DataType SparseMatrix::getDataType() { return dtype_; }
+
+uint64_t SparseMatrix::getNonZeros() { return non_zeros_; }
+
+Operation* SparseMatrix::getRowIndices() { return row_op_; }
+
+Operation* SparseMatrix::getColumnIndices() { return column_op_; }
+
+Operation* SparseMatrix::getValues() { return value_op_; }
+
+Allocator* SparseMatrix::getAllocator() { return allocator_; }
+
+} // namespace deeplib
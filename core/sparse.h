@@ -0,0 +1,107 @@
+#ifndef SPARSE
+#define SPARSE
+#include <vector>
+#include "core/allocator.h"
+#include "core/buffer.h"
+#include "core/data_types.h"
+
+namespace deeplib {
+
+class Operation;
+
+enum class SparseFormat { CSR, COO };
+
+// A [rows, columns] matrix storing only its non-zero elements, e.g. a graph's
+// adjacency or a batch of bag-of-words features.
+//
+// Elements are kept sorted by row, then column, in one of two formats:
+//   - CSR: the offset of every row's first element [rows + 1] (INT64),
+//     i.e. row r holds elements [offsets[r], offsets[r + 1]).
+//   - COO: the row of every element [non-zeros] (INT32).
+// Either way, along with the column [non-zeros] (INT32) and value
+// [non-zeros] of every element.
+//
+// A matrix's format and shape are set on construction, while its elements
+// can be reassigned (from a dense buffer, coordinates, or another sparse
+// matrix, i.e. converting between formats). Storage grows as needed, and
+// is only reallocated when the elements outgrow it.
+//
+// Graphs read a sparse matrix through the Constants over its storage (see
+// matmul() and toDense() in op_functions.h), so reassigning it is picked up
+// by the next run, as with any other refilled input.
+//
+// Sparse matrices are created through Allocator::newSparseMatrix(), which owns them.
+//
+// NOTE: Only floating point values are supported.
+class SparseMatrix {
+    SparseFormat format_;
+    int rows_;
+    int columns_;
+    DataType dtype_;
+    Allocator* allocator_;
+
+    uint64_t non_zeros_;
+
+    // Row offsets (CSR) or rows (COO), columns and values.
+    Buffer* row_buf_;
+    Buffer* column_buf_;
+    Buffer* value_buf_;
+
+    // Constants over the buffers above, for graphs to read them through.
+    Operation* row_op_;
+    Operation* column_op_;
+    Operation* value_op_;
+
+    // Returns a pinned buffer of the given data type with room for `capacity` elements.
+    Buffer* newStorage(uint64_t capacity, DataType dtype);
+
+    // Makes room for `non_zeros` elements and sizes the buffers to them.
+    void resize(uint64_t non_zeros);
+
+    // Replaces the elements with the given ones, sorted by row then column.
+    template <typename SDType>
+    void store(std::vector<int>& rows, std::vector<int>& columns, std::vector<SDType>& values);
+
+    // Lists the elements, sorted by row then column.
+    template <typename SDType>
+    void load(std::vector<int>& rows, std::vector<int>& columns, std::vector<SDType>& values);
+
+    template <typename SDType>
+    void assignAs(Buffer* dense);
+
+    template <typename SDType>
+    void assignAs(std::vector<int>& rows, std::vector<int>& columns, std::vector<double>& values);
+
+  public:
+    SparseMatrix(int rows, int columns, DataType dtype, SparseFormat format, Allocator* a);
+
+    // Keeps the non-zero elements of a dense [rows, columns] buffer.
+    void assign(Buffer* dense);
+
+    // Sets the elements from their coordinates, in any order.
+    // Repeated coordinates add up.
+    void assign(std::vector<int>& rows, std::vector<int>& columns, std::vector<double>& values);
+
+    // Takes the elements of another matrix of the same shape and data type,
+    // converting them to this matrix's format.
+    void assign(SparseMatrix* other);
+
+    // Writes the matrix into a dense [rows, columns] buffer.
+    void copyTo(Buffer* dense);
+
+    SparseFormat getFormat();
+    int getRows();
+    int getColumns();
+    DataType getDataType();
+    uint64_t getNonZeros();
+
+    Operation* getRowIndices();
+    Operation* getColumnIndices();
+    Operation* getValues();
+
+    Allocator* getAllocator();
+};
+
+} // namespace deeplib
+
+#endif
@@ -1,6 +1,7 @@
 #include <cassert>
 #include <vector>
 #include <memory>
+#include <unordered_map>
 #include "core/data_types.h"
 #include "core/tensor.h"
 #include "core/buffer.h"
@@ -16,6 +17,8 @@ Tensor::Tensor(std::vector<int> new_shape, DataType data_type, Allocator* a) {
     dtype_ = data_type;
 
     buffer_ = allocator_->newBuffer(new Buffer(new_shape, a));
+    buffer_->setDataType(dtype_);
+    buffer_->pin();
     operation_ = allocator_->newOperation(new Constant(buffer_)); // ?? subject to change
 }
 
@@ -26,9 +29,21 @@ Tensor::Tensor(std::vector<int> values, std::vector<int> shape, Allocator* a) {
     dtype_ = DataType::INT32;
 
     buffer_ = allocator_->newBuffer(new Buffer(values, shape, a));
+    buffer_->pin();
     operation_ = allocator_->newOperation(new Constant(buffer_));
 }
 
+Tensor::Tensor(Buffer* buf, Operation* op) {
+    children_ = 0;
+    allocator_ = buf->getAllocator();
+
+    dtype_ = buf->getDataType();
+
+    buffer_ = buf;
+    buffer_->pin();
+    operation_ = op;
+}
+
 Tensor::Tensor(Tensor& t1, Tensor& t2, Operation* op) {
     children_ = 0;
 
@@ -45,10 +60,27 @@ Tensor::Tensor(Tensor& t1, Tensor& t2, Operation* op) {
 
     if (&t1 == &t2) {
         buffer_ = allocator_->newBuffer(new Buffer(t1.getShape(), t1.getAllocator()));
+        buffer_->setDataType(t1.getDataType());
 
         t1.incrChildren();
     }
 
+    // Pinned buffers hold graph inputs and are never overwritten, so the
+    // result either takes the larger parent's buffer (if it's free to take)
+    // or gets a buffer of it's own.
+    else if (t1.getBuffer()->isPinned() || t2.getBuffer()->isPinned()) {
+        Tensor& larger = (t1.getBuffer()->getElements() >= t2.getBuffer()->getElements()) ? t1 : t2;
+
+        if (!larger.getBuffer()->isPinned() && larger.getChildren() == 0)
+            buffer_ = larger.getBuffer();
+        else {
+            buffer_ = allocator_->newBuffer(new Buffer(larger.getShape(), allocator_));
+            buffer_->setDataType(larger.getDataType());
+        }
+
+        larger.incrChildren();
+    }
+
     // Buffer shenanigans if a single tensor is used in two or more operations.
     //
     // For each tensor, n-1 buffers need to be allocated
@@ -58,7 +90,7 @@ Tensor::Tensor(Tensor& t1, Tensor& t2, Operation* op) {
     // needs moved to the latest tensor so that in-place calculations
     // don't overwrite the original buffer and throw off the rest
     // of the calculation graph.
-    else if (t1.getSize() >= t2.getSize()) {
+    else if (t1.getBuffer()->getElements() >= t2.getBuffer()->getElements()) {
         if (t1.getChildren() > 0) {
             buffer_ = t1.getBuffer();
             t1.setBuffer(allocator_->newBuffer(new Buffer(t1.getBuffer())));
@@ -79,7 +111,7 @@ Tensor::Tensor(Tensor& t1, Tensor& t2, Operation* op) {
     }
     else {
         if (t2.getChildren() > 0) {
-            buffer_ = t1.getBuffer();
+            buffer_ = t2.getBuffer();
             t2.setBuffer(allocator_->newBuffer(new Buffer(t2.getBuffer())));
 
             t2.incrChildren();
@@ -100,8 +132,9 @@ Tensor::Tensor(Tensor& t1, Tensor& t2, Operation* op, std::vector<int> new_shape
     children_ = 0;
 
     allocator_ = t1.getAllocator();
-    buffer_ = allocator_->newBuffer(new Buffer(new_shape, allocator_));
     dtype_ = t1.getDataType();
+    buffer_ = allocator_->newBuffer(new Buffer(new_shape, allocator_));
+    buffer_->setDataType(dtype_);
     operation_ = op;
     operation_->setBuffer(buffer_);
 }
@@ -111,8 +144,27 @@ Tensor::Tensor(Tensor& t, Operation* op) {
     t.incrChildren();
 
     allocator_ = t.getAllocator();
-    buffer_ = t.getBuffer();
     dtype_ = t.getDataType();
+
+    if (t.getBuffer()->isPinned()) {
+        buffer_ = allocator_->newBuffer(new Buffer(t.getShape(), allocator_));
+        buffer_->setDataType(dtype_);
+    }
+    else
+        buffer_ = t.getBuffer();
+
+    operation_ = op;
+    operation_->setBuffer(buffer_);
+}
+
+Tensor::Tensor(Tensor& t, Operation* op, std::vector<int> new_shape) {
+    children_ = 0;
+    t.incrChildren();
+
+    allocator_ = t.getAllocator();
+    dtype_ = t.getDataType();
+    buffer_ = allocator_->newBuffer(new Buffer(new_shape, allocator_));
+    buffer_->setDataType(dtype_);
     operation_ = op;
     operation_->setBuffer(buffer_);
 }
@@ -134,10 +186,59 @@ Tensor::Tensor(Tensor& t, Operation* op, DataType new_dtype) {
     operation_->setBuffer(buffer_);
 }
 
+Tensor::Tensor(Tensor& t, Operation* op, std::vector<int> new_shape, DataType new_dtype) {
+    children_ = 0;
+    t.incrChildren();
+
+    allocator_ = t.getAllocator();
+    dtype_ = new_dtype;
+    buffer_ = allocator_->newBuffer(new Buffer(new_shape, allocator_));
+    buffer_->setDataType(dtype_);
+    operation_ = op;
+    operation_->setBuffer(buffer_);
+}
+
 Tensor::~Tensor() {}
 
-void Tensor::operate() {
-    operation_->operate();
+void Tensor::operate(bool incremental) {
+    if (incremental && !operation_->isSeparated())
+        separateBuffers();
+
+    buffer_ = operation_->operate(incremental);
+}
+
+void Tensor::separateBuffers() {
+    std::unordered_map<Buffer*, Operation*> owners;
+
+    // Parents come first, so the operation that first
+    // wrote to a buffer is the one that keeps it.
+    for (Operation* op : topologicalOrder(operation_)) {
+        Buffer* buf = op->getBuffer();
+
+        auto owner = owners.find(buf);
+        if (owner == owners.end()) {
+            owners[buf] = op;
+            continue;
+        }
+
+        // The owner's result may have been overwritten in place.
+        owner->second->invalidate();
+
+        Buffer* own_buf = allocator_->newBuffer(new Buffer(buf->getShape(), allocator_));
+        own_buf->setDataType(buf->getDataType());
+        op->setBuffer(own_buf);
+
+        owners[own_buf] = op;
+    }
+
+    operation_->setSeparated();
+}
+
+void Tensor::feed(Buffer* buf) {
+    assert(!operation_->getType().compare("placeholder"));
+
+    static_cast<Placeholder*>(operation_)->bind(buf);
+    buffer_ = buf;
 }
 
 void Tensor::uproot() {
@@ -145,11 +246,11 @@ void Tensor::uproot() {
 }
 
 std::vector<int>& Tensor::getShape() {
-    return buffer_->getShape();
+    return getBuffer()->getShape();
 }
 
 uint64_t Tensor::getSize() {
-    return buffer_->getSize();
+    return getBuffer()->getSize();
 }
 
 DataType Tensor::getDataType() {
@@ -165,10 +266,13 @@ Operation* Tensor::getOperation() {
 }
 
 Allocator* Tensor::getAllocator() {
-    return buffer_->getAllocator();
+    return getBuffer()->getAllocator();
 }
 
 Buffer* Tensor::getBuffer() {
+    // The operation's buffer may have been replaced since, e.g. when
+    // an incremental operate of a later tensor separated the buffers.
+    buffer_ = operation_->getBuffer();
     return buffer_;
 }
 
@@ -177,50 +281,63 @@ void Tensor::setBuffer(Buffer* buf) {
     operation_->setBuffer(buf);
 }
 
+void Tensor::setOperation(Operation* op) {
+    operation_ = op;
+    buffer_ = op->getBuffer();
+}
+
 void Tensor::print(bool linear) {
     switch (dtype_) {
       case DataType::UINT8:
-        buffer_->print<uint8_t>(linear);
+        getBuffer()->print<uint8_t>(linear);
         return;
 
       case DataType::UINT16:
-        buffer_->print<uint16_t>(linear);
+        getBuffer()->print<uint16_t>(linear);
         return;
 
       case DataType::UINT32:
-        buffer_->print<uint32_t>(linear);
+        getBuffer()->print<uint32_t>(linear);
         return;
 
       case DataType::UINT64:
-        buffer_->print<uint64_t>(linear);
+        getBuffer()->print<uint64_t>(linear);
         return;
 
       case DataType::INT8:
-        buffer_->print<int8_t>(linear);
+        getBuffer()->print<int8_t>(linear);
         return;
 
       case DataType::INT16:
-        buffer_->print<int16_t>(linear);
+        getBuffer()->print<int16_t>(linear);
         return;
 
       case DataType::INT32:
-        buffer_->print<int32_t>(linear);
+        getBuffer()->print<int32_t>(linear);
         return;
 
       case DataType::INT64:
-        buffer_->print<int64_t>(linear);
+        getBuffer()->print<int64_t>(linear);
         return;
         
       case DataType::FLOAT32:
-        buffer_->print<float>(linear);
+        getBuffer()->print<float>(linear);
         return;
 
       case DataType::FLOAT64:
-        buffer_->print<double>(linear);
+        getBuffer()->print<double>(linear);
         return;
 
       case DataType::BOOL:
-        buffer_->print<bool>(linear);
+        getBuffer()->print<bool>(linear);
+        return;
+
+      case DataType::FLOAT16:
+        getBuffer()->print<float16>(linear);
+        return;
+
+      case DataType::BFLOAT16:
+        getBuffer()->print<bfloat16>(linear);
         return;
 
       default:
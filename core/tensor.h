@@ -22,6 +22,10 @@ class Tensor {
 
     void incrChildren() { children_++; }
 
+    // Gives every operation in the graph whose buffer is shared
+    // with one of its ancestors a buffer of its own.
+    void separateBuffers();
+
   public:
     Tensor(std::vector<int> new_shape, DataType dt, Allocator* a);
 
@@ -31,6 +35,10 @@ class Tensor {
     //       some other way. Eigen tensors/matrices?
     Tensor(std::vector<int> values, std::vector<int> s, Allocator* a);
 
+    // Tensor wrapping a graph input, i.e. a Constant or Placeholder,
+    // along with the buffer it reads from.
+    Tensor(Buffer* buf, Operation* op);
+
     // Tensor constructed from a binary operation. The operation given
     // is what this tensors operation will be.
     Tensor(Tensor& t1, Tensor& t2, Operation* op);
@@ -42,16 +50,41 @@ class Tensor {
     // Tensor constructed from a unary operation.
     Tensor(Tensor& t, Operation* op);
 
+    // Unary operation yielding a differently shaped output.
+    Tensor(Tensor& t, Operation* op, std::vector<int> new_shape);
+
     // Constructor for implicit casts from operations.
     Tensor(Tensor& t, Operation* op, DataType new_dtype);
 
+    // Unary operation yielding an output of a different shape and data type.
+    Tensor(Tensor& t, Operation* op, std::vector<int> new_shape, DataType new_dtype);
+
     ~Tensor();
 
     // Operates the tensor, bringing the data in the buffer up to speed
     // at the current operation. 
     // NOTE: This overwrites buffers.
     // TODO: How directly (or indirectly) will the user interact with this?
-    void operate();
+    //
+    // If `incremental` is true, only the operations downstream of inputs
+    // changed since the last operate are recomputed. Since that relies on
+    // every intermediate result staying intact, the first incremental
+    // operate undoes the graph's in place buffer sharing, costing one
+    // buffer per operation from then on. Tensors in the graph pick up
+    // their new buffers on their next getBuffer().
+    void operate(bool incremental=false);
+
+    // Refills a placeholder tensor with new values. The values are converted
+    // to the tensor's data type and must match it's number of elements.
+    //
+    // Neither the graph nor any of it's buffers are rebuilt, so the next
+    // operate() only costs the computation itself.
+    template <typename TDType>
+    void feed(std::vector<TDType> values);
+
+    // Rebinds a placeholder tensor to the given buffer, which must match
+    // the placeholder's shape and data type.
+    void feed(Buffer* buf);
 
     // Deallocate this tensor and ALL of it's ancestors.
     // Once this is called, all affected tensors will be unusable.
@@ -77,9 +110,14 @@ class Tensor {
 
     void setBuffer(Buffer* buf);
 
+    // Points the tensor at an operation standing in for its own,
+    // e.g. after a graph pass (see passes.h) replaced it.
+    void setOperation(Operation* op);
+
     void print(bool linear=false);
 };
 
 } // namespace deeplib
 
+#include "core/tensor.t.h"
 #endif
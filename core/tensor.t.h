@@ -0,0 +1,12 @@
+namespace deeplib {
+
+template <typename TDType>
+void Tensor::feed(std::vector<TDType> values) {
+    assert(!operation_->getType().compare("placeholder"));
+
+    // The placeholder may have been rebound since this tensor last saw it.
+    buffer_ = operation_->getBuffer();
+    buffer_->fill<TDType>(values);
+}
+
+} // namespace deeplib
@@ -0,0 +1,100 @@
+#include "core/thread_pool.h"
+#include "core/config.h"
+
+namespace deeplib {
+
+// Whether the current thread is working on a run, of any pool.
+static thread_local bool working = false;
+
+ThreadPool::ThreadPool(int threads) {
+    job_ = nullptr;
+    tasks_ = 0;
+    next_ = 0;
+    busy_ = 0;
+    generation_ = 0;
+    stopping_ = false;
+
+    for (int i = 1; i < threads; i++)
+        workers_.push_back(std::thread(&ThreadPool::serve, this));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+
+    start_.notify_all();
+    for (std::thread& worker : workers_)
+        worker.join();
+}
+
+void ThreadPool::serve() {
+    uint64_t seen = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            start_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+
+            if (stopping_)
+                return;
+
+            seen = generation_;
+        }
+
+        work();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--busy_ == 0)
+            done_.notify_one();
+    }
+}
+
+void ThreadPool::work() {
+    working = true;
+    for (int task = next_++; task < tasks_; task = next_++)
+        (*job_)(task);
+
+    working = false;
+}
+
+void ThreadPool::run(int tasks, const std::function<void(int)>& job) {
+    // Not worth waking anyone up for, or nobody's free to wake up.
+    // `working` is checked first, as the thread may hold run_mutex_ itself.
+    std::unique_lock<std::mutex> running(run_mutex_, std::defer_lock);
+    if (workers_.empty() || tasks <= 1 || working || !running.try_lock()) {
+        for (int task = 0; task < tasks; task++)
+            job(task);
+
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        job_ = &job;
+        tasks_ = tasks;
+        next_ = 0;
+        busy_ = workers_.size();
+        generation_++;
+    }
+
+    start_.notify_all();
+    work();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return busy_ == 0; });
+
+    job_ = nullptr;
+}
+
+int ThreadPool::getThreads() {
+    return workers_.size() + 1;
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool(getDefaultThreads());
+    return pool;
+}
+
+} // namespace deeplib
@@ -0,0 +1,70 @@
+#ifndef THREAD_POOL
+#define THREAD_POOL
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+namespace deeplib {
+
+// Fixed set of worker threads splitting a number of tasks among themselves.
+//
+// run() hands out task indices to the workers and the calling thread alike,
+// and returns once every task is done. Dispatching allocates nothing, so
+// kernels can be run through a pool on every step of a hot loop.
+//
+// A run() made while the pool is busy, i.e. from a task (a nested run) or
+// from another thread in the middle of a run (e.g. a second ExecutionContext),
+// runs its tasks inline on the calling thread rather than waiting for the
+// pool. Concurrent callers thus each keep a thread going instead of taking
+// turns, and nesting never waits on itself.
+class ThreadPool {
+    std::vector<std::thread> workers_;
+
+    // Held by the run the workers are on.
+    std::mutex run_mutex_;
+
+    std::mutex mutex_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+
+    // Job of the current run, its task count and the next task to be taken.
+    const std::function<void(int)>* job_;
+    int tasks_;
+    std::atomic<int> next_;
+
+    // Workers still working on the current run.
+    int busy_;
+
+    // Incremented on every run, so workers can tell a new one apart.
+    uint64_t generation_;
+
+    bool stopping_;
+
+    void serve();
+
+    // Takes and runs tasks of the current job until there are none left.
+    void work();
+
+  public:
+    // `threads` counts the calling thread, i.e. `threads - 1` workers are started.
+    ThreadPool(int threads = std::thread::hardware_concurrency());
+
+    ~ThreadPool();
+
+    // Runs job(0) ... job(tasks - 1), returning once all of them are done.
+    void run(int tasks, const std::function<void(int)>& job);
+
+    // Threads working on a run, including the calling one.
+    int getThreads();
+
+    // Pool shared by the library's kernels, using every hardware
+    // thread unless configured otherwise (see getDefaultThreads()).
+    static ThreadPool& shared();
+};
+
+} // namespace deeplib
+
+#endif
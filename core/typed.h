@@ -0,0 +1,396 @@
+#ifndef TYPED
+#define TYPED
+#include <cassert>
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <iostream>
+#include <type_traits>
+#include "core/tensor.h"
+#include "core/vector_math.h"
+
+namespace deeplib {
+namespace typed {
+
+// Tensors whose data type is known at compile time, for element-wise
+// expressions known at compile time as well.
+//
+// Operators and the functions below don't compute anything, they build an
+// expression (e.g. Binary<Divide, Binary<Add, ...>, Leaf<float>>) that reads
+// its operands element by element. Assigning it to a Tensor<T> evaluates
+// the whole expression in a single loop, compiled for it alone:
+//
+//   typed::Tensor<float> z = (x + exp(x * y)) / x;
+//
+// is one pass over x and y, with no Operation, Buffer or data type switch
+// in between, and vectorized like the kernels of simd.h and vector_math.h.
+//
+// Operands are Tensor<T>s of the same shape and T, or scalars (converted to
+// T). Expressions hold their tensors' data by pointer, so they must not
+// outlive them, and are meant to be assigned right away rather than kept
+// (`auto e = x + y` is fine, as long as x and y are still around at `z = e`).
+//
+// As every element of the result only depends on the same element of the
+// operands, a tensor can be assigned an expression reading it (x = x * x).
+
+// DataType of a C++ type, for exchanging data with the graph.
+template <typename T> struct DataTypeOf;
+template <> struct DataTypeOf<uint8_t>  { static const DataType value = DataType::UINT8; };
+template <> struct DataTypeOf<int8_t>   { static const DataType value = DataType::INT8; };
+template <> struct DataTypeOf<uint16_t> { static const DataType value = DataType::UINT16; };
+template <> struct DataTypeOf<int16_t>  { static const DataType value = DataType::INT16; };
+template <> struct DataTypeOf<uint32_t> { static const DataType value = DataType::UINT32; };
+template <> struct DataTypeOf<int32_t>  { static const DataType value = DataType::INT32; };
+template <> struct DataTypeOf<uint64_t> { static const DataType value = DataType::UINT64; };
+template <> struct DataTypeOf<int64_t>  { static const DataType value = DataType::INT64; };
+template <> struct DataTypeOf<float>    { static const DataType value = DataType::FLOAT32; };
+template <> struct DataTypeOf<double>   { static const DataType value = DataType::FLOAT64; };
+
+// Expressions of this many elements and up are split across ThreadPool::shared().
+const uint64_t typed_parallel_threshold = 1 << 16;
+
+// Base of every expression node E (the curiously recurring template pattern),
+// marking it as one for the operators.
+template <class E>
+struct Expression {
+    const E& self() const { return static_cast<const E&>(*this); }
+};
+
+// A tensor's data, read as an operand.
+template <typename T>
+class Leaf : public Expression<Leaf<T>> {
+    const T* data_;
+    const std::vector<int>* shape_;
+
+  public:
+    using value_type = T;
+    static const bool is_scalar = false;
+
+    Leaf(const T* data, const std::vector<int>* shape) : data_(data), shape_(shape) {}
+
+    T operator[](uint64_t i) const { return data_[i]; }
+
+    const std::vector<int>* getShape() const { return shape_; }
+};
+
+// A scalar, the same for every element.
+template <typename T>
+class Scalar : public Expression<Scalar<T>> {
+    T value_;
+
+  public:
+    using value_type = T;
+    static const bool is_scalar = true;
+
+    Scalar(T value) : value_(value) {}
+
+    T operator[](uint64_t) const { return value_; }
+
+    const std::vector<int>* getShape() const { return nullptr; }
+};
+
+template <class Op, class A>
+class Unary : public Expression<Unary<Op, A>> {
+    A a_;
+
+  public:
+    using value_type = typename A::value_type;
+    static const bool is_scalar = A::is_scalar;
+
+    Unary(const A& a) : a_(a) {}
+
+    value_type operator[](uint64_t i) const { return Op()(a_[i]); }
+
+    const std::vector<int>* getShape() const { return a_.getShape(); }
+};
+
+template <class Op, class A, class B>
+class Binary : public Expression<Binary<Op, A, B>> {
+    A a_;
+    B b_;
+
+  public:
+    using value_type = typename A::value_type;
+    static const bool is_scalar = A::is_scalar && B::is_scalar;
+
+    Binary(const A& a, const B& b);
+
+    value_type operator[](uint64_t i) const { return Op()(a_[i], b_[i]); }
+
+    const std::vector<int>* getShape() const { return A::is_scalar ? b_.getShape() : a_.getShape(); }
+};
+
+// Element-wise functions of the expressions. The transcendental ones are
+// those of vector_math.h, and are only defined for float and double.
+
+struct Negate {
+    template <typename T>
+    T operator()(T x) const { return -x; }
+};
+
+struct Absolute {
+    template <typename T>
+    T operator()(T x) const { return (x < 0) ? -x : x; }
+};
+
+struct Exp {
+    template <typename T>
+    T operator()(T x) const { return vmath::exp(x); }
+};
+
+struct Log {
+    template <typename T>
+    T operator()(T x) const { return vmath::log(x); }
+};
+
+struct Sqrt {
+    template <typename T>
+    T operator()(T x) const { return std::sqrt(x); }
+};
+
+struct Tanh {
+    template <typename T>
+    T operator()(T x) const { return vmath::tanh(x); }
+};
+
+struct Sigmoid {
+    template <typename T>
+    T operator()(T x) const { return vmath::sigmoid(x); }
+};
+
+struct Add {
+    template <typename T>
+    T operator()(T a, T b) const { return a + b; }
+};
+
+struct Subtract {
+    template <typename T>
+    T operator()(T a, T b) const { return a - b; }
+};
+
+struct Multiply {
+    template <typename T>
+    T operator()(T a, T b) const { return a * b; }
+};
+
+struct Divide {
+    template <typename T>
+    T operator()(T a, T b) const { return a / b; }
+};
+
+struct Maximum {
+    template <typename T>
+    T operator()(T a, T b) const { return (b > a) ? b : a; }
+};
+
+struct Minimum {
+    template <typename T>
+    T operator()(T a, T b) const { return (b < a) ? b : a; }
+};
+
+struct Power {
+    template <typename T>
+    T operator()(T a, T b) const {
+        if constexpr (std::is_same<T, float>::value)
+            return vmath::pow(a, b);
+        else
+            return std::pow(a, b);
+    }
+};
+
+// Tensor of T's laid out in row-major order, either holding its own data
+// or viewing a Buffer's (e.g. a graph input or result).
+template <typename T>
+class Tensor {
+    static_assert(std::is_arithmetic<T>::value, "typed::Tensor holds integers or floats");
+
+    std::vector<int> shape_;
+
+    // Null for views. Left uninitialized until assigned, as most
+    // tensors are made from an expression filling them anyway.
+    std::unique_ptr<T[]> values_;
+
+    T* data_;
+    uint64_t elements_;
+
+    // Takes `shape` and allocates values_ for it.
+    void allocate(const std::vector<int>& shape);
+
+    // Evaluates `e` into data_.
+    template <class E>
+    void assign(const E& e);
+
+  public:
+    using value_type = T;
+
+    // Tensor of the given shape, zeroed.
+    Tensor(std::vector<int> shape);
+
+    // Tensor of the given shape initialized from a 1D set of values.
+    Tensor(std::vector<T> values, std::vector<int> shape);
+
+    // View of a buffer of data type DataTypeOf<T>. Writes go to the buffer,
+    // whose graph (if any) should be told about them with bumpVersion().
+    Tensor(Buffer* buf);
+
+    // Evaluates an expression into a new tensor of its shape.
+    template <class E>
+    Tensor(const Expression<E>& e);
+
+    // Copies hold their own data, even when copying a view.
+    Tensor(const Tensor& t);
+    Tensor(Tensor&& t);
+
+    // Assignments evaluate into the tensor's data (including a view's),
+    // which must have as many elements unless the tensor holds its own.
+    Tensor& operator=(const Tensor& t);
+    Tensor& operator=(Tensor&& t);
+
+    template <class E>
+    Tensor& operator=(const Expression<E>& e);
+
+    // Compound assignments, each a single pass as well.
+    template <class X>
+    Tensor& operator+=(const X& x);
+
+    template <class X>
+    Tensor& operator-=(const X& x);
+
+    template <class X>
+    Tensor& operator*=(const X& x);
+
+    template <class X>
+    Tensor& operator/=(const X& x);
+
+    // Copies the data into a new pinned Constant of the graph, allocated by `a`.
+    deeplib::Tensor toConstant(Allocator* a) const;
+
+    Leaf<T> leaf() const { return Leaf<T>(data_, &shape_); }
+
+    T& operator[](uint64_t i) { return data_[i]; }
+    const T& operator[](uint64_t i) const { return data_[i]; }
+
+    // Self-explanatory getters.
+
+    const std::vector<int>& getShape() const { return shape_; }
+
+    uint64_t getElements() const { return elements_; }
+
+    T* getData() { return data_; }
+    const T* getData() const { return data_; }
+
+    bool isView() const { return data_ != values_.get(); }
+};
+
+// Operands as expression nodes: tensors become Leafs, and scalars Scalars
+// of the value type of the expression they're used in.
+template <class X>
+struct IsTensor : std::false_type {};
+
+template <typename T>
+struct IsTensor<Tensor<T>> : std::true_type {};
+
+template <class X>
+struct IsExpression {
+    static const bool value = IsTensor<X>::value || std::is_base_of<Expression<X>, X>::value;
+};
+
+template <class X, typename T, bool = IsTensor<X>::value, bool = std::is_arithmetic<X>::value>
+struct Operand {
+    using type = X;
+    static const X& wrap(const X& x) { return x; }
+};
+
+template <class X, typename T>
+struct Operand<X, T, true, false> {
+    using type = Leaf<T>;
+    static Leaf<T> wrap(const X& x) { return x.leaf(); }
+};
+
+template <class X, typename T>
+struct Operand<X, T, false, true> {
+    using type = Scalar<T>;
+    static Scalar<T> wrap(X x) { return Scalar<T>(static_cast<T>(x)); }
+};
+
+// Value type of an expression combining A and B, at least one of them
+// an expression.
+template <class A, class B, bool = IsExpression<A>::value>
+struct ValueOf { using type = typename A::value_type; };
+
+template <class A, class B>
+struct ValueOf<A, B, false> { using type = typename B::value_type; };
+
+template <class Op, class A, class B>
+using BinaryOf = Binary<Op,
+    typename Operand<A, typename ValueOf<A, B>::type>::type,
+    typename Operand<B, typename ValueOf<A, B>::type>::type>;
+
+template <class Op, class A>
+using UnaryOf = Unary<Op, typename Operand<A, typename A::value_type>::type>;
+
+// Enables the operators and functions for operands at least one of which
+// is an expression, and the other an expression or a scalar.
+template <class A, class B>
+using EnableBinary = typename std::enable_if<
+    (IsExpression<A>::value && (IsExpression<B>::value || std::is_arithmetic<B>::value)) ||
+    (IsExpression<B>::value && std::is_arithmetic<A>::value)>::type;
+
+template <class A>
+using EnableUnary = typename std::enable_if<IsExpression<A>::value>::type;
+
+template <class Op, class A, class B>
+BinaryOf<Op, A, B> binary(const A& a, const B& b);
+
+template <class Op, class A>
+UnaryOf<Op, A> unary(const A& a);
+
+template <class A, class B, class = EnableBinary<A, B>>
+BinaryOf<Add, A, B> operator+(const A& a, const B& b) { return binary<Add>(a, b); }
+
+template <class A, class B, class = EnableBinary<A, B>>
+BinaryOf<Subtract, A, B> operator-(const A& a, const B& b) { return binary<Subtract>(a, b); }
+
+template <class A, class B, class = EnableBinary<A, B>>
+BinaryOf<Multiply, A, B> operator*(const A& a, const B& b) { return binary<Multiply>(a, b); }
+
+template <class A, class B, class = EnableBinary<A, B>>
+BinaryOf<Divide, A, B> operator/(const A& a, const B& b) { return binary<Divide>(a, b); }
+
+template <class A, class B, class = EnableBinary<A, B>>
+BinaryOf<Maximum, A, B> maximum(const A& a, const B& b) { return binary<Maximum>(a, b); }
+
+template <class A, class B, class = EnableBinary<A, B>>
+BinaryOf<Minimum, A, B> minimum(const A& a, const B& b) { return binary<Minimum>(a, b); }
+
+template <class A, class B, class = EnableBinary<A, B>>
+BinaryOf<Power, A, B> pow(const A& a, const B& b) { return binary<Power>(a, b); }
+
+template <class A, class = EnableUnary<A>>
+UnaryOf<Negate, A> operator-(const A& a) { return unary<Negate>(a); }
+
+template <class A, class = EnableUnary<A>>
+UnaryOf<Absolute, A> abs(const A& a) { return unary<Absolute>(a); }
+
+template <class A, class = EnableUnary<A>>
+UnaryOf<Exp, A> exp(const A& a) { return unary<Exp>(a); }
+
+template <class A, class = EnableUnary<A>>
+UnaryOf<Log, A> log(const A& a) { return unary<Log>(a); }
+
+template <class A, class = EnableUnary<A>>
+UnaryOf<Sqrt, A> sqrt(const A& a) { return unary<Sqrt>(a); }
+
+template <class A, class = EnableUnary<A>>
+UnaryOf<Tanh, A> tanh(const A& a) { return unary<Tanh>(a); }
+
+template <class A, class = EnableUnary<A>>
+UnaryOf<Sigmoid, A> sigmoid(const A& a) { return unary<Sigmoid>(a); }
+
+} // namespace typed
+} // namespace deeplib
+
+#include "core/typed.t.h"
+#endif
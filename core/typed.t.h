@@ -0,0 +1,187 @@
+namespace deeplib {
+namespace typed {
+
+template <class Op, class A, class B>
+Binary<Op, A, B>::Binary(const A& a, const B& b) : a_(a), b_(b) {
+    static_assert(std::is_same<typename A::value_type, typename B::value_type>::value,
+                  "operands of an expression must have the same data type");
+
+    if (!A::is_scalar && !B::is_scalar && *a.getShape() != *b.getShape()) {
+        std::cout << "ERROR: mismatching shapes in typed expression!" << std::endl;
+        assert(false);
+    }
+}
+
+template <class Op, class A, class B>
+BinaryOf<Op, A, B> binary(const A& a, const B& b) {
+    using T = typename ValueOf<A, B>::type;
+
+    return BinaryOf<Op, A, B>(Operand<A, T>::wrap(a), Operand<B, T>::wrap(b));
+}
+
+template <class Op, class A>
+UnaryOf<Op, A> unary(const A& a) {
+    return UnaryOf<Op, A>(Operand<A, typename A::value_type>::wrap(a));
+}
+
+template <typename T>
+void Tensor<T>::allocate(const std::vector<int>& shape) {
+    shape_ = shape;
+
+    elements_ = 1;
+    for (int dim : shape_)
+        elements_ *= dim;
+
+    values_.reset(new T[elements_]);
+    data_ = values_.get();
+}
+
+template <typename T>
+Tensor<T>::Tensor(std::vector<int> shape) {
+    allocate(shape);
+    std::fill(data_, data_ + elements_, T(0));
+}
+
+template <typename T>
+Tensor<T>::Tensor(std::vector<T> values, std::vector<int> shape) {
+    allocate(shape);
+    assert(values.size() == elements_);
+
+    std::copy(values.begin(), values.end(), data_);
+}
+
+template <typename T>
+Tensor<T>::Tensor(Buffer* buf) : shape_(buf->getShape()) {
+    if (buf->getDataType() != DataTypeOf<T>::value || buf->isQuantized()) {
+        std::cout << "ERROR: typed tensor viewing a buffer of another data type!" << std::endl;
+        assert(false);
+    }
+
+    buf->initialize();
+
+    data_ = buf->getBufferDataAsTemplate<T>();
+    elements_ = buf->getElements();
+}
+
+template <typename T>
+template <class E>
+Tensor<T>::Tensor(const Expression<E>& e) {
+    allocate(*e.self().getShape());
+    assign(e.self());
+}
+
+template <typename T>
+Tensor<T>::Tensor(const Tensor& t) {
+    allocate(t.shape_);
+    std::copy(t.data_, t.data_ + t.elements_, data_);
+}
+
+template <typename T>
+Tensor<T>::Tensor(Tensor&& t) : shape_(std::move(t.shape_)), values_(std::move(t.values_)) {
+    data_ = t.data_;
+    elements_ = t.elements_;
+
+    t.data_ = nullptr;
+    t.elements_ = 0;
+}
+
+template <typename T>
+Tensor<T>& Tensor<T>::operator=(const Tensor& t) {
+    if (this != &t)
+        *this = t.leaf();
+
+    return *this;
+}
+
+template <typename T>
+Tensor<T>& Tensor<T>::operator=(Tensor&& t) {
+    if (isView() || t.isView())
+        return *this = t.leaf();
+
+    shape_ = std::move(t.shape_);
+    values_ = std::move(t.values_);
+    data_ = t.data_;
+    elements_ = t.elements_;
+
+    t.data_ = nullptr;
+    t.elements_ = 0;
+
+    return *this;
+}
+
+template <typename T>
+template <class E>
+Tensor<T>& Tensor<T>::operator=(const Expression<E>& e) {
+    const std::vector<int>& shape = *e.self().getShape();
+
+    uint64_t elements = 1;
+    for (int dim : shape)
+        elements *= dim;
+
+    if (elements != elements_) {
+        if (isView()) {
+            std::cout << "ERROR: mismatching sizes assigning to a typed view!" << std::endl;
+            assert(false);
+        }
+
+        // The expression may read the old data, which is only let go of
+        // once the new data is computed.
+        Tensor<T> result(e);
+        *this = std::move(result);
+        return *this;
+    }
+
+    shape_ = shape;
+    assign(e.self());
+
+    return *this;
+}
+
+template <typename T>
+template <class X>
+Tensor<T>& Tensor<T>::operator+=(const X& x) {
+    return *this = *this + x;
+}
+
+template <typename T>
+template <class X>
+Tensor<T>& Tensor<T>::operator-=(const X& x) {
+    return *this = *this - x;
+}
+
+template <typename T>
+template <class X>
+Tensor<T>& Tensor<T>::operator*=(const X& x) {
+    return *this = *this * x;
+}
+
+template <typename T>
+template <class X>
+Tensor<T>& Tensor<T>::operator/=(const X& x) {
+    return *this = *this / x;
+}
+
+template <typename T>
+template <class E>
+void Tensor<T>::assign(const E& e) {
+    T* data = data_;
+
+    forEachRange(elements_, elements_ >= typed_parallel_threshold, [&](uint64_t begin, uint64_t end) {
+        for (uint64_t i = begin; i < end; i++)
+            data[i] = e[i];
+    });
+}
+
+template <typename T>
+deeplib::Tensor Tensor<T>::toConstant(Allocator* a) const {
+    Buffer* buf = a->newBuffer(new Buffer(shape_, a));
+    buf->setDataType(DataTypeOf<T>::value);
+    buf->initialize();
+
+    std::memcpy(buf->getBufferDataAsTemplate<T>(), data_, elements_ * sizeof(T));
+
+    return deeplib::Tensor(buf, a->newOperation(new Constant(buf)));
+}
+
+} // namespace typed
+} // namespace deeplib
@@ -0,0 +1,453 @@
+#ifndef VECTOR_MATH
+#define VECTOR_MATH
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace deeplib {
+namespace vmath {
+
+// Math functions over whole arrays, for kernels that would otherwise
+// call into libm once per element.
+//
+// The float and double versions are branch-free (out of range inputs are
+// clamped and patched up with selects), so the compiler can vectorize the
+// loops calling them just as it does simd::accumulate(). GCC only does so
+// with -fno-trapping-math (and sqrt() with -fno-math-errno), which the build
+// sets. Any other data type goes through libm in double precision.
+
+// exp(x) == 2^n * exp(r), where n = round(x / ln(2)) and |r| <= ln(2) / 2.
+// exp(r) is a polynomial, and 2^n is put straight into the exponent bits
+// (as 2 * 2^(n-1), so n can reach the top of the exponent range).
+//
+// Max error: 3 ULP (float), 1 ULP (double). Results below the normal range
+// are flushed to 0 (x < -86.6 for float, x < -707.7 for double, and -inf),
+// and results above it are inf.
+inline float exp(float x) {
+    const float log2e = 1.44269504f;
+    const float ln2_hi = 0.693145752f;
+    const float ln2_lo = 1.42860677e-6f;
+
+    // Adding and subtracting 1.5 * 2^23 rounds to the nearest integer.
+    const float round = 12582912.0f;
+
+    // NaN clamps to the low end, and is put back by the last select.
+    float clamped = (x > -86.6f) ? x : -86.6f;
+    clamped = (clamped < 88.72f) ? clamped : 88.72f;
+    float n = (clamped * log2e + round) - round;
+    float r = (clamped - n * ln2_hi) - n * ln2_lo;
+
+    float p = 1.0f / 720;
+    p = p * r + 1.0f / 120;
+    p = p * r + 1.0f / 24;
+    p = p * r + 1.0f / 6;
+    p = p * r + 0.5f;
+    p = p * r + 1.0f;
+    p = p * r + 1.0f;
+
+    int32_t bits = (static_cast<int32_t>(n) + 126) << 23;
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+
+    float result = (x > 88.72f) ? INFINITY : 2 * p * scale;
+    result = (x < -86.6f) ? 0.0f : result;
+    return (x != x) ? x : result;
+}
+
+inline double exp(double x) {
+    const double log2e = 1.4426950408889634;
+    const double ln2_hi = 0.6931471803691238;
+    const double ln2_lo = 1.9082149292705877e-10;
+
+    // Adding and subtracting 1.5 * 2^52 rounds to the nearest integer.
+    const double round = 6755399441055744.0;
+
+    // Past ln(DBL_MAX) == 709.78, the result overflows to inf by itself.
+    double clamped = (x > -707.7) ? x : -707.7;
+    clamped = (clamped < 709.8) ? clamped : 709.8;
+    double shifted = clamped * log2e + round;
+    double n = shifted - round;
+    double r = (clamped - n * ln2_hi) - n * ln2_lo;
+
+    double p = 1.0 / 6227020800;
+    p = p * r + 1.0 / 479001600;
+    p = p * r + 1.0 / 39916800;
+    p = p * r + 1.0 / 3628800;
+    p = p * r + 1.0 / 362880;
+    p = p * r + 1.0 / 40320;
+    p = p * r + 1.0 / 5040;
+    p = p * r + 1.0 / 720;
+    p = p * r + 1.0 / 120;
+    p = p * r + 1.0 / 24;
+    p = p * r + 1.0 / 6;
+    p = p * r + 0.5;
+    p = p * r + 1.0;
+    p = p * r + 1.0;
+
+    // n sits in the low bits of `shifted` (read from there rather than
+    // converted from n, as most targets can't vectorize a conversion to int64_t).
+    uint64_t bits;
+    std::memcpy(&bits, &shifted, sizeof(bits));
+    bits = (bits - 0x4338000000000000 + 1022) << 52;
+    double scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+
+    double result = 2 * p * scale;
+    result = (x < -707.7) ? 0.0 : result;
+    return (x != x) ? x : result;
+}
+
+// log(x) == n * ln(2) + log(m), where x == m * 2^n and sqrt(1/2) <= m < sqrt(2).
+// log(m) == 2 * atanh(f) with f == (m - 1) / (m + 1), as a series in f^2.
+// Subnormal x are scaled into the normal range first.
+//
+// Max error: 2 ULP.
+inline float log(float x) {
+    const float ln2_hi = 0.693145752f;
+    const float ln2_lo = 1.42860677e-6f;
+
+    bool subnormal = x < 1.17549435e-38f;
+    float scaled = subnormal ? x * 8388608.0f : x;
+
+    // Subtracting the bits of sqrt(1/2) puts its exponent at 0.
+    uint32_t bits;
+    std::memcpy(&bits, &scaled, sizeof(bits));
+    bits -= 0x3f3504f3;
+
+    float n = static_cast<float>(static_cast<int32_t>(bits) >> 23) - (subnormal ? 23 : 0);
+
+    uint32_t m_bits = (bits & 0x007fffff) + 0x3f3504f3;
+    float m;
+    std::memcpy(&m, &m_bits, sizeof(m));
+
+    float f = (m - 1) / (m + 1);
+    float f2 = f * f;
+
+    float p = 2.0f / 11;
+    p = p * f2 + 2.0f / 9;
+    p = p * f2 + 2.0f / 7;
+    p = p * f2 + 2.0f / 5;
+    p = p * f2 + 2.0f / 3;
+
+    float result = n * ln2_hi + ((2 * f + f * f2 * p) + n * ln2_lo);
+    result = (x == INFINITY) ? x : result;
+    result = (x == 0) ? -INFINITY : result;
+    return (x < 0 || x != x) ? NAN : result;
+}
+
+inline double log(double x) {
+    const double ln2_hi = 0.6931471803691238;
+    const double ln2_lo = 1.9082149292705877e-10;
+
+    // Adding 1.5 * 2^52 to an integer this small puts it in the low bits.
+    const double round = 6755399441055744.0;
+
+    bool subnormal = x < 2.2250738585072014e-308;
+    double scaled = subnormal ? x * 4503599627370496.0 : x;
+
+    uint64_t bits;
+    std::memcpy(&bits, &scaled, sizeof(bits));
+    bits -= 0x3fe6a09e667f3bcd;
+
+    // The exponent goes through `round` rather than a conversion
+    // from int64_t, which most targets can't vectorize.
+    uint64_t n_bits = static_cast<uint64_t>(static_cast<int64_t>(bits) >> 52) + 0x4338000000000000;
+    double n;
+    std::memcpy(&n, &n_bits, sizeof(n));
+    n = (n - round) - (subnormal ? 52 : 0);
+
+    uint64_t m_bits = (bits & 0x000fffffffffffff) + 0x3fe6a09e667f3bcd;
+    double m;
+    std::memcpy(&m, &m_bits, sizeof(m));
+
+    double f = (m - 1) / (m + 1);
+    double f2 = f * f;
+
+    double p = 2.0 / 23;
+    p = p * f2 + 2.0 / 21;
+    p = p * f2 + 2.0 / 19;
+    p = p * f2 + 2.0 / 17;
+    p = p * f2 + 2.0 / 15;
+    p = p * f2 + 2.0 / 13;
+    p = p * f2 + 2.0 / 11;
+    p = p * f2 + 2.0 / 9;
+    p = p * f2 + 2.0 / 7;
+    p = p * f2 + 2.0 / 5;
+    p = p * f2 + 2.0 / 3;
+
+    double result = n * ln2_hi + ((2 * f + f * f2 * p) + n * ln2_lo);
+    result = (x == INFINITY) ? x : result;
+    result = (x == 0) ? -INFINITY : result;
+    return (x < 0 || x != x) ? NAN : result;
+}
+
+// exp(x) - 1, accurate near 0 where exp(x) - 1 would cancel out. Same
+// reduction as exp(), with exp(r) - 1 as the polynomial, and then
+// 2^n * (exp(r) - 1) + (2^n - 1), whose second term is 0 for n == 0.
+//
+// Max error: 2 ULP.
+inline float expm1(float x) {
+    const float log2e = 1.44269504f;
+    const float ln2_hi = 0.693145752f;
+    const float ln2_lo = 1.42860677e-6f;
+    const float round = 12582912.0f;
+
+    float clamped = (x > -86.6f) ? x : -86.6f;
+    clamped = (clamped < 88.72f) ? clamped : 88.72f;
+    float n = (clamped * log2e + round) - round;
+    float r = (clamped - n * ln2_hi) - n * ln2_lo;
+
+    float p = 1.0f / 5040;
+    p = p * r + 1.0f / 720;
+    p = p * r + 1.0f / 120;
+    p = p * r + 1.0f / 24;
+    p = p * r + 1.0f / 6;
+    p = p * r + 0.5f;
+    float q = p * r * r + r;
+
+    int32_t bits = (static_cast<int32_t>(n) + 126) << 23;
+    float half_scale;
+    std::memcpy(&half_scale, &bits, sizeof(half_scale));
+
+    float result = 2 * (half_scale * q + (half_scale - 0.5f));
+    result = (x > 88.72f) ? INFINITY : result;
+    result = (x < -86.6f) ? -1.0f : result;
+    return (x != x) ? x : result;
+}
+
+inline double expm1(double x) {
+    const double log2e = 1.4426950408889634;
+    const double ln2_hi = 0.6931471803691238;
+    const double ln2_lo = 1.9082149292705877e-10;
+    const double round = 6755399441055744.0;
+
+    // Past ln(DBL_MAX) == 709.78, the result overflows to inf by itself.
+    double clamped = (x > -707.7) ? x : -707.7;
+    clamped = (clamped < 709.8) ? clamped : 709.8;
+    double shifted = clamped * log2e + round;
+    double n = shifted - round;
+    double r = (clamped - n * ln2_hi) - n * ln2_lo;
+
+    double p = 1.0 / 87178291200;
+    p = p * r + 1.0 / 6227020800;
+    p = p * r + 1.0 / 479001600;
+    p = p * r + 1.0 / 39916800;
+    p = p * r + 1.0 / 3628800;
+    p = p * r + 1.0 / 362880;
+    p = p * r + 1.0 / 40320;
+    p = p * r + 1.0 / 5040;
+    p = p * r + 1.0 / 720;
+    p = p * r + 1.0 / 120;
+    p = p * r + 1.0 / 24;
+    p = p * r + 1.0 / 6;
+    p = p * r + 0.5;
+    double q = p * r * r + r;
+
+    uint64_t bits;
+    std::memcpy(&bits, &shifted, sizeof(bits));
+    bits = (bits - 0x4338000000000000 + 1022) << 52;
+    double half_scale;
+    std::memcpy(&half_scale, &bits, sizeof(half_scale));
+
+    double result = 2 * (half_scale * q + (half_scale - 0.5));
+    result = (x < -707.7) ? -1.0 : result;
+    return (x != x) ? x : result;
+}
+
+// tanh(|x|) == e / (e + 2) with e == expm1(2|x|), then the sign of x.
+// |x| is capped where tanh(x) rounds to 1 anyway, keeping e finite.
+//
+// Max error: 2 ULP.
+template <typename T>
+T tanh(T x) {
+    const T cap = (sizeof(T) == 4) ? 22 : 40;
+
+    T a = std::fabs(x);
+    a = (a < cap) ? a : cap;
+
+    T e = vmath::expm1(2 * a);
+    T result = std::copysign(e / (e + 2), x);
+    return (x != x) ? x : result;
+}
+
+// 1 / (1 + exp(-x)).
+//
+// Max error: 3 ULP (float), 2 ULP (double).
+template <typename T>
+T sigmoid(T x) {
+    return 1 / (1 + vmath::exp(-x));
+}
+
+// x^y == exp(y * log(|x|)), taken in double so that the error of log(|x|)
+// isn't scaled up by y, then negated for negative x and odd integer y.
+// Special cases follow std::pow(): x^0 == 1^y == 1, negative finite x to a
+// non-integer power is NaN, and 0 to a negative power is inf.
+//
+// Max error: 1 ULP.
+inline float pow(float x, float y) {
+    const double round = 4503599627370496.0;
+
+    double wide_y = y;
+    double result = vmath::exp(wide_y * vmath::log(static_cast<double>(std::fabs(x))));
+
+    // |y| >= 2^52 can only be an even integer.
+    double abs_y = std::fabs(wide_y);
+    double half = abs_y * 0.5;
+    bool integer = abs_y >= round || (abs_y + round) - round == abs_y;
+    bool odd = integer && abs_y < round && (half + round) - round != half;
+
+    result = (std::signbit(x) && odd) ? -result : result;
+    result = (x < 0 && x > -INFINITY && !integer) ? NAN : result;
+    result = (std::fabs(x) == 1 && abs_y == INFINITY) ? 1.0 : result;
+    result = (y == 0 || x == 1) ? 1.0 : result;
+    return static_cast<float>(result);
+}
+
+// Type integer arithmetic is done in, for overflow to wrap around.
+template <typename T, bool = std::is_integral<T>::value>
+struct Wrapping { using type = T; };
+
+template <typename T>
+struct Wrapping<T, true> { using type = typename std::make_unsigned<T>::type; };
+
+// x^exponent by repeated squaring and multiplication. Integer data
+// wraps around on overflow, as it would with a plain multiplication.
+template <typename T>
+T pow(T x, uint64_t exponent) {
+    using Wide = typename Wrapping<T>::type;
+
+    Wide base = static_cast<Wide>(x);
+    Wide result = 1;
+    for (; exponent != 0; exponent >>= 1) {
+        if (exponent & 1)
+            result *= base;
+
+        base *= base;
+    }
+
+    return static_cast<T>(result);
+}
+
+// dst[i] = exp(src[i]) for i in [0, n). `dst` may be `src`.
+template <typename T>
+void exp(T* dst, const T* src, uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+        if constexpr (std::is_floating_point<T>::value)
+            dst[i] = vmath::exp(src[i]);
+        else
+            dst[i] = std::exp(static_cast<double>(src[i]));
+    }
+}
+
+// dst[i] = log(src[i]) for i in [0, n). `dst` may be `src`.
+template <typename T>
+void log(T* dst, const T* src, uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+        if constexpr (std::is_floating_point<T>::value)
+            dst[i] = vmath::log(src[i]);
+        else
+            dst[i] = std::log(static_cast<double>(src[i]));
+    }
+}
+
+// dst[i] = sqrt(src[i]) for i in [0, n). `dst` may be `src`.
+//
+// sqrt() is exact, so this is libm's, which becomes a vector
+// instruction as long as errno is left alone (-fno-math-errno).
+template <typename T>
+void sqrt(T* dst, const T* src, uint64_t n) {
+    for (uint64_t i = 0; i < n; i++)
+        dst[i] = std::sqrt(src[i]);
+}
+
+// dst[i] = pow(x[i], y[i]) for i in [0, n). A single element `x` or `y`
+// (`x_n` or `y_n` == 1) is used for every i. `dst` may be `x` or `y`.
+//
+// double goes through libm, a vectorized double pow needing log in more
+// than double precision. So does integer data to a negative power, other
+// integer powers being taken by repeated multiplication.
+template <typename T>
+void pow(T* dst, const T* x, uint64_t x_n, const T* y, uint64_t y_n, uint64_t n) {
+    auto power = [](T base, T exponent) -> T {
+        if constexpr (std::is_same<T, float>::value)
+            return vmath::pow(base, exponent);
+        else if constexpr (std::is_floating_point<T>::value)
+            return std::pow(base, exponent);
+        else if (exponent >= 0)
+            return vmath::pow(base, static_cast<uint64_t>(exponent));
+        else
+            return static_cast<T>(std::pow(static_cast<double>(base), static_cast<double>(exponent)));
+    };
+
+    // Separate loops, so that each one has a fixed stride.
+    if (x_n == 1) {
+        T base = x[0];
+        for (uint64_t i = 0; i < n; i++)
+            dst[i] = power(base, y[i]);
+    }
+    else if (y_n == 1) {
+        T exponent = y[0];
+        for (uint64_t i = 0; i < n; i++)
+            dst[i] = power(x[i], exponent);
+    }
+    else {
+        for (uint64_t i = 0; i < n; i++)
+            dst[i] = power(x[i], y[i]);
+    }
+}
+
+// Elements powi() works on at a time.
+const uint64_t powi_block = 256;
+
+// dst[i] = src[i]^exponent for i in [0, n), by repeated squaring and
+// multiplication, one block of elements at a time so that every step is a
+// plain element-wise loop. `dst` may be `src`.
+//
+// Each squaring doubles the rounding error so far, so floating point results
+// drift by up to about |exponent| / 2 ULP, plus 1 for a negative exponent
+// (taken as 1 / src[i]^-exponent), which is for floating point data only.
+template <typename T>
+void powi(T* dst, const T* src, uint64_t n, int64_t exponent) {
+    using Wide = typename Wrapping<T>::type;
+
+    uint64_t magnitude = (exponent < 0) ? -static_cast<uint64_t>(exponent) : exponent;
+
+    Wide base[powi_block];
+    Wide result[powi_block];
+
+    for (uint64_t begin = 0; begin < n; begin += powi_block) {
+        uint64_t count = (n - begin < powi_block) ? n - begin : powi_block;
+
+        for (uint64_t i = 0; i < count; i++) {
+            base[i] = static_cast<Wide>(src[begin + i]);
+            result[i] = 1;
+        }
+
+        for (uint64_t e = magnitude; e != 0; e >>= 1) {
+            if (e & 1) {
+                for (uint64_t i = 0; i < count; i++)
+                    result[i] *= base[i];
+            }
+
+            if (e > 1) {
+                for (uint64_t i = 0; i < count; i++)
+                    base[i] *= base[i];
+            }
+        }
+
+        if (exponent < 0) {
+            for (uint64_t i = 0; i < count; i++)
+                dst[begin + i] = 1 / result[i];
+        }
+        else {
+            for (uint64_t i = 0; i < count; i++)
+                dst[begin + i] = static_cast<T>(result[i]);
+        }
+    }
+}
+
+} // namespace vmath
+} // namespace deeplib
+
+#endif
@@ -1,14 +1,43 @@
 #include <iostream>
 #include <vector>
 #include <chrono>
+#include <cmath>
+#include <functional>
+#include <thread>
+#include <future>
+#include <cstdio>
+#include <cstring>
 #include "core/tensor.h"
 #include "core/op_functions.h"
 #include "core/data_types.h"
+#include "core/config.h"
+#include "core/execution_context.h"
+#include "core/batcher.h"
+#include "core/gradients.h"
+#include "core/optimizers.h"
+#include "core/thread_pool.h"
+#include "core/passes.h"
+#include "core/typed.h"
+#include "core/kv_cache.h"
+#include "core/sparse.h"
+#include "core/half.h"
+#include "core/quantization.h"
+#include "core/bits.h"
 
 using std::cout; using std::endl; using std::vector;
 using namespace std::chrono;
 using namespace deeplib;
 
+// Number of failed checks, returned by main().
+int failures = 0;
+
+void check(std::string name, bool passed) {
+    cout << name << ": " << (passed ? "ok" : "FAILED") << endl;
+
+    if (!passed)
+        failures++;
+}
+
 // Operations displayed below are := f(x, y) = (x + ((exp(x * y))^y * x)^1 - y) / x)
 // where x == { 2, 2, ... } and y == { 3, 3, ... }
 void basicOperations() {
@@ -45,6 +74,9 @@ void basicOperations() {
     t3 = sqrt(t3);
     t3 = add(t3, t1);
 
+    // Converts the integer inputs to FLOAT32 once, rather than on every operate.
+    foldCasts(t3);
+
     auto time1 = high_resolution_clock::now();
     t3.operate();
     auto time2 = high_resolution_clock::now();
@@ -112,6 +144,1890 @@ void convolution() {
     a.printStats();
 }
 
-int main() {
+// The graph is built once and re-executed on new data fed into the placeholders.
+void placeholders() {
+    Allocator a;
+
+    vector<int> shape = { 3, 3 };
+
+    vector<int> m = { 1, 0, 0,
+                      0, 1, 0,
+                      1, 1, 1 };
+
+    Tensor x = placeholder(shape, DataType::FLOAT32, &a);
+    Tensor w(m, shape, &a);
+    w = cast(w, DataType::FLOAT32);
+
+    Tensor y = matmul(x, w);
+    y = exp(y);
+    foldCasts(y);
+
+    for (int request = 0; request < 3; request++) {
+        x.feed(vector<float>(9, 0.5f * request));
+
+        y.operate();
+        y.print();
+    }
+
+    a.printStats();
+}
+
+// A partial batch fed to a context only shrinks what's computed from the
+// placeholder: the cast weights keep all 3 of their rows.
+void partialBatches() {
+    Allocator a;
+
+    vector<int> shape = { 3, 3 };
+
+    vector<int> m = { 1, 0, 0,
+                      0, 1, 0,
+                      1, 1, 1 };
+
+    vector<float> samples = { 1, 2, 3,
+                              4, 5, 6,
+                              7, 8, 9 };
+
+    Tensor x = placeholder(shape, DataType::FLOAT32, &a);
+    Tensor w(m, shape, &a);
+    w = cast(w, DataType::FLOAT32);
+
+    Tensor y = matmul(x, w);
+
+    ExecutionContext full;
+    full.feed(x, samples);
+    Buffer* full_result = full.operate(y);
+
+    ExecutionContext partial;
+    partial.feed(x, vector<float>(samples.begin(), samples.begin() + 6));
+    Buffer* partial_result = partial.operate(y);
+
+    float difference = 0;
+    for (int i = 0; i < partial_result->getElements(); i++)
+        difference = std::max(difference, std::abs(partial_result->getIndex<float>(i) - full_result->getIndex<float>(i)));
+
+    cout << "partial batch: " << partial_result->getShape()[0] << " rows, largest difference to the full batch "
+         << difference << endl;
+    check("partial batch, rows match the full batch",
+          partial_result->getShape() == vector<int>({ 2, 3 }) && difference < 1e-6f);
+
+    // Sums over the batch and transposes only shrink along the batch.
+    Tensor column_sums = sum(x, { 0 });
+    Tensor transposed = transpose(x);
+
+    Buffer* sums = partial.operate(column_sums);
+    check("partial batch, sum over the batch",
+          sums->getShape() == vector<int>({ 3 }) && sums->getIndex<float>(0) == 5 && sums->getIndex<float>(2) == 9);
+
+    Buffer* transposed_result = partial.operate(transposed);
+    check("partial batch, transpose",
+          transposed_result->getShape() == vector<int>({ 3, 2 }) && transposed_result->getIndex<float>(1) == 4);
+
+    // Placeholders built for different batch sizes are fed their own.
+    Tensor z = placeholder({ 4, 3 }, DataType::FLOAT32, &a);
+    Tensor ez = exp(z);
+
+    partial.feed(z, vector<float>(3, 0.0f));
+    Buffer* ez_result = partial.operate(ez);
+    Buffer* y_result = partial.operate(y);
+
+    check("partial batches, two placeholders",
+          ez_result->getShape() == vector<int>({ 1, 3 }) && y_result->getShape() == vector<int>({ 2, 3 }));
+}
+
+// Requests from several threads come back with their own rows of the
+// batches they were evaluated in.
+void batcher() {
+    Allocator a;
+
+    Tensor x = placeholder({ 4, 3 }, DataType::FLOAT32, &a);
+
+    vector<int> m = { 1, 0,
+                      0, 1,
+                      1, 1 };
+    Tensor w(m, { 3, 2 }, &a);
+    w = cast(w, DataType::FLOAT32);
+
+    Tensor y = matmul(x, w);
+    foldCasts(y);
+
+    const int requests = 10;
+    vector<std::future<vector<float>>> results(requests);
+
+    {
+        Batcher batcher(x, y, 1000);
+
+        vector<std::thread> clients;
+        for (int c = 0; c < 2; c++) {
+            clients.emplace_back([&, c]() {
+                for (int r = c; r < requests; r += 2)
+                    results[r] = batcher.submit({ float(r), 1, 2 });
+            });
+        }
+
+        for (std::thread& client : clients)
+            client.join();
+
+        bool correct = true;
+        for (int r = 0; r < requests; r++) {
+            vector<float> result = results[r].get();
+            correct = correct && result == vector<float>({ r + 2.0f, 3 });
+        }
+
+        check("batcher, results", correct);
+        check("batcher, batch sizes", batcher.getBatchSizes().getCount() >= 3 &&
+                                      batcher.getBatchSizes().getMax() <= 4);
+    }
+}
+
+// Constant of the given shape and values.
+Tensor constant(vector<int> shape, vector<double> values, DataType dtype, Allocator* a) {
+    Buffer* buf = a->newBuffer(new Buffer(shape, a));
+    buf->setDataType(dtype);
+    buf->fill<double>(values);
+
+    return Tensor(buf, a->newOperation(new Constant(buf)));
+}
+
+// A buffer's values as doubles, converted from whatever its data type is.
+vector<double> valuesOf(Buffer* buf) {
+    vector<double> values(buf->getElements());
+    buf->copyTo<double>(values, 0);
+
+    return values;
+}
+
+// Largest difference between the gradients Gradients gives and central
+// differences, for FLOAT64 parameters of the given shapes (made up values in
+// (-1, 1)) feeding f. The output is weighted, so every element of it counts
+// differently (a plain sum of a softmax has no gradient), and differentiated
+// as if summed.
+double gradientError(vector<vector<int>> shapes, std::function<Tensor(vector<Tensor>&, Allocator*)> f) {
+    Allocator a;
+
+    vector<Tensor> parameters;
+    for (int p = 0; p < shapes.size(); p++) {
+        int elements = 1;
+        for (int dim : shapes[p])
+            elements *= dim;
+
+        vector<double> values(elements);
+        for (int i = 0; i < elements; i++)
+            values[i] = 0.9 * std::sin(1.7 * i + p + 0.3);
+
+        parameters.push_back(constant(shapes[p], values, DataType::FLOAT64, &a));
+    }
+
+    Tensor y = f(parameters, &a);
+
+    vector<double> weights(y.getBuffer()->getElements());
+    for (int i = 0; i < weights.size(); i++)
+        weights[i] = 0.5 + 0.25 * std::cos(0.9 * i);
+
+    Tensor w = constant(y.getShape(), weights, DataType::FLOAT64, &a);
+    Tensor loss = multiply(y, w);
+
+    vector<Tensor*> parameter_ptrs;
+    for (Tensor& p : parameters)
+        parameter_ptrs.push_back(&p);
+
+    Gradients gradients(loss, parameter_ptrs);
+    gradients.backward();
+
+    ExecutionContext context;
+    auto evaluate = [&]() {
+        Buffer* result = context.operate(loss);
+
+        double total = 0;
+        for (uint64_t i = 0; i < result->getElements(); i++)
+            total += result->getIndex<double>(i);
+
+        return total;
+    };
+
+    const double h = 1e-6;
+
+    double error = 0;
+    for (Tensor& p : parameters) {
+        Buffer* gradient = gradients.getGradient(p);
+        double* values = p.getBuffer()->getBufferDataAsTemplate<double>();
+
+        for (uint64_t i = 0; i < p.getBuffer()->getElements(); i++) {
+            double value = values[i];
+
+            values[i] = value + h;
+            p.getBuffer()->bumpVersion();
+            double above = evaluate();
+
+            values[i] = value - h;
+            p.getBuffer()->bumpVersion();
+            double below = evaluate();
+
+            values[i] = value;
+            p.getBuffer()->bumpVersion();
+
+            double numeric = (above - below) / (2 * h);
+            error = std::max(error, std::abs(numeric - gradient->getIndex<double>(i)) / std::max(1.0, std::abs(numeric)));
+        }
+    }
+
+    return error;
+}
+
+// Central differences with h = 1e-6 in FLOAT64 are good to about 1e-10
+// (rounding over h), which leaves room for the activations' curvature.
+void gradientCheck(std::string name, vector<vector<int>> shapes, std::function<Tensor(vector<Tensor>&, Allocator*)> f) {
+    double error = gradientError(shapes, f);
+
+    cout << "gradient check, " << name << ": largest error " << error << endl;
+    check("gradient check, " + name, error < 1e-6);
+}
+
+// LSTM and GRU layers against a step by step reference, before and after their
+// hidden weights are changed (which the layers must pack again).
+void recurrentLayers() {
+    const int batch = 2, time = 4, input = 3, hidden = 5;
+
+    auto sigmoid = [](double v) { return 1 / (1 + std::exp(-v)); };
+
+    for (bool is_lstm : { true, false }) {
+        Allocator a;
+        int gates = is_lstm ? 4 : 3;
+        int columns = gates * hidden;
+
+        vector<double> x(batch * time * input), wi(input * columns), wh(hidden * columns), bias(columns);
+        for (int i = 0; i < x.size(); i++)
+            x[i] = std::sin(0.9 * i + 0.1);
+        for (int i = 0; i < wi.size(); i++)
+            wi[i] = 0.5 * std::cos(1.1 * i);
+        for (int i = 0; i < wh.size(); i++)
+            wh[i] = 0.4 * std::sin(0.7 * i + 0.3);
+        for (int i = 0; i < bias.size(); i++)
+            bias[i] = 0.1 * i - 0.5;
+
+        Tensor tx = constant({ batch, time, input }, x, DataType::FLOAT64, &a);
+        Tensor twi = constant({ input, columns }, wi, DataType::FLOAT64, &a);
+        Tensor twh = constant({ hidden, columns }, wh, DataType::FLOAT64, &a);
+        Tensor tb = constant({ columns }, bias, DataType::FLOAT64, &a);
+
+        Tensor y = is_lstm ? lstm(tx, twi, twh, tb) : gru(tx, twi, twh, tb);
+
+        double error = 0;
+        for (int run = 0; run < 2; run++) {
+            if (run == 1) {
+                for (int i = 0; i < wh.size(); i++) {
+                    wh[i] *= -0.5;
+                    twh.getBuffer()->setIndex<double>(i, wh[i]);
+                }
+
+                twh.getBuffer()->bumpVersion();
+            }
+
+            y.operate();
+
+            for (int b = 0; b < batch; b++) {
+                vector<double> h(hidden, 0), c(hidden, 0);
+
+                for (int t = 0; t < time; t++) {
+                    // Input and hidden projections of the step, the bias going with the input's.
+                    vector<double> px(bias), ph(columns, 0);
+                    for (int j = 0; j < columns; j++) {
+                        for (int m = 0; m < input; m++)
+                            px[j] += x[(b * time + t) * input + m] * wi[m * columns + j];
+                        for (int k = 0; k < hidden; k++)
+                            ph[j] += h[k] * wh[k * columns + j];
+                    }
+
+                    for (int u = 0; u < hidden; u++) {
+                        if (is_lstm) {
+                            double i = sigmoid(px[u] + ph[u]);
+                            double f = sigmoid(px[hidden + u] + ph[hidden + u]);
+                            double n = std::tanh(px[2 * hidden + u] + ph[2 * hidden + u]);
+                            double o = sigmoid(px[3 * hidden + u] + ph[3 * hidden + u]);
+
+                            c[u] = f * c[u] + i * n;
+                            h[u] = o * std::tanh(c[u]);
+                        }
+                        else {
+                            double r = sigmoid(px[u] + ph[u]);
+                            double z = sigmoid(px[hidden + u] + ph[hidden + u]);
+                            double n = std::tanh(px[2 * hidden + u] + r * ph[2 * hidden + u]);
+
+                            h[u] = (1 - z) * n + z * h[u];
+                        }
+
+                        double result = y.getBuffer()->getIndex<double>((b * time + t) * hidden + u);
+                        error = std::max(error, std::abs(result - h[u]));
+                    }
+                }
+            }
+        }
+
+        check(std::string("recurrent layers, ") + (is_lstm ? "lstm" : "gru") + " against a step by step reference",
+              error < 1e-12);
+    }
+}
+
+// Numeric gradient checks, one per family of operations.
+void gradientChecks() {
+    int unit[2] = { 1, 1 };
+    int two[2] = { 2, 2 };
+
+    // Only addition broadcasts rows, the others single elements.
+    gradientCheck("arithmetic", { { 2, 3 }, { 1 }, { 3 } }, [](vector<Tensor>& p, Allocator*) {
+        Tensor t = multiply(p[0], p[1]);
+        t = add(t, p[2]);
+        t = sub(t, p[1]);
+        t = multiply(t, p[0]);
+        Tensor positive = exp(p[0]);
+        t = divide(t, positive);
+        t = divide(t, p[1]);
+        return power(positive, t);
+    });
+
+    gradientCheck("exp, log, sqrt", { { 5 } }, [](vector<Tensor>& p, Allocator*) {
+        Tensor t = exp(p[0]);
+        Tensor u = sqrt(t);
+        t = log(t);
+        return add(t, u);
+    });
+
+    gradientCheck("matmul", { { 2, 2, 3 }, { 3, 4 } }, [](vector<Tensor>& p, Allocator*) {
+        return matmul(p[0], p[1]);
+    });
+
+    gradientCheck("conv2d", { { 2, 5, 5 }, { 3, 3 } }, [&](vector<Tensor>& p, Allocator*) {
+        return conv2d(p[0], p[1], "same", unit);
+    });
+
+    gradientCheck("reductions", { { 3, 4 } }, [](vector<Tensor>& p, Allocator*) {
+        Tensor s = sum(p[0], { 0 }, true);
+        Tensor m = mean(p[0]);
+        Tensor x = max(p[0], { 0 }, true);
+        Tensor t = add(s, x);
+        return multiply(t, m);
+    });
+
+    gradientCheck("softmax", { { 3, 4 } }, [](vector<Tensor>& p, Allocator*) {
+        Tensor s = softmax(p[0]);
+        Tensor l = logSoftmax(p[0]);
+        return add(s, l);
+    });
+
+    gradientCheck("softmax cross-entropy", { { 3, 4 }, { 3, 4 } }, [](vector<Tensor>& p, Allocator*) {
+        Tensor labels = softmax(p[1]);
+        return softmaxCrossEntropy(p[0], labels);
+    });
+
+    gradientCheck("normalization", { { 4, 3 }, { 3 }, { 3 } }, [](vector<Tensor>& p, Allocator*) {
+        Tensor l = layerNorm(p[0], p[1], p[2]);
+        Tensor r = rmsNorm(p[0], p[1]);
+        Tensor b = batchNorm(p[0], p[1], p[2]);
+        Tensor t = add(l, r);
+        return add(t, b);
+    });
+
+    gradientCheck("activations", { { 8 } }, [](vector<Tensor>& p, Allocator*) {
+        Tensor t = relu(p[0]);
+        Tensor s = sigmoid(p[0]);
+        t = add(t, s);
+        s = tanh(p[0]);
+        t = add(t, s);
+        s = gelu(p[0]);
+        t = add(t, s);
+        s = silu(p[0]);
+        return add(t, s);
+    });
+
+    // A single image, so the global average is a single element.
+    gradientCheck("pooling", { { 1, 4, 4 } }, [&](vector<Tensor>& p, Allocator*) {
+        Tensor m = maxPool2d(p[0], two, "valid", two);
+        Tensor v = avgPool2d(p[0], two, "valid", two);
+        Tensor g = globalAvgPool2d(p[0]);
+        Tensor t = add(m, v);
+        return multiply(t, g);
+    });
+
+    gradientCheck("conv2d transpose", { { 2, 3, 3 }, { 3, 3 } }, [&](vector<Tensor>& p, Allocator*) {
+        return conv2dTranspose(p[0], p[1], "valid", two);
+    });
+
+    gradientCheck("attention", { { 2, 3, 4 }, { 2, 5, 4 }, { 2, 5, 3 } }, [](vector<Tensor>& p, Allocator*) {
+        return attention(p[0], p[1], p[2]);
+    });
+
+    gradientCheck("lstm", { { 2, 3, 4 }, { 4, 12 }, { 3, 12 }, { 12 } }, [](vector<Tensor>& p, Allocator*) {
+        return lstm(p[0], p[1], p[2], p[3]);
+    });
+
+    gradientCheck("gru", { { 2, 3, 4 }, { 4, 9 }, { 3, 9 }, { 9 } }, [](vector<Tensor>& p, Allocator*) {
+        return gru(p[0], p[1], p[2], p[3]);
+    });
+
+    gradientCheck("gather", { { 5, 3 } }, [](vector<Tensor>& p, Allocator* a) {
+        Tensor ids = constant({ 4 }, { 1, 4, 1, 0 }, DataType::INT32, a);
+        return embedding(p[0], ids);
+    });
+
+    gradientCheck("select", { { 2, 3 }, { 2, 3 } }, [](vector<Tensor>& p, Allocator*) {
+        Tensor condition = greaterThan(p[0], p[1]);
+        return where(condition, p[0], p[1]);
+    });
+}
+
+// Max and average pooling against a loop over every window, the windows
+// clipped to the image (so averages only count the image's elements).
+void pooling() {
+    struct Case { const char* name; vector<int> shape; int window[2]; const char* padding; int strides[2]; };
+
+    // An even window centred as conv2d pads it, strides, and windows longer
+    // than the ones maxima are taken of element by element.
+    vector<Case> cases = {
+        { "same, even window", { 2, 5, 7 }, { 2, 4 }, "same", { 1, 1 } },
+        { "valid, strides", { 2, 7, 8 }, { 3, 2 }, "valid", { 2, 3 } },
+        { "valid, long windows", { 1, 13, 20 }, { 10, 11 }, "valid", { 1, 2 } },
+        { "same, long windows", { 1, 12, 14 }, { 12, 9 }, "same", { 1, 1 } },
+    };
+
+    for (Case& c : cases) {
+        Allocator a;
+
+        int rows = c.shape[1], columns = c.shape[2];
+
+        vector<double> values(c.shape[0] * rows * columns);
+        for (int i = 0; i < values.size(); i++)
+            values[i] = std::sin(1.3 * i + 0.2) + 0.01 * (i % 7);
+
+        Tensor image = constant(c.shape, values, DataType::FLOAT64, &a);
+        Tensor largest = maxPool2d(image, c.window, c.padding, c.strides);
+        Tensor average = avgPool2d(image, c.window, c.padding, c.strides);
+
+        largest.operate();
+        average.operate();
+
+        bool padded = !std::string(c.padding).compare("same") && c.strides[0] == 1 && c.strides[1] == 1;
+        int out_rows = padded ? rows : (rows - c.window[0]) / c.strides[0] + 1;
+        int out_columns = padded ? columns : (columns - c.window[1]) / c.strides[1] + 1;
+        // conv2d pads ceil((window - 1) / 2) before the image.
+        int top = padded ? c.window[0] / 2 : 0, left = padded ? c.window[1] / 2 : 0;
+
+        bool shaped = largest.getShape() == vector<int>({ c.shape[0], out_rows, out_columns }) &&
+                      average.getShape() == largest.getShape();
+
+        double max_error = 0, average_error = 0;
+        for (int i = 0; shaped && i < c.shape[0]; i++) {
+            for (int y = 0; y < out_rows; y++) {
+                for (int x = 0; x < out_columns; x++) {
+                    double m = -INFINITY, total = 0;
+                    int count = 0;
+
+                    for (int wy = 0; wy < c.window[0]; wy++) {
+                        for (int wx = 0; wx < c.window[1]; wx++) {
+                            int iy = y * c.strides[0] - top + wy, ix = x * c.strides[1] - left + wx;
+                            if (iy < 0 || iy >= rows || ix < 0 || ix >= columns)
+                                continue;
+
+                            double v = values[(i * rows + iy) * columns + ix];
+                            m = std::max(m, v);
+                            total += v;
+                            count++;
+                        }
+                    }
+
+                    int o = (i * out_rows + y) * out_columns + x;
+                    max_error = std::max(max_error, std::abs(largest.getBuffer()->getIndex<double>(o) - m));
+                    average_error = std::max(average_error,
+                                             std::abs(average.getBuffer()->getIndex<double>(o) - total / count));
+                }
+            }
+        }
+
+        check(std::string("pooling, max, ") + c.name, shaped && max_error == 0);
+        check(std::string("pooling, average, ") + c.name, shaped && average_error < 1e-12);
+    }
+
+    // The global average of each image is its mean.
+    Allocator a;
+
+    vector<double> values(3 * 4 * 5);
+    for (int i = 0; i < values.size(); i++)
+        values[i] = std::cos(0.7 * i);
+
+    Tensor image = constant({ 3, 4, 5 }, values, DataType::FLOAT64, &a);
+    Tensor global = globalAvgPool2d(image);
+    global.operate();
+
+    double error = 0;
+    for (int i = 0; i < 3; i++) {
+        double total = 0;
+        for (int j = 0; j < 20; j++)
+            total += values[i * 20 + j];
+
+        error = std::max(error, std::abs(global.getBuffer()->getIndex<double>(i) - total / 20));
+    }
+
+    check("pooling, global average", global.getShape() == vector<int>({ 3 }) && error < 1e-12);
+}
+
+// conv2dTranspose is the adjoint of conv2d with the same kernel, padding and
+// strides: <conv2dTranspose(x, k), y> == <x, conv2d(y, k)> for any x and y.
+void convolutionTranspose() {
+    struct Case { const char* name; vector<int> shape; vector<int> kernel; const char* padding; int strides[2]; };
+
+    vector<Case> cases = {
+        { "valid", { 2, 4, 5 }, { 3, 2 }, "valid", { 1, 1 } },
+        { "same", { 2, 5, 6 }, { 3, 3 }, "same", { 1, 1 } },
+        { "same, even kernel", { 2, 5, 6 }, { 2, 4 }, "same", { 1, 1 } },
+        { "valid, strides", { 2, 3, 4 }, { 3, 2 }, "valid", { 2, 3 } },
+        { "same, strides", { 1, 4, 3 }, { 2, 3 }, "same", { 3, 2 } },
+    };
+
+    for (Case& c : cases) {
+        Allocator a;
+
+        auto values = [](int elements, double phase) {
+            vector<double> v(elements);
+            for (int i = 0; i < elements; i++)
+                v[i] = std::sin(0.8 * i + phase);
+            return v;
+        };
+
+        vector<double> x_values = values(c.shape[0] * c.shape[1] * c.shape[2], 0.1);
+        vector<double> k_values = values(c.kernel[0] * c.kernel[1], 1.3);
+
+        Tensor x = constant(c.shape, x_values, DataType::FLOAT64, &a);
+        Tensor k = constant(c.kernel, k_values, DataType::FLOAT64, &a);
+        Tensor transposed = conv2dTranspose(x, k, c.padding, c.strides);
+
+        vector<double> y_values = values(transposed.getBuffer()->getElements(), 2.9);
+        Tensor y = constant(transposed.getShape(), y_values, DataType::FLOAT64, &a);
+        Tensor convolved = conv2d(y, k, c.padding, c.strides);
+
+        transposed.operate();
+        convolved.operate();
+
+        bool shaped = convolved.getShape() == c.shape;
+
+        double left = 0, right = 0;
+        for (int i = 0; i < y_values.size(); i++)
+            left += transposed.getBuffer()->getIndex<double>(i) * y_values[i];
+        for (int i = 0; shaped && i < x_values.size(); i++)
+            right += x_values[i] * convolved.getBuffer()->getIndex<double>(i);
+
+        check(std::string("conv2d transpose, adjoint of conv2d, ") + c.name,
+              shaped && std::abs(left - right) < 1e-12 * std::max(1.0, std::abs(left)));
+    }
+
+    // A single element scatters the kernel, flipped as conv2d flips it, to its
+    // strided position.
+    Allocator a;
+
+    int strides[2] = { 2, 2 };
+    Tensor x = constant({ 2, 2 }, { 0, 0, 0, 1 }, DataType::FLOAT64, &a);
+    Tensor k = constant({ 2, 3 }, { 1, 2, 3, 4, 5, 6 }, DataType::FLOAT64, &a);
+    Tensor y = conv2dTranspose(x, k, "valid", strides);
+    y.operate();
+
+    vector<double> expected = { 0, 0, 0, 0, 0,
+                                0, 0, 0, 0, 0,
+                                0, 0, 6, 5, 4,
+                                0, 0, 3, 2, 1 };
+
+    vector<double> result(y.getBuffer()->getElements());
+    y.getBuffer()->copyTo<double>(result, 0);
+
+    check("conv2d transpose, strided scatter", y.getShape() == vector<int>({ 4, 5 }) && result == expected);
+}
+
+// Attention against softmax(scale * q kT) v computed explicitly, over more
+// keys than fit in a block. The keys grow along the sequence, so later
+// blocks hold larger scores and the running max is rescaled.
+void attentionReference() {
+    struct Case { const char* name; int queries, keys; bool causal; double scale; };
+
+    vector<Case> cases = {
+        { "fewer queries than keys", 40, 150, false, 0 },
+        { "causal", 70, 150, true, 0 },
+        { "causal, single queries", 3, 130, true, 0.3 },
+    };
+
+    const int batch = 2, depth = 5, value_depth = 3;
+
+    for (Case& c : cases) {
+        Allocator a;
+
+        vector<double> q(batch * c.queries * depth), k(batch * c.keys * depth), v(batch * c.keys * value_depth);
+        for (int i = 0; i < q.size(); i++)
+            q[i] = std::sin(0.9 * i + 0.4);
+        for (int i = 0; i < k.size(); i++)
+            k[i] = std::cos(1.7 * i) * (1 + (i / depth % c.keys) / 40.0);
+        for (int i = 0; i < v.size(); i++)
+            v[i] = std::sin(0.3 * i + 1.1);
+
+        Tensor tq = constant({ batch, c.queries, depth }, q, DataType::FLOAT64, &a);
+        Tensor tk = constant({ batch, c.keys, depth }, k, DataType::FLOAT64, &a);
+        Tensor tv = constant({ batch, c.keys, value_depth }, v, DataType::FLOAT64, &a);
+
+        Tensor y = attention(tq, tk, tv, c.causal, c.scale);
+        y.operate();
+
+        double scale = c.scale ? c.scale : 1 / std::sqrt(static_cast<double>(depth));
+
+        double error = 0;
+        for (int b = 0; b < batch; b++) {
+            for (int i = 0; i < c.queries; i++) {
+                int visible = c.causal ? i + c.keys - c.queries + 1 : c.keys;
+
+                vector<double> scores(visible);
+                for (int j = 0; j < visible; j++) {
+                    scores[j] = 0;
+                    for (int d = 0; d < depth; d++)
+                        scores[j] += q[(b * c.queries + i) * depth + d] * k[(b * c.keys + j) * depth + d];
+                    scores[j] *= scale;
+                }
+
+                double largest = *std::max_element(scores.begin(), scores.end()), total = 0;
+                for (double& s : scores) {
+                    s = std::exp(s - largest);
+                    total += s;
+                }
+
+                for (int d = 0; d < value_depth; d++) {
+                    double expected = 0;
+                    for (int j = 0; j < visible; j++)
+                        expected += scores[j] / total * v[(b * c.keys + j) * value_depth + d];
+
+                    double result = y.getBuffer()->getIndex<double>((b * c.queries + i) * value_depth + d);
+                    error = std::max(error, std::abs(result - expected));
+                }
+            }
+        }
+
+        check(std::string("attention, against softmax(q kT) v, ") + c.name,
+              y.getShape() == vector<int>({ batch, c.queries, value_depth }) && error < 1e-12);
+    }
+}
+
+// Gather and scatterAdd along the first and inner axes against loops, with
+// repeated indices adding up, and the sparse gradient of a gathered table
+// against the dense one it stands for.
+void gatherScatter() {
+    Allocator a;
+
+    auto values = [](int elements, double phase) {
+        vector<double> v(elements);
+        for (int i = 0; i < elements; i++)
+            v[i] = std::sin(1.1 * i + phase);
+        return v;
+    };
+
+    // Slices 1 and 3 of axis 1 of a [2, 4, 3] table, in a [2, 2] arrangement.
+    vector<double> t_values = values(2 * 4 * 3, 0.2);
+    vector<int> picks = { 3, 0, 0, 2 };
+
+    Tensor t = constant({ 2, 4, 3 }, t_values, DataType::FLOAT64, &a);
+    Tensor picked = constant({ 2, 2 }, { 3, 0, 0, 2 }, DataType::INT64, &a);
+    Tensor gathered = gather(t, picked, 1);
+    gathered.operate();
+
+    bool same = gathered.getShape() == vector<int>({ 2, 2, 2, 3 });
+    for (int b = 0; same && b < 2; b++) {
+        for (int p = 0; p < picks.size(); p++) {
+            for (int c = 0; c < 3; c++)
+                same = same && gathered.getBuffer()->getIndex<double>((b * 4 + p) * 3 + c) ==
+                               t_values[(b * 4 + picks[p]) * 3 + c];
+        }
+    }
+
+    check("gather, inner axis", same);
+
+    Tensor columns = constant({ 2 }, { 2, 0 }, DataType::INT32, &a);
+    Tensor selected = indexSelect(t, -1, columns);
+    selected.operate();
+
+    same = selected.getShape() == vector<int>({ 2, 4, 2 });
+    for (int r = 0; same && r < 8; r++) {
+        same = selected.getBuffer()->getIndex<double>(r * 2) == t_values[r * 3 + 2] &&
+               selected.getBuffer()->getIndex<double>(r * 2 + 1) == t_values[r * 3];
+    }
+
+    check("gather, index select along the last axis", same);
+
+    // Rows 2 (three times) and 0 of a [4, 3] table.
+    vector<double> base = values(4 * 3, 0.7), updates = values(4 * 3, 1.9);
+    vector<int> rows = { 2, 0, 2, 2 };
+
+    Tensor table = constant({ 4, 3 }, base, DataType::FLOAT64, &a);
+    Tensor row_ids = constant({ 4 }, { 2, 0, 2, 2 }, DataType::INT32, &a);
+    Tensor row_updates = constant({ 4, 3 }, updates, DataType::FLOAT64, &a);
+    Tensor scattered = scatterAdd(table, row_ids, row_updates);
+    scattered.operate();
+
+    vector<double> expected(base);
+    for (int i = 0; i < rows.size(); i++) {
+        for (int c = 0; c < 3; c++)
+            expected[rows[i] * 3 + c] += updates[i * 3 + c];
+    }
+
+    double error = 0;
+    for (int i = 0; i < expected.size(); i++)
+        error = std::max(error, std::abs(scattered.getBuffer()->getIndex<double>(i) - expected[i]));
+
+    check("scatter add, repeated rows", scattered.getShape() == vector<int>({ 4, 3 }) && error < 1e-12);
+
+    // Columns 4, 1 and 4 again of a [2, 5] table.
+    vector<double> column_base = values(2 * 5, 0.4), column_updates = values(2 * 3, 2.3);
+    vector<int> column_picks = { 4, 1, 4 };
+
+    Tensor wide = constant({ 2, 5 }, column_base, DataType::FLOAT64, &a);
+    Tensor column_ids = constant({ 3 }, { 4, 1, 4 }, DataType::INT64, &a);
+    Tensor column_values = constant({ 2, 3 }, column_updates, DataType::FLOAT64, &a);
+    Tensor column_scattered = scatterAdd(wide, column_ids, column_values, 1);
+    column_scattered.operate();
+
+    expected = column_base;
+    for (int r = 0; r < 2; r++) {
+        for (int i = 0; i < column_picks.size(); i++)
+            expected[r * 5 + column_picks[i]] += column_updates[r * 3 + i];
+    }
+
+    error = 0;
+    for (int i = 0; i < expected.size(); i++)
+        error = std::max(error, std::abs(column_scattered.getBuffer()->getIndex<double>(i) - expected[i]));
+
+    check("scatter add, repeated columns", error < 1e-12);
+
+    // The same loss of a gathered table, the table read only through the
+    // gather (a sparse gradient) and through a multiplication by 1 first (a
+    // dense one). Two backward passes, so accumulation is covered.
+    vector<double> embedding_values = values(6 * 3, 0.5), weights = values(4 * 3, 1.2);
+
+    vector<vector<double>> gradients;
+    for (bool sparse : { true, false }) {
+        Tensor embeddings = constant({ 6, 3 }, embedding_values, DataType::FLOAT64, &a);
+        Tensor ones = constant({ 6, 3 }, vector<double>(6 * 3, 1), DataType::FLOAT64, &a);
+        Tensor ids = constant({ 4 }, { 4, 1, 4, 0 }, DataType::INT32, &a);
+        Tensor w = constant({ 4, 3 }, weights, DataType::FLOAT64, &a);
+
+        Tensor read = sparse ? embeddings : multiply(embeddings, ones);
+        Tensor gathered_rows = embedding(read, ids);
+        Tensor loss = multiply(gathered_rows, w);
+
+        Gradients g(loss, { &embeddings });
+        g.backward();
+        g.backward();
+
+        if (sparse) {
+            check("sparse gradient, gathered table", g.isSparse(0));
+            check("sparse gradient, rows in the order first touched",
+                  g.getRows(0) == vector<uint64_t>({ 4, 1, 0 }));
+        }
+        else
+            check("sparse gradient, table read otherwise is dense", !g.isSparse(0));
+
+        Buffer* gradient = g.getGradient(embeddings);
+        gradients.push_back(vector<double>(gradient->getElements()));
+        gradient->copyTo<double>(gradients.back(), 0);
+    }
+
+    error = 0;
+    for (int i = 0; i < gradients[0].size(); i++)
+        error = std::max(error, std::abs(gradients[0][i] - gradients[1][i]));
+
+    check("sparse gradient, same as the dense one", error < 1e-12);
+}
+
+// Checkpointing a chain of matmuls and tanh to fit a budget lowers the
+// peak memory of a backward pass without changing the gradients.
+void checkpointing() {
+    Allocator a;
+
+    vector<double> values(64 * 64);
+    for (int i = 0; i < values.size(); i++)
+        values[i] = 0.2 * std::sin(0.37 * i);
+
+    Tensor x = constant({ 64, 64 }, values, DataType::FLOAT64, &a);
+    Tensor w = constant({ 64, 64 }, values, DataType::FLOAT64, &a);
+
+    Tensor y = x;
+    for (int layer = 0; layer < 8; layer++) {
+        y = matmul(y, w);
+        y = tanh(y);
+    }
+
+    vector<uint64_t> peaks;
+    vector<vector<double>> gradients;
+
+    for (bool checkpointed : { false, true }) {
+        Gradients g(y, { &w });
+        Allocator* context_allocator = g.getContext().getAllocator();
+
+        if (checkpointed) {
+            // A budget that can be met, and then one that can't.
+            bool fits = g.checkpoint(peaks[0] * 3 / 4);
+            check("checkpointing, budget met", fits && !g.getCheckpoints().empty());
+
+            bool impossible = g.checkpoint(1);
+            check("checkpointing, impossible budget keeps the best checkpoints",
+                  !impossible && !g.getCheckpoints().empty());
+
+            // Leaves the plans tried out of the peak.
+            context_allocator->resetPeak();
+        }
+
+        g.backward();
+
+        Buffer* gradient = g.getGradient(w);
+        gradients.push_back(vector<double>(gradient->getElements()));
+        gradient->copyTo<double>(gradients.back(), 0);
+
+        peaks.push_back(context_allocator->getPeakBytesAllocated());
+    }
+
+    cout << "checkpointing: peak bytes " << peaks[0] << " without, " << peaks[1] << " with" << endl;
+    check("checkpointing, lower peak", peaks[1] < peaks[0]);
+    check("checkpointing, same gradients", gradients[0] == gradients[1]);
+}
+
+// Two steps of each optimizer on w * c, whose gradient is c, and on rows 1, 3
+// and 1 again gathered from a table (a sparse gradient). The gradients don't
+// change from step to step, so with learning rate 0.1:
+//     SGD, momentum 0.9:   p - 0.1 * g - 0.1 * 1.9 * g    = p - 0.29 * g
+//     Adam:                m_hat = g, v_hat = g^2 twice   = p - 0.2 * g / (|g| + eps)
+//     AdamW, decay 0.1:    0.99 * (0.99 * p - 0.1 * k) - 0.1 * k
+//                                     = 0.9801 * p - 0.199 * k, k = g / (|g| + eps)
+// Rows 0 and 2 of the table are never touched, and stay as they are.
+void optimizers() {
+    vector<double> w_values = { 0.5, -1, 2, 0.25, -0.75, 1.5 };
+    vector<double> c_values = { 1, -2, 0.5, 3, -0.25, 2 };
+    vector<double> table_values = { 0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8 };
+    vector<double> d_values = { 1, -1, 2, 4, -3, 0.5 };
+
+    // Gradient of each table element: rows 1 and 3 are d's rows 0 + 2 and 1.
+    vector<double> table_gradient = { 0, 0, -2, -0.5, 0, 0, 2, 4 };
+    vector<bool> touched = { false, false, true, true, false, false, true, true };
+
+    const double eps = 1e-8;
+
+    for (std::string name : { "sgd", "adam", "adamw" }) {
+        Allocator a;
+
+        Tensor w = constant({ 3, 2 }, w_values, DataType::FLOAT64, &a);
+        Tensor c = constant({ 3, 2 }, c_values, DataType::FLOAT64, &a);
+        Tensor table = constant({ 4, 2 }, table_values, DataType::FLOAT64, &a);
+        Tensor ids = constant({ 3 }, { 1, 3, 1 }, DataType::INT32, &a);
+        Tensor d = constant({ 3, 2 }, d_values, DataType::FLOAT64, &a);
+
+        Tensor wc = multiply(w, c);
+        Tensor rows = embedding(table, ids);
+        Tensor rd = multiply(rows, d);
+        Tensor y = add(wc, rd);
+
+        Gradients g(y, { &w, &table });
+
+        Optimizer* optimizer;
+        if (name == "sgd")
+            optimizer = new SGD(g, 0.1, 0.9);
+        else if (name == "adam")
+            optimizer = new Adam(g, 0.1);
+        else
+            optimizer = new AdamW(g, 0.1, 0.1);
+
+        for (int step = 0; step < 2; step++) {
+            g.backward();
+            optimizer->step();
+        }
+
+        delete optimizer;
+
+        auto expected = [&](double p, double gradient) {
+            double k = gradient / (std::abs(gradient) + eps);
+            if (name == "sgd")
+                return p - 0.29 * gradient;
+            if (name == "adam")
+                return p - 0.2 * k;
+
+            return 0.9801 * p - 0.199 * k;
+        };
+
+        double error = 0;
+        for (int i = 0; i < w_values.size(); i++)
+            error = std::max(error, std::abs(w.getBuffer()->getIndex<double>(i) - expected(w_values[i], c_values[i])));
+
+        bool untouched = true;
+        for (int i = 0; i < table_values.size(); i++) {
+            double value = table.getBuffer()->getIndex<double>(i);
+            if (touched[i])
+                error = std::max(error, std::abs(value - expected(table_values[i], table_gradient[i])));
+            else
+                untouched = untouched && value == table_values[i];
+        }
+
+        check("optimizers, " + name + " two steps", error < 1e-12);
+        check("optimizers, " + name + " untouched rows", untouched);
+    }
+}
+
+// A task running on the pool it was run from, and two threads running
+// on the same pool at once, finish every task.
+void threadPool() {
+    ThreadPool pool(4);
+
+    std::atomic<int> count(0);
+    pool.run(4, [&](int) {
+        pool.run(4, [&](int) { count++; });
+    });
+
+    check("thread pool, nested runs", count == 16);
+
+    count = 0;
+    auto concurrent = [&]() {
+        for (int i = 0; i < 100; i++)
+            pool.run(8, [&](int) { count++; });
+    };
+
+    std::thread other(concurrent);
+    concurrent();
+    other.join();
+
+    check("thread pool, concurrent runs", count == 1600);
+}
+
+// Refeeding one of two inputs of sqrt(exp(x) + exp(y)) only recomputes
+// exp(x) and what follows, and gives what a full operate gives. The sum and
+// the square root are computed in place, until the first incremental operate
+// gives them buffers of their own.
+void incrementalOperate() {
+    Allocator a;
+
+    vector<int> shape = { 4 };
+
+    Tensor x = placeholder(shape, DataType::FLOAT32, &a);
+    Tensor y = placeholder(shape, DataType::FLOAT32, &a);
+    x.feed(vector<float>({ 1, 2, 3, 4 }));
+    y.feed(vector<float>({ 0.5f, 0.25f, 2, 1 }));
+
+    Tensor ex = exp(x);
+    Tensor ey = exp(y);
+    Tensor s = add(ex, ey);
+    Tensor r = sqrt(s);
+
+    r.operate(true);
+
+    uint64_t ex_version = ex.getOperation()->getVersion();
+    uint64_t ey_version = ey.getOperation()->getVersion();
+
+    x.feed(vector<float>({ 4, 3, 2, 1 }));
+    r.operate(true);
+
+    check("incremental operate, only exp(x) recomputed",
+          ex.getOperation()->getVersion() == ex_version + 1 && ey.getOperation()->getVersion() == ey_version);
+
+    // The sum's tensor sees the buffer it was given.
+    vector<float> incremental;
+    bool intermediate = true;
+    for (int i = 0; i < 4; i++) {
+        incremental.push_back(r.getBuffer()->getIndex<float>(i));
+        intermediate = intermediate && std::sqrt(s.getBuffer()->getIndex<float>(i)) == incremental[i];
+    }
+
+    check("incremental operate, intermediate result", intermediate);
+
+    r.operate();
+
+    bool same = true;
+    for (int i = 0; i < 4; i++)
+        same = same && r.getBuffer()->getIndex<float>(i) == incremental[i];
+
+    check("incremental operate, same result as a full operate", same);
+}
+
+// Prints the bits of a sum over all of a 4M element FLOAT32 tensor, of a sum
+// over axis 0 of it as [1M, 4] (too few outputs to go around, so fast mode
+// would split the reduced axis one chunk per thread) and of a mean over the
+// last axis of it as [8, 512K], for determinism() to compare.
+void reductionBits() {
+    Allocator a;
+
+    int size = 1 << 22;
+    vector<float> values(size);
+    for (int i = 0; i < size; i++)
+        values[i] = std::sin(0.001f * i) * (1 + i % 7);
+
+    vector<vector<int>> shapes = { { size }, { size / 4, 4 }, { 8, size / 8 } };
+    vector<vector<int>> axes = { {}, { 0 }, { 1 } };
+
+    for (int r = 0; r < shapes.size(); r++) {
+        Tensor x = placeholder(shapes[r], DataType::FLOAT32, &a);
+        x.feed(values);
+
+        Tensor y = (r < 2) ? sum(x, axes[r]) : mean(x, axes[r]);
+        y.operate();
+
+        for (uint64_t i = 0; i < y.getBuffer()->getElements(); i++) {
+            float value = y.getBuffer()->getIndex<float>(i);
+            uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+
+            cout << bits << " ";
+        }
+    }
+
+    cout << endl;
+}
+
+// Runs `program` (this test) with `DEEPLIB_THREADS` at 1, 3 and 8 in
+// deterministic mode, each printing reductionBits(), which must all agree.
+void determinism(std::string program) {
+    vector<std::string> outputs;
+
+    for (int threads : { 1, 3, 8 }) {
+        std::string command = "DEEPLIB_DETERMINISTIC=1 DEEPLIB_THREADS=" + std::to_string(threads) +
+                              " " + program + " reductions";
+
+        FILE* pipe = popen(command.c_str(), "r");
+        std::string output;
+
+        char chunk[256];
+        while (pipe != nullptr && std::fgets(chunk, sizeof(chunk), pipe) != nullptr)
+            output += chunk;
+
+        if (pipe != nullptr)
+            pclose(pipe);
+
+        outputs.push_back(output);
+    }
+
+    check("determinism, bit-identical reductions across thread counts",
+          !outputs[0].empty() && outputs[0] == outputs[1] && outputs[0] == outputs[2]);
+}
+
+// Deterministic against fast mode reductions over the shapes reductionBits()
+// uses, averaged over a few runs each: a single row, many short columns (too
+// few output elements without chunking) and a few long rows.
+void reductionTimings() {
+    Allocator a;
+
+    int size = 1 << 22;
+    vector<float> values(size);
+    for (int i = 0; i < size; i++)
+        values[i] = std::sin(0.001f * i) * (1 + i % 7);
+
+    vector<vector<int>> shapes = { { size }, { size / 4, 4 }, { 8, size / 8 } };
+    vector<vector<int>> axes = { {}, { 0 }, { 1 } };
+    const int runs = 5;
+    bool deterministic_before = isDeterministic();
+
+    for (int r = 0; r < shapes.size(); r++) {
+        Tensor x = placeholder(shapes[r], DataType::FLOAT32, &a);
+        x.feed(values);
+
+        Tensor y = sum(x, axes[r]);
+
+        // Leaves allocating the result out of the timings.
+        y.operate();
+
+        cout << "reduction of " << shapes[r][0] << (shapes[r].size() > 1 ? "x" + std::to_string(shapes[r][1]) : "")
+             << " over " << (axes[r].empty() ? "everything" : "axis " + std::to_string(axes[r][0])) << " on "
+             << ThreadPool::shared().getThreads() << " threads:";
+
+        for (bool deterministic : { false, true }) {
+            setDeterministic(deterministic);
+
+            auto time1 = high_resolution_clock::now();
+            for (int run = 0; run < runs; run++)
+                y.operate();
+            auto time2 = high_resolution_clock::now();
+
+            cout << (deterministic ? ", deterministic " : " fast ")
+                 << duration_cast<microseconds>(time2 - time1).count() / runs << " microseconds";
+        }
+
+        cout << endl;
+    }
+
+    setDeterministic(deterministic_before);
+}
+
+// Inference batch norms (given a mean and variance) of a matmul, a matmul plus
+// bias and a conv2d give the same results folded into them as unfolded.
+void batchNormFolding() {
+    Allocator a;
+
+    auto values = [](int n, double offset) {
+        vector<double> v(n);
+        for (int i = 0; i < n; i++)
+            v[i] = std::sin(0.7 * i + offset);
+
+        return v;
+    };
+
+    auto positive = [](int n) {
+        vector<double> v(n);
+        for (int i = 0; i < n; i++)
+            v[i] = 0.5 + 0.1 * i;
+
+        return v;
+    };
+
+    Tensor x = constant({ 4, 3 }, values(12, 0.1), DataType::FLOAT64, &a);
+    Tensor w = constant({ 3, 5 }, values(15, 0.2), DataType::FLOAT64, &a);
+    Tensor bias = constant({ 5 }, values(5, 0.3), DataType::FLOAT64, &a);
+
+    Tensor image = constant({ 2, 6, 6 }, values(72, 0.4), DataType::FLOAT64, &a);
+    Tensor kernel = constant({ 3, 3 }, values(9, 0.5), DataType::FLOAT64, &a);
+
+    int unit[2] = { 1, 1 };
+
+    // Scale, shift, mean and variance of the given number of channels.
+    auto normalize = [&](Tensor& t, int channels) {
+        Tensor scale = constant({ channels }, values(channels, 0.6), DataType::FLOAT64, &a);
+        Tensor shift = constant({ channels }, values(channels, 0.7), DataType::FLOAT64, &a);
+        Tensor mean = constant({ channels }, values(channels, 0.8), DataType::FLOAT64, &a);
+        Tensor variance = constant({ channels }, positive(channels), DataType::FLOAT64, &a);
+
+        return batchNorm(t, scale, shift, mean, variance);
+    };
+
+    vector<std::string> names = { "matmul", "matmul plus bias", "conv2d" };
+    for (int n = 0; n < names.size(); n++) {
+        vector<vector<double>> results;
+
+        for (bool folded : { false, true }) {
+            Tensor y = matmul(x, w);
+            if (n == 1)
+                y = add(y, bias);
+            if (n == 2)
+                y = conv2d(image, kernel, "valid", unit);
+
+            Tensor normalized = normalize(y, (n == 2) ? 1 : 5);
+            Operation* unfolded = normalized.getOperation();
+
+            if (folded) {
+                foldBatchNormalization(normalized);
+                check("batch norm folding, " + names[n] + " folded",
+                      normalized.getOperation() != unfolded && normalized.getOperation()->getType().compare("batch_norm"));
+            }
+
+            normalized.operate();
+
+            results.push_back(vector<double>(normalized.getBuffer()->getElements()));
+            normalized.getBuffer()->copyTo<double>(results.back(), 0);
+        }
+
+        double error = 0;
+        for (int i = 0; i < results[0].size(); i++)
+            error = std::max(error, std::abs(results[0][i] - results[1][i]));
+
+        check("batch norm folding, " + names[n] + " same result", error < 1e-12);
+    }
+}
+
+// Six single position steps of attention over a cache of capacity 3, which
+// wraps around twice, against softmax(q k^T / sqrt(d)) v over the last (up to)
+// three positions' keys and values worked out directly. 16 bit caches are
+// held to the values they store, and to their result's rounding.
+void kvCacheWraparound() {
+    struct Case { const char* name; DataType dtype; double tolerance; };
+
+    vector<Case> cases = {
+        { "", DataType::FLOAT64, 1e-12 },
+        { ", float16", DataType::FLOAT16, 2e-3 },
+        { ", bfloat16", DataType::BFLOAT16, 1e-2 },
+    };
+
+    for (Case& c : cases) {
+        Allocator a;
+
+        const int d = 2;
+        KVCache* cache = a.newKVCache(new KVCache({ 1, 3, d }, { 1, 3, d }, c.dtype, &a));
+
+        Tensor q = placeholder({ 1, 1, d }, c.dtype, &a);
+        Tensor y = attention(q, cache);
+
+        Buffer* key = a.newBuffer(new Buffer({ 1, 1, d }, &a));
+        Buffer* value = a.newBuffer(new Buffer({ 1, 1, d }, &a));
+        key->setDataType(c.dtype);
+        value->setDataType(c.dtype);
+
+        vector<vector<double>> keys, values;
+
+        double error = 0;
+        for (int step = 0; step < 6; step++) {
+            vector<double> step_key = { std::sin(1.3 * step), std::cos(0.7 * step) };
+            vector<double> step_value = { 0.5 * step - 1, std::sin(step + 0.5) };
+
+            key->fill<double>(step_key);
+            value->fill<double>(step_value);
+            cache->append(key, value);
+
+            q.feed(vector<double>({ std::cos(0.9 * step), 0.3 * step - 0.5 }));
+            y.operate();
+
+            // What the buffers hold, i.e. rounded to 16 bits if they are.
+            vector<double> query = valuesOf(q.getBuffer());
+            keys.push_back(valuesOf(key));
+            values.push_back(valuesOf(value));
+            vector<double> result = valuesOf(y.getBuffer());
+
+            // Sliding window of the last three positions.
+            int first = std::max(0, step - 2);
+
+            vector<double> scores;
+            double largest = -1e300;
+            for (int p = first; p <= step; p++) {
+                scores.push_back((query[0] * keys[p][0] + query[1] * keys[p][1]) / std::sqrt(d));
+                largest = std::max(largest, scores.back());
+            }
+
+            double total = 0;
+            for (double& score : scores) {
+                score = std::exp(score - largest);
+                total += score;
+            }
+
+            for (int j = 0; j < d; j++) {
+                double expected = 0;
+                for (int p = first; p <= step; p++)
+                    expected += scores[p - first] / total * values[p][j];
+
+                // NaN stays, failing the check.
+                double difference = std::abs(result[j] - expected);
+                error = std::isnan(difference) ? difference : std::max(error, difference);
+            }
+        }
+
+        check(std::string("kv cache, sliding window after wrapping around") + c.name,
+              error < c.tolerance && cache->getLength() == 3 && cache->getPosition() == 6);
+    }
+}
+
+// Products with CSR and COO matrices (and their transposes) on either side,
+// and their dense forms, against the same products with the dense matrix.
+// The CSR matrix is taken from the dense one, the COO one from coordinates
+// (one of them given twice, in halves) and then from the CSR one.
+void sparseMatrices() {
+    Allocator a;
+
+    // Row 2 is empty.
+    vector<double> dense = { 0, 1.5, 0, 0, -2,
+                             3, 0, 0, 0.5, 0,
+                             0, 0, 0, 0, 0,
+                             0, -1, 2, 0, 4 };
+    vector<int> rows = { 3, 0, 1, 3, 0, 1, 3, 0 };
+    vector<int> columns = { 4, 1, 0, 1, 4, 3, 2, 4 };
+    vector<double> values = { 4, 1.5, 3, -1, -1, 0.5, 2, -1 };
+
+    auto made_up = [](int n, double offset) {
+        vector<double> v(n);
+        for (int i = 0; i < n; i++)
+            v[i] = std::sin(0.8 * i + offset);
+
+        return v;
+    };
+
+    Tensor s = constant({ 4, 5 }, dense, DataType::FLOAT64, &a);
+    Tensor st = transpose(s);
+    Tensor b = constant({ 5, 3 }, made_up(15, 0.1), DataType::FLOAT64, &a);
+    Tensor c = constant({ 4, 3 }, made_up(12, 0.2), DataType::FLOAT64, &a);
+    Tensor l = constant({ 2, 4 }, made_up(8, 0.3), DataType::FLOAT64, &a);
+    Tensor m = constant({ 2, 5 }, made_up(10, 0.4), DataType::FLOAT64, &a);
+
+    SparseMatrix* csr = a.newSparseMatrix(new SparseMatrix(4, 5, DataType::FLOAT64, SparseFormat::CSR, &a));
+    SparseMatrix* coo = a.newSparseMatrix(new SparseMatrix(4, 5, DataType::FLOAT64, SparseFormat::COO, &a));
+    csr->assign(s.getBuffer());
+    coo->assign(rows, columns, values);
+
+    // Largest difference between two results.
+    auto difference = [](Tensor& t1, Tensor& t2) {
+        t1.operate();
+        t2.operate();
+
+        double error = t1.getShape() == t2.getShape() ? 0 : 1;
+        for (uint64_t i = 0; error == 0 && i < t1.getBuffer()->getElements(); i++)
+            error = std::max(error, std::abs(t1.getBuffer()->getIndex<double>(i) - t2.getBuffer()->getIndex<double>(i)));
+
+        return error;
+    };
+
+    Tensor sb = matmul(s, b);
+    Tensor stc = matmul(st, c);
+    Tensor ls = matmul(l, s);
+    Tensor mst = matmul(m, st);
+
+    for (int round = 0; round < 2; round++) {
+        if (round == 1)
+            coo->assign(csr);
+
+        for (SparseMatrix* sparse : { csr, coo }) {
+            std::string name = (sparse == csr) ? "csr" : "coo";
+
+            Tensor product = matmul(sparse, b);
+            Tensor transposed = matmul(sparse, c, true);
+            Tensor left = matmul(l, sparse);
+            Tensor left_transposed = matmul(m, sparse, true);
+            Tensor as_dense = toDense(sparse);
+
+            double error = std::max({ difference(product, sb), difference(transposed, stc),
+                                      difference(left, ls), difference(left_transposed, mst) });
+
+            check("sparse matrices, " + name + " products (round " + std::to_string(round) + ")", error < 1e-12);
+            check("sparse matrices, " + name + " to dense (round " + std::to_string(round) + ")",
+                  difference(as_dense, s) == 0 && sparse->getNonZeros() == 7);
+        }
+    }
+}
+
+// FLOAT16 and BFLOAT16 conversions, through the bit manipulation path unless
+// the test is built for F16C: every half round trips through float, and the
+// edge cases (subnormals, the largest half and where rounding reaches inf,
+// NaN, ties to even) convert to the expected bits.
+void halfConversions() {
+    auto bits = [](float value) { return half::fromFloat(value); };
+    auto brain = [](float value) { return half::fromFloatBrain(value); };
+
+    bool round_trips = true;
+    for (uint32_t h = 0; h < 0x10000; h++) {
+        float value = half::toFloat(h);
+        bool nan = (h & 0x7c00) == 0x7c00 && (h & 0x3ff) != 0;
+
+        if (nan)
+            round_trips = round_trips && std::isnan(value) && std::isnan(half::toFloat(bits(value)));
+        else
+            round_trips = round_trips && bits(value) == h;
+    }
+
+    check("half conversions, every half round trips", round_trips);
+
+    float tiny = std::ldexp(1.0f, -24);
+    check("half conversions, subnormals",
+          bits(tiny) == 0x0001 && half::toFloat(0x0001) == tiny && half::toFloat(0x03ff) == 1023 * tiny &&
+          bits(0.5f * tiny) == 0x0000 && bits(0.75f * tiny) == 0x0001 && bits(1.5f * tiny) == 0x0002 &&
+          bits(2.5f * tiny) == 0x0002 && bits(-tiny) == 0x8001 && bits(std::ldexp(1.0f, -14)) == 0x0400);
+
+    check("half conversions, largest half and overflow",
+          bits(65504) == 0x7bff && bits(65519.99f) == 0x7bff && bits(65520) == 0x7c00 &&
+          bits(-65520) == 0xfc00 && bits(1e6f) == 0x7c00 && half::toFloat(0x7bff) == 65504);
+
+    uint16_t nan = bits(std::nanf(""));
+    check("half conversions, NaN",
+          (nan & 0x7c00) == 0x7c00 && (nan & 0x3ff) != 0 && std::isnan(half::toFloat(nan)) &&
+          bits(INFINITY) == 0x7c00 && half::toFloat(0x7c00) == INFINITY);
+
+    check("half conversions, ties to even",
+          bits(1 + std::ldexp(1.0f, -11)) == 0x3c00 && bits(1 + 3 * std::ldexp(1.0f, -11)) == 0x3c02 &&
+          bits(1 + std::ldexp(1.0f, -11) + std::ldexp(1.0f, -20)) == 0x3c01);
+
+    bool brain_round_trips = true;
+    for (uint32_t h = 0; h < 0x10000; h++) {
+        bool nan = (h & 0x7f80) == 0x7f80 && (h & 0x7f) != 0;
+        if (!nan)
+            brain_round_trips = brain_round_trips && brain(half::toFloatBrain(h)) == h;
+    }
+
+    check("bfloat16 conversions, every bfloat16 round trips", brain_round_trips);
+    check("bfloat16 conversions, ties to even and NaN",
+          brain(1 + std::ldexp(1.0f, -8)) == 0x3f80 && brain(1 + 3 * std::ldexp(1.0f, -8)) == 0x3f82 &&
+          brain(1 + std::ldexp(1.0f, -8) + std::ldexp(1.0f, -20)) == 0x3f81 &&
+          std::isnan(half::toFloatBrain(brain(std::nanf("")))));
+}
+
+// FLOAT16 and BFLOAT16 element-wise operations and reductions against FP64
+// results of the 16 bit values they're given, to within the rounding of
+// their results. Rows are longer than the blocks inputs are widened in,
+// and not a multiple of them, as are the reduced axes. Deterministic mode
+// chunks the long reductions, which then combine partial FP32 rows. Softmax
+// goes through the FP32 fallback, twice with different shapes.
+void halfOperations() {
+    struct Case { const char* name; DataType dtype; double tolerance; };
+
+    vector<Case> cases = {
+        { "float16", DataType::FLOAT16, 1e-3 },
+        { "bfloat16", DataType::BFLOAT16, 8e-3 },
+    };
+
+    for (Case& c : cases) {
+        Allocator a;
+        ExecutionContext context;
+
+        const int rows = 3, columns = 700;
+
+        auto made_up = [](int n, double phase) {
+            vector<double> v(n);
+            for (int i = 0; i < n; i++)
+                v[i] = 1.25 + 0.75 * std::sin(0.37 * i + phase);
+            return v;
+        };
+
+        Tensor x = constant({ rows, columns }, made_up(rows * columns, 0.1), c.dtype, &a);
+        Tensor y = constant({ rows, columns }, made_up(rows * columns, 2.3), c.dtype, &a);
+        Tensor row = constant({ columns }, made_up(columns, 1.7), c.dtype, &a);
+        Tensor scalar = constant({ 1 }, { 1.5 }, c.dtype, &a);
+
+        // The values as stored, i.e. rounded to 16 bits.
+        vector<double> xs = valuesOf(x.getBuffer()), ys = valuesOf(y.getBuffer()), rs = valuesOf(row.getBuffer());
+        double ss = valuesOf(scalar.getBuffer())[0];
+
+        // Largest error relative to the expected values, NaN if any result is.
+        auto error = [&](Tensor& t, std::function<double(int)> expected) {
+            vector<double> result = valuesOf(context.operate(t));
+
+            double largest = 0;
+            for (int i = 0; i < result.size(); i++) {
+                double e = expected(i);
+                double relative = std::abs(result[i] - e) / std::max(1e-3, std::abs(e));
+
+                largest = (std::isnan(relative) || std::isnan(largest)) ? NAN : std::max(largest, relative);
+            }
+
+            return largest;
+        };
+
+        std::string name = std::string("half operations, ") + c.name;
+
+        Tensor sum_xy = add(x, y), biased = add(x, row), shifted = sub(x, scalar);
+        Tensor product = multiply(x, y), quotient = divide(x, y), raised = power(x, scalar);
+        check(name + " add, sub, multiply, divide and power",
+              error(sum_xy, [&](int i) { return xs[i] + ys[i]; }) < c.tolerance &&
+              error(biased, [&](int i) { return xs[i] + rs[i % columns]; }) < c.tolerance &&
+              error(product, [&](int i) { return xs[i] * ys[i]; }) < c.tolerance &&
+              error(quotient, [&](int i) { return xs[i] / ys[i]; }) < c.tolerance &&
+              error(raised, [&](int i) { return std::pow(xs[i], ss); }) < c.tolerance);
+
+        // x - 1.5 goes through 0, so it's held to the rounding of x alone.
+        vector<double> shifted_result = valuesOf(context.operate(shifted));
+        bool shifted_close = true;
+        for (int i = 0; i < xs.size(); i++)
+            shifted_close = shifted_close && std::abs(shifted_result[i] - (xs[i] - ss)) < 2 * c.tolerance;
+
+        check(name + " sub of a single element", shifted_close);
+
+        Tensor exps = exp(x), logs = log(x), roots = sqrt(x);
+        Tensor log_offset = add(logs, scalar);
+        check(name + " exp, log and sqrt",
+              error(exps, [&](int i) { return std::exp(xs[i]); }) < c.tolerance &&
+              error(log_offset, [&](int i) { return std::log(xs[i]) + ss; }) < 2 * c.tolerance &&
+              error(roots, [&](int i) { return std::sqrt(xs[i]); }) < c.tolerance);
+
+        auto reduced = [&](int axis, std::function<double(double, double)> f, bool mean) {
+            int n = axis ? rows : columns, extent = axis ? columns : rows;
+
+            vector<double> v(n);
+            for (int o = 0; o < n; o++) {
+                v[o] = axis ? xs[o * columns] : xs[o];
+                for (int r = 1; r < extent; r++)
+                    v[o] = f(v[o], axis ? xs[o * columns + r] : xs[r * columns + o]);
+
+                if (mean)
+                    v[o] /= extent;
+            }
+            return v;
+        };
+
+        auto plus = [](double u, double v) { return u + v; };
+        auto larger = [](double u, double v) { return std::max(u, v); };
+        auto smaller = [](double u, double v) { return std::min(u, v); };
+
+        vector<double> row_sums = reduced(1, plus, false), column_means = reduced(0, plus, true);
+        vector<double> column_maxima = reduced(0, larger, false), row_minima = reduced(1, smaller, false);
+
+        Tensor sums = sum(x, { 1 }), means = mean(x, { 0 }), maxima = max(x, { 0 }), minima = min(x, { 1 });
+        check(name + " sum, mean, max and min",
+              error(sums, [&](int i) { return row_sums[i]; }) < c.tolerance &&
+              error(means, [&](int i) { return column_means[i]; }) < c.tolerance &&
+              error(maxima, [&](int i) { return column_maxima[i]; }) == 0 &&
+              error(minima, [&](int i) { return row_minima[i]; }) == 0);
+
+        Tensor largest = argmax(x, 1);
+        Buffer* indices = context.operate(largest);
+
+        bool first_largest = true;
+        for (int r = 0; r < rows; r++) {
+            int64_t index = indices->getIndex<int64_t>(r);
+            first_largest = first_largest && xs[r * columns + index] == reduced(1, larger, false)[r] &&
+                            std::find(xs.begin() + r * columns, xs.begin() + r * columns + index,
+                                      xs[r * columns + index]) == xs.begin() + r * columns + index;
+        }
+
+        check(name + " argmax", first_largest);
+
+        // Long reductions, chunked in deterministic mode, along either axis.
+        const int length = 20000;
+        Tensor wide = constant({ 2, length }, made_up(2 * length, 0.9), c.dtype, &a);
+        Tensor tall = constant({ length, 3 }, made_up(length * 3, 1.9), c.dtype, &a);
+        vector<double> ws = valuesOf(wide.getBuffer()), ts = valuesOf(tall.getBuffer());
+
+        setDeterministic(true);
+
+        Tensor wide_sums = sum(wide, { 1 }), tall_means = mean(tall, { 0 });
+        double wide_error = error(wide_sums, [&](int o) {
+            double total = 0;
+            for (int r = 0; r < length; r++)
+                total += ws[o * length + r];
+            return total;
+        });
+        double tall_error = error(tall_means, [&](int j) {
+            double total = 0;
+            for (int r = 0; r < length; r++)
+                total += ts[r * 3 + j];
+            return total / length;
+        });
+
+        setDeterministic(false);
+
+        check(name + " chunked sum and mean", wide_error < c.tolerance && tall_error < c.tolerance);
+
+        // Softmax of a row and then of every row, through the FP32 fallback.
+        Tensor first_row = constant({ 1, columns }, made_up(columns, 0.1), c.dtype, &a);
+        Tensor row_softmax = softmax(first_row), softmaxes = softmax(x);
+
+        auto softmaxOf = [&](int i) {
+            int r = i / columns;
+
+            double total = 0;
+            for (int j = 0; j < columns; j++)
+                total += std::exp(xs[r * columns + j]);
+
+            return std::exp(xs[i]) / total;
+        };
+
+        check(name + " softmax", error(row_softmax, softmaxOf) < c.tolerance && error(softmaxes, softmaxOf) < c.tolerance);
+    }
+}
+
+// Quantized data and products against the FP32 results of the values they
+// stand for. x is quantized with the range a Calibrator observes, the weights
+// per column and the kernel as a whole. Quantizing is within half a step of
+// the real values, and FLOAT32 products equal the products of the dequantized
+// operands up to float rounding. Requantized results are within half a step
+// of them (plus the rounding).
+void quantizedOperations() {
+    Allocator a;
+
+    auto made_up = [](int n, double offset, double amplitude) {
+        vector<double> v(n);
+        for (int i = 0; i < n; i++)
+            v[i] = amplitude * std::sin(0.9 * i + offset) + 0.2;
+
+        return v;
+    };
+
+    // Largest difference between two FLOAT32 results.
+    auto difference = [](Tensor& t1, Tensor& t2) {
+        t1.operate();
+        t2.operate();
+
+        double error = 0;
+        for (uint64_t i = 0; i < t1.getBuffer()->getElements(); i++)
+            error = std::max(error, static_cast<double>(std::abs(t1.getBuffer()->getIndex<float>(i) - t2.getBuffer()->getIndex<float>(i))));
+
+        return error;
+    };
+
+    vector<double> x_values = made_up(24, 0.1, 1.5);
+    Tensor x = constant({ 4, 6 }, x_values, DataType::FLOAT32, &a);
+    Tensor w = constant({ 6, 5 }, made_up(30, 0.2, 0.8), DataType::FLOAT32, &a);
+    Tensor image = constant({ 2, 7, 7 }, made_up(98, 0.3, 2), DataType::FLOAT32, &a);
+    Tensor kernel = constant({ 3, 3 }, made_up(9, 0.4, 0.5), DataType::FLOAT32, &a);
+
+    Calibrator calibrator({ &x, &image });
+    calibrator.observe();
+
+    float x_min = *std::min_element(x_values.begin(), x_values.end());
+    float x_max = *std::max_element(x_values.begin(), x_values.end());
+    check("quantization, calibrated range", calibrator.getMin(0) == x_min && calibrator.getMax(0) == x_max);
+
+    Quantization x_quantization = calibrator.getQuantization(0, DataType::UINT8);
+    Tensor xq = quantize(x, DataType::UINT8, x_quantization);
+    Tensor xd = dequantize(xq);
+    check("quantization, quantize within half a step", difference(xd, x) <= x_quantization.scales[0] * 0.5001);
+
+    Tensor wq = quantizeWeights(w, 1);
+    Tensor wd = dequantize(wq);
+    wd.operate();
+
+    Quantization& w_quantization = wq.getBuffer()->getQuantization();
+    bool weights_within = w_quantization.scales.size() == 5;
+    for (int i = 0; weights_within && i < 30; i++) {
+        float step = w_quantization.scales[i % 5];
+        weights_within = std::abs(wd.getBuffer()->getIndex<float>(i) - w.getBuffer()->getIndex<float>(i)) <= step * 0.5001;
+    }
+
+    check("quantization, per column weights within half a step", weights_within);
+
+    Tensor product = quantizedMatmul(xq, wq);
+    Tensor reference = matmul(xd, wd);
+    double product_error = difference(product, reference);
+    check("quantization, quantized matmul", product_error < 1e-5);
+
+    // The reference's range, requantized to INT8.
+    float low = 0, high = 0;
+    for (uint64_t i = 0; i < reference.getBuffer()->getElements(); i++) {
+        low = std::min(low, reference.getBuffer()->getIndex<float>(i));
+        high = std::max(high, reference.getBuffer()->getIndex<float>(i));
+    }
+
+    Quantization out_quantization = rangeQuantization(low, high, DataType::INT8);
+    Tensor requantized = quantizedMatmul(xq, wq, DataType::INT8, out_quantization);
+    Tensor requantized_real = dequantize(requantized);
+    check("quantization, requantized matmul within half a step",
+          difference(requantized_real, reference) <= out_quantization.scales[0] * 0.5 + 1e-5);
+
+    // Signed images, with padding (the zero point) and with strides.
+    Quantization image_quantization = calibrator.getQuantization(1, DataType::INT8);
+    Tensor imageq = quantize(image, DataType::INT8, image_quantization);
+    Tensor imaged = dequantize(imageq);
+    Tensor kernelq = quantizeWeights(kernel);
+    Tensor kerneld = dequantize(kernelq);
+
+    int unit[2] = { 1, 1 };
+    int two[2] = { 2, 2 };
+
+    Tensor same = quantizedConv2d(imageq, kernelq, "same", unit);
+    Tensor same_reference = conv2d(imaged, kerneld, "same", unit);
+    Tensor strided = quantizedConv2d(imageq, kernelq, "valid", two);
+    Tensor strided_reference = conv2d(imaged, kerneld, "valid", two);
+
+    check("quantization, quantized conv2d",
+          difference(same, same_reference) < 1e-5 && difference(strided, strided_reference) < 1e-5);
+}
+
+// Bit-packed masks of 131 elements (two words and a 3 bit tail), and of
+// [3, 43] (rows straddling words), against the comparisons they hold. The
+// mask reductions must ignore whatever the bits past the last element are.
+void masks() {
+    Allocator a;
+
+    const int n = 131;
+    vector<double> values(n);
+    for (int i = 0; i < n; i++)
+        values[i] = std::sin(0.37 * i);
+
+    // Row 1 is all positive and row 2 all negative.
+    for (int i = 43; i < 129; i++)
+        values[i] = (i < 86 ? 1 : -1) * (std::abs(values[i]) + 0.1);
+
+    Tensor x = constant({ n }, values, DataType::FLOAT32, &a);
+    Tensor zero = constant({ 1 }, { 0 }, DataType::FLOAT32, &a);
+
+    Tensor mask = greaterThan(x, zero);
+    mask.operate();
+
+    int positive = 0;
+    bool same = true;
+    for (int i = 0; i < n; i++) {
+        positive += values[i] > 0;
+        same = same && mask.getBuffer()->getIndex<bool>(i) == (values[i] > 0);
+    }
+
+    check("masks, packed comparison", same);
+
+    Tensor count = countTrue(mask);
+    Tensor inverted = logicalNot(mask);
+    Tensor inverted_count = countTrue(inverted);
+    count.operate();
+    inverted_count.operate();
+
+    check("masks, count and count of the inverse",
+          count.getBuffer()->getIndex<int64_t>(0) == positive && inverted_count.getBuffer()->getIndex<int64_t>(0) == n - positive);
+
+    // All clear and all set, with the tail's bits the other way around.
+    Tensor none_set = constant({ n }, vector<double>(n, 0), DataType::BOOL, &a);
+    Tensor all_set = constant({ n }, vector<double>(n, 1), DataType::BOOL, &a);
+    none_set.getBuffer()->getBufferDataAsTemplate<uint64_t>()[2] |= ~bits::tailMask(n);
+    all_set.getBuffer()->getBufferDataAsTemplate<uint64_t>()[2] &= bits::tailMask(n);
+
+    Tensor none_count = countTrue(none_set);
+    Tensor none_any = any(none_set);
+    Tensor all_count = countTrue(all_set);
+    Tensor all_all = all(all_set);
+    for (Tensor* t : { &none_count, &none_any, &all_count, &all_all })
+        t->operate();
+
+    check("masks, reductions ignore the tail",
+          none_count.getBuffer()->getIndex<int64_t>(0) == 0 && !none_any.getBuffer()->getIndex<bool>(0) &&
+          all_count.getBuffer()->getIndex<int64_t>(0) == n && all_all.getBuffer()->getIndex<bool>(0));
+
+    vector<double> row_values(values.begin(), values.begin() + 129);
+    Tensor rows = constant({ 3, 43 }, row_values, DataType::FLOAT32, &a);
+    Tensor row_mask = greaterThan(rows, zero);
+    Tensor row_counts = countTrue(row_mask, { 1 });
+    Tensor row_any = any(row_mask, { 1 });
+    Tensor row_all = all(row_mask, { 1 });
+    for (Tensor* t : { &row_counts, &row_any, &row_all })
+        t->operate();
+
+    bool rows_same = true;
+    for (int r = 0; r < 3; r++) {
+        int row_positive = 0;
+        for (int i = 0; i < 43; i++)
+            row_positive += row_values[r * 43 + i] > 0;
+
+        rows_same = rows_same && row_counts.getBuffer()->getIndex<int64_t>(r) == row_positive &&
+                    row_any.getBuffer()->getIndex<bool>(r) == (row_positive > 0) &&
+                    row_all.getBuffer()->getIndex<bool>(r) == (row_positive == 43);
+    }
+
+    check("masks, per row count, any and all", rows_same);
+}
+
+// Casts out of the target's range, saturating and not. Floats to integers
+// always saturate, with NaN becoming 0; other narrowing wraps around (or
+// overflows to inf) unless saturating.
+void saturatingCasts() {
+    Allocator a;
+
+    const double inf = INFINITY;
+
+    // Values of t cast to dtype, as doubles.
+    auto converted = [&](vector<double> values, DataType from, DataType to, bool saturate) {
+        Tensor t = constant({ static_cast<int>(values.size()) }, values, from, &a);
+        Tensor c = cast(t, to, saturate);
+        c.operate();
+
+        vector<double> result(values.size());
+        c.getBuffer()->copyTo<double>(result, 0);
+
+        return result;
+    };
+
+    vector<double> large = { 1e6, -1e6, 65520, inf, 1.5 };
+    check("saturating casts, FLOAT32 to FLOAT16",
+          converted(large, DataType::FLOAT32, DataType::FLOAT16, true) == vector<double>({ 65504, -65504, 65504, inf, 1.5 }) &&
+          converted(large, DataType::FLOAT32, DataType::FLOAT16, false) == vector<double>({ inf, -inf, inf, inf, 1.5 }));
+
+    vector<double> half_nan = converted({ NAN }, DataType::FLOAT32, DataType::FLOAT16, true);
+    check("saturating casts, NaN stays NaN in FLOAT16", std::isnan(half_nan[0]));
+
+    vector<double> out_of_int8 = { 300, -300, NAN, 127.5, -128.6, 3e38 };
+    vector<double> int8_expected = { 127, -128, 0, 127, -128, 127 };
+    check("saturating casts, FLOAT32 to INT8",
+          converted(out_of_int8, DataType::FLOAT32, DataType::INT8, true) == int8_expected &&
+          converted(out_of_int8, DataType::FLOAT32, DataType::INT8, false) == int8_expected);
+
+    vector<double> ints = { 300, -300, 127, -129 };
+    check("saturating casts, INT32 to INT8",
+          converted(ints, DataType::INT32, DataType::INT8, true) == vector<double>({ 127, -128, 127, -128 }) &&
+          converted(ints, DataType::INT32, DataType::INT8, false) == vector<double>({ 44, -44, 127, 127 }));
+
+    vector<double> huge = { 1e300, -1e300 };
+    double largest_float = std::numeric_limits<float>::max();
+    check("saturating casts, FLOAT64 to FLOAT32",
+          converted(huge, DataType::FLOAT64, DataType::FLOAT32, true) == vector<double>({ largest_float, -largest_float }) &&
+          converted(huge, DataType::FLOAT64, DataType::FLOAT32, false) == vector<double>({ inf, -inf }));
+
+    check("saturating casts, FLOAT32 to BFLOAT16",
+          converted({ 3.4e38 }, DataType::FLOAT32, DataType::BFLOAT16, true)[0] == static_cast<double>(3.38953139e38f));
+}
+
+// exp(x) and x^3 of a million elements, with vector math and then libm.
+void vectorMath() {
+    Allocator a;
+
+    vector<int> shape = { 1 << 20 };
+
+    Tensor x = placeholder(shape, DataType::FLOAT32, &a);
+    x.feed(vector<float>(1 << 20, 1.5f));
+
+    Tensor three({ 3 }, { 1 }, &a);
+    three = cast(three, DataType::FLOAT32);
+
+    Tensor e = exp(x);
+    Tensor p = power(x, three);
+    foldCasts(p);
+
+    // Leaves allocating the results out of the timings.
+    e.operate();
+    p.operate();
+
+    for (bool vector_math : { true, false }) {
+        setVectorMath(vector_math);
+
+        auto time1 = high_resolution_clock::now();
+        e.operate();
+        auto time2 = high_resolution_clock::now();
+        p.operate();
+        auto time3 = high_resolution_clock::now();
+
+        cout << (vector_math ? "vector math" : "libm") << ": exp "
+             << duration_cast<microseconds>(time2 - time1).count() << " microseconds, power "
+             << duration_cast<microseconds>(time3 - time2).count() << " microseconds" << endl;
+    }
+
+    setVectorMath(true);
+}
+
+// (x + exp(x * y)) / x of a million elements, as a graph and as a typed
+// expression evaluated in a single loop.
+void typedExpressions() {
+    Allocator a;
+
+    int size = 1 << 20;
+    vector<int> shape = { size };
+
+    typed::Tensor<float> x(vector<float>(size, 1.5f), shape);
+    typed::Tensor<float> y(vector<float>(size, 0.25f), shape);
+
+    Tensor gx = x.toConstant(&a);
+    Tensor gy = y.toConstant(&a);
+
+    Tensor g = multiply(gx, gy);
+    g = exp(g);
+    g = add(gx, g);
+    g = divide(g, gx);
+
+    // Leaves allocating the results out of the timings.
+    g.operate();
+    typed::Tensor<float> z = (x + exp(x * y)) / x;
+
+    auto time1 = high_resolution_clock::now();
+    g.operate();
+    auto time2 = high_resolution_clock::now();
+    z = (x + exp(x * y)) / x;
+    auto time3 = high_resolution_clock::now();
+
+    cout << "graph " << duration_cast<microseconds>(time2 - time1).count() << " microseconds, typed "
+         << duration_cast<microseconds>(time3 - time2).count() << " microseconds" << endl;
+
+    Buffer* result = g.getBuffer();
+    bool same = z.getElements() == result->getElements();
+    for (uint64_t i = 0; same && i < z.getElements(); i++)
+        same = std::abs(z[i] - result->getIndex<float>(i)) <= 1e-6f * std::abs(z[i]);
+
+    check("typed expressions, same result as the graph", same);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && !std::string(argv[1]).compare("reductions")) {
+        reductionBits();
+        return 0;
+    }
+
+    placeholders();
+    partialBatches();
+    batcher();
+    incrementalOperate();
+    recurrentLayers();
+    gradientChecks();
+    pooling();
+    convolutionTranspose();
+    attentionReference();
+    gatherScatter();
+    checkpointing();
+    optimizers();
+    threadPool();
+    determinism(argv[0]);
+    reductionTimings();
+    batchNormFolding();
+    kvCacheWraparound();
+    sparseMatrices();
+    halfConversions();
+    halfOperations();
+    quantizedOperations();
+    masks();
+    saturatingCasts();
     convolution();
+    vectorMath();
+    typedExpressions();
+
+    return failures > 0;
 }